@@ -0,0 +1,12 @@
+#define VERSION "4.1.0"
+#define PACKAGEVERSION "4.1.0"
+#define SYSCONFDIR "/etc/powerdns"
+#define PKGLIBDIR "/usr/lib/pdns"
+#define LOCALSTATEDIR "/var/run"
+#define BINDIR "/usr/bin"
+#define LIBDIR "/usr/lib"
+#define HAVE_LIBCRYPTO_ECDSA 1
+#define HAVE_BOOST_CONTAINER_FLAT_SET_HPP 1
+#define HAVE_CLOCK_GETTIME 1
+#define HAVE_IPV6 1
+#define RECURSOR 1
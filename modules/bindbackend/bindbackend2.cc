@@ -34,6 +34,8 @@
 #include <sstream>
 #include <boost/algorithm/string.hpp>
 #include <system_error>
+#include <unordered_map>
+#include <numeric>
 
 #include "pdns/dnsseckeeper.hh"
 #include "pdns/dnssecinfra.hh"
@@ -78,7 +80,8 @@ bool Bind2Backend::s_ignore_broken_records=false;
 pthread_rwlock_t Bind2Backend::s_state_lock=PTHREAD_RWLOCK_INITIALIZER;
 pthread_mutex_t Bind2Backend::s_supermaster_config_lock=PTHREAD_MUTEX_INITIALIZER; // protects writes to config file
 pthread_mutex_t Bind2Backend::s_startup_lock=PTHREAD_MUTEX_INITIALIZER;
-string Bind2Backend::s_binddirectory;  
+string Bind2Backend::s_binddirectory;
+string Bind2Backend::s_snapshotdirectory;  
 
 BB2DomainInfo::BB2DomainInfo()
 {
@@ -129,6 +132,182 @@ void BB2DomainInfo::setCtime()
   d_ctime=buf.st_ctime;
 }
 
+namespace {
+struct DNSNameHash
+{
+  size_t operator()(const DNSName& name) const
+  {
+    return name.hash();
+  }
+};
+}
+
+Bind2RecordStorage::Bind2RecordStorage(const vector<Bind2DNSRecord>& records)
+{
+  if(records.size() >= std::numeric_limits<uint32_t>::max())
+    throw PDNSException("Too many records in a single zone");
+
+  // intern the owner names, and put them in canonical order
+  std::unordered_map<DNSName, uint32_t, DNSNameHash> ids;
+  ids.reserve(records.size());
+  vector<uint32_t> nameOf(records.size());
+  vector<DNSName> names;
+  for(size_t n = 0; n < records.size(); ++n) {
+    auto res = ids.insert(make_pair(records[n].qname, static_cast<uint32_t>(names.size())));
+    if(res.second)
+      names.push_back(records[n].qname);
+    nameOf[n] = res.first->second;
+  }
+  ids.clear();
+
+  vector<uint32_t> order(names.size());
+  iota(order.begin(), order.end(), 0);
+  sort(order.begin(), order.end(), [&names](uint32_t a, uint32_t b) { return names[a].canonCompare(names[b]); });
+
+  vector<uint32_t> rank(names.size());
+  d_names.reserve(names.size());
+  for(uint32_t n = 0; n < order.size(); ++n) {
+    rank[order[n]] = n;
+    d_names.push_back(std::move(names[order[n]]));
+  }
+  names.clear();
+  for(auto& name : nameOf)
+    name = rank[name];
+
+  // records of a name have the SOA first, then go by type, content and ttl
+  vector<uint32_t> sorted(records.size());
+  iota(sorted.begin(), sorted.end(), 0);
+  sort(sorted.begin(), sorted.end(), [&records, &nameOf](uint32_t a, uint32_t b) {
+      if(nameOf[a] != nameOf[b])
+        return nameOf[a] < nameOf[b];
+      const Bind2DNSRecord& ra = records[a];
+      const Bind2DNSRecord& rb = records[b];
+      if((ra.qtype == QType::SOA) != (rb.qtype == QType::SOA))
+        return ra.qtype == QType::SOA;
+      return tie(ra.qtype, ra.content, ra.ttl) < tie(rb.qtype, rb.content, rb.ttl);
+    });
+
+  size_t arenaSize = 0;
+  for(const auto& bdr : records)
+    arenaSize += bdr.content.size() + bdr.nsec3hash.size();
+  if(arenaSize >= std::numeric_limits<uint32_t>::max())
+    throw PDNSException("Zone contents too large");
+  d_arena.reserve(arenaSize);
+
+  d_entries.reserve(records.size());
+  for(auto n : sorted) {
+    const Bind2DNSRecord& bdr = records[n];
+    Entry entry;
+    entry.name = nameOf[n];
+    entry.offset = d_arena.size();
+    entry.length = bdr.content.size();
+    entry.ttl = bdr.ttl;
+    entry.qtype = bdr.qtype;
+    entry.auth = bdr.auth;
+    d_arena.append(bdr.content);
+    d_entries.push_back(entry);
+  }
+
+  d_nameFirst.resize(d_names.size() + 1);
+  for(size_t pos = d_entries.size(); pos-- > 0; )
+    d_nameFirst[d_entries[pos].name] = pos;
+  d_nameFirst[d_names.size()] = d_entries.size();
+
+  size_t buckets = 2;
+  while(buckets < 2 * d_names.size())
+    buckets <<= 1;
+  d_buckets.assign(buckets, 0);
+  for(uint32_t n = 0; n < d_names.size(); ++n) {
+    size_t bucket = d_names[n].hash() & (buckets - 1);
+    while(d_buckets[bucket])
+      bucket = (bucket + 1) & (buckets - 1);
+    d_buckets[bucket] = n + 1;
+  }
+
+  // all hashed records of a name carry the same hash, the index only needs one
+  vector<pair<string, uint32_t> > hashes;
+  for(auto n : sorted) {
+    if(!records[n].nsec3hash.empty() && (hashes.empty() || hashes.back().second != nameOf[n]))
+      hashes.push_back(make_pair(records[n].nsec3hash, nameOf[n]));
+  }
+  sort(hashes.begin(), hashes.end());
+  d_hashes.reserve(hashes.size());
+  for(const auto& hash : hashes) {
+    HashEntry he;
+    he.offset = d_arena.size();
+    he.length = hash.first.size();
+    he.name = hash.second;
+    d_arena.append(hash.first);
+    d_hashes.push_back(he);
+  }
+}
+
+pair<size_t, size_t> Bind2RecordStorage::equalRange(const DNSName& qname) const
+{
+  if(d_buckets.empty())
+    return make_pair(0, 0);
+
+  const size_t mask = d_buckets.size() - 1;
+  for(size_t bucket = qname.hash() & mask; d_buckets[bucket]; bucket = (bucket + 1) & mask) {
+    uint32_t name = d_buckets[bucket] - 1;
+    if(d_names[name] == qname)
+      return make_pair(d_nameFirst[name], d_nameFirst[name + 1]);
+  }
+  return make_pair(d_entries.size(), d_entries.size());
+}
+
+size_t Bind2RecordStorage::upperBound(const DNSName& qname) const
+{
+  auto iter = upper_bound(d_names.begin(), d_names.end(), qname, [](const DNSName& a, const DNSName& b) { return a.canonCompare(b); });
+  return d_nameFirst.empty() ? 0 : d_nameFirst[iter - d_names.begin()];
+}
+
+bool Bind2RecordStorage::getBeforeAndAfterHashes(const string& hash, string& before, string& after, DNSName& unhashed) const
+{
+  if(d_hashes.empty())
+    return false;
+
+  auto iter = upper_bound(d_hashes.begin(), d_hashes.end(), hash, [this](const string& a, const HashEntry& b) { return d_arena.compare(b.offset, b.length, a) > 0; });
+  if(iter == d_hashes.end()) {
+    --iter;
+    before = hashAt(*iter);
+    after = hashAt(d_hashes.front());
+  } else {
+    after = hashAt(*iter);
+    if(iter != d_hashes.begin())
+      --iter;
+    else
+      iter = --d_hashes.end();
+    before = hashAt(*iter);
+  }
+  unhashed = d_names[iter->name];
+  return true;
+}
+
+Bind2DNSRecord Bind2RecordStorage::record(size_t pos) const
+{
+  Bind2DNSRecord bdr;
+  bdr.qname = qname(pos);
+  bdr.content = content(pos);
+  bdr.ttl = ttl(pos);
+  bdr.qtype = qtype(pos);
+  bdr.auth = auth(pos);
+  return bdr;
+}
+
+size_t Bind2RecordStorage::memoryUsage() const
+{
+  size_t ret = sizeof(*this) + d_arena.capacity();
+  ret += d_names.capacity() * sizeof(DNSName);
+  for(const auto& name : d_names)
+    ret += name.wirelength() > DNSName::string_t::s_inlineCapacity ? name.wirelength() : 0; // short names are stored inline
+  ret += d_nameFirst.capacity() * sizeof(uint32_t);
+  ret += d_entries.capacity() * sizeof(Entry);
+  ret += d_hashes.capacity() * sizeof(HashEntry);
+  ret += d_buckets.capacity() * sizeof(uint32_t);
+  return ret;
+}
+
 bool Bind2Backend::safeGetBBDomainInfo(int id, BB2DomainInfo* bbd)
 {
   ReadLock rl(&s_state_lock);
@@ -193,6 +372,9 @@ bool Bind2Backend::startTransaction(const DNSName &qname, int id)
   if(id < 0) {
     d_transaction_tmpname.clear();
     d_transaction_id=id;
+    d_transaction_rrsets.clear();
+    d_transaction_records.reset();
+    d_transaction_replaced=false;
     return true;
   }
   if(id == 0) {
@@ -221,20 +403,28 @@ bool Bind2Backend::startTransaction(const DNSName &qname, int id)
 
 bool Bind2Backend::commitTransaction()
 {
-  if(d_transaction_id < 0)
+  // the transaction is over even if committing it fails, a next one must not find it still open
+  int id = d_transaction_id;
+  d_transaction_id=0;
+
+  if(id < 0) {
+    if(d_transaction_replaced)
+      commitReplacedRRSets();
     return true;
+  }
   delete d_of;
   d_of=0;
 
   BB2DomainInfo bbd;
-  if(safeGetBBDomainInfo(d_transaction_id, &bbd)) {
-    if(rename(d_transaction_tmpname.c_str(), bbd.d_filename.c_str())<0)
-    throw DBException("Unable to commit (rename to: '" + bbd.d_filename+"') AXFRed zone: "+stringerror());
+  if(safeGetBBDomainInfo(id, &bbd)) {
+    if(rename(d_transaction_tmpname.c_str(), bbd.d_filename.c_str())<0) {
+      string err = stringerror();
+      unlink(d_transaction_tmpname.c_str());
+      throw DBException("Unable to commit (rename to: '" + bbd.d_filename+"') AXFRed zone: "+err);
+    }
     queueReloadAndStore(bbd.d_id);
   }
 
-  d_transaction_id=0;
-
   return true;
 }
 
@@ -249,51 +439,186 @@ bool Bind2Backend::abortTransaction()
     unlink(d_transaction_tmpname.c_str());
     d_transaction_id=0;
   }
+  d_transaction_rrsets.clear();
+  d_transaction_records.reset();
+  d_transaction_replaced=false;
 
   return true;
 }
 
-bool Bind2Backend::feedRecord(const DNSResourceRecord &rr, string *ordername)
+//! writes a single record in zone file format, with names relative to the zone where possible
+static void writeZoneRecord(ostream& os, const DNSName& zone, const DNSName& qname, const QType& qtype, uint32_t ttl, const string& rawcontent)
 {
-  BB2DomainInfo bbd;
-  safeGetBBDomainInfo(d_transaction_id, &bbd);
-
-  string qname;
-  string name = bbd.d_name.toString();
-  if (bbd.d_name.empty()) {
-    qname = rr.qname.toString();
+  string name;
+  if (zone.empty()) {
+    name = qname.toString();
   }
-  else if (rr.qname.isPartOf(bbd.d_name)) {
-    if (rr.qname == bbd.d_name) {
-      qname = "@";
+  else if (qname.isPartOf(zone)) {
+    if (qname == zone) {
+      name = "@";
     }
     else {
-      DNSName relName = rr.qname.makeRelative(bbd.d_name);
-      qname = relName.toStringNoDot();
+      DNSName relName = qname.makeRelative(zone);
+      name = relName.toStringNoDot();
     }
   }
   else {
-    throw DBException("out-of-zone data '"+rr.qname.toLogString()+"' during AXFR of zone '"+bbd.d_name.toLogString()+"'");
+    throw DBException("out-of-zone data '"+qname.toLogString()+"' during AXFR of zone '"+zone.toLogString()+"'");
   }
 
-  shared_ptr<DNSRecordContent> drc(DNSRecordContent::mastermake(rr.qtype.getCode(), 1, rr.content));
+  shared_ptr<DNSRecordContent> drc(DNSRecordContent::mastermake(qtype.getCode(), 1, rawcontent));
   string content = drc->getZoneRepresentation();
 
   // SOA needs stripping too! XXX FIXME - also, this should not be here I think
-  switch(rr.qtype.getCode()) {
+  switch(qtype.getCode()) {
   case QType::MX:
   case QType::SRV:
   case QType::CNAME:
   case QType::DNAME:
   case QType::NS:
-    stripDomainSuffix(&content, name);
+    stripDomainSuffix(&content, zone.toString());
     // falltrough
   default:
-    *d_of<<qname<<"\t"<<rr.ttl<<"\t"<<rr.qtype.getName()<<"\t"<<content<<endl;
+    os<<name<<"\t"<<ttl<<"\t"<<qtype.getName()<<"\t"<<content<<endl;
   }
+}
+
+bool Bind2Backend::feedRecord(const DNSResourceRecord &rr, string *ordername)
+{
+  BB2DomainInfo bbd;
+  safeGetBBDomainInfo(d_transaction_id, &bbd);
+
+  writeZoneRecord(*d_of, bbd.d_name, rr.qname, rr.qtype, rr.ttl, rr.content);
   return true;
 }
 
+/** Replacing an RRSet works on a private copy of the zone, which is only made visible (and written back to disk)
+    on commitTransaction(). This lets incremental transfers and updates touch a handful of records without
+    re-reading the whole zone file. */
+bool Bind2Backend::replaceRRSet(uint32_t domain_id, const DNSName& qname, const QType& qt, const vector<DNSResourceRecord>& rrset)
+{
+  if(d_transaction_id >= 0)
+    throw DBException("Bind2Backend can only replace RRSets inside a transaction that does not replace the zone");
+
+  BB2DomainInfo bbd;
+  if(!safeGetBBDomainInfo(domain_id, &bbd))
+    return false;
+
+  if(!qname.isPartOf(bbd.d_name))
+    throw DBException("out-of-zone data '"+qname.toLogString()+"' replaced in zone '"+bbd.d_name.toLogString()+"'");
+
+  if(!d_transaction_replaced) {
+    // copy the zone, leaving out what fixupOrderAndAuth() and doEmptyNonTerminals() will recalculate
+    d_transaction_rrsets.clear();
+    d_transaction_records_id = domain_id;
+    d_transaction_replaced = true;
+    shared_ptr<const recordstorage_t> records = bbd.d_records.get();
+    for(size_t pos = 0; pos < records->size(); ++pos) {
+      if(!records->qtype(pos))
+        continue;
+      Bind2DNSRecord copy = records->record(pos);
+      copy.auth = true;
+      d_transaction_rrsets[copy.qname].push_back(copy);
+    }
+  }
+  else if(d_transaction_records_id != domain_id)
+    throw DBException("Bind2Backend can not replace RRSets of more than one zone in a single transaction");
+  d_transaction_records.reset();
+
+  DNSName relative = qname.makeRelative(bbd.d_name);
+  vector<Bind2DNSRecord>& rrs = d_transaction_rrsets[relative];
+  for(auto iter = rrs.begin(); iter != rrs.end(); ) {
+    if(qt.getCode() == QType::ANY || iter->qtype == qt.getCode())
+      iter = rrs.erase(iter);
+    else
+      ++iter;
+  }
+
+  for(const auto& rr : rrset) {
+    Bind2DNSRecord bdr;
+    bdr.qname = relative;
+    bdr.qtype = rr.qtype.getCode();
+    shared_ptr<DNSRecordContent> drc(DNSRecordContent::mastermake(bdr.qtype, 1, rr.content));
+    bdr.content = drc->getZoneRepresentation();
+    bdr.ttl = rr.ttl;
+    bdr.auth = true;
+    rrs.push_back(bdr);
+  }
+  if(rrs.empty())
+    d_transaction_rrsets.erase(relative);
+  return true;
+}
+
+//! makes the uncommitted replaceRRSet() changes visible to our own lookup()s
+void Bind2Backend::buildTransactionRecords()
+{
+  vector<Bind2DNSRecord> records;
+  for(const auto& rrs : d_transaction_rrsets)
+    records.insert(records.end(), rrs.second.begin(), rrs.second.end());
+  d_transaction_records = shared_ptr<recordstorage_t>(new recordstorage_t(records));
+}
+
+void Bind2Backend::commitReplacedRRSets()
+{
+  vector<Bind2DNSRecord> records;
+  for(const auto& rrs : d_transaction_rrsets)
+    records.insert(records.end(), rrs.second.begin(), rrs.second.end());
+  d_transaction_rrsets.clear();
+  d_transaction_records.reset();
+  d_transaction_replaced = false;
+
+  BB2DomainInfo bbd;
+  if(!safeGetBBDomainInfo(d_transaction_records_id, &bbd))
+    return;
+
+  NSEC3PARAMRecordContent ns3pr;
+  bool nsec3zone = getNSEC3PARAMForZone(bbd.d_name, &ns3pr);
+
+  fixupOrderAndAuth(records, bbd.d_name, nsec3zone, ns3pr);
+  doEmptyNonTerminals(records, bbd.d_name, nsec3zone, ns3pr);
+  shared_ptr<recordstorage_t> storage(new recordstorage_t(records));
+  records.clear();
+  bbd.d_records = storage;
+
+  string tmpname = bbd.d_filename+"."+itoa(random());
+  {
+    ofstream of(tmpname.c_str());
+    if(!of)
+      throw DBException("Unable to open temporary zonefile '"+tmpname+"': "+stringerror());
+
+    of<<"; Written by PowerDNS, don't edit!"<<endl;
+    of<<"; Zone '"<<bbd.d_name<<"' updated incrementally "<<endl<<"; at "<<nowTime()<<endl;
+    try {
+      for(size_t pos = 0; pos < storage->size(); ++pos) {
+        if(!storage->qtype(pos))
+          continue;
+        writeZoneRecord(of, bbd.d_name, storage->qname(pos) + bbd.d_name, QType(storage->qtype(pos)), storage->ttl(pos), storage->content(pos));
+      }
+    }
+    catch(...) {
+      unlink(tmpname.c_str());
+      throw;
+    }
+    of.close();
+    if(!of) {
+      string err = stringerror();
+      unlink(tmpname.c_str());
+      throw DBException("Unable to write temporary zonefile '"+tmpname+"': "+err);
+    }
+  }
+  if(rename(tmpname.c_str(), bbd.d_filename.c_str())<0) {
+    string err = stringerror();
+    unlink(tmpname.c_str());
+    throw DBException("Unable to commit (rename to: '" + bbd.d_filename+"') updated zone: "+err);
+  }
+
+  bbd.setCtime();
+  bbd.d_checknow=false;
+  bbd.d_status="updated incrementally at "+nowTime();
+  safePutBBDomainInfo(bbd);
+  L<<Logger::Warning<<"Zone '"<<bbd.d_name<<"' ("<<bbd.d_filename<<") updated in place"<<endl;
+}
+
 void Bind2Backend::getUpdatedMasters(vector<DomainInfo> *changedDomains)
 {
   vector<DomainInfo> consider;
@@ -438,50 +763,76 @@ void Bind2Backend::alsoNotifies(const DNSName& domain, set<string> *ips)
   }   
 }
 
-// only parses, does NOT add to s_state!
-void Bind2Backend::parseZoneFile(BB2DomainInfo *bbd) 
+bool Bind2Backend::getNSEC3PARAMForZone(const DNSName& name, NSEC3PARAMRecordContent* ns3p)
 {
-  NSEC3PARAMRecordContent ns3pr;
-  bool nsec3zone;
   if (d_hybrid) {
     DNSSECKeeper dk;
-    nsec3zone=dk.getNSEC3PARAM(bbd->d_name, &ns3pr);
-  } else
-    nsec3zone=getNSEC3PARAM(bbd->d_name, &ns3pr);
+    return dk.getNSEC3PARAM(name, ns3p);
+  }
+  return getNSEC3PARAM(name, ns3p);
+}
 
-  bbd->d_records = shared_ptr<recordstorage_t>(new recordstorage_t());
-        
-  ZoneParserTNG zpt(bbd->d_filename, bbd->d_name, s_binddirectory);
-  DNSResourceRecord rr;
-  string hashed;
-  while(zpt.get(rr)) { 
-    if(rr.qtype.getCode() == QType::NSEC || rr.qtype.getCode() == QType::NSEC3)
-      continue; // we synthesise NSECs on demand
+// only parses, does NOT add to s_state!
+void Bind2Backend::parseZoneFile(BB2DomainInfo *bbd) 
+{
+  NSEC3PARAMRecordContent ns3pr;
+  bool nsec3zone = getNSEC3PARAMForZone(bbd->d_name, &ns3pr);
+  parseZoneFile(bbd, nsec3zone, ns3pr);
+}
 
-    insertRecord(*bbd, rr.qname, rr.qtype, rr.content, rr.ttl, "");
+// does not touch this backend's DNSSEC database, so it can run on the zone loader threads
+void Bind2Backend::parseZoneFile(BB2DomainInfo *bbd, bool nsec3zone, const NSEC3PARAMRecordContent& ns3pr, bool readSnapshot)
+{
+  DTime dt;
+  dt.set();
+
+  bool snapshots = !s_snapshotdirectory.empty();
+  string nsec3param = nsec3zone ? ns3pr.getZoneRepresentation() : string();
+  string origin;
+
+  shared_ptr<recordstorage_t> storage;
+  if(snapshots && readSnapshot)
+    storage = loadSnapshot(*bbd, nsec3param);
+  if(storage)
+    origin = ", from snapshot";
+  else {
+    vector<Bind2DNSRecord> records;
+    ZoneParserTNG zpt(bbd->d_filename, bbd->d_name, s_binddirectory);
+    DNSResourceRecord rr;
+    while(zpt.get(rr)) { 
+      if(rr.qtype.getCode() == QType::NSEC || rr.qtype.getCode() == QType::NSEC3)
+        continue; // we synthesise NSECs on demand
+
+      insertRecord(records, bbd->d_name, rr.qname, rr.qtype, rr.content, rr.ttl);
+    }
+    fixupOrderAndAuth(records, bbd->d_name, nsec3zone, ns3pr);
+    doEmptyNonTerminals(records, bbd->d_name, nsec3zone, ns3pr);
+    storage = std::make_shared<recordstorage_t>(records);
+    records.clear();
+    // the snapshot records the zone file and its $INCLUDEs as they were when the parser opened them
+    if(snapshots && writeSnapshot(*bbd, zpt.getOpenedFiles(), nsec3param, *storage))
+      origin = ", snapshot saved";
   }
-  fixupOrderAndAuth(*bbd, nsec3zone, ns3pr);
-  doEmptyNonTerminals(*bbd, nsec3zone, ns3pr);
+  bbd->d_records = storage;
+
   bbd->setCtime();
   bbd->d_loaded=true; 
   bbd->d_checknow=false;
-  bbd->d_status="parsed into memory at "+nowTime();
+  bbd->d_status="parsed into memory at "+nowTime()+" ("+std::to_string(storage->size())+" records, "+std::to_string(storage->memoryUsage()/1024)+" kB, "+std::to_string(dt.udiff()/1000)+" ms"+origin+")";
 }
 
-/** THIS IS AN INTERNAL FUNCTION! It does moadnsparser prio impedance matching
-    Much of the complication is due to the efforts to benefit from std::string reference counting copy on write semantics */
-void Bind2Backend::insertRecord(BB2DomainInfo& bb2, const DNSName &qname, const QType &qtype, const string &content, int ttl, const std::string& hashed, bool *auth)
+/** THIS IS AN INTERNAL FUNCTION! Adds a record to the list that will be turned into the Bind2RecordStorage of 'zone' */
+void Bind2Backend::insertRecord(vector<Bind2DNSRecord>& records, const DNSName& zone, const DNSName &qname, const QType &qtype, const string &content, int ttl)
 {
   Bind2DNSRecord bdr;
-  shared_ptr<recordstorage_t> records = bb2.d_records.getWRITABLE();
   bdr.qname=qname;
 
-  if(bb2.d_name.empty())
+  if(zone.empty())
     ;
-  else if(bdr.qname.isPartOf(bb2.d_name))
-    bdr.qname = bdr.qname.makeRelative(bb2.d_name);
+  else if(bdr.qname.isPartOf(zone))
+    bdr.qname = bdr.qname.makeRelative(zone);
   else {
-    string msg = "Trying to insert non-zone data, name='"+bdr.qname.toLogString()+"', qtype="+qtype.getName()+", zone='"+bb2.d_name.toLogString()+"'";
+    string msg = "Trying to insert non-zone data, name='"+bdr.qname.toLogString()+"', qtype="+qtype.getName()+", zone='"+zone.toLogString()+"'";
     if(s_ignore_broken_records) {
         L<<Logger::Warning<<msg<< " ignored" << endl;
         return;
@@ -490,23 +841,11 @@ void Bind2Backend::insertRecord(BB2DomainInfo& bb2, const DNSName &qname, const
       throw PDNSException(msg);
   }
 
-//  bdr.qname.swap(bdr.qname);
-
-  if(!records->empty() && bdr.qname==boost::prior(records->end())->qname)
-    bdr.qname=boost::prior(records->end())->qname;
-
-  bdr.qname=bdr.qname;
   bdr.qtype=qtype.getCode();
   bdr.content=content; 
-  bdr.nsec3hash = hashed;
-  
-  if (auth) // Set auth on empty non-terminals
-    bdr.auth=*auth;
-  else
-    bdr.auth=true;
-
+  bdr.auth=true;
   bdr.ttl=ttl;
-  records->insert(bdr);
+  records.push_back(bdr);
 }
 
 string Bind2Backend::DLReloadNowHandler(const vector<string>&parts, Utility::pid_t ppid)
@@ -518,7 +857,7 @@ string Bind2Backend::DLReloadNowHandler(const vector<string>&parts, Utility::pid
     if(safeGetBBDomainInfo(DNSName(*i), &bbd)) {
       Bind2Backend bb2;
       bb2.queueReloadAndStore(bbd.d_id);
-      ret<< *i << ": "<< (bbd.d_loaded ? "": "[rejected]") <<"\t"<<bbd.d_status<<"\n";      
+      ret<< *i << ": "<< (bbd.d_loaded || bbd.d_checknow ? "": "[rejected]") <<"\t"<<bbd.d_status<<"\n";      
     }
     else
       ret<< *i << " no such domain\n";
@@ -537,7 +876,7 @@ string Bind2Backend::DLDomStatusHandler(const vector<string>&parts, Utility::pid
     for(vector<string>::const_iterator i=parts.begin()+1;i<parts.end();++i) {
       BB2DomainInfo bbd;
       if(safeGetBBDomainInfo(DNSName(*i), &bbd)) {	
-        ret<< *i << ": "<< (bbd.d_loaded ? "": "[rejected]") <<"\t"<<bbd.d_status<<"\n";
+        ret<< *i << ": "<< (bbd.d_loaded || bbd.d_checknow ? "": "[rejected]") <<"\t"<<bbd.d_status<<"\n";
     }
       else
         ret<< *i << " no such domain\n";
@@ -546,7 +885,7 @@ string Bind2Backend::DLDomStatusHandler(const vector<string>&parts, Utility::pid
   else {
     ReadLock rl(&s_state_lock);
     for(state_t::const_iterator i = s_state.begin(); i != s_state.end() ; ++i) {
-      ret<< i->d_name << ": "<< (i->d_loaded ? "": "[rejected]") <<"\t"<<i->d_status<<"\n";
+      ret<< i->d_name << ": "<< (i->d_loaded || i->d_checknow ? "": "[rejected]") <<"\t"<<i->d_status<<"\n";
     }
   }
 
@@ -561,7 +900,7 @@ string Bind2Backend::DLListRejectsHandler(const vector<string>&parts, Utility::p
   ostringstream ret;
   ReadLock rl(&s_state_lock);
   for(state_t::const_iterator i = s_state.begin(); i != s_state.end() ; ++i) {
-    if(!i->d_loaded)
+    if(!i->d_loaded && !i->d_checknow)
       ret<<i->d_name<<"\t"<<i->d_status<<endl;
   }
   return ret.str();
@@ -619,6 +958,7 @@ Bind2Backend::Bind2Backend(const string &suffix, bool loadZones)
   d_logprefix="[bind"+suffix+"backend]";
   d_hybrid=mustDo("hybrid");
   s_ignore_broken_records=mustDo("ignore-broken-records");
+  s_snapshotdirectory=getArg("snapshot-directory");
 
   if (!loadZones && d_hybrid)
     return;
@@ -626,6 +966,8 @@ Bind2Backend::Bind2Backend(const string &suffix, bool loadZones)
   Lock l(&s_startup_lock);
   
   d_transaction_id=0;
+  d_transaction_records_id=0;
+  d_transaction_replaced=false;
   setupDNSSEC();
   if(!s_first) {
     return;
@@ -659,51 +1001,45 @@ void Bind2Backend::reload()
   }
 }
 
-void Bind2Backend::fixupOrderAndAuth(BB2DomainInfo& bbd, bool nsec3zone, NSEC3PARAMRecordContent ns3pr)
+void Bind2Backend::fixupOrderAndAuth(vector<Bind2DNSRecord>& records, const DNSName& zone, bool nsec3zone, NSEC3PARAMRecordContent ns3pr)
 {
-  shared_ptr<recordstorage_t> records = bbd.d_records.getWRITABLE();
-  recordstorage_t::const_iterator iter;
-
   bool skip;
   DNSName shorter;
   set<DNSName> nssets, dssets;
 
-  for(const auto& bdr: *records) {
+  for(const auto& bdr: records) {
     if(!bdr.qname.isRoot() && bdr.qtype == QType::NS)
       nssets.insert(bdr.qname);
     else if(bdr.qtype == QType::DS)
       dssets.insert(bdr.qname);
   }
 
-  for(auto iter = records->begin(); iter != records->end(); iter++) {
+  for(auto& bdr : records) {
     skip = false;
-    shorter = iter->qname;
+    shorter = bdr.qname;
 
-    if (!iter->qname.isRoot() && shorter.chopOff() && !iter->qname.isRoot()) {
+    if (!bdr.qname.isRoot() && shorter.chopOff() && !bdr.qname.isRoot()) {
       do {
         if(nssets.count(shorter)) {
           skip = true;
           break;
         }
-      } while(shorter.chopOff() && !iter->qname.isRoot());
+      } while(shorter.chopOff() && !bdr.qname.isRoot());
     }
 
-    iter->auth = (!skip && (iter->qtype == QType::DS || iter->qtype == QType::RRSIG || !nssets.count(iter->qname)));
+    bdr.auth = (!skip && (bdr.qtype == QType::DS || bdr.qtype == QType::RRSIG || !nssets.count(bdr.qname)));
 
-    if(!skip && nsec3zone && iter->qtype != QType::RRSIG && (iter->auth || (iter->qtype == QType::NS && !ns3pr.d_flags) || dssets.count(iter->qname))) {
-      Bind2DNSRecord bdr = *iter;
-      bdr.nsec3hash = toBase32Hex(hashQNameWithSalt(ns3pr, bdr.qname+bbd.d_name));
-      records->replace(iter, bdr);
-    }
+    if(!skip && nsec3zone && bdr.qtype != QType::RRSIG && (bdr.auth || (bdr.qtype == QType::NS && !ns3pr.d_flags) || dssets.count(bdr.qname)))
+      bdr.nsec3hash = toBase32Hex(hashQNameWithSalt(ns3pr, bdr.qname+zone));
+    else
+      bdr.nsec3hash.clear();
 
-    // cerr<<iter->qname<<"\t"<<QType(iter->qtype).getName()<<"\t"<<iter->nsec3hash<<"\t"<<iter->auth<<endl;
+    // cerr<<bdr.qname<<"\t"<<QType(bdr.qtype).getName()<<"\t"<<bdr.nsec3hash<<"\t"<<bdr.auth<<endl;
   }
 }
 
-void Bind2Backend::doEmptyNonTerminals(BB2DomainInfo& bbd, bool nsec3zone, NSEC3PARAMRecordContent ns3pr)
+void Bind2Backend::doEmptyNonTerminals(vector<Bind2DNSRecord>& records, const DNSName& zone, bool nsec3zone, NSEC3PARAMRecordContent ns3pr)
 {
-  shared_ptr<const recordstorage_t> records = bbd.d_records.get();
-
   bool auth;
   DNSName shorter;
   set<DNSName> qnames;
@@ -711,10 +1047,10 @@ void Bind2Backend::doEmptyNonTerminals(BB2DomainInfo& bbd, bool nsec3zone, NSEC3
 
   uint32_t maxent = ::arg().asNum("max-ent-entries");
 
-  for(const auto& bdr : *records)
+  for(const auto& bdr : records)
     qnames.insert(bdr.qname);
 
-  for(const auto& bdr : *records) {
+  for(const auto& bdr : records) {
 
     if (!bdr.auth && bdr.qtype == QType::NS)
       auth = (!nsec3zone || !ns3pr.d_flags);
@@ -728,7 +1064,7 @@ void Bind2Backend::doEmptyNonTerminals(BB2DomainInfo& bbd, bool nsec3zone, NSEC3
       {
         if(!(maxent))
         {
-          L<<Logger::Error<<"Zone '"<<bbd.d_name<<"' has too many empty non terminals."<<endl;
+          L<<Logger::Error<<"Zone '"<<zone<<"' has too many empty non terminals."<<endl;
           return;
         }
 
@@ -741,22 +1077,48 @@ void Bind2Backend::doEmptyNonTerminals(BB2DomainInfo& bbd, bool nsec3zone, NSEC3
     }
   }
 
-  DNSResourceRecord rr;
-  rr.qtype = "#0";
-  rr.content = "";
-  rr.ttl = 0;
+  Bind2DNSRecord bdr;
+  bdr.qtype = 0;
+  bdr.ttl = 0;
   for(auto& nt : nonterm)
   {
-    string hashed;
-    rr.qname = nt.first + bbd.d_name;
+    bdr.qname = nt.first;
+    bdr.auth = nt.second;
+    bdr.nsec3hash.clear();
     if(nsec3zone && nt.second)
-      hashed = toBase32Hex(hashQNameWithSalt(ns3pr, rr.qname));
-    insertRecord(bbd, rr.qname, rr.qtype, rr.content, rr.ttl, hashed, &nt.second);
+      bdr.nsec3hash = toBase32Hex(hashQNameWithSalt(ns3pr, nt.first + zone));
+    records.push_back(bdr);
 
-    // cerr<<rr.qname<<"\t"<<rr.qtype.getName()<<"\t"<<hashed<<"\t"<<nt.second<<endl;
+    // cerr<<bdr.qname<<"\t"<<bdr.nsec3hash<<"\t"<<nt.second<<endl;
   }
 }
 
+//! zones for loadConfig() to parse, shared by the zone loader threads
+struct Bind2Backend::ZoneLoadQueue
+{
+  ZoneLoadQueue()
+  {
+    pthread_mutex_init(&d_lock, 0);
+  }
+  ~ZoneLoadQueue()
+  {
+    pthread_mutex_destroy(&d_lock);
+  }
+
+  struct Job
+  {
+    unsigned int id;
+    bool nsec3zone;
+    NSEC3PARAMRecordContent ns3pr;
+    bool newSlave;
+  };
+
+  pthread_mutex_t d_lock;
+  deque<Job> d_jobs;
+  string d_logprefix;
+  unsigned int d_rejected{0};
+};
+
 void Bind2Backend::loadConfig(string* status)
 {
   static int domain_id=1;
@@ -777,7 +1139,15 @@ void Bind2Backend::loadConfig(string* status)
     s_binddirectory=BP.getDirectory();
     //    ZP.setDirectory(d_binddirectory);
 
-    L<<Logger::Warning<<d_logprefix<<" Parsing "<<domains.size()<<" domain(s), will report when done"<<endl;
+    bool lazy=mustDo("lazy-load");
+    if(lazy)
+      L<<Logger::Warning<<d_logprefix<<" Found "<<domains.size()<<" domain(s), will parse them when first used"<<endl;
+    else
+      L<<Logger::Warning<<d_logprefix<<" Parsing "<<domains.size()<<" domain(s), will report when done"<<endl;
+    DTime dt;
+    dt.set();
+    ZoneLoadQueue queue;
+    queue.d_logprefix=d_logprefix;
     
     set<DNSName> oldnames, newnames;
     {
@@ -835,39 +1205,34 @@ void Bind2Backend::loadConfig(string* status)
 
         newnames.insert(bbd.d_name);
         if(filenameChanged || !bbd.d_loaded || !bbd.current()) {
-          L<<Logger::Info<<d_logprefix<<" parsing '"<<i->name<<"' from file '"<<i->filename<<"'"<<endl;
-
-          try {
-            parseZoneFile(&bbd);
-          }
-          catch(PDNSException &ae) {
-            ostringstream msg;
-            msg<<" error at "+nowTime()+" parsing '"<<i->name<<"' from file '"<<i->filename<<"': "<<ae.reason;
-
-            if(status)
-              *status+=msg.str();
-	    bbd.d_status=msg.str();
-
-            L<<Logger::Warning<<d_logprefix<<msg.str()<<endl;
-            rejected++;
+          if(lazy) {
+            // lookup() and list() parse it when it is first needed
+            bbd.d_checknow=true;
+            bbd.d_status="will be parsed on first use, queued at "+nowTime();
           }
-          catch(std::system_error &ae) {
-            ostringstream msg;
-            if (ae.code().value() == ENOENT && isNew && i->type == "slave")
-              msg<<" error at "+nowTime()<<" no file found for new slave domain '"<<i->name<<"'. Has not been AXFR'd yet";
-            else
-              msg<<" error at "+nowTime()+" parsing '"<<i->name<<"' from file '"<<i->filename<<"': "<<ae.what();
-
-            if(status)
-              *status+=msg.str();
-            bbd.d_status=msg.str();
-            L<<Logger::Warning<<d_logprefix<<msg.str()<<endl;
-            rejected++;
+          else {
+            ZoneLoadQueue::Job job;
+            job.id=bbd.d_id;
+            job.nsec3zone=getNSEC3PARAMForZone(bbd.d_name, &job.ns3pr);
+            job.newSlave=(isNew && i->type == "slave");
+            queue.d_jobs.push_back(job);
           }
-	  safePutBBDomainInfo(bbd);
-	  
+          safePutBBDomainInfo(bbd);
         }
       }
+
+    unsigned int threads=std::min<size_t>(std::max(getArgAsNum("load-threads"), 1), queue.d_jobs.size());
+    if(threads > 1) {
+      vector<pthread_t> tids(threads);
+      for(auto& tid : tids)
+        pthread_create(&tid, 0, &zoneLoaderThread, &queue);
+      for(auto& tid : tids)
+        pthread_join(tid, 0);
+    }
+    else
+      zoneLoaderThread(&queue);
+    rejected+=queue.d_rejected;
+
     vector<DNSName> diff;
 
     set_difference(oldnames.begin(), oldnames.end(), newnames.begin(), newnames.end(), back_inserter(diff));
@@ -882,15 +1247,87 @@ void Bind2Backend::loadConfig(string* status)
     set_difference(newnames.begin(), newnames.end(), oldnames.begin(), oldnames.end(), back_inserter(diff));
     newdomains=diff.size();
 
+    unsigned int msec = dt.udiff()/1000;
+    size_t records=0, bytes=0;
+    vector<unsigned int> ids;
+    {
+      ReadLock rl(&s_state_lock);
+      for(const BB2DomainInfo& bbd : s_state)
+        ids.push_back(bbd.d_id);
+    }
+    for(auto id : ids) {
+      BB2DomainInfo bbd;
+      if(!safeGetBBDomainInfo(id, &bbd))
+        continue;
+      shared_ptr<const recordstorage_t> storage = bbd.d_records.get();
+      if(!storage)
+        continue;
+      records += storage->size();
+      bytes += storage->memoryUsage();
+    }
+
     ostringstream msg;
     msg<<" Done parsing domains, "<<rejected<<" rejected, "<<newdomains<<" new, "<<remdomains<<" removed"; 
     if(status)
       *status=msg.str();
 
     L<<Logger::Error<<d_logprefix<<msg.str()<<endl;
+    L<<Logger::Warning<<d_logprefix<<" Loading took "<<msec<<" ms, "<<records<<" records use "<<bytes/(1024*1024)<<" MB, process now uses "<<getRealMemoryUsage(string())/(1024*1024)<<" MB"<<endl;
   }
 }
 
+/* Parses zones from the queue until it is empty, storing each one as soon as it is done.
+   Only one zone per thread is being parsed at any time, which bounds the memory needed. */
+void* Bind2Backend::zoneLoaderThread(void* arg)
+{
+  ZoneLoadQueue* queue=static_cast<ZoneLoadQueue*>(arg);
+  for(;;) {
+    ZoneLoadQueue::Job job;
+    {
+      Lock l(&queue->d_lock);
+      if(queue->d_jobs.empty())
+        break;
+      job=queue->d_jobs.front();
+      queue->d_jobs.pop_front();
+    }
+
+    BB2DomainInfo bbd;
+    if(!safeGetBBDomainInfo(job.id, &bbd))
+      continue;
+    L<<Logger::Info<<queue->d_logprefix<<" parsing '"<<bbd.d_name<<"' from file '"<<bbd.d_filename<<"'"<<endl;
+
+    ostringstream msg;
+    try {
+      parseZoneFile(&bbd, job.nsec3zone, job.ns3pr);
+      bbd.d_checknow=false;
+    }
+    catch(PDNSException &ae) {
+      msg<<" error at "+nowTime()+" parsing '"<<bbd.d_name<<"' from file '"<<bbd.d_filename<<"': "<<ae.reason;
+    }
+    catch(std::system_error &ae) {
+      if (ae.code().value() == ENOENT && job.newSlave)
+        msg<<" error at "+nowTime()<<" no file found for new slave domain '"<<bbd.d_name<<"'. Has not been AXFR'd yet";
+      else
+        msg<<" error at "+nowTime()+" parsing '"<<bbd.d_name<<"' from file '"<<bbd.d_filename<<"': "<<ae.what();
+    }
+    // this may run as a thread start routine, nothing may escape from here
+    catch(std::exception &ae) {
+      msg<<" error at "+nowTime()+" parsing '"<<bbd.d_name<<"' from file '"<<bbd.d_filename<<"': "<<ae.what();
+    }
+    catch(...) {
+      msg<<" error at "+nowTime()+" parsing '"<<bbd.d_name<<"' from file '"<<bbd.d_filename<<"': unknown exception";
+    }
+    if(!msg.str().empty()) {
+      bbd.d_status=msg.str();
+      L<<Logger::Warning<<queue->d_logprefix<<msg.str()<<endl;
+      Lock l(&queue->d_lock);
+      queue->d_rejected++;
+    }
+    safePutBBDomainInfo(bbd);
+  }
+  return 0;
+}
+
 void Bind2Backend::queueReloadAndStore(unsigned int id)
 {
   BB2DomainInfo bbold;
@@ -906,12 +1343,16 @@ void Bind2Backend::queueReloadAndStore(unsigned int id)
     ostringstream msg;
     msg<<" error at "+nowTime()+" parsing '"<<bbold.d_name<<"' from file '"<<bbold.d_filename<<"': "<<ae.reason;
     bbold.d_status=msg.str();
+    if(!bbold.d_loaded)
+      bbold.d_checknow=false; // never parsed, don't retry on every query
     safePutBBDomainInfo(bbold);
   }
   catch(std::exception &ae) {
     ostringstream msg;
     msg<<" error at "+nowTime()+" parsing '"<<bbold.d_name<<"' from file '"<<bbold.d_filename<<"': "<<ae.what();
     bbold.d_status=msg.str();
+    if(!bbold.d_loaded)
+      bbold.d_checknow=false;
     safePutBBDomainInfo(bbold);
   }
 }
@@ -919,19 +1360,19 @@ void Bind2Backend::queueReloadAndStore(unsigned int id)
 bool Bind2Backend::findBeforeAndAfterUnhashed(BB2DomainInfo& bbd, const DNSName& qname, DNSName& unhashed, string& before, string& after)
 {
   shared_ptr<const recordstorage_t> records = bbd.d_records.get();
-  recordstorage_t::const_iterator iter = records->upper_bound(qname);
+  size_t iter;
 
   if (before.empty()){
     //cout<<"starting before for: '"<<domain<<"'"<<endl;
-    iter = records->upper_bound(qname);
+    iter = records->upperBound(qname);
 
-    while(iter == records->end() || (qname.canonCompare(iter->qname)) || (!(iter->auth) && (!(iter->qtype == QType::NS))) || (!(iter->qtype)))
+    while(iter == records->size() || (qname.canonCompare(records->qname(iter))) || (!(records->auth(iter)) && (!(records->qtype(iter) == QType::NS))) || (!(records->qtype(iter))))
       iter--;
 
-    if(iter->qname.empty())
+    if(records->qname(iter).empty())
       before.clear();
     else {
-      before=iter->qname.labelReverse().toString(" ",false);
+      before=records->qname(iter).labelReverse().toString(" ",false);
     }
   }
   else {
@@ -942,26 +1383,26 @@ bool Bind2Backend::findBeforeAndAfterUnhashed(BB2DomainInfo& bbd, const DNSName&
   }
 
   //cerr<<"Now after"<<endl;
-  iter = records->upper_bound(qname);
+  iter = records->upperBound(qname);
 
-  if(iter == records->end()) {
-    //cerr<<"\tFound the end, begin storage: '"<<bbd.d_records->begin()->qname<<"', '"<<bbd.d_name<<"'"<<endl;
+  if(iter == records->size()) {
+    //cerr<<"\tFound the end, begin storage: '"<<records->qname(0)<<"', '"<<bbd.d_name<<"'"<<endl;
     after.clear(); // this does the right thing (i.e. point to apex, which is sure to have auth records)
   } else {
-    //cerr<<"\tFound: '"<<(iter->qname)<<"' (nsec3hash='"<<(iter->nsec3hash)<<"')"<<endl;
+    //cerr<<"\tFound: '"<<records->qname(iter)<<"'"<<endl;
     // this iteration is theoretically unnecessary - glue always sorts right behind a delegation
     // so we will never get here. But let's do it anyway.
-    while((!(iter->auth) && (!(iter->qtype == QType::NS))) || (!(iter->qtype)))
+    while((!(records->auth(iter)) && (!(records->qtype(iter) == QType::NS))) || (!(records->qtype(iter))))
     {
       iter++;
-      if(iter == records->end())
+      if(iter == records->size())
       {
         after.clear();
         break;
       }
     }
-    if(iter != records->end())
-      after = (iter)->qname.labelReverse().toString(" ",false);
+    if(iter != records->size())
+      after = records->qname(iter).labelReverse().toString(" ",false);
   }
 
   // cerr<<"Before: '"<<before<<"', after: '"<<after<<"'\n";
@@ -989,29 +1430,10 @@ bool Bind2Backend::getBeforeAndAfterNamesAbsolute(uint32_t id, const std::string
     return findBeforeAndAfterUnhashed(bbd, dqname, unhashed, before, after);
   }
   else {
-    typedef recordstorage_t::index<HashedTag>::type records_by_hashindex_t;
-    records_by_hashindex_t& hashindex=boost::multi_index::get<HashedTag>(*bbd.d_records.getWRITABLE());
-
-    records_by_hashindex_t::const_iterator iter, first;
-    first = hashindex.upper_bound(""); // skip records without a hash
-
-    // for(auto iter = first; iter != hashindex.end(); iter++)
-    //   cerr<<iter->nsec3hash<<endl;
-
-    iter = hashindex.upper_bound(toLower(qname));
-    if (iter == hashindex.end()) {
-      --iter;
-      before = iter->nsec3hash;
-      after = first->nsec3hash;
-    } else {
-      after = iter->nsec3hash;
-      if (iter != first)
-        --iter;
-      else
-        iter = --hashindex.end();
-      before = iter->nsec3hash;
-    }
-    unhashed = iter->qname+bbd.d_name;
+    shared_ptr<const recordstorage_t> records = bbd.d_records.get();
+    if(!records->getBeforeAndAfterHashes(toLower(qname), before, after, unhashed))
+      return false;
+    unhashed = unhashed + bbd.d_name;
 
     return true;
   }
@@ -1055,7 +1477,8 @@ void Bind2Backend::lookup(const QType &qtype, const DNSName &qname, DNSPacket *p
   d_handle.qtype=qtype;
   d_handle.domain=domain;
 
-  if(!bbd.d_loaded) {
+  // a zone that was never loaded is only worth trying if it is waiting for its first parse (bind-lazy-load)
+  if(!bbd.d_loaded && !bbd.d_checknow) {
     d_handle.reset();
     throw DBException("Zone for '"+bbd.d_name.toLogString()+"' in '"+bbd.d_filename+"' temporarily not available (file missing, or master dead)"); // fsck
   }
@@ -1065,16 +1488,26 @@ void Bind2Backend::lookup(const QType &qtype, const DNSName &qname, DNSPacket *p
     queueReloadAndStore(bbd.d_id);
     if (!safeGetBBDomainInfo(domain, &bbd))
       throw DBException("Zone '"+bbd.d_name.toLogString()+"' ("+bbd.d_filename+") gone after reload"); // if we don't throw here, we crash for some reason
+    if(!bbd.d_loaded) {
+      d_handle.reset();
+      throw DBException("Zone for '"+bbd.d_name.toLogString()+"' in '"+bbd.d_filename+"' temporarily not available (file missing, or master dead)");
+    }
   }
 
-  d_handle.d_records = bbd.d_records.get();
+  if(d_transaction_replaced && d_transaction_records_id == bbd.d_id) {
+    if(!d_transaction_records)
+      buildTransactionRecords();
+    d_handle.d_records = d_transaction_records; // see our own uncommitted replaceRRSet() changes
+  }
+  else
+    d_handle.d_records = bbd.d_records.get();
   
   if(d_handle.d_records->empty())
     DLOG(L<<"Query with no results"<<endl);
 
-  pair<recordstorage_t::const_iterator, recordstorage_t::const_iterator> range;
+  pair<size_t, size_t> range;
 
-  range = d_handle.d_records->equal_range(d_handle.qname);
+  range = d_handle.d_records->equalRange(d_handle.qname);
   //cout<<"End equal range"<<endl;
   d_handle.mustlog = mustlog;
   
@@ -1144,25 +1577,24 @@ bool Bind2Backend::handle::get_normal(DNSResourceRecord &r)
     return false;
   }
 
-  while(d_iter!=d_end_iter && !(qtype.getCode()==QType::ANY || (d_iter)->qtype==qtype.getCode())) {
-    DLOG(L<<Logger::Warning<<"Skipped "<<qname<<"/"<<QType(d_iter->qtype).getName()<<": '"<<d_iter->content<<"'"<<endl);
+  while(d_iter!=d_end_iter && !(qtype.getCode()==QType::ANY || d_records->qtype(d_iter)==qtype.getCode())) {
+    DLOG(L<<Logger::Warning<<"Skipped "<<qname<<"/"<<QType(d_records->qtype(d_iter)).getName()<<": '"<<d_records->content(d_iter)<<"'"<<endl);
     d_iter++;
   }
   if(d_iter==d_end_iter) {
     return false;
   }
-  DLOG(L << "Bind2Backend get() returning a rr with a "<<QType(d_iter->qtype).getCode()<<endl);
+  DLOG(L << "Bind2Backend get() returning a rr with a "<<QType(d_records->qtype(d_iter)).getCode()<<endl);
 
   r.qname=qname.empty() ? domain : (qname+domain);
   r.domain_id=id;
-  r.content=(d_iter)->content;
-  //  r.domain_id=(d_iter)->domain_id;
-  r.qtype=(d_iter)->qtype;
-  r.ttl=(d_iter)->ttl;
+  r.content=d_records->content(d_iter);
+  r.qtype=d_records->qtype(d_iter);
+  r.ttl=d_records->ttl(d_iter);
 
-  //if(!d_iter->auth && r.qtype.getCode() != QType::A && r.qtype.getCode()!=QType::AAAA && r.qtype.getCode() != QType::NS)
+  //if(!d_records->auth(d_iter) && r.qtype.getCode() != QType::A && r.qtype.getCode()!=QType::AAAA && r.qtype.getCode() != QType::NS)
   //  cerr<<"Warning! Unauth response for qtype "<< r.qtype.getName() << " for '"<<r.qname<<"'"<<endl;
-  r.auth = d_iter->auth;
+  r.auth = d_records->auth(d_iter);
 
   d_iter++;
 
@@ -1176,12 +1608,20 @@ bool Bind2Backend::list(const DNSName& target, int id, bool include_disabled)
   if(!safeGetBBDomainInfo(id, &bbd))
     return false;
 
+  if(!bbd.current()) {
+    queueReloadAndStore(bbd.d_id);
+    if(!safeGetBBDomainInfo(id, &bbd))
+      return false;
+  }
+  if(!bbd.d_loaded)
+    return false;
+
   d_handle.reset(); 
   DLOG(L<<"Bind2Backend constructing handle for list of "<<id<<endl);
 
   d_handle.d_records=bbd.d_records.get(); // give it a copy, which will stay around
-  d_handle.d_qname_iter= d_handle.d_records->begin();
-  d_handle.d_qname_end=d_handle.d_records->end();   // iter now points to a vector of pointers to vector<BBResourceRecords>
+  d_handle.d_qname_iter=0;
+  d_handle.d_qname_end=d_handle.d_records->size();
 
   d_handle.id=id;
   d_handle.domain=bbd.d_name;
@@ -1192,12 +1632,13 @@ bool Bind2Backend::list(const DNSName& target, int id, bool include_disabled)
 bool Bind2Backend::handle::get_list(DNSResourceRecord &r)
 {
   if(d_qname_iter!=d_qname_end) {
-    r.qname=d_qname_iter->qname.empty() ? domain : (d_qname_iter->qname+domain);
+    const DNSName& name=d_records->qname(d_qname_iter);
+    r.qname=name.empty() ? domain : (name+domain);
     r.domain_id=id;
-    r.content=(d_qname_iter)->content;
-    r.qtype=(d_qname_iter)->qtype;
-    r.ttl=(d_qname_iter)->ttl;
-    r.auth = d_qname_iter->auth;
+    r.content=d_records->content(d_qname_iter);
+    r.qtype=d_records->qtype(d_qname_iter);
+    r.ttl=d_records->ttl(d_qname_iter);
+    r.auth = d_records->auth(d_qname_iter);
     d_qname_iter++;
     return true;
   }
@@ -1320,16 +1761,17 @@ bool Bind2Backend::searchRecords(const string &pattern, int maxResults, vector<D
       safeGetBBDomainInfo(i->d_id, &h);
       shared_ptr<const recordstorage_t> handle = h.d_records.get();
 
-      for(recordstorage_t::const_iterator ri = handle->begin(); result.size() < static_cast<vector<DNSResourceRecord>::size_type>(maxResults) && ri != handle->end(); ri++) {
-        DNSName name = ri->qname.empty() ? i->d_name : (ri->qname+i->d_name);
-        if (sm.match(name) || sm.match(ri->content)) {
+      for(size_t ri = 0; result.size() < static_cast<vector<DNSResourceRecord>::size_type>(maxResults) && ri != handle->size(); ri++) {
+        DNSName name = handle->qname(ri).empty() ? i->d_name : (handle->qname(ri)+i->d_name);
+        string content = handle->content(ri);
+        if (sm.match(name) || sm.match(content)) {
           DNSResourceRecord r;
           r.qname=name;
           r.domain_id=i->d_id;
-          r.content=ri->content;
-          r.qtype=ri->qtype;
-          r.ttl=ri->ttl;
-          r.auth = ri->auth;
+          r.content=content;
+          r.qtype=handle->qtype(ri);
+          r.ttl=handle->ttl(ri);
+          r.auth = handle->auth(ri);
           result.push_back(r);
         }
       }
@@ -1349,6 +1791,9 @@ class Bind2Factory : public BackendFactory
          declare(suffix,"ignore-broken-records","Ignore records that are out-of-bound for the zone.","no");
          declare(suffix,"config","Location of named.conf","");
          declare(suffix,"check-interval","Interval for zonefile changes","0");
+         declare(suffix,"load-threads","Number of threads parsing zone files concurrently when (re)loading the configuration","1");
+         declare(suffix,"snapshot-directory","Directory to keep binary snapshots of parsed zones in, for faster loading. Empty to disable","");
+         declare(suffix,"lazy-load","Parse zone files when they are first needed instead of when loading the configuration","no");
          declare(suffix,"supermaster-config","Location of (part of) named.conf where pdns can write zone-statements to","");
          declare(suffix,"supermasters","List of IP-addresses of supermasters","");
          declare(suffix,"supermaster-destdir","Destination directory for newly added slave zones",::arg()["config-dir"]);
@@ -48,9 +48,9 @@
 using namespace ::boost::multi_index;
 
 /**
-  This struct is used within the Bind2Backend to store DNS information. It is
-  almost identical to a DNSResourceRecord, but then a bit smaller and with
-  different sorting rules, which make sure that the SOA record comes up front.
+  This struct is used within the Bind2Backend to hand records to Bind2RecordStorage, and to get
+  them back out of it when a zone is changed. It is almost identical to a DNSResourceRecord, but
+  with names relative to the zone.
 */
 
 struct Bind2DNSRecord
@@ -60,40 +60,74 @@ struct Bind2DNSRecord
   string nsec3hash;
   uint32_t ttl;
   uint16_t qtype;
-  mutable bool auth;
-  bool operator<(const Bind2DNSRecord& rhs) const
-  {
-    if(qname.canonCompare(rhs.qname))
-      return true;
-    if(rhs.qname.canonCompare(qname))
-      return false;
-    if(qtype==QType::SOA && rhs.qtype!=QType::SOA)
-      return true;
-    return tie(qtype,content, ttl) < tie(rhs.qtype, rhs.content, rhs.ttl);
-  }
+  bool auth;
 };
 
-struct Bind2DNSCompare : std::less<Bind2DNSRecord> 
-{ 
-    using std::less<Bind2DNSRecord>::operator(); 
-    // use operator< 
-    bool operator() (const DNSName& a, const Bind2DNSRecord& b) const
-    {return a.canonCompare(b.qname);}
-    bool operator() (const Bind2DNSRecord& a, const DNSName& b) const
-    {return a.qname.canonCompare(b);}
-    bool operator() (const Bind2DNSRecord& a, const Bind2DNSRecord& b) const
-    {return a.qname.canonCompare(b.qname);}
-};
+/** Read-only storage for the records of a single zone, built in one go from a vector of Bind2DNSRecord.
+    Every owner name is stored once, all record contents (and NSEC3 hashes) share a single arena and
+    each record only costs a small fixed size entry. The records are sorted in canonical order, with
+    the SOA first, for listing and NSEC, and exact name lookups go through a hash index.
+    Records are addressed by their position, from 0 to size(). */
+class Bind2RecordStorage
+{
+public:
+  Bind2RecordStorage() {}
+  explicit Bind2RecordStorage(const vector<Bind2DNSRecord>& records);
+  //! restores storage written by serialize(), throws std::runtime_error if the data is not valid
+  Bind2RecordStorage(const char* data, size_t length);
+
+  //! appends the storage, index included, in the format read back by the constructor above
+  void serialize(string& out) const;
+
+  size_t size() const { return d_entries.size(); }
+  bool empty() const { return d_entries.empty(); }
+
+  //! positions [first, second) of the records with this owner name, which must be relative to the zone
+  pair<size_t, size_t> equalRange(const DNSName& qname) const;
+  //! position of the first record with an owner name that sorts canonically after qname, size() if there is none
+  size_t upperBound(const DNSName& qname) const;
+  //! finds the NSEC3 hashes around 'hash' and the name that hashes to 'before', false if nothing in the zone is hashed
+  bool getBeforeAndAfterHashes(const string& hash, string& before, string& after, DNSName& unhashed) const;
+
+  const DNSName& qname(size_t pos) const { return d_names[d_entries[pos].name]; }
+  string content(size_t pos) const { return d_arena.substr(d_entries[pos].offset, d_entries[pos].length); }
+  uint32_t ttl(size_t pos) const { return d_entries[pos].ttl; }
+  uint16_t qtype(size_t pos) const { return d_entries[pos].qtype; }
+  bool auth(size_t pos) const { return d_entries[pos].auth; }
+  //! the record at pos, without its NSEC3 hash
+  Bind2DNSRecord record(size_t pos) const;
+
+  //! approximate number of bytes used
+  size_t memoryUsage() const;
 
-struct HashedTag{};
+private:
+  struct Entry
+  {
+    uint32_t name;    //!< index in d_names
+    uint32_t offset;  //!< of the content in d_arena
+    uint32_t length;
+    uint32_t ttl;
+    uint16_t qtype;
+    bool auth;
+  };
+  struct HashEntry
+  {
+    uint32_t offset;  //!< of the hash in d_arena
+    uint32_t length;
+    uint32_t name;
+  };
+
+  string hashAt(const HashEntry& he) const { return d_arena.substr(he.offset, he.length); }
+
+  vector<DNSName> d_names;        //!< unique owner names, in canonical order
+  vector<uint32_t> d_nameFirst;   //!< position of the first record of every name, plus size() at the end
+  vector<Entry> d_entries;
+  vector<HashEntry> d_hashes;     //!< one entry per hashed name, ordered by hash
+  vector<uint32_t> d_buckets;     //!< open addressing hash table of 1 + index in d_names, 0 is unused
+  string d_arena;
+};
 
-typedef multi_index_container<
-  Bind2DNSRecord,
-  indexed_by  <
-                ordered_non_unique<identity<Bind2DNSRecord>, Bind2DNSCompare >,
-                ordered_non_unique<tag<HashedTag>, member<Bind2DNSRecord, std::string, &Bind2DNSRecord::nsec3hash> >
-              >
-> recordstorage_t;
+typedef Bind2RecordStorage recordstorage_t;
 
 template <typename T>
 class LookButDontTouch //  : public boost::noncopyable
@@ -193,6 +227,7 @@ public:
   bool list(const DNSName &target, int id, bool include_disabled=false);
   bool get(DNSResourceRecord &);
   void getAllDomains(vector<DomainInfo> *domains, bool include_disabled=false);
+  string directBackendCmd(const string &query);
 
   static DNSBackend *maker();
   static pthread_mutex_t s_startup_lock;
@@ -201,6 +236,7 @@ public:
   void setNotified(uint32_t id, uint32_t serial);
   bool startTransaction(const DNSName &qname, int id);
   bool feedRecord(const DNSResourceRecord &rr, string *ordername=0);
+  bool replaceRRSet(uint32_t domain_id, const DNSName& qname, const QType& qt, const vector<DNSResourceRecord>& rrset);
   bool commitTransaction();
   bool abortTransaction();
   void alsoNotifies(const DNSName &domain, set<string> *ips);
@@ -230,7 +266,8 @@ public:
   static pthread_rwlock_t s_state_lock;
 
   void parseZoneFile(BB2DomainInfo *bbd);
-  void insertRecord(BB2DomainInfo& bbd, const DNSName &qname, const QType &qtype, const string &content, int ttl, const std::string& hashed=string(), bool *auth=0);
+  static void parseZoneFile(BB2DomainInfo *bbd, bool nsec3zone, const NSEC3PARAMRecordContent& ns3pr, bool readSnapshot=true);
+  static void insertRecord(vector<Bind2DNSRecord>& records, const DNSName& zone, const DNSName &qname, const QType &qtype, const string &content, int ttl);
   void rediscover(string *status=0);
 
   bool isMaster(const DNSName &name, const string &ip);
@@ -252,6 +289,8 @@ private:
   bool GetBBDomainInfo(int id, BB2DomainInfo** bbd);
   shared_ptr<SSQLite3> d_dnssecdb;
   bool getNSEC3PARAM(const DNSName& name, NSEC3PARAMRecordContent* ns3p);
+  bool getNSEC3PARAMForZone(const DNSName& name, NSEC3PARAMRecordContent* ns3p);
+  void commitReplacedRRSets();
   class handle
   {
   public:
@@ -261,9 +300,9 @@ private:
     handle();
 
     shared_ptr<const recordstorage_t > d_records;
-    recordstorage_t::const_iterator d_iter, d_end_iter;
-    recordstorage_t::const_iterator d_qname_iter;
-    recordstorage_t::const_iterator d_qname_end;
+    size_t d_iter, d_end_iter;
+    size_t d_qname_iter;
+    size_t d_qname_end;
     DNSName qname;
     DNSName domain;
 
@@ -295,6 +334,10 @@ private:
   SSqlStatement* d_getTSIGKeysQuery_stmt;
 
   string d_transaction_tmpname;
+  map<DNSName, vector<Bind2DNSRecord> > d_transaction_rrsets; //!< copy of the zone being modified by replaceRRSet(), by owner name
+  shared_ptr<recordstorage_t> d_transaction_records; //!< d_transaction_rrsets as lookup() sees them, built on demand
+  uint32_t d_transaction_records_id;
+  bool d_transaction_replaced; //!< if replaceRRSet() was called in this transaction
   string d_logprefix;
   set<string> alsoNotify; //!< this is used to store the also-notify list of interested peers.
   ofstream *d_of;
@@ -303,19 +346,27 @@ private:
   static int s_first;                                  //!< this is raised on construction to prevent multiple instances of us being generated
   int d_transaction_id;
   static bool s_ignore_broken_records;
+  static string s_snapshotdirectory;                          //!< where zone snapshots are kept, empty if they are disabled
   bool d_hybrid;
 
   BB2DomainInfo createDomainEntry(const DNSName& domain, const string &filename); //!< does not insert in s_state
 
+  struct ZoneLoadQueue;
+  static void* zoneLoaderThread(void* queue);
   void queueReloadAndStore(unsigned int id);
+  static string snapshotFilename(const DNSName& zone);
+  static shared_ptr<recordstorage_t> loadSnapshot(const BB2DomainInfo& bbd, const string& nsec3param);
+  static bool writeSnapshot(const BB2DomainInfo& bbd, const vector<pair<string, struct stat> >& files, const string& nsec3param, const recordstorage_t& storage);
+  string buildSnapshots(const vector<string>& zones);
   bool findBeforeAndAfterUnhashed(BB2DomainInfo& bbd, const DNSName& qname, DNSName& unhashed, string& before, string& after);
   void reload();
   static string DLDomStatusHandler(const vector<string>&parts, Utility::pid_t ppid);
   static string DLListRejectsHandler(const vector<string>&parts, Utility::pid_t ppid);
   static string DLReloadNowHandler(const vector<string>&parts, Utility::pid_t ppid);
   static string DLAddDomainHandler(const vector<string>&parts, Utility::pid_t ppid);
-  static void fixupOrderAndAuth(BB2DomainInfo& bbd, bool nsec3zone, NSEC3PARAMRecordContent ns3pr);
-  void doEmptyNonTerminals(BB2DomainInfo& bbd, bool nsec3zone, NSEC3PARAMRecordContent ns3pr);
+  static void fixupOrderAndAuth(vector<Bind2DNSRecord>& records, const DNSName& zone, bool nsec3zone, NSEC3PARAMRecordContent ns3pr);
+  static void doEmptyNonTerminals(vector<Bind2DNSRecord>& records, const DNSName& zone, bool nsec3zone, NSEC3PARAMRecordContent ns3pr);
+  void buildTransactionRecords();
   void loadConfig(string *status=0);
   static void nukeZoneRecords(BB2DomainInfo *bbd);
 
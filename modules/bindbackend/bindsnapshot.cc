@@ -0,0 +1,359 @@
+/*
+    PowerDNS Versatile Database Driven Nameserver
+    Copyright (C) 2016  PowerDNS.COM BV
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation
+
+    Additionally, the license of this program contains a special
+    exception which allows to distribute the program in binary form when
+    it is linked against OpenSSL.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdexcept>
+#include "bindbackend2.hh"
+#include "pdns/arguments.hh"
+#include "pdns/dnsrecords.hh"
+#include "pdns/logger.hh"
+
+/* A snapshot holds the parsed records of one zone, including the lookup index of
+   Bind2RecordStorage, so it can be loaded without parsing, sorting or hashing anything.
+
+   Layout, all integers in host byte order:
+     "PDNSBZS" and a 0 byte, uint32_t version, uint32_t byte order marker
+     uint32_t number of files the snapshot was made from, the zone file first and then
+       everything it $INCLUDEs, each as its name and uint64_t inode, mtime and size
+     zone name and NSEC3PARAM of the zone, as strings
+     the serialized Bind2RecordStorage
+   Strings are a uint32_t length followed by the data, vectors a uint64_t count followed
+   by the elements. A snapshot that does not match in any way, or of which any of the
+   files changed, is ignored, and the zone file is parsed instead. */
+
+static const char s_snapshotMagic[8] = {'P', 'D', 'N', 'S', 'B', 'Z', 'S', 0};
+static const uint32_t s_snapshotVersion = 2;
+static const uint32_t s_snapshotByteOrder = 0x01020304;
+
+namespace {
+template<typename T> void put(string& out, const T& val)
+{
+  out.append(reinterpret_cast<const char*>(&val), sizeof(val));
+}
+
+void putString(string& out, const string& str)
+{
+  put<uint32_t>(out, str.size());
+  out.append(str);
+}
+
+template<typename T> void putVector(string& out, const vector<T>& vec)
+{
+  put<uint64_t>(out, vec.size());
+  out.append(reinterpret_cast<const char*>(vec.data()), vec.size() * sizeof(T));
+}
+
+//! bounds checked reading of what put() and friends wrote
+class SnapshotReader
+{
+public:
+  SnapshotReader(const char* data, size_t length) : d_pos(data), d_end(data + length)
+  {
+  }
+
+  template<typename T> T get()
+  {
+    T ret;
+    memcpy(&ret, need(sizeof(T)), sizeof(T));
+    return ret;
+  }
+
+  string getString()
+  {
+    uint32_t length = get<uint32_t>();
+    return string(need(length), length);
+  }
+
+  template<typename T> void getVector(vector<T>& vec)
+  {
+    uint64_t count = get<uint64_t>();
+    if(count > remaining() / sizeof(T))
+      throw std::runtime_error("snapshot is truncated");
+    vec.resize(count);
+    memcpy(vec.data(), need(count * sizeof(T)), count * sizeof(T));
+  }
+
+  const char* pos() const { return d_pos; }
+  size_t remaining() const { return d_end - d_pos; }
+
+private:
+  const char* need(size_t length)
+  {
+    if(length > remaining())
+      throw std::runtime_error("snapshot is truncated");
+    const char* ret = d_pos;
+    d_pos += length;
+    return ret;
+  }
+
+  const char* d_pos;
+  const char* d_end;
+};
+}
+
+void Bind2RecordStorage::serialize(string& out) const
+{
+  // the entries are copied as they are, so their layout has to match when reading
+  put<uint32_t>(out, sizeof(Entry));
+  put<uint32_t>(out, sizeof(HashEntry));
+  put<uint64_t>(out, d_names.size());
+  for(const auto& name : d_names)
+    putString(out, name.empty() ? string() : name.toDNSString());
+  putVector(out, d_nameFirst);
+  putVector(out, d_entries);
+  putVector(out, d_hashes);
+  putVector(out, d_buckets);
+  putString(out, d_arena);
+}
+
+Bind2RecordStorage::Bind2RecordStorage(const char* data, size_t length)
+{
+  SnapshotReader sr(data, length);
+  if(sr.get<uint32_t>() != sizeof(Entry) || sr.get<uint32_t>() != sizeof(HashEntry))
+    throw std::runtime_error("snapshot was written by an incompatible build");
+
+  uint64_t names = sr.get<uint64_t>();
+  if(names > sr.remaining() / sizeof(uint32_t))
+    throw std::runtime_error("snapshot is truncated");
+  d_names.reserve(names);
+  for(uint64_t n = 0; n < names; ++n) {
+    string wire = sr.getString();
+    d_names.push_back(wire.empty() ? DNSName() : DNSName(wire.c_str(), wire.size(), 0, false));
+  }
+  sr.getVector(d_nameFirst);
+  sr.getVector(d_entries);
+  sr.getVector(d_hashes);
+  sr.getVector(d_buckets);
+  d_arena = sr.getString();
+  if(sr.remaining())
+    throw std::runtime_error("trailing data after the records");
+
+  // a damaged snapshot must not make us read out of bounds, or loop forever in equalRange()
+  if(d_nameFirst.size() != d_names.size() + 1 || d_nameFirst.back() != d_entries.size())
+    throw std::runtime_error("name index does not match the records");
+  for(size_t n = 1; n < d_nameFirst.size(); ++n)
+    if(d_nameFirst[n] < d_nameFirst[n - 1])
+      throw std::runtime_error("name index is not ordered");
+  for(const auto& entry : d_entries)
+    if(entry.name >= d_names.size() || (uint64_t)entry.offset + entry.length > d_arena.size())
+      throw std::runtime_error("record points outside of the snapshot");
+  for(const auto& he : d_hashes)
+    if(he.name >= d_names.size() || (uint64_t)he.offset + he.length > d_arena.size())
+      throw std::runtime_error("NSEC3 hash points outside of the snapshot");
+  if(d_buckets.size() <= d_names.size() || (d_buckets.size() & (d_buckets.size() - 1)))
+    throw std::runtime_error("hash index has an invalid size");
+  for(auto bucket : d_buckets)
+    if(bucket > d_names.size())
+      throw std::runtime_error("hash index points outside of the snapshot");
+}
+
+string Bind2Backend::snapshotFilename(const DNSName& zone)
+{
+  if(s_snapshotdirectory.empty())
+    return string();
+
+  // zone names can contain anything, escape what a filename can not
+  string name;
+  for(auto c : zone.toString()) {
+    if(c == '/' || c == '%')
+      name.append(c == '/' ? "%2F" : "%25");
+    else
+      name.append(1, c);
+  }
+  return s_snapshotdirectory + "/" + name + "snapshot";
+}
+
+shared_ptr<recordstorage_t> Bind2Backend::loadSnapshot(const BB2DomainInfo& bbd, const string& nsec3param)
+{
+  string filename = snapshotFilename(bbd.d_name);
+  int fd = open(filename.c_str(), O_RDONLY);
+  if(fd < 0) {
+    if(errno != ENOENT)
+      L<<Logger::Warning<<"Unable to open snapshot '"<<filename<<"' of zone '"<<bbd.d_name<<"': "<<stringerror()<<endl;
+    return shared_ptr<recordstorage_t>();
+  }
+
+  struct stat snapst;
+  if(fstat(fd, &snapst) < 0 || snapst.st_size < (off_t)sizeof(s_snapshotMagic)) {
+    close(fd);
+    return shared_ptr<recordstorage_t>();
+  }
+  void* map = mmap(0, snapst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) {
+    L<<Logger::Warning<<"Unable to map snapshot '"<<filename<<"' of zone '"<<bbd.d_name<<"': "<<stringerror()<<endl;
+    return shared_ptr<recordstorage_t>();
+  }
+
+  shared_ptr<recordstorage_t> ret;
+  try {
+    SnapshotReader sr(static_cast<const char*>(map), snapst.st_size);
+    char magic[sizeof(s_snapshotMagic)];
+    for(auto& c : magic)
+      c = sr.get<char>();
+    if(memcmp(magic, s_snapshotMagic, sizeof(magic)) || sr.get<uint32_t>() != s_snapshotVersion || sr.get<uint32_t>() != s_snapshotByteOrder)
+      throw std::runtime_error("not a snapshot of this version, or from another architecture");
+
+    // every file the zone was parsed from has to be as it was when the snapshot was made
+    string changed;
+    uint32_t files = sr.get<uint32_t>();
+    for(uint32_t n = 0; n < files; ++n) {
+      string name = sr.getString();
+      uint64_t ino = sr.get<uint64_t>();
+      uint64_t mtime = sr.get<uint64_t>();
+      uint64_t size = sr.get<uint64_t>();
+      struct stat st;
+      if(!changed.empty())
+        continue;
+      if((!n && name != bbd.d_filename) || stat(name.c_str(), &st) < 0 ||
+         ino != (uint64_t)st.st_ino || mtime != (uint64_t)st.st_mtime || size != (uint64_t)st.st_size)
+        changed = name;
+    }
+    string zone = sr.getString();
+    string param = sr.getString();
+    if(!files)
+      throw std::runtime_error("no zone file recorded");
+    if(!changed.empty())
+      L<<Logger::Info<<"Snapshot of zone '"<<bbd.d_name<<"' is older than '"<<changed<<"', not using it"<<endl;
+    else if(zone != bbd.d_name.toDNSStringLC() || param != nsec3param)
+      L<<Logger::Info<<"Snapshot of zone '"<<bbd.d_name<<"' was made with different zone settings, not using it"<<endl;
+    else
+      ret = std::make_shared<recordstorage_t>(sr.pos(), sr.remaining());
+  }
+  catch(std::exception& e) {
+    L<<Logger::Warning<<"Ignoring snapshot '"<<filename<<"' of zone '"<<bbd.d_name<<"': "<<e.what()<<endl;
+    ret.reset();
+  }
+  munmap(map, snapst.st_size);
+  return ret;
+}
+
+bool Bind2Backend::writeSnapshot(const BB2DomainInfo& bbd, const vector<pair<string, struct stat> >& files, const string& nsec3param, const recordstorage_t& storage)
+{
+  string filename = snapshotFilename(bbd.d_name);
+
+  string out;
+  out.reserve(storage.memoryUsage());
+  out.append(s_snapshotMagic, sizeof(s_snapshotMagic));
+  put<uint32_t>(out, s_snapshotVersion);
+  put<uint32_t>(out, s_snapshotByteOrder);
+  put<uint32_t>(out, files.size());
+  for(const auto& file : files) {
+    putString(out, file.first);
+    put<uint64_t>(out, file.second.st_ino);
+    put<uint64_t>(out, file.second.st_mtime);
+    put<uint64_t>(out, file.second.st_size);
+  }
+  putString(out, bbd.d_name.toDNSStringLC());
+  putString(out, nsec3param);
+  storage.serialize(out);
+
+  // write a temporary file and rename it, so readers never see a partial snapshot
+  string tmpname = filename + ".XXXXXX";
+  int fd = mkstemp(&tmpname[0]);
+  if(fd < 0) {
+    L<<Logger::Warning<<"Unable to create snapshot of zone '"<<bbd.d_name<<"' in '"<<s_snapshotdirectory<<"': "<<stringerror()<<endl;
+    return false;
+  }
+  const char* pos = out.c_str();
+  size_t left = out.size();
+  while(left) {
+    ssize_t written = write(fd, pos, left);
+    if(written < 0) {
+      if(errno == EINTR)
+        continue;
+      break;
+    }
+    pos += written;
+    left -= written;
+  }
+  if(close(fd) < 0 || left || rename(tmpname.c_str(), filename.c_str()) < 0) {
+    L<<Logger::Warning<<"Unable to write snapshot '"<<filename<<"' of zone '"<<bbd.d_name<<"': "<<stringerror()<<endl;
+    unlink(tmpname.c_str());
+    return false;
+  }
+  L<<Logger::Info<<"Wrote snapshot '"<<filename<<"' of zone '"<<bbd.d_name<<"' ("<<out.size()/1024<<" kB)"<<endl;
+  return true;
+}
+
+//! reparses the zone files of 'zones', or of all zones, and (re)writes their snapshots
+string Bind2Backend::buildSnapshots(const vector<string>& zones)
+{
+  if(s_snapshotdirectory.empty())
+    return "No "+getPrefix()+"-snapshot-directory configured\n";
+
+  vector<unsigned int> ids;
+  if(zones.empty()) {
+    ReadLock rl(&s_state_lock);
+    for(const auto& bbd : s_state)
+      ids.push_back(bbd.d_id);
+  }
+  else {
+    for(const auto& zone : zones) {
+      BB2DomainInfo bbd;
+      if(!safeGetBBDomainInfo(DNSName(zone), &bbd))
+        return zone+": no such zone\n";
+      ids.push_back(bbd.d_id);
+    }
+  }
+
+  ostringstream ret;
+  unsigned int failed = 0;
+  for(auto id : ids) {
+    BB2DomainInfo bbd;
+    if(!safeGetBBDomainInfo(id, &bbd))
+      continue;
+    try {
+      NSEC3PARAMRecordContent ns3pr;
+      bool nsec3zone = getNSEC3PARAMForZone(bbd.d_name, &ns3pr);
+      parseZoneFile(&bbd, nsec3zone, ns3pr, false);
+      ret<<bbd.d_name<<": "<<bbd.d_status<<endl;
+    }
+    catch(PDNSException& ae) {
+      ret<<bbd.d_name<<": error parsing '"<<bbd.d_filename<<"': "<<ae.reason<<endl;
+      failed++;
+    }
+    catch(std::exception& e) {
+      ret<<bbd.d_name<<": error parsing '"<<bbd.d_filename<<"': "<<e.what()<<endl;
+      failed++;
+    }
+  }
+  ret<<"Built snapshots of "<<ids.size() - failed<<" zone(s), "<<failed<<" failed"<<endl;
+  return ret.str();
+}
+
+string Bind2Backend::directBackendCmd(const string &query)
+{
+  vector<string> parts;
+  stringtok(parts, query);
+  if(!parts.empty() && parts[0] == "build-snapshots")
+    return buildSnapshots(vector<string>(parts.begin() + 1, parts.end()));
+
+  return "Unknown command, available is: build-snapshots [ZONE..]\n";
+}
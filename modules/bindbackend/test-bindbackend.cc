@@ -0,0 +1,172 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_MODULE unit
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <boost/test/unit_test.hpp>
+
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "pdns/arguments.hh"
+#include "pdns/dnsrecords.hh"
+#include "pdns/packetcache.hh"
+#include "pdns/statbag.hh"
+#include "bindbackend2.hh"
+#include "pdns/dynlistener.hh"
+
+StatBag S;
+PacketCache PC;
+DynListener* dl; // Bind2Backend only registers its commands when it loads zones
+ArgvMap &arg()
+{
+  static ArgvMap arg;
+  return arg;
+}
+
+/* Every test gets a directory of its own, with the snapshots kept next to the zone files */
+struct BindSnapshotSetup {
+  BindSnapshotSetup()
+  {
+    char tmpl[] = "/tmp/pdns-bindbackend.XXXXXX";
+    BOOST_REQUIRE(mkdtemp(tmpl));
+    d_dir = tmpl;
+    d_zonefile = d_dir + "/example.com.zone";
+    d_include = d_dir + "/www.example.com.zone";
+    d_snapshot = d_dir + "/example.com.snapshot";
+
+    reportAllTypes();
+    ::arg().set("max-ent-entries") = "100000";
+    ::arg().set("bind-hybrid") = "yes";
+    ::arg().set("bind-ignore-broken-records") = "no";
+    ::arg().set("bind-snapshot-directory") = d_dir;
+    Bind2Backend bb("", false); // picks up the snapshot directory
+
+    writeFile(d_zonefile,
+              "$TTL 3600\n"
+              "@ IN SOA ns.example.com. hostmaster.example.com. 1 2 3 4 5\n"
+              "@ IN NS ns.example.com.\n"
+              "ns IN A 192.0.2.53\n"
+              "$INCLUDE " + d_include + "\n");
+    writeFile(d_include, "www IN A 192.0.2.1\n");
+    d_bbd.d_name = DNSName("example.com.");
+    d_bbd.d_filename = d_zonefile;
+  }
+
+  ~BindSnapshotSetup()
+  {
+    unlink(d_snapshot.c_str());
+    unlink(d_include.c_str());
+    unlink(d_zonefile.c_str());
+    rmdir(d_dir.c_str());
+  }
+
+  static void writeFile(const string& fname, const string& content, bool append=false)
+  {
+    ofstream ofs(fname, append ? ofstream::app : ofstream::trunc);
+    ofs<<content;
+    BOOST_REQUIRE(ofs);
+  }
+
+  static string readFile(const string& fname)
+  {
+    ifstream ifs(fname);
+    return string(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+  }
+
+  //! returns how the zone was loaded, as parseZoneFile() puts it at the end of its status
+  string parse(bool readSnapshot=true)
+  {
+    Bind2Backend::parseZoneFile(&d_bbd, false, NSEC3PARAMRecordContent(), readSnapshot);
+    if(d_bbd.d_status.find(", from snapshot") != string::npos)
+      return "loaded";
+    if(d_bbd.d_status.find(", snapshot saved") != string::npos)
+      return "saved";
+    return "parsed";
+  }
+
+  size_t countRecords(const DNSName& qname)
+  {
+    auto records = d_bbd.d_records.get();
+    auto range = records->equalRange(qname);
+    return range.second - range.first;
+  }
+
+  string d_dir, d_zonefile, d_include, d_snapshot;
+  BB2DomainInfo d_bbd;
+};
+
+BOOST_FIXTURE_TEST_SUITE(bindsnapshot_cc, BindSnapshotSetup)
+
+BOOST_AUTO_TEST_CASE(test_snapshot_roundtrip) {
+  BOOST_CHECK_EQUAL(parse(), "saved");
+  const size_t size = d_bbd.d_records.get()->size();
+  BOOST_CHECK_EQUAL(countRecords(DNSName("www")), 1U);
+
+  BOOST_CHECK_EQUAL(parse(), "loaded");
+  auto records = d_bbd.d_records.get();
+  BOOST_CHECK_EQUAL(records->size(), size);
+  auto range = records->equalRange(DNSName("www"));
+  BOOST_REQUIRE_EQUAL(range.second - range.first, 1U);
+  BOOST_CHECK_EQUAL(records->qtype(range.first), QType::A);
+  BOOST_CHECK_EQUAL(records->content(range.first), "192.0.2.1");
+  BOOST_CHECK_EQUAL(records->ttl(range.first), 3600U);
+
+  /* asked not to read it, the zone is parsed and the snapshot rewritten */
+  BOOST_CHECK_EQUAL(parse(false), "saved");
+  BOOST_CHECK_EQUAL(parse(), "loaded");
+}
+
+BOOST_AUTO_TEST_CASE(test_snapshot_include_changed) {
+  BOOST_CHECK_EQUAL(parse(), "saved");
+
+  /* only the included file changes, the zone file itself stays as it was */
+  writeFile(d_include, "www IN AAAA 2001:db8::1\n", true);
+  BOOST_CHECK_EQUAL(parse(), "saved");
+  BOOST_CHECK_EQUAL(countRecords(DNSName("www")), 2U);
+  BOOST_CHECK_EQUAL(parse(), "loaded");
+  BOOST_CHECK_EQUAL(countRecords(DNSName("www")), 2U);
+
+  /* a missing include is not papered over with the snapshot either */
+  unlink(d_include.c_str());
+  BOOST_CHECK_THROW(parse(), std::exception);
+}
+
+BOOST_AUTO_TEST_CASE(test_snapshot_zone_changed) {
+  BOOST_CHECK_EQUAL(parse(), "saved");
+
+  writeFile(d_zonefile, "mail IN A 192.0.2.25\n", true);
+  BOOST_CHECK_EQUAL(parse(), "saved");
+  BOOST_CHECK_EQUAL(countRecords(DNSName("mail")), 1U);
+
+  /* neither is a snapshot of the same file made for a zone by another name */
+  const string other = d_dir + "/example.net.snapshot";
+  writeFile(other, readFile(d_snapshot));
+  d_bbd.d_name = DNSName("example.net.");
+  BOOST_CHECK_EQUAL(parse(), "saved");
+  BOOST_CHECK_EQUAL(countRecords(DNSName("mail")), 1U);
+  unlink(other.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(test_snapshot_truncated) {
+  BOOST_CHECK_EQUAL(parse(), "saved");
+  const string snapshot = readFile(d_snapshot);
+  BOOST_REQUIRE_GT(snapshot.size(), 64U);
+  const size_t size = d_bbd.d_records.get()->size();
+
+  /* every truncation of the header, and a good few of the records, are noticed */
+  for(size_t length = 0; length < snapshot.size(); length += (length < 256 ? 1 : 97)) {
+    writeFile(d_snapshot, snapshot.substr(0, length));
+    BOOST_CHECK_MESSAGE(parse() == "saved", "snapshot truncated to " << length << " bytes was used");
+    BOOST_CHECK_EQUAL(d_bbd.d_records.get()->size(), size);
+  }
+
+  /* as is trailing garbage */
+  writeFile(d_snapshot, snapshot + "garbage");
+  BOOST_CHECK_EQUAL(parse(), "saved");
+  BOOST_CHECK_EQUAL(parse(), "loaded");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -5,14 +5,118 @@
 #include <sstream>
 #include <regex.h>
 #include <glob.h>
+#include <atomic>
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/sequenced_index.hpp>
+#include "pdns/cachecleaner.hh"
+
+using namespace ::boost::multi_index;
 
 pthread_rwlock_t GeoIPBackend::s_state_lock=PTHREAD_RWLOCK_INITIALIZER;
 
+/* Record contents and service targets, split when the zones are loaded into
+   literal text and the placeholders to substitute, so that answering a query
+   only has to fill in the blanks. */
+struct GeoIPTemplate {
+  enum PartType {
+    Literal,
+    Attribute, // %cn, %co, %as, %re, %na, %ci
+    Family,    // %af
+    Hour,      // %hh
+    Year,      // %yy
+    YearDay,   // %dd
+    WeekdayName, // %wds
+    MonthName, // %mos
+    Weekday,   // %wd
+    Month,     // %mo
+    IP         // %ip
+  };
+
+  struct Part {
+    PartType type;
+    GeoIPBackend::GeoIPQueryAttribute attribute;
+    string text;
+  };
+
+  GeoIPTemplate() {}
+  explicit GeoIPTemplate(const string& format);
+
+  string d_format;
+  vector<Part> d_parts;
+  bool d_static{true};    //!< no placeholders, d_format is the result
+  bool d_needsTime{false};
+};
+
+GeoIPTemplate::GeoIPTemplate(const string& format): d_format(format)
+{
+  static const struct {
+    const char* placeholder;
+    PartType type;
+    GeoIPBackend::GeoIPQueryAttribute attribute;
+  } placeholders[] = {
+    // longest first, %wds has to win over %wd
+    { "%wds", WeekdayName, GeoIPBackend::ASn },
+    { "%mos", MonthName, GeoIPBackend::ASn },
+    { "%cn", Attribute, GeoIPBackend::Continent },
+    { "%co", Attribute, GeoIPBackend::Country },
+    { "%af", Family, GeoIPBackend::ASn },
+    { "%as", Attribute, GeoIPBackend::ASn },
+    { "%re", Attribute, GeoIPBackend::Region },
+    { "%na", Attribute, GeoIPBackend::Name },
+    { "%ci", Attribute, GeoIPBackend::City },
+    { "%hh", Hour, GeoIPBackend::ASn },
+    { "%yy", Year, GeoIPBackend::ASn },
+    { "%dd", YearDay, GeoIPBackend::ASn },
+    { "%wd", Weekday, GeoIPBackend::ASn },
+    { "%mo", Month, GeoIPBackend::ASn },
+    { "%ip", IP, GeoIPBackend::ASn }
+  };
+
+  string literal;
+  string::size_type cur, last = 0;
+  while((cur = format.find('%', last)) != string::npos) {
+    literal.append(format, last, cur - last);
+    if (!format.compare(cur, 2, "%%")) { // left as is
+      literal.append("%%");
+      last = cur + 2;
+      continue;
+    }
+    bool found = false;
+    for(const auto& ph : placeholders) {
+      size_t len = strlen(ph.placeholder);
+      if (format.compare(cur, len, ph.placeholder))
+        continue;
+      if (!literal.empty()) {
+        d_parts.push_back({Literal, GeoIPBackend::ASn, literal});
+        literal.clear();
+      }
+      d_parts.push_back({ph.type, ph.attribute, string()});
+      if (ph.type >= Hour && ph.type <= Month)
+        d_needsTime = true;
+      last = cur + len;
+      found = true;
+      break;
+    }
+    if (!found) { // not ours, left as is
+      literal.append(1, '%');
+      last = cur + 1;
+    }
+  }
+  literal.append(format, last, string::npos);
+  if (!literal.empty())
+    d_parts.push_back({Literal, GeoIPBackend::ASn, literal});
+  d_static = d_parts.size() <= 1 && (d_parts.empty() || d_parts[0].type == Literal);
+}
+
 struct GeoIPDNSResourceRecord: DNSResourceRecord {
 public:
 	int weight;
 	bool has_weight;
+	GeoIPTemplate tmpl;
 };
 
 class GeoIPDomain {
@@ -20,12 +124,138 @@ public:
   int id;
   DNSName domain;
   int ttl;
-  map<DNSName, NetmaskTree<vector<string> > > services;
+  map<DNSName, NetmaskTree<vector<GeoIPTemplate> > > services;
   map<DNSName, vector<GeoIPDNSResourceRecord> > records;
 };
 
+/* What the databases answered for an attribute, kept per thread for the whole
+   network the databases reported the client address to be part of, so that
+   the next client from that network does not need any GeoIP call at all.
+   Flushed when the databases are reloaded. */
+class GeoIPCache
+{
+public:
+  GeoIPCache()
+  {
+    memset(d_bitsInUse, 0, sizeof(d_bitsInUse));
+  }
+
+  bool get(GeoIPBackend::GeoIPQueryAttribute attribute, const ComboAddress& ip, string& value, int& netmask)
+  {
+    bool v6 = ip.sin4.sin_family == AF_INET6;
+    uint64_t addr[2];
+    toBits(ip, addr);
+    const uint32_t* inUse = d_bitsInUse[attribute][v6];
+    for(int bits = v6 ? 128 : 32; bits >= 0; bits--) {
+      if (!inUse[bits])
+        continue;
+      auto it = d_entries.find(Key(attribute, addr, v6, bits));
+      if (it != d_entries.end()) {
+        moveCacheItemToBack(d_entries, it);
+        value = it->d_value;
+        netmask = bits;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void insert(GeoIPBackend::GeoIPQueryAttribute attribute, const ComboAddress& ip, int netmask, const string& value, size_t maxEntries)
+  {
+    bool v6 = ip.sin4.sin_family == AF_INET6;
+    uint64_t addr[2];
+    toBits(ip, addr);
+    Key key(attribute, addr, v6, std::max(0, std::min(netmask, v6 ? 128 : 32)));
+    if (!d_entries.insert({key, value}).second)
+      return;
+    d_bitsInUse[attribute][v6][key.d_bits]++;
+
+    auto& sidx = d_entries.get<1>();
+    while (d_entries.size() > maxEntries) {
+      const Key& oldest = sidx.begin()->d_key;
+      d_bitsInUse[oldest.d_attribute][oldest.d_v6][oldest.d_bits]--;
+      sidx.pop_front();
+    }
+  }
+
+  void clear()
+  {
+    d_entries.clear();
+    memset(d_bitsInUse, 0, sizeof(d_bitsInUse));
+  }
+
+  uint64_t d_generation{0};
+
+private:
+  //! the address as a 128 bits number, IPv4 ones in the top 32 bits
+  static void toBits(const ComboAddress& ip, uint64_t addr[2])
+  {
+    if (ip.sin4.sin_family == AF_INET6) {
+      memcpy(addr, ip.sin6.sin6_addr.s6_addr, 2 * sizeof(uint64_t));
+      addr[0] = be64toh(addr[0]);
+      addr[1] = be64toh(addr[1]);
+    } else {
+      addr[0] = static_cast<uint64_t>(ntohl(ip.sin4.sin_addr.s_addr)) << 32;
+      addr[1] = 0;
+    }
+  }
+
+  struct Key
+  {
+    //! keeps only the first bits bits of addr
+    Key(GeoIPBackend::GeoIPQueryAttribute attribute, const uint64_t addr[2], bool v6, int bits): d_bits(bits), d_attribute(attribute), d_v6(v6)
+    {
+      d_addr[0] = bits == 0 ? 0 : (bits >= 64 ? addr[0] : addr[0] & (~0ULL << (64 - bits)));
+      d_addr[1] = bits <= 64 ? 0 : (bits >= 128 ? addr[1] : addr[1] & (~0ULL << (128 - bits)));
+    }
+
+    bool operator==(const Key& rhs) const
+    {
+      return d_addr[0] == rhs.d_addr[0] && d_addr[1] == rhs.d_addr[1] && d_bits == rhs.d_bits && d_attribute == rhs.d_attribute && d_v6 == rhs.d_v6;
+    }
+
+    uint64_t d_addr[2];
+    uint8_t d_bits;
+    uint8_t d_attribute;
+    bool d_v6;
+  };
+
+  struct KeyHash
+  {
+    size_t operator()(const Key& key) const
+    {
+      size_t seed = 0;
+      boost::hash_combine(seed, key.d_addr[0]);
+      boost::hash_combine(seed, key.d_addr[1]);
+      boost::hash_combine(seed, key.d_bits);
+      boost::hash_combine(seed, key.d_attribute);
+      return seed;
+    }
+  };
+
+  struct Entry
+  {
+    Key d_key;
+    string d_value;
+  };
+
+  typedef multi_index_container<
+    Entry,
+    indexed_by <
+      hashed_unique<member<Entry, Key, &Entry::d_key>, KeyHash>,
+      sequenced<>
+      >
+    > cache_t;
+
+  cache_t d_entries;
+  uint32_t d_bitsInUse[GeoIPBackend::s_attributeCount][2][129]; //!< number of entries for each attribute, family and prefix length
+};
+
 static vector<GeoIPDomain> s_domains;
 static int s_rc = 0; // refcount
+static size_t s_cache_size = 0;
+static std::atomic<uint64_t> s_cache_generation{0};
+static thread_local GeoIPCache t_cache;
 
 struct geoip_deleter {
   void operator()(GeoIP* ptr) {
@@ -35,6 +265,15 @@ struct geoip_deleter {
 
 static vector<GeoIPBackend::geoip_file_t> s_geoip_files;
 
+static vector<GeoIPTemplate> compileTemplates(const vector<string>& formats)
+{
+  vector<GeoIPTemplate> ret;
+  ret.reserve(formats.size());
+  for(const auto& format : formats)
+    ret.emplace_back(format);
+  return ret;
+}
+
 static string GeoIP_WEEKDAYS[] = { "mon", "tue", "wed", "thu", "fri", "sat", "sun" };
 static string GeoIP_MONTHS[] = { "jan", "feb", "mar", "apr", "may", "jun", "jul", "aug", "sep", "oct", "nov", "dec" };
 
@@ -158,13 +397,14 @@ void GeoIPBackend::initialize() {
         } 
         rr.auth = 1;
         rr.d_place = DNSResourceRecord::ANSWER;
+        rr.tmpl = GeoIPTemplate(rr.content);
         rrs.push_back(rr);
       }
       std::swap(dom.records[qname], rrs);
     }
 
     for(YAML::const_iterator service = domain["services"].begin(); service != domain["services"].end(); service++) {
-      NetmaskTree<vector<string> > nmt;
+      NetmaskTree<vector<GeoIPTemplate> > nmt;
 
       // if it's an another map, we need to iterate it again, otherwise we just add two root entries.
       if (service->second.IsMap()) {
@@ -176,10 +416,10 @@ void GeoIPBackend::initialize() {
             value.push_back(net->second.as<string>());
           }
           if (net->first.as<string>() == "default") {
-            nmt.insert(Netmask("0.0.0.0/0")).second.assign(value.begin(),value.end());
-            nmt.insert(Netmask("::/0")).second.swap(value);
+            nmt.insert(Netmask("0.0.0.0/0")).second = compileTemplates(value);
+            nmt.insert(Netmask("::/0")).second = compileTemplates(value);
           } else {
-            nmt.insert(Netmask(net->first.as<string>())).second.swap(value);
+            nmt.insert(Netmask(net->first.as<string>())).second = compileTemplates(value);
           }
         }
       } else {
@@ -189,8 +429,8 @@ void GeoIPBackend::initialize() {
         } else {
           value.push_back(service->second.as<string>());
         }
-        nmt.insert(Netmask("0.0.0.0/0")).second.assign(value.begin(),value.end());
-        nmt.insert(Netmask("::/0")).second.swap(value);
+        nmt.insert(Netmask("0.0.0.0/0")).second = compileTemplates(value);
+        nmt.insert(Netmask("::/0")).second = compileTemplates(value);
       }
       dom.services[DNSName(service->first.as<string>())].swap(nmt);
     }
@@ -269,6 +509,9 @@ void GeoIPBackend::initialize() {
 
   s_domains.clear();
   std::swap(s_domains, tmp_domains);
+
+  s_cache_size = std::max(getArgAsNum("cache-size"), 0);
+  s_cache_generation++; // answers from the previous databases are stale now
 }
 
 GeoIPBackend::~GeoIPBackend() {
@@ -282,9 +525,8 @@ GeoIPBackend::~GeoIPBackend() {
 
 void GeoIPBackend::lookup(const QType &qtype, const DNSName& qdomain, DNSPacket *pkt_p, int zoneId) {
   ReadLock rl(&s_state_lock);
-  GeoIPDomain dom;
+  const GeoIPDomain* dom = nullptr;
   GeoIPLookup gl;
-  bool found = false;
   int probability_rnd = 1+(random() % 1000); // setting probability=0 means it never is used
   int cumul_probability = 0;
 
@@ -296,29 +538,33 @@ void GeoIPBackend::lookup(const QType &qtype, const DNSName& qdomain, DNSPacket
   d_result.clear();
 
   if (zoneId > -1 && zoneId < static_cast<int>(s_domains.size())) 
-    dom = s_domains[zoneId];
+    dom = &s_domains[zoneId];
   else {
     for(const GeoIPDomain& i : s_domains) {   // this is arguably wrong, we should probably find the most specific match
       if (search.isPartOf(i.domain)) {
-        dom = i;
-        found = true;
+        dom = &i;
         break;
       }
     }
-    if (!found) return; // not found
+    if (dom == nullptr) return; // not found
   }
 
-  string ip = "0.0.0.0";
+  if (t_cache.d_generation != s_cache_generation) {
+    t_cache.clear();
+    t_cache.d_generation = s_cache_generation;
+  }
+
+  ComboAddress ip("0.0.0.0");
   bool v6 = false;
   if (pkt_p != NULL) {
-    ip = pkt_p->getRealRemote().toStringNoMask();
-    v6 = pkt_p->getRealRemote().isIpv6();
+    ip = pkt_p->getRealRemote().getNetwork();
+    v6 = ip.sin4.sin_family == AF_INET6;
   }
 
   gl.netmask = 0;
 
-  auto i = dom.records.find(search);
-  if (i != dom.records.end()) { // return static value
+  auto i = dom->records.find(search);
+  if (i != dom->records.end()) { // return static value
     for(const auto& rr : i->second) {
       if (rr.has_weight) {
         gl.netmask = (v6?128:32);
@@ -329,7 +575,8 @@ void GeoIPBackend::lookup(const QType &qtype, const DNSName& qdomain, DNSPacket
       }
       if (qtype == QType::ANY || rr.qtype == qtype) {
 	d_result.push_back(rr);
-        d_result.back().content = format2str(rr.content, ip, v6, &gl);
+        if (!rr.tmpl.d_static)
+          d_result.back().content = format2str(rr.tmpl, ip, &gl);
 	d_result.back().qname = qdomain;
       }
     }
@@ -340,10 +587,10 @@ void GeoIPBackend::lookup(const QType &qtype, const DNSName& qdomain, DNSPacket
     return; // no need to go further
   }
 
-  auto target = dom.services.find(search);
-  if (target == dom.services.end()) return; // no hit
+  auto target = dom->services.find(search);
+  if (target == dom->services.end()) return; // no hit
 
-  const NetmaskTree<vector<string> >::node_type* node = target->second.lookup(ComboAddress(ip));
+  const NetmaskTree<vector<GeoIPTemplate> >::node_type* node = target->second.lookup(ip);
   if (node == NULL) return; // no hit, again.
 
   string format;
@@ -351,15 +598,16 @@ void GeoIPBackend::lookup(const QType &qtype, const DNSName& qdomain, DNSPacket
 
   // note that this means the array format won't work with indirect
   for(auto it = node->second.begin(); it != node->second.end(); it++) {
-    format = format2str(*it, ip, v6, &gl);
+    format = format2str(*it, ip, &gl);
 
     // see if the record can be found
-    auto ri = dom.records.find(DNSName(format));
-    if (ri != dom.records.end()) { // return static value
+    auto ri = dom->records.find(DNSName(format));
+    if (ri != dom->records.end()) { // return static value
       for(const auto& rr: ri->second) {
         if (qtype == QType::ANY || rr.qtype == qtype) {
           d_result.push_back(rr);
-          d_result.back().content = format2str(rr.content, ip, v6, &gl);
+          if (!rr.tmpl.d_static)
+            d_result.back().content = format2str(rr.tmpl, ip, &gl);
           d_result.back().qname = qdomain;
         }
       }
@@ -375,12 +623,12 @@ void GeoIPBackend::lookup(const QType &qtype, const DNSName& qdomain, DNSPacket
   if (!(qtype == QType::ANY || qtype == QType::CNAME)) return;
 
   DNSResourceRecord rr;
-  rr.domain_id = dom.id;
+  rr.domain_id = dom->id;
   rr.qtype = QType::CNAME;
   rr.qname = qdomain;
   rr.content = format;
   rr.auth = 1;
-  rr.ttl = dom.ttl;
+  rr.ttl = dom->ttl;
   rr.scopeMask = gl.netmask;
   d_result.push_back(rr);
 }
@@ -394,106 +642,130 @@ bool GeoIPBackend::get(DNSResourceRecord &r) {
   return true;
 }
 
-bool GeoIPBackend::queryCountry(string &ret, GeoIPLookup* gl, const string &ip, const geoip_file_t& gi) {
+/* the _by_ipnum functions spare libGeoIP from parsing the address from a string */
+static unsigned long toIPNum(const ComboAddress& ip) {
+  return ntohl(ip.sin4.sin_addr.s_addr);
+}
+
+static geoipv6_t toIPNumV6(const ComboAddress& ip) {
+  return ip.sin6.sin6_addr;
+}
+
+bool GeoIPBackend::queryCountry(string &ret, GeoIPLookup* gl, const ComboAddress& ip, const geoip_file_t& gi) {
   if (gi.first == GEOIP_COUNTRY_EDITION ||
       gi.first == GEOIP_LARGE_COUNTRY_EDITION) {
-    ret = GeoIP_code3_by_id(GeoIP_id_by_addr_gl(gi.second.get(), ip.c_str(), gl));
+    ret = GeoIP_code3_by_id(GeoIP_id_by_ipnum_gl(gi.second.get(), toIPNum(ip), gl));
     return true;
   } else if (gi.first == GEOIP_REGION_EDITION_REV0 ||
              gi.first == GEOIP_REGION_EDITION_REV1) {
-    GeoIPRegion* gir = GeoIP_region_by_addr_gl(gi.second.get(), ip.c_str(), gl);
+    GeoIPRegion* gir = GeoIP_region_by_ipnum_gl(gi.second.get(), toIPNum(ip), gl);
     if (gir) {
       ret = GeoIP_code3_by_id(GeoIP_id_by_code(gir->country_code));
+      GeoIPRegion_delete(gir);
       return true;
     }
   } else if (gi.first == GEOIP_CITY_EDITION_REV0 ||
              gi.first == GEOIP_CITY_EDITION_REV1) {
-    GeoIPRecord *gir = GeoIP_record_by_addr(gi.second.get(), ip.c_str());
+    GeoIPRecord *gir = GeoIP_record_by_ipnum(gi.second.get(), toIPNum(ip));
     if (gir) {
       ret = gir->country_code3;
       gl->netmask = gir->netmask;
+      GeoIPRecord_delete(gir);
       return true;
     }
   }
   return false;
 }
 
-bool GeoIPBackend::queryCountryV6(string &ret, GeoIPLookup* gl, const string &ip, const geoip_file_t& gi) {
+bool GeoIPBackend::queryCountryV6(string &ret, GeoIPLookup* gl, const ComboAddress& ip, const geoip_file_t& gi) {
   if (gi.first == GEOIP_COUNTRY_EDITION_V6 ||
       gi.first == GEOIP_LARGE_COUNTRY_EDITION_V6) {
-    ret = GeoIP_code3_by_id(GeoIP_id_by_addr_v6_gl(gi.second.get(), ip.c_str(), gl));
+    ret = GeoIP_code3_by_id(GeoIP_id_by_ipnum_v6_gl(gi.second.get(), toIPNumV6(ip), gl));
     return true;
   } else if (gi.first == GEOIP_REGION_EDITION_REV0 ||
              gi.first == GEOIP_REGION_EDITION_REV1) {
-    GeoIPRegion* gir = GeoIP_region_by_addr_v6_gl(gi.second.get(), ip.c_str(), gl);
+    GeoIPRegion* gir = GeoIP_region_by_ipnum_v6_gl(gi.second.get(), toIPNumV6(ip), gl);
     if (gir) {
       ret = GeoIP_code3_by_id(GeoIP_id_by_code(gir->country_code));
+      GeoIPRegion_delete(gir);
       return true;
     }
   } else if (gi.first == GEOIP_CITY_EDITION_REV0_V6 ||
              gi.first == GEOIP_CITY_EDITION_REV1_V6) {
-    GeoIPRecord *gir = GeoIP_record_by_addr_v6(gi.second.get(), ip.c_str());
+    GeoIPRecord *gir = GeoIP_record_by_ipnum_v6(gi.second.get(), toIPNumV6(ip));
     if (gir) {
       ret = gir->country_code3;
       gl->netmask = gir->netmask;
+      GeoIPRecord_delete(gir);
       return true;
     }
   }
   return false;
 }
 
-bool GeoIPBackend::queryContinent(string &ret, GeoIPLookup* gl, const string &ip, const geoip_file_t& gi) {
+bool GeoIPBackend::queryContinent(string &ret, GeoIPLookup* gl, const ComboAddress& ip, const geoip_file_t& gi) {
   if (gi.first == GEOIP_COUNTRY_EDITION ||
       gi.first == GEOIP_LARGE_COUNTRY_EDITION) {
-    ret = GeoIP_continent_by_id(GeoIP_id_by_addr_gl(gi.second.get(), ip.c_str(), gl));
+    ret = GeoIP_continent_by_id(GeoIP_id_by_ipnum_gl(gi.second.get(), toIPNum(ip), gl));
     return true;
   } else if (gi.first == GEOIP_REGION_EDITION_REV0 ||
              gi.first == GEOIP_REGION_EDITION_REV1) {
-    GeoIPRegion* gir = GeoIP_region_by_addr_gl(gi.second.get(), ip.c_str(), gl);
+    GeoIPRegion* gir = GeoIP_region_by_ipnum_gl(gi.second.get(), toIPNum(ip), gl);
     if (gir) {
       ret = GeoIP_continent_by_id(GeoIP_id_by_code(gir->country_code));
+      GeoIPRegion_delete(gir);
       return true;
     }
   } else if (gi.first == GEOIP_CITY_EDITION_REV0 ||
              gi.first == GEOIP_CITY_EDITION_REV1) {
-    GeoIPRecord *gir = GeoIP_record_by_addr(gi.second.get(), ip.c_str());
+    GeoIPRecord *gir = GeoIP_record_by_ipnum(gi.second.get(), toIPNum(ip));
     if (gir) {
-      ret =  ret = GeoIP_continent_by_id(GeoIP_id_by_code(gir->country_code));
+      ret = GeoIP_continent_by_id(GeoIP_id_by_code(gir->country_code));
       gl->netmask = gir->netmask;
+      GeoIPRecord_delete(gir);
       return true;
     }
   }
   return false;
 }
 
-bool GeoIPBackend::queryContinentV6(string &ret, GeoIPLookup* gl, const string &ip, const geoip_file_t& gi) {
+bool GeoIPBackend::queryContinentV6(string &ret, GeoIPLookup* gl, const ComboAddress& ip, const geoip_file_t& gi) {
   if (gi.first == GEOIP_COUNTRY_EDITION_V6 ||
       gi.first == GEOIP_LARGE_COUNTRY_EDITION_V6) {
-    ret = GeoIP_continent_by_id(GeoIP_id_by_addr_v6_gl(gi.second.get(), ip.c_str(), gl));
+    ret = GeoIP_continent_by_id(GeoIP_id_by_ipnum_v6_gl(gi.second.get(), toIPNumV6(ip), gl));
     return true;
   } else if (gi.first == GEOIP_REGION_EDITION_REV0 ||
              gi.first == GEOIP_REGION_EDITION_REV1) {
-    GeoIPRegion* gir = GeoIP_region_by_addr_v6_gl(gi.second.get(), ip.c_str(), gl);
+    GeoIPRegion* gir = GeoIP_region_by_ipnum_v6_gl(gi.second.get(), toIPNumV6(ip), gl);
     if (gir) {
       ret = GeoIP_continent_by_id(GeoIP_id_by_code(gir->country_code));
+      GeoIPRegion_delete(gir);
       return true;
     }
   } else if (gi.first == GEOIP_CITY_EDITION_REV0_V6 ||
              gi.first == GEOIP_CITY_EDITION_REV1_V6) {
-    GeoIPRecord *gir = GeoIP_record_by_addr_v6(gi.second.get(), ip.c_str());
+    GeoIPRecord *gir = GeoIP_record_by_ipnum_v6(gi.second.get(), toIPNumV6(ip));
     if (gir) {
       ret = GeoIP_continent_by_id(GeoIP_id_by_code(gir->country_code));
       gl->netmask = gir->netmask;
+      GeoIPRecord_delete(gir);
       return true;
     }
   }
   return false;
 }
 
-bool GeoIPBackend::queryName(string &ret, GeoIPLookup* gl, const string &ip, const geoip_file_t& gi) {
+// the name is allocated by libGeoIP for us
+static string takeName(char* name) {
+  string ret = valueOrEmpty<char*,string>(name);
+  free(name);
+  return ret;
+}
+
+bool GeoIPBackend::queryName(string &ret, GeoIPLookup* gl, const ComboAddress& ip, const geoip_file_t& gi) {
   if (gi.first == GEOIP_ISP_EDITION ||
       gi.first == GEOIP_ORG_EDITION) {
-    string val = valueOrEmpty<char*,string>(GeoIP_name_by_addr_gl(gi.second.get(), ip.c_str(), gl));
+    string val = takeName(GeoIP_name_by_ipnum_gl(gi.second.get(), toIPNum(ip), gl));
     if (!val.empty()) {
       // reduce space to dash
       ret = boost::replace_all_copy(val, " ", "-");
@@ -503,10 +775,10 @@ bool GeoIPBackend::queryName(string &ret, GeoIPLookup* gl, const string &ip, con
   return false;
 }
 
-bool GeoIPBackend::queryNameV6(string &ret, GeoIPLookup* gl, const string &ip, const geoip_file_t& gi) {
+bool GeoIPBackend::queryNameV6(string &ret, GeoIPLookup* gl, const ComboAddress& ip, const geoip_file_t& gi) {
   if (gi.first == GEOIP_ISP_EDITION_V6 ||
       gi.first == GEOIP_ORG_EDITION_V6) {
-    string val = valueOrEmpty<char*,string>(GeoIP_name_by_addr_v6_gl(gi.second.get(), ip.c_str(), gl));
+    string val = takeName(GeoIP_name_by_ipnum_v6_gl(gi.second.get(), toIPNumV6(ip), gl));
     if (!val.empty()) {
       // reduce space to dash
       ret = boost::replace_all_copy(val, " ", "-");
@@ -516,9 +788,9 @@ bool GeoIPBackend::queryNameV6(string &ret, GeoIPLookup* gl, const string &ip, c
   return false;
 }
 
-bool GeoIPBackend::queryASnum(string &ret, GeoIPLookup* gl, const string &ip, const geoip_file_t& gi) {
+bool GeoIPBackend::queryASnum(string &ret, GeoIPLookup* gl, const ComboAddress& ip, const geoip_file_t& gi) {
   if (gi.first == GEOIP_ASNUM_EDITION) {
-    string val = valueOrEmpty<char*,string>(GeoIP_name_by_addr_gl(gi.second.get(), ip.c_str(), gl));
+    string val = takeName(GeoIP_name_by_ipnum_gl(gi.second.get(), toIPNum(ip), gl));
     if (!val.empty()) {
       vector<string> asnr;
       stringtok(asnr, val);
@@ -531,9 +803,9 @@ bool GeoIPBackend::queryASnum(string &ret, GeoIPLookup* gl, const string &ip, co
   return false;
 }
 
-bool GeoIPBackend::queryASnumV6(string &ret, GeoIPLookup* gl, const string &ip, const geoip_file_t& gi) {
+bool GeoIPBackend::queryASnumV6(string &ret, GeoIPLookup* gl, const ComboAddress& ip, const geoip_file_t& gi) {
   if (gi.first == GEOIP_ASNUM_EDITION_V6) {
-    string val = valueOrEmpty<char*,string>(GeoIP_name_by_addr_v6_gl(gi.second.get(), ip.c_str(), gl));
+    string val = takeName(GeoIP_name_by_ipnum_v6_gl(gi.second.get(), toIPNumV6(ip), gl));
     if (!val.empty()) {
       vector<string> asnr;
       stringtok(asnr, val);
@@ -546,50 +818,54 @@ bool GeoIPBackend::queryASnumV6(string &ret, GeoIPLookup* gl, const string &ip,
   return false;
 }
 
-bool GeoIPBackend::queryRegion(string &ret, GeoIPLookup* gl, const string &ip, const geoip_file_t& gi) {
+bool GeoIPBackend::queryRegion(string &ret, GeoIPLookup* gl, const ComboAddress& ip, const geoip_file_t& gi) {
   if (gi.first == GEOIP_REGION_EDITION_REV0 ||
       gi.first == GEOIP_REGION_EDITION_REV1) {
-    GeoIPRegion *gir = GeoIP_region_by_addr_gl(gi.second.get(), ip.c_str(), gl);
+    GeoIPRegion *gir = GeoIP_region_by_ipnum_gl(gi.second.get(), toIPNum(ip), gl);
     if (gir) {
       ret = valueOrEmpty<char*,string>(gir->region);
+      GeoIPRegion_delete(gir);
       return true;
     }
   }
   return false;
 }
 
-bool GeoIPBackend::queryRegionV6(string &ret, GeoIPLookup* gl, const string &ip, const geoip_file_t& gi) {
+bool GeoIPBackend::queryRegionV6(string &ret, GeoIPLookup* gl, const ComboAddress& ip, const geoip_file_t& gi) {
   if (gi.first == GEOIP_REGION_EDITION_REV0 ||
       gi.first == GEOIP_REGION_EDITION_REV1) {
-    GeoIPRegion *gir = GeoIP_region_by_addr_v6_gl(gi.second.get(), ip.c_str(), gl);
+    GeoIPRegion *gir = GeoIP_region_by_ipnum_v6_gl(gi.second.get(), toIPNumV6(ip), gl);
     if (gir) {
       ret = valueOrEmpty<char*,string>(gir->region);
+      GeoIPRegion_delete(gir);
       return true;
     }
   }
   return false;
 }
 
-bool GeoIPBackend::queryCity(string &ret, GeoIPLookup* gl, const string &ip, const geoip_file_t& gi) {
+bool GeoIPBackend::queryCity(string &ret, GeoIPLookup* gl, const ComboAddress& ip, const geoip_file_t& gi) {
   if (gi.first == GEOIP_CITY_EDITION_REV0 ||
       gi.first == GEOIP_CITY_EDITION_REV1) {
-    GeoIPRecord *gir = GeoIP_record_by_addr(gi.second.get(), ip.c_str());
+    GeoIPRecord *gir = GeoIP_record_by_ipnum(gi.second.get(), toIPNum(ip));
     if (gir) {
       ret = valueOrEmpty<char*,string>(gir->city);
       gl->netmask = gir->netmask;
+      GeoIPRecord_delete(gir);
       return true;
     }
   }
   return false;
 }
 
-bool GeoIPBackend::queryCityV6(string &ret, GeoIPLookup* gl, const string &ip, const geoip_file_t& gi) {
+bool GeoIPBackend::queryCityV6(string &ret, GeoIPLookup* gl, const ComboAddress& ip, const geoip_file_t& gi) {
   if (gi.first == GEOIP_CITY_EDITION_REV0_V6 ||
       gi.first == GEOIP_CITY_EDITION_REV1_V6) {
-    GeoIPRecord *gir = GeoIP_record_by_addr_v6(gi.second.get(), ip.c_str());
+    GeoIPRecord *gir = GeoIP_record_by_ipnum_v6(gi.second.get(), toIPNumV6(ip));
     if (gir) {
       ret = valueOrEmpty<char*,string>(gir->city);
       gl->netmask = gir->netmask;
+      GeoIPRecord_delete(gir);
       return true;
     }
   }
@@ -597,12 +873,20 @@ bool GeoIPBackend::queryCityV6(string &ret, GeoIPLookup* gl, const string &ip, c
 }
 
 
-string GeoIPBackend::queryGeoIP(const string &ip, bool v6, GeoIPQueryAttribute attribute, GeoIPLookup* gl) {
-  string ret = "unknown";
+string GeoIPBackend::queryGeoIP(const ComboAddress& ip, GeoIPQueryAttribute attribute, GeoIPLookup* gl) {
+  string ret;
+  if (s_cache_size > 0 && t_cache.get(attribute, ip, ret, gl->netmask))
+    return ret;
+
+  ret = "unknown";
+  bool v6 = ip.sin4.sin_family == AF_INET6;
+  int netmask = 0; // the answer holds for the narrowest network any database we asked told us about
+  bool missed = false;
 
   for(auto const& gi: s_geoip_files) {
     string val;
     bool found = false;
+    gl->netmask = 0;
 
     switch(attribute) {
     case ASn:
@@ -631,78 +915,93 @@ string GeoIPBackend::queryGeoIP(const string &ip, bool v6, GeoIPQueryAttribute a
       break;
     }
 
-    if (!found || val.empty() || val == "--") continue; // try next database
+    if (gl->netmask > netmask) netmask = gl->netmask;
+    if (!found || val.empty() || val == "--") {
+      /* a database without an answer does not say for which network it has none,
+         so the answer of the next one only holds for this very address */
+      missed = true;
+      continue;
+    }
     ret = val;
     std::transform(ret.begin(), ret.end(), ret.begin(), ::tolower);
     break;
   }
 
-  if (ret == "unknown") gl->netmask = (v6?128:32); // prevent caching
+  if (missed || ret == "unknown") netmask = (v6?128:32);
+  gl->netmask = netmask;
+  if (s_cache_size > 0)
+    t_cache.insert(attribute, ip, netmask, ret, s_cache_size);
   return ret;
 }
 
-string GeoIPBackend::format2str(string format, const string& ip, bool v6, GeoIPLookup* gl) {
-  string::size_type cur,last;
-  time_t t = time((time_t*)NULL);
-  GeoIPLookup tmp_gl; // largest wins
+static void appendTwoDigits(string& out, int value) {
+  if (value < 10)
+    out.append(1, '0');
+  out.append(std::to_string(value));
+}
+
+string GeoIPBackend::format2str(const GeoIPTemplate& format, const ComboAddress& ip, GeoIPLookup* gl) {
+  if (format.d_static)
+    return format.d_format;
+
+  bool v6 = ip.sin4.sin_family == AF_INET6;
   struct tm gtm;
-  gmtime_r(&t, &gtm);
-  last=0;
+  if (format.d_needsTime) {
+    time_t t = time((time_t*)NULL);
+    gmtime_r(&t, &gtm);
+  }
 
-  while((cur = format.find("%", last)) != string::npos) {
-    string rep;
-    int nrep=3;
+  string ret;
+  ret.reserve(format.d_format.size() + 32);
+  for(const auto& part : format.d_parts) {
+    GeoIPLookup tmp_gl; // largest wins
     tmp_gl.netmask = 0;
-    if (!format.compare(cur,3,"%cn")) {
-      rep = queryGeoIP(ip, v6, Continent, &tmp_gl);
-    } else if (!format.compare(cur,3,"%co")) {
-      rep = queryGeoIP(ip, v6, Country, &tmp_gl);
-    } else if (!format.compare(cur,3,"%af")) {
-      rep = (v6?"v6":"v4");
-    } else if (!format.compare(cur,3,"%as")) {
-      rep = queryGeoIP(ip, v6, ASn, &tmp_gl);
-    } else if (!format.compare(cur,3,"%re")) {
-      rep = queryGeoIP(ip, v6, Region, &tmp_gl);
-    } else if (!format.compare(cur,3,"%na")) {
-      rep = queryGeoIP(ip, v6, Name, &tmp_gl);
-    } else if (!format.compare(cur,3,"%ci")) {
-      rep = queryGeoIP(ip, v6, City, &tmp_gl);
-    } else if (!format.compare(cur,3,"%hh")) {
-      rep = boost::str(boost::format("%02d") % gtm.tm_hour);
+    switch(part.type) {
+    case GeoIPTemplate::Literal:
+      ret.append(part.text);
+      break;
+    case GeoIPTemplate::Attribute:
+      ret.append(queryGeoIP(ip, part.attribute, &tmp_gl));
+      break;
+    case GeoIPTemplate::Family:
+      ret.append(v6?"v6":"v4");
+      break;
+    case GeoIPTemplate::Hour:
+      appendTwoDigits(ret, gtm.tm_hour);
       tmp_gl.netmask = (v6?128:32);
-    } else if (!format.compare(cur,3,"%yy")) {
-      rep = boost::str(boost::format("%02d") % (gtm.tm_year + 1900));
+      break;
+    case GeoIPTemplate::Year:
+      appendTwoDigits(ret, gtm.tm_year + 1900);
       tmp_gl.netmask = (v6?128:32);
-    } else if (!format.compare(cur,3,"%dd")) {
-      rep = boost::str(boost::format("%02d") % (gtm.tm_yday + 1));
+      break;
+    case GeoIPTemplate::YearDay:
+      appendTwoDigits(ret, gtm.tm_yday + 1);
       tmp_gl.netmask = (v6?128:32);
-    } else if (!format.compare(cur,4,"%wds")) {
-      nrep=4;
-      rep = GeoIP_WEEKDAYS[gtm.tm_wday];
+      break;
+    case GeoIPTemplate::WeekdayName:
+      ret.append(GeoIP_WEEKDAYS[gtm.tm_wday]);
       tmp_gl.netmask = (v6?128:32);
-    } else if (!format.compare(cur,4,"%mos")) {
-      nrep=4;
-      rep = GeoIP_MONTHS[gtm.tm_mon];
+      break;
+    case GeoIPTemplate::MonthName:
+      ret.append(GeoIP_MONTHS[gtm.tm_mon]);
       tmp_gl.netmask = (v6?128:32);
-    } else if (!format.compare(cur,3,"%wd")) {
-      rep = boost::str(boost::format("%02d") % (gtm.tm_wday + 1));
+      break;
+    case GeoIPTemplate::Weekday:
+      appendTwoDigits(ret, gtm.tm_wday + 1);
       tmp_gl.netmask = (v6?128:32);
-    } else if (!format.compare(cur,3,"%mo")) {
-      rep = boost::str(boost::format("%02d") % (gtm.tm_mon + 1));
+      break;
+    case GeoIPTemplate::Month:
+      appendTwoDigits(ret, gtm.tm_mon + 1);
       tmp_gl.netmask = (v6?128:32);
-    } else if (!format.compare(cur,3,"%ip")) {
-      rep = ip;
+      break;
+    case GeoIPTemplate::IP:
+      ret.append(ip.toString());
       tmp_gl.netmask = (v6?128:32);
-    } else if (!format.compare(cur,2,"%%")) {
-      last = cur + 2; continue;
-    } else {
-      last = cur + 1; continue; 
+      break;
     }
     if (tmp_gl.netmask > gl->netmask) gl->netmask = tmp_gl.netmask;
-    format.replace(cur, nrep, rep);
-    last = cur + rep.size(); // move to next attribute
   }
-  return format;
+  return ret;
 }
 
 void GeoIPBackend::reload() {
@@ -971,6 +1270,7 @@ public:
     declare(suffix, "database-files", "File(s) to load geoip data from", "");
     declare(suffix, "database-cache", "Cache mode (standard, memory, index, mmap)", "standard");
     declare(suffix, "dnssec-keydir", "Directory to hold dnssec keys (also turns DNSSEC on)", "");
+    declare(suffix, "cache-size", "Number of GeoIP answers to cache, per thread (0 to disable)", "10000");
   }
 
   DNSBackend *make(const string &suffix) {
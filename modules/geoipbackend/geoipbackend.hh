@@ -23,6 +23,7 @@
 struct geoip_deleter;
 
 class GeoIPDomain;
+struct GeoIPTemplate;
 
 class GeoIPBackend: public DNSBackend {
 public:
@@ -55,26 +56,27 @@ public:
     Name,
     Region
   };
+  static const size_t s_attributeCount = Region + 1;
 
 private:
   static pthread_rwlock_t s_state_lock;
 
   void initialize();
   void ip2geo(const GeoIPDomain& dom, const string& qname, const string& ip);
-  string queryGeoIP(const string &ip, bool v6, GeoIPQueryAttribute attribute, GeoIPLookup* gl);
-  bool queryCountry(string &ret, GeoIPLookup* gl, const string &ip, const geoip_file_t& gi);
-  bool queryCountryV6(string &ret, GeoIPLookup* gl, const string &ip, const geoip_file_t& gi);
-  bool queryContinent(string &ret, GeoIPLookup* gl, const string &ip, const geoip_file_t& gi);
-  bool queryContinentV6(string &ret, GeoIPLookup* gl, const string &ip, const geoip_file_t& gi);
-  bool queryName(string &ret, GeoIPLookup* gl, const string &ip, const geoip_file_t& gi);
-  bool queryNameV6(string &ret, GeoIPLookup* gl, const string &ip, const geoip_file_t& gi);
-  bool queryASnum(string &ret, GeoIPLookup* gl, const string &ip, const geoip_file_t& gi);
-  bool queryASnumV6(string &ret, GeoIPLookup* gl, const string &ip, const geoip_file_t& gi);
-  bool queryRegion(string &ret, GeoIPLookup* gl, const string &ip, const geoip_file_t& gi);
-  bool queryRegionV6(string &ret, GeoIPLookup* gl, const string &ip, const geoip_file_t& gi);
-  bool queryCity(string &ret, GeoIPLookup* gl, const string &ip, const geoip_file_t& gi);
-  bool queryCityV6(string &ret, GeoIPLookup* gl, const string &ip, const geoip_file_t& gi);
-  string format2str(string format, const string& ip, bool v6, GeoIPLookup* gl);
+  string queryGeoIP(const ComboAddress& ip, GeoIPQueryAttribute attribute, GeoIPLookup* gl);
+  bool queryCountry(string &ret, GeoIPLookup* gl, const ComboAddress& ip, const geoip_file_t& gi);
+  bool queryCountryV6(string &ret, GeoIPLookup* gl, const ComboAddress& ip, const geoip_file_t& gi);
+  bool queryContinent(string &ret, GeoIPLookup* gl, const ComboAddress& ip, const geoip_file_t& gi);
+  bool queryContinentV6(string &ret, GeoIPLookup* gl, const ComboAddress& ip, const geoip_file_t& gi);
+  bool queryName(string &ret, GeoIPLookup* gl, const ComboAddress& ip, const geoip_file_t& gi);
+  bool queryNameV6(string &ret, GeoIPLookup* gl, const ComboAddress& ip, const geoip_file_t& gi);
+  bool queryASnum(string &ret, GeoIPLookup* gl, const ComboAddress& ip, const geoip_file_t& gi);
+  bool queryASnumV6(string &ret, GeoIPLookup* gl, const ComboAddress& ip, const geoip_file_t& gi);
+  bool queryRegion(string &ret, GeoIPLookup* gl, const ComboAddress& ip, const geoip_file_t& gi);
+  bool queryRegionV6(string &ret, GeoIPLookup* gl, const ComboAddress& ip, const geoip_file_t& gi);
+  bool queryCity(string &ret, GeoIPLookup* gl, const ComboAddress& ip, const geoip_file_t& gi);
+  bool queryCityV6(string &ret, GeoIPLookup* gl, const ComboAddress& ip, const geoip_file_t& gi);
+  string format2str(const GeoIPTemplate& format, const ComboAddress& ip, GeoIPLookup* gl);
   bool d_dnssec; 
   bool hasDNSSECkey(const DNSName& name);
 
@@ -54,6 +54,7 @@ public:
     declare(suffix,"timeout", "The timeout in seconds for each attempt to read/write to the server", "10");
 
     declare(suffix,"dnssec","Enable DNSSEC processing","no");
+    declare(suffix,"feed-batch-size","Number of rows to insert with a single statement during zone loads and transfers","100");
 
     string record_query = "SELECT content,ttl,prio,type,domain_id,disabled,name,auth FROM records WHERE";
 
@@ -61,6 +62,7 @@ public:
     declare(suffix, "id-query", "Basic with ID query", record_query+" disabled=0 and type=? and name=? and domain_id=?");
     declare(suffix, "any-query", "Any query", record_query+" disabled=0 and name=?");
     declare(suffix, "any-id-query", "Any with ID query", record_query+" disabled=0 and name=? and domain_id=?");
+    declare(suffix, "any-batch-query", "Any query for 8 names at once", record_query+" disabled=0 and name IN (?,?,?,?,?,?,?,?)");
 
     declare(suffix, "list-query", "AXFR query", record_query+" (disabled=0 OR ?) and domain_id=? order by name, type");
     declare(suffix, "list-subzone-query", "Subzone listing", record_query+" disabled=0 and (name=? OR name like ?) and domain_id=?");
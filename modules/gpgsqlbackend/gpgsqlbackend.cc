@@ -47,6 +47,7 @@ public:
     declare(suffix,"password","Pdns backend password to connect with","");
 
     declare(suffix,"dnssec","Enable DNSSEC processing","no");
+    declare(suffix,"feed-batch-size","Number of rows to insert with a single statement during zone loads and transfers","100");
 
     string record_query = "SELECT content,ttl,prio,type,domain_id,disabled::int,name,auth::int FROM records WHERE";
 
@@ -54,6 +55,7 @@ public:
     declare(suffix, "id-query", "Basic with ID query", record_query+" disabled=false and type=$1 and name=$2 and domain_id=$3");
     declare(suffix, "any-query", "Any query", record_query+" disabled=false and name=$1");
     declare(suffix, "any-id-query", "Any with ID query", record_query+" disabled=false and name=$1 and domain_id=$2");
+    declare(suffix, "any-batch-query", "Any query for 8 names at once", record_query+" disabled=false and name IN ($1,$2,$3,$4,$5,$6,$7,$8)");
 
     declare(suffix, "list-query", "AXFR query", record_query+" (disabled=false OR $1) and domain_id=$2 order by name, type");
     declare(suffix, "list-subzone-query", "Subzone listing", record_query+" disabled=false and (name=$1 OR name like $2) and domain_id=$3");
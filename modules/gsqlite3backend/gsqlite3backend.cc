@@ -81,6 +81,7 @@ public:
     declare(suffix, "pragma-foreign-keys", "Enable foreign key constraints", "no" );
 
     declare(suffix, "dnssec", "Enable DNSSEC processing","no");
+    declare(suffix, "feed-batch-size", "Number of rows to insert with a single statement during zone loads and transfers", "100");
 
     string record_query = "SELECT content,ttl,prio,type,domain_id,disabled,name,auth FROM records WHERE";
 
@@ -88,6 +89,7 @@ public:
     declare(suffix, "id-query", "Basic with ID query", record_query+" disabled=0 and type=:qtype and name=:qname and domain_id=:domain_id");
     declare(suffix, "any-query", "Any query", record_query+" disabled=0 and name=:qname");
     declare(suffix, "any-id-query", "Any with ID query", record_query+" disabled=0 and name=:qname and domain_id=:domain_id");
+    declare(suffix, "any-batch-query", "Any query for 8 names at once", record_query+" disabled=0 and name IN (:qname0,:qname1,:qname2,:qname3,:qname4,:qname5,:qname6,:qname7)");
 
     declare(suffix, "list-query", "AXFR query", record_query+" (disabled=0 OR :include_disabled) and domain_id=:domain_id order by name, type");
     declare(suffix, "list-subzone-query", "Subzone listing", record_query+" disabled=0 and (name=:zone OR name like :wildzone) and domain_id=:domain_id");
@@ -22,7 +22,8 @@ struct QuestionIdentifier
   }
 
   // the canonical direction is that of the question
-  static QuestionIdentifier create(const ComboAddress& src, const ComboAddress& dst, const MOADNSParser& mdp)
+  template<typename P> // MOADNSParser or LazyMOADNSParser
+  static QuestionIdentifier create(const ComboAddress& src, const ComboAddress& dst, const P& mdp)
   {
     QuestionIdentifier ret;
 
@@ -0,0 +1,127 @@
+/*
+    PowerDNS Versatile Database Driven Nameserver
+    Copyright (C) 2016  PowerDNS.COM BV
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation
+
+    Additionally, the license of this program contains a special
+    exception which allows to distribute the program in binary form when
+    it is linked against OpenSSL.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "auth-zonecache.hh"
+#include "lock.hh"
+
+AuthZoneCache g_zoneCache;
+
+AuthZoneCache::AuthZoneCache()
+{
+  pthread_rwlock_init(&d_lock, 0);
+}
+
+AuthZoneCache::~AuthZoneCache()
+{
+  pthread_rwlock_destroy(&d_lock);
+}
+
+//! returns whether zone was not in the trie yet
+bool AuthZoneCache::addZone(ZoneNode& root, const DNSName& zone, int zoneId)
+{
+  ZoneNode* node = &root;
+  const auto labels = zone.getRawLabels();
+  for(auto label = labels.rbegin(); label != labels.rend(); ++label)
+    node = &node->d_children[*label];
+
+  bool added = !node->d_isZone;
+  node->d_zone = zone;
+  node->d_zoneId = zoneId;
+  node->d_isZone = true;
+  return added;
+}
+
+//! removes the zone 'left' labels below node, returns whether node itself can go as well
+bool AuthZoneCache::removeZone(ZoneNode& node, const vector<string>& labels, size_t left, bool* removed)
+{
+  if(!left) {
+    *removed = node.d_isZone;
+    node.d_zone = DNSName();
+    node.d_isZone = false;
+  }
+  else {
+    auto child = node.d_children.find(labels[left - 1]);
+    if(child != node.d_children.end() && removeZone(child->second, labels, left - 1, removed))
+      node.d_children.erase(child);
+  }
+  return !node.d_isZone && node.d_children.empty();
+}
+
+void AuthZoneCache::replace(const vector<DomainInfo>& zones)
+{
+  ZoneNode newRoot;
+  size_t newSize = 0;
+  for(const auto& di : zones)
+    if(addZone(newRoot, di.zone, di.id))
+      newSize++;
+
+  WriteLock wl(&d_lock);
+  std::swap(d_root, newRoot);
+  d_size = newSize;
+}
+
+void AuthZoneCache::add(const DNSName& zone, int zoneId)
+{
+  WriteLock wl(&d_lock);
+  if(addZone(d_root, zone, zoneId))
+    d_size++;
+}
+
+void AuthZoneCache::remove(const DNSName& zone)
+{
+  const auto labels = zone.getRawLabels();
+  bool removed = false;
+  WriteLock wl(&d_lock);
+  removeZone(d_root, labels, labels.size(), &removed);
+  if(removed)
+    d_size--;
+}
+
+bool AuthZoneCache::getEnclosing(const DNSName& name, DNSName* zone, int* zoneId) const
+{
+  const auto labels = name.getRawLabels();
+  ReadLock rl(&d_lock);
+  const ZoneNode* node = &d_root;
+  const ZoneNode* found = node->d_isZone ? node : nullptr;
+  for(auto label = labels.rbegin(); label != labels.rend(); ++label) {
+    auto child = node->d_children.find(*label);
+    if(child == node->d_children.end())
+      break;
+    node = &child->second;
+    if(node->d_isZone)
+      found = node;
+  }
+  if(!found)
+    return false;
+
+  *zone = found->d_zone;
+  *zoneId = found->d_zoneId;
+  return true;
+}
+
+size_t AuthZoneCache::size() const
+{
+  ReadLock rl(&d_lock);
+  return d_size;
+}
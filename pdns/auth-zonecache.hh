@@ -0,0 +1,83 @@
+/*
+    PowerDNS Versatile Database Driven Nameserver
+    Copyright (C) 2016  PowerDNS.COM BV
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation
+
+    Additionally, the license of this program contains a special
+    exception which allows to distribute the program in binary form when
+    it is linked against OpenSSL.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#ifndef PDNS_AUTH_ZONECACHE_HH
+#define PDNS_AUTH_ZONECACHE_HH
+#include <map>
+#include <vector>
+#include <pthread.h>
+#include <boost/utility.hpp>
+#include "dnsname.hh"
+#include "dnsbackend.hh"
+#include "misc.hh"
+
+/** In-memory index of all zone apexes served by the backends. When enabled, UeberBackend::getAuth()
+    uses it to find the closest enclosing zone of a name without sending a SOA query to the backends
+    for every label of the qname. The index is (re)built from getAllDomains(), and kept up to date
+    when zones are created or deleted through the API. */
+class AuthZoneCache : public boost::noncopyable
+{
+public:
+  AuthZoneCache();
+  ~AuthZoneCache();
+
+  void replace(const vector<DomainInfo>& zones);
+  void add(const DNSName& zone, int zoneId);
+  void remove(const DNSName& zone);
+
+  //! Finds the closest zone apex at or above name, returns false if there is none
+  bool getEnclosing(const DNSName& name, DNSName* zone, int* zoneId) const;
+
+  size_t size() const;
+
+  bool isEnabled() const
+  {
+    return d_enabled;
+  }
+  void setEnabled(bool enabled)
+  {
+    d_enabled = enabled;
+  }
+
+private:
+  /* Reverse-label trie of the zone apexes, like SuffixMatchNode: the children of a node are the
+     names one label longer, so a lookup walks the labels of a name from the root down and the
+     deepest zone it passes is the closest enclosing one. */
+  struct ZoneNode
+  {
+    std::map<std::string, ZoneNode, CIStringCompare> d_children; //!< by label
+    DNSName d_zone; //!< the apex, if this node is a zone
+    int d_zoneId{-1};
+    bool d_isZone{false};
+  };
+
+  static bool addZone(ZoneNode& root, const DNSName& zone, int zoneId);
+  static bool removeZone(ZoneNode& node, const vector<string>& labels, size_t left, bool* removed);
+
+  ZoneNode d_root;
+  size_t d_size{0};
+  mutable pthread_rwlock_t d_lock;
+  bool d_enabled{false};
+};
+
+extern AuthZoneCache g_zoneCache;
+
+#endif
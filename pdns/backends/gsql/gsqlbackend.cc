@@ -59,6 +59,14 @@ GSQLBackend::GSQLBackend(const string &mode, const string &suffix)
   d_IdQuery=getArg("id-query");
   d_ANYNoIdQuery=getArg("any-query");
   d_ANYIdQuery=getArg("any-id-query");
+  try
+  {
+    d_ANYBatchQuery=getArg("any-batch-query");
+  }
+  catch (ArgException e)
+  {
+    // not declared by this gsql flavour, lookupBatch() falls back to one lookup per question
+  }
 
   d_listQuery=getArg("list-query");
   d_listSubZoneQuery=getArg("list-subzone-query");
@@ -124,11 +132,28 @@ GSQLBackend::GSQLBackend(const string &mode, const string &suffix)
   d_SearchRecordsQuery = getArg("search-records-query");
   d_SearchCommentsQuery = getArg("search-comments-query");
 
+  try
+  {
+    d_feedBatchSize = getArgAsNum("feed-batch-size");
+  }
+  catch (ArgException e)
+  {
+    d_feedBatchSize = 1; // not every gsql flavour can do multi-row inserts
+  }
+
+  if(d_feedBatchSize > 1) {
+    d_InsertRecordsQuery = makeMultiRowInsertQuery(d_InsertRecordQuery, d_feedBatchSize);
+    d_InsertEmptyNonTerminalsOrderQuery = makeMultiRowInsertQuery(d_InsertEmptyNonTerminalOrderQuery, d_feedBatchSize);
+    if(d_InsertRecordsQuery.empty() || d_InsertEmptyNonTerminalsOrderQuery.empty())
+      L<<Logger::Warning<<d_logprefix<<"insert-record-query or insert-empty-non-terminal-order-query does not end in a single VALUES list, inserting those one row at a time"<<endl;
+  }
+
   d_query_stmt = NULL;
   d_NoIdQuery_stmt = NULL;
   d_IdQuery_stmt = NULL;
   d_ANYNoIdQuery_stmt = NULL;
   d_ANYIdQuery_stmt = NULL;
+  d_ANYBatchQuery_stmt = NULL;
   d_listQuery_stmt = NULL;
   d_listSubZoneQuery_stmt = NULL;
   d_MasterOfDomainsZoneQuery_stmt = NULL;
@@ -139,6 +164,8 @@ GSQLBackend::GSQLBackend(const string &mode, const string &suffix)
   d_InsertZoneQuery_stmt = NULL;
   d_InsertRecordQuery_stmt = NULL;
   d_InsertEmptyNonTerminalOrderQuery_stmt = NULL;
+  d_InsertRecordsQuery_stmt = NULL;
+  d_InsertEmptyNonTerminalsOrderQuery_stmt = NULL;
   d_UpdateMasterOfZoneQuery_stmt = NULL;
   d_UpdateKindOfZoneQuery_stmt = NULL;
   d_UpdateSerialOfZoneQuery_stmt = NULL;
@@ -981,6 +1008,62 @@ void GSQLBackend::lookup(const QType &qtype,const DNSName &qname, DNSPacket *pkt
   d_qname=qname;
 }
 
+/* Fetches all records for up to s_anyBatchQueryNames distinct names with one any-batch-query,
+   and hands out the ones matching each question. Lookups within a zone are not batched. */
+void GSQLBackend::lookupBatch(const vector<DNSLookupQuestion>& questions, vector<vector<DNSResourceRecord> >& answers, DNSPacket *pkt_p, int zoneId)
+{
+  if(!d_ANYBatchQuery_stmt || zoneId >= 0 || questions.size() < 2) {
+    DNSBackend::lookupBatch(questions, answers, pkt_p, zoneId);
+    return;
+  }
+
+  answers.assign(questions.size(), vector<DNSResourceRecord>());
+
+  map<DNSName, vector<vector<DNSLookupQuestion>::size_type> > byName;
+  for(vector<DNSLookupQuestion>::size_type n = 0; n < questions.size(); ++n)
+    byName[questions[n].qname].push_back(n);
+
+  vector<DNSName> names;
+  names.reserve(byName.size());
+  for(const auto& entry : byName)
+    names.push_back(entry.first);
+
+  DNSResourceRecord rr;
+  SSqlStatement::row_t row;
+  d_qname.clear(); // extractRecord() takes the name from the row
+  for(vector<DNSName>::size_type pos = 0; pos < names.size(); pos += s_anyBatchQueryNames) {
+    try {
+      // unused slots repeat the last name, which does not change the result
+      for(unsigned int slot = 0; slot < s_anyBatchQueryNames; ++slot)
+        d_ANYBatchQuery_stmt->bind("qname"+std::to_string(slot), names[std::min(pos + slot, names.size() - 1)]);
+      d_ANYBatchQuery_stmt->execute();
+
+      while(d_ANYBatchQuery_stmt->hasNextRow()) {
+        d_ANYBatchQuery_stmt->nextRow(row);
+        ASSERT_ROW_COLUMNS("any-batch-query", row, 8);
+        try {
+          extractRecord(row, rr);
+        } catch (...) {
+          continue;
+        }
+        auto match = byName.find(rr.qname);
+        if(match == byName.end())
+          continue;
+        for(auto n : match->second) {
+          if(questions[n].qtype.getCode() == QType::ANY || questions[n].qtype == rr.qtype) {
+            answers[n].push_back(rr);
+            answers[n].back().qname = questions[n].qname;
+          }
+        }
+      }
+      d_ANYBatchQuery_stmt->reset();
+    }
+    catch(SSqlException &e) {
+      throw PDNSException("GSQLBackend lookupBatch query: "+e.txtReason());
+    }
+  }
+}
+
 bool GSQLBackend::list(const DNSName &target, int domain_id, bool include_disabled)
 {
   DLOG(L<<"GSQLBackend constructing handle for list of domain id '"<<domain_id<<"'"<<endl);
@@ -1253,7 +1336,86 @@ bool GSQLBackend::replaceRRSet(uint32_t domain_id, const DNSName& qname, const Q
   return true;
 }
 
-bool GSQLBackend::feedRecord(const DNSResourceRecord &r, string *ordername)
+/* Turns an insert query that ends in a single VALUES (...) list into one that inserts 'rows' rows
+   at once. '?' placeholders are left alone, '$N' ones are renumbered for every row and ':name' ones
+   become ':name_<row>', so the row can be bound with the same suffix on its parameter names.
+   Returns an empty string if the query does not have that shape. */
+string GSQLBackend::makeMultiRowInsertQuery(const string& query, unsigned int rows)
+{
+  string lower = toLower(query);
+  string::size_type pos = lower.rfind("values");
+  if(rows < 2 || pos == string::npos || (pos > 0 && (isalnum(lower[pos-1]) || lower[pos-1] == '_')))
+    return string();
+
+  string::size_type open = lower.find_first_not_of(" \t\r\n", pos + 6);
+  if(open == string::npos || query[open] != '(')
+    return string();
+
+  string::size_type close = string::npos;
+  int depth = 0;
+  bool quoted = false;
+  for(string::size_type i = open; i < query.size() && close == string::npos; ++i) {
+    char c = query[i];
+    if(quoted)
+      quoted = (c != '\'');
+    else if(c == '\'')
+      quoted = true;
+    else if(c == '(')
+      depth++;
+    else if(c == ')' && !--depth)
+      close = i;
+  }
+  if(close == string::npos || query.find_first_not_of(" \t\r\n;", close + 1) != string::npos)
+    return string();
+
+  const string prefix = query.substr(0, open);
+  const string tuple = query.substr(open, close - open + 1);
+  if(prefix.find_first_of("?$") != string::npos)
+    return string();
+
+  // the rewrite runs twice: once to find the highest $N, once per row to emit it
+  unsigned int maxDollar = 0;
+  auto rewrite = [&tuple, &maxDollar](unsigned int row, string* out) {
+    bool quoted = false;
+    for(string::size_type i = 0; i < tuple.size(); ++i) {
+      char c = tuple[i];
+      if(quoted || c == '\'') {
+        quoted = quoted ? (c != '\'') : true;
+        if(out)
+          out->append(1, c);
+      }
+      else if(c == '$' && i + 1 < tuple.size() && isdigit(tuple[i+1])) {
+        unsigned int num = 0;
+        while(i + 1 < tuple.size() && isdigit(tuple[i+1]))
+          num = num * 10 + (tuple[++i] - '0');
+        maxDollar = std::max(maxDollar, num);
+        if(out)
+          out->append("$" + std::to_string(num + row * maxDollar));
+      }
+      else if(c == ':' && i + 1 < tuple.size() && (isalpha(tuple[i+1]) || tuple[i+1] == '_') && (i == 0 || tuple[i-1] != ':')) {
+        string::size_type end = i + 1;
+        while(end < tuple.size() && (isalnum(tuple[end]) || tuple[end] == '_'))
+          end++;
+        if(out)
+          out->append(tuple, i, end - i).append("_" + std::to_string(row));
+        i = end - 1;
+      }
+      else if(out)
+        out->append(1, c);
+    }
+  };
+
+  rewrite(0, nullptr);
+  string ret = prefix;
+  for(unsigned int row = 0; row < rows; ++row) {
+    if(row)
+      ret.append(", ");
+    rewrite(row, &ret);
+  }
+  return ret;
+}
+
+void GSQLBackend::bindInsertRecord(SSqlStatement* stmt, const DNSResourceRecord& r, const string* ordername, const string& suffix)
 {
   int prio=0;
   string content(r.content);
@@ -1266,26 +1428,30 @@ bool GSQLBackend::feedRecord(const DNSResourceRecord &r, string *ordername)
     trim_left(content);
   }
 
-  try {
-    d_InsertRecordQuery_stmt->
-      bind("content",content)->
-      bind("ttl",r.ttl)->
-      bind("priority",prio)->
-      bind("qtype",r.qtype.getName())->
-      bind("domain_id",r.domain_id)->
-      bind("disabled",r.disabled)->
-      bind("qname",r.qname);
-
-    if (ordername == NULL)
-      d_InsertRecordQuery_stmt->bindNull("ordername");
-    else
-      d_InsertRecordQuery_stmt->bind("ordername",*ordername);
+  stmt->
+    bind("content"+suffix,content)->
+    bind("ttl"+suffix,r.ttl)->
+    bind("priority"+suffix,prio)->
+    bind("qtype"+suffix,r.qtype.getName())->
+    bind("domain_id"+suffix,r.domain_id)->
+    bind("disabled"+suffix,r.disabled)->
+    bind("qname"+suffix,r.qname);
 
-    if (d_dnssecQueries)
-      d_InsertRecordQuery_stmt->bind("auth", r.auth);
-    else
-      d_InsertRecordQuery_stmt->bind("auth", true);
+  if (ordername == NULL)
+    stmt->bindNull("ordername"+suffix);
+  else
+    stmt->bind("ordername"+suffix,*ordername);
 
+  if (d_dnssecQueries)
+    stmt->bind("auth"+suffix, r.auth);
+  else
+    stmt->bind("auth"+suffix, true);
+}
+
+bool GSQLBackend::feedRecord(const DNSResourceRecord &r, string *ordername)
+{
+  try {
+    bindInsertRecord(d_InsertRecordQuery_stmt, r, ordername, "");
     d_InsertRecordQuery_stmt->
       execute()->
       reset();
@@ -1296,22 +1462,81 @@ bool GSQLBackend::feedRecord(const DNSResourceRecord &r, string *ordername)
   return true; // XXX FIXME this API should not return 'true' I think -ahu 
 }
 
-bool GSQLBackend::feedEnts(int domain_id, map<DNSName,bool>& nonterm)
+bool GSQLBackend::feedRecords(const vector<DNSFeedRecord>& records)
 {
-  for(const auto& nt: nonterm) {
-    try {
+  size_t pos = 0;
+  if(d_InsertRecordsQuery_stmt) {
+    for(; records.size() - pos >= d_feedBatchSize; pos += d_feedBatchSize) {
+      try {
+        for(unsigned int row = 0; row < d_feedBatchSize; ++row) {
+          const DNSFeedRecord& record = records[pos + row];
+          bindInsertRecord(d_InsertRecordsQuery_stmt, record.rr, record.hasOrdername ? &record.ordername : NULL, "_"+std::to_string(row));
+        }
+        d_InsertRecordsQuery_stmt->
+          execute()->
+          reset();
+      }
+      catch (SSqlException &e) {
+        throw PDNSException("GSQLBackend unable to feed records: "+e.txtReason());
+      }
+    }
+  }
+
+  for(; pos < records.size(); ++pos) {
+    string ordername(records[pos].ordername);
+    feedRecord(records[pos].rr, records[pos].hasOrdername ? &ordername : NULL);
+  }
+  return true;
+}
+
+void GSQLBackend::bindInsertEmptyNonTerminal(SSqlStatement* stmt, int domain_id, const DNSFeedRecord& ent, const string& suffix)
+{
+  stmt->
+    bind("domain_id"+suffix, domain_id)->
+    bind("qname"+suffix, ent.rr.qname);
+  if (ent.hasOrdername)
+    stmt->bind("ordername"+suffix, ent.ordername);
+  else
+    stmt->bindNull("ordername"+suffix);
+  stmt->bind("auth"+suffix, ent.rr.auth);
+}
+
+void GSQLBackend::insertEmptyNonTerminals(int domain_id, const vector<DNSFeedRecord>& ents)
+{
+  size_t pos = 0;
+  try {
+    if(d_InsertEmptyNonTerminalsOrderQuery_stmt) {
+      for(; ents.size() - pos >= d_feedBatchSize; pos += d_feedBatchSize) {
+        for(unsigned int row = 0; row < d_feedBatchSize; ++row)
+          bindInsertEmptyNonTerminal(d_InsertEmptyNonTerminalsOrderQuery_stmt, domain_id, ents[pos + row], "_"+std::to_string(row));
+        d_InsertEmptyNonTerminalsOrderQuery_stmt->
+          execute()->
+          reset();
+      }
+    }
+    for(; pos < ents.size(); ++pos) {
+      bindInsertEmptyNonTerminal(d_InsertEmptyNonTerminalOrderQuery_stmt, domain_id, ents[pos], "");
       d_InsertEmptyNonTerminalOrderQuery_stmt->
-        bind("domain_id",domain_id)->
-        bind("qname", nt.first)->
-        bindNull("ordername")->
-        bind("auth",(nt.second || !d_dnssecQueries))->
         execute()->
         reset();
     }
-    catch (SSqlException &e) {
-      throw PDNSException("GSQLBackend unable to feed empty non-terminal: "+e.txtReason());
-    }
   }
+  catch (SSqlException &e) {
+    throw PDNSException("GSQLBackend unable to feed empty non-terminal: "+e.txtReason());
+  }
+}
+
+bool GSQLBackend::feedEnts(int domain_id, map<DNSName,bool>& nonterm)
+{
+  vector<DNSFeedRecord> ents;
+  ents.reserve(nonterm.size());
+  for(const auto& nt: nonterm) {
+    DNSFeedRecord ent;
+    ent.rr.qname = nt.first;
+    ent.rr.auth = (nt.second || !d_dnssecQueries);
+    ents.push_back(ent);
+  }
+  insertEmptyNonTerminals(domain_id, ents);
   return true;
 }
 
@@ -1320,30 +1545,19 @@ bool GSQLBackend::feedEnts3(int domain_id, const DNSName &domain, map<DNSName,bo
   if(!d_dnssecQueries)
       return false;
 
-  string ordername;
-
+  vector<DNSFeedRecord> ents;
+  ents.reserve(nonterm.size());
   for(const auto& nt: nonterm) {
-    try {
-      d_InsertEmptyNonTerminalOrderQuery_stmt->
-        bind("domain_id",domain_id)->
-        bind("qname", nt.first);
-      if (narrow || !nt.second) {
-        d_InsertEmptyNonTerminalOrderQuery_stmt->
-          bindNull("ordername");
-      } else {
-        ordername=toBase32Hex(hashQNameWithSalt(ns3prc, nt.first));
-        d_InsertEmptyNonTerminalOrderQuery_stmt->
-          bind("ordername", ordername);
-      }
-      d_InsertEmptyNonTerminalOrderQuery_stmt->
-        bind("auth",nt.second)->
-        execute()->
-        reset();
-    }
-    catch (SSqlException &e) {
-      throw PDNSException("GSQLBackend unable to feed empty non-terminal: "+e.txtReason());
+    DNSFeedRecord ent;
+    ent.rr.qname = nt.first;
+    ent.rr.auth = nt.second;
+    if (!narrow && nt.second) {
+      ent.ordername = toBase32Hex(hashQNameWithSalt(ns3prc, nt.first));
+      ent.hasOrdername = true;
     }
+    ents.push_back(ent);
   }
+  insertEmptyNonTerminals(domain_id, ents);
   return true;
 }
 
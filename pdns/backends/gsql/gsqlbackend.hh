@@ -35,6 +35,8 @@ public:
       d_IdQuery_stmt = d_db->prepare(d_IdQuery, 3);
       d_ANYNoIdQuery_stmt = d_db->prepare(d_ANYNoIdQuery, 1);
       d_ANYIdQuery_stmt = d_db->prepare(d_ANYIdQuery, 2);
+      if(!d_ANYBatchQuery.empty())
+        d_ANYBatchQuery_stmt = d_db->prepare(d_ANYBatchQuery, s_anyBatchQueryNames);
       d_listQuery_stmt = d_db->prepare(d_listQuery, 2);
       d_listSubZoneQuery_stmt = d_db->prepare(d_listSubZoneQuery, 3);
       d_MasterOfDomainsZoneQuery_stmt = d_db->prepare(d_MasterOfDomainsZoneQuery, 1);
@@ -45,6 +47,10 @@ public:
       d_InsertZoneQuery_stmt = d_db->prepare(d_InsertZoneQuery, 4);
       d_InsertRecordQuery_stmt = d_db->prepare(d_InsertRecordQuery, 9);
       d_InsertEmptyNonTerminalOrderQuery_stmt = d_db->prepare(d_InsertEmptyNonTerminalOrderQuery, 4);
+      if(!d_InsertRecordsQuery.empty())
+        d_InsertRecordsQuery_stmt = d_db->prepare(d_InsertRecordsQuery, 9*d_feedBatchSize);
+      if(!d_InsertEmptyNonTerminalsOrderQuery.empty())
+        d_InsertEmptyNonTerminalsOrderQuery_stmt = d_db->prepare(d_InsertEmptyNonTerminalsOrderQuery, 4*d_feedBatchSize);
       d_UpdateMasterOfZoneQuery_stmt = d_db->prepare(d_UpdateMasterOfZoneQuery, 2);
       d_UpdateKindOfZoneQuery_stmt = d_db->prepare(d_UpdateKindOfZoneQuery, 2);
       d_UpdateAccountOfZoneQuery_stmt = d_db->prepare(d_UpdateAccountOfZoneQuery, 2);
@@ -101,6 +107,7 @@ public:
     release(&d_IdQuery_stmt);
     release(&d_ANYNoIdQuery_stmt);
     release(&d_ANYIdQuery_stmt);
+    release(&d_ANYBatchQuery_stmt);
     release(&d_listQuery_stmt);
     release(&d_listSubZoneQuery_stmt);
     release(&d_MasterOfDomainsZoneQuery_stmt);
@@ -111,6 +118,8 @@ public:
     release(&d_InsertZoneQuery_stmt);
     release(&d_InsertRecordQuery_stmt);
     release(&d_InsertEmptyNonTerminalOrderQuery_stmt);
+    release(&d_InsertRecordsQuery_stmt);
+    release(&d_InsertEmptyNonTerminalsOrderQuery_stmt);
     release(&d_UpdateMasterOfZoneQuery_stmt);
     release(&d_UpdateKindOfZoneQuery_stmt);
     release(&d_UpdateAccountOfZoneQuery_stmt);
@@ -157,6 +166,7 @@ public:
   }
 
   void lookup(const QType &, const DNSName &qdomain, DNSPacket *p=0, int zoneId=-1);
+  void lookupBatch(const vector<DNSLookupQuestion>& questions, vector<vector<DNSResourceRecord> >& answers, DNSPacket *p=0, int zoneId=-1);
   bool list(const DNSName &target, int domain_id, bool include_disabled=false);
   bool get(DNSResourceRecord &r);
   void getAllDomains(vector<DomainInfo> *domains, bool include_disabled=false);
@@ -166,6 +176,7 @@ public:
   bool commitTransaction();
   bool abortTransaction();
   bool feedRecord(const DNSResourceRecord &r, string *ordername=0);
+  bool feedRecords(const vector<DNSFeedRecord>& records);
   bool feedEnts(int domain_id, map<DNSName,bool>& nonterm);
   bool feedEnts3(int domain_id, const DNSName &domain, map<DNSName,bool> &nonterm, const NSEC3PARAMRecordContent& ns3prc, bool narrow);
   bool createDomain(const DNSName &domain, const string &type, const string &masters, const string &account);
@@ -219,12 +230,18 @@ public:
   bool searchRecords(const string &pattern, int maxResults, vector<DNSResourceRecord>& result);
   bool searchComments(const string &pattern, int maxResults, vector<Comment>& result);
 
+  static string makeMultiRowInsertQuery(const string& query, unsigned int rows);
+
 protected:
   string pattern2SQLPattern(const string& pattern);
   void extractRecord(const SSqlStatement::row_t& row, DNSResourceRecord& rr);
   void extractComment(const SSqlStatement::row_t& row, Comment& c);
 
 private:
+  void bindInsertRecord(SSqlStatement* stmt, const DNSResourceRecord& r, const string* ordername, const string& suffix);
+  void bindInsertEmptyNonTerminal(SSqlStatement* stmt, int domain_id, const DNSFeedRecord& ent, const string& suffix);
+  void insertEmptyNonTerminals(int domain_id, const vector<DNSFeedRecord>& ents);
+
   string d_query_name;
   DNSName d_qname;
   SSql *d_db;
@@ -234,6 +251,7 @@ private:
   string d_IdQuery;
   string d_ANYNoIdQuery;
   string d_ANYIdQuery;
+  string d_ANYBatchQuery; //!< any-query for s_anyBatchQueryNames names at once, empty if not available
 
   string d_listQuery;
   string d_listSubZoneQuery;
@@ -249,6 +267,8 @@ private:
   string d_InsertZoneQuery;
   string d_InsertRecordQuery;
   string d_InsertEmptyNonTerminalOrderQuery;
+  string d_InsertRecordsQuery; //!< d_InsertRecordQuery for d_feedBatchSize rows at once, empty if not batching
+  string d_InsertEmptyNonTerminalsOrderQuery; //!< same for d_InsertEmptyNonTerminalOrderQuery
   string d_UpdateMasterOfZoneQuery;
   string d_UpdateKindOfZoneQuery;
   string d_UpdateAccountOfZoneQuery;
@@ -308,6 +328,7 @@ private:
   SSqlStatement* d_IdQuery_stmt;
   SSqlStatement* d_ANYNoIdQuery_stmt;
   SSqlStatement* d_ANYIdQuery_stmt;
+  SSqlStatement* d_ANYBatchQuery_stmt;
   SSqlStatement* d_listQuery_stmt;
   SSqlStatement* d_listSubZoneQuery_stmt;
   SSqlStatement* d_MasterOfDomainsZoneQuery_stmt;
@@ -317,6 +338,8 @@ private:
   SSqlStatement* d_GetSuperMasterIPs_stmt;
   SSqlStatement* d_InsertZoneQuery_stmt;
   SSqlStatement* d_InsertRecordQuery_stmt;
+  SSqlStatement* d_InsertRecordsQuery_stmt;
+  SSqlStatement* d_InsertEmptyNonTerminalsOrderQuery_stmt;
   SSqlStatement* d_InsertEmptyNonTerminalOrderQuery_stmt;
   SSqlStatement* d_UpdateMasterOfZoneQuery_stmt;
   SSqlStatement* d_UpdateKindOfZoneQuery_stmt;
@@ -364,6 +387,8 @@ private:
 
 protected:
   bool d_dnssecQueries;
+  unsigned int d_feedBatchSize;
+  static const unsigned int s_anyBatchQueryNames = 8; //!< number of names any-batch-query takes
 };
 
 #endif /* PDNS_GSQLBACKEND_HH */
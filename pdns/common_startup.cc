@@ -28,6 +28,7 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 #include "dynhandler.hh"
+#include "auth-zonecache.hh"
 
 #ifdef HAVE_SYSTEMD
 #include <systemd/sd-daemon.h>
@@ -93,6 +94,9 @@ void declareArguments()
   ::arg().set("control-console","Debugging switch - don't use")="no"; // but I know you will!
   ::arg().set("loglevel","Amount of logging. Higher is more. Do not set below 3")="4";
   ::arg().set("disable-syslog","Disable logging to syslog, useful when running inside a supervisor that logs stdout")="no";
+  ::arg().setSwitch("log-async","Write out log messages from a separate thread")="no";
+  ::arg().set("log-async-queue-size","Number of log messages each thread can queue for the writer thread")="1024";
+  ::arg().setSwitch("log-async-drop","Drop log messages instead of waiting when a thread's log queue is full")="no";
   ::arg().set("default-soa-name","name to insert in the SOA record if none set in the backend")="a.misconfigured.powerdns.server";
   ::arg().set("default-soa-mail","mail address to insert in the SOA record if none set in the backend")="";
   ::arg().set("distributor-threads","Default number of Distributor (backend) threads to start")="3";
@@ -133,6 +137,7 @@ void declareArguments()
   ::arg().set("webserver-port","Port of webserver to listen on")="8081";
   ::arg().set("webserver-password","Password required for accessing the webserver")="";
   ::arg().set("webserver-allow-from","Webserver access is only allowed from these subnets")="0.0.0.0/0,::/0";
+  ::arg().set("webserver-ring-sample-rate","Only account one in this many queries and remotes in the webserver's top lists, per thread")="1";
 
   ::arg().setSwitch("out-of-zone-additional-processing","Do out of zone additional processing")="yes";
   ::arg().setSwitch("do-ipv6-additional-processing", "Do AAAA additional processing")="yes";
@@ -155,6 +160,7 @@ void declareArguments()
   ::arg().set("default-soa-edit-signed","Default SOA-EDIT value for signed zones")="";
   ::arg().set("dnssec-key-cache-ttl","Seconds to cache DNSSEC keys from the database")="30";
   ::arg().set("domain-metadata-cache-ttl","Seconds to cache domain metadata from the database")="60";
+  ::arg().set("zone-cache-refresh-interval","Seconds between refreshes of the in-memory zone index, 0 to disable it")="0";
 
   ::arg().set("trusted-notification-proxy", "IP address of incoming notification proxy")="";
   ::arg().set("slave-renotify", "If we should send out notifications for slaved updates")="no";
@@ -168,6 +174,8 @@ void declareArguments()
 
   ::arg().set("max-cache-entries", "Maximum number of cache entries")="1000000";
   ::arg().set("max-signature-cache-entries", "Maximum number of signatures cache entries")="";
+  ::arg().set("signature-cache-file", "If set, the signature cache is loaded from and periodically saved to this file")="";
+  ::arg().set("signature-cache-save-interval", "Number of seconds between saves of the signature cache to signature-cache-file")="3600";
   ::arg().set("max-ent-entries", "Maximum number of empty non-terminals in a zone")="100000";
   ::arg().set("entropy-source", "If set, read entropy from this file")="/dev/urandom";
 
@@ -237,6 +245,16 @@ static uint64_t getLatency(const std::string& str)
   return avg_latency;
 }
 
+static uint64_t getZoneCacheSize(const std::string& str)
+{
+  return g_zoneCache.size();
+}
+
+static uint64_t getLogMessagesDropped(const std::string& str)
+{
+  return L.getDroppedMessages();
+}
+
 void declareStats(void)
 {
   S.declare("udp-queries","Number of UDP queries received");
@@ -257,6 +275,8 @@ void declareStats(void)
   S.declare("recursing-questions","Number of questions sent to recursor");
   S.declare("corrupt-packets","Number of corrupt packets received");
   S.declare("signatures", "Number of DNSSEC signatures made");
+  S.declare("signing-rrsets", "Number of RRsets signed for outgoing zone transfers");
+  S.declare("signing-rrsets-per-second", "Number of RRsets signed per second during the last live-signed zone transfer");
   S.declare("tcp-queries","Number of TCP queries received");
   S.declare("tcp-answers","Number of answers sent out over TCP");
   S.declare("tcp-answers-bytes","Total size of answers sent out over TCP");
@@ -288,6 +308,7 @@ void declareStats(void)
   S.declare("uptime", "Uptime of process in seconds", uptimeOfProcess);
   S.declare("real-memory-usage", "Actual unique use of memory in bytes (approx)", getRealMemoryUsage);
   S.declare("fd-usage", "Number of open filedescriptors", getOpenFileDescriptors);
+  S.declare("log-messages-dropped", "Number of log messages dropped because the log queue was full", getLogMessagesDropped);
 #ifdef __linux__
   S.declare("udp-recvbuf-errors", "UDP 'recvbuf' errors", udpErrorStats);
   S.declare("udp-sndbuf-errors", "UDP 'sndbuf' errors", udpErrorStats);
@@ -300,6 +321,7 @@ void declareStats(void)
   S.declare("meta-cache-size", "Number of entries in the metadata cache", DNSSECKeeper::dbdnssecCacheSizes);
   S.declare("key-cache-size", "Number of entries in the key cache", DNSSECKeeper::dbdnssecCacheSizes);
   S.declare("signature-cache-size", "Number of entries in the signature cache", signatureCacheSize);
+  S.declare("zone-cache-size", "Number of zones in the in-memory zone index", getZoneCacheSize);
 
   S.declare("servfail-packets","Number of times a server-failed packet was sent out");
   S.declare("latency","Average number of microseconds needed to answer a question", getLatency);
@@ -387,7 +409,7 @@ void *qthread(void *number)
      if(P->d.qr)
        continue;
 
-    S.ringAccount("queries", P->qdomain.toLogString()+"/"+P->qtype.getName());
+    S.ringAccount("queries", P->qdomain, P->qtype);
     S.ringAccount("remotes",P->d_remote);
     if(logDNSQueries) {
       string remote;
@@ -454,6 +476,49 @@ void *qthread(void *number)
   return 0;
 }
 
+static void loadZoneCache()
+{
+  UeberBackend B;
+  vector<DomainInfo> domains;
+  B.getAllDomains(&domains);
+  g_zoneCache.replace(domains);
+}
+
+static void* zoneCacheRefreshThread(void*)
+{
+  unsigned int interval = ::arg().asNum("zone-cache-refresh-interval");
+  for(;;) {
+    sleep(interval);
+    try {
+      loadZoneCache();
+    }
+    catch(PDNSException& e) {
+      L<<Logger::Error<<"Unable to refresh the zone cache: "<<e.reason<<endl;
+    }
+    catch(std::exception& e) {
+      L<<Logger::Error<<"Unable to refresh the zone cache: "<<e.what()<<endl;
+    }
+  }
+  return 0;
+}
+
+static void* signatureCacheSaveThread(void*)
+{
+  const string fname = ::arg()["signature-cache-file"];
+  unsigned int interval = ::arg().asNum("signature-cache-save-interval");
+  for(;;) {
+    sleep(interval);
+    try {
+      size_t count = dumpSignatureCache(fname);
+      L<<Logger::Info<<"Saved "<<count<<" signatures to '"<<fname<<"'"<<endl;
+    }
+    catch(PDNSException& e) {
+      L<<Logger::Error<<"Unable to save the signature cache: "<<e.reason<<endl;
+    }
+  }
+  return 0;
+}
+
 static void* dummyThread(void *)
 {
   void* ignore=0;
@@ -517,6 +582,27 @@ void mainthread()
   }
   catch(...) {}
 
+  if(::arg().asNum("zone-cache-refresh-interval") > 0) {
+    try {
+      loadZoneCache();
+      g_zoneCache.setEnabled(true);
+      L<<Logger::Warning<<"Loaded "<<g_zoneCache.size()<<" zones into the zone cache"<<endl;
+    }
+    catch(PDNSException& e) {
+      L<<Logger::Error<<"Unable to load the zone cache, continuing without it: "<<e.reason<<endl;
+    }
+  }
+
+  if(!::arg()["signature-cache-file"].empty()) {
+    try {
+      size_t count = loadSignatureCache(::arg()["signature-cache-file"]);
+      L<<Logger::Warning<<"Loaded "<<count<<" signatures from '"<<::arg()["signature-cache-file"]<<"'"<<endl;
+    }
+    catch(PDNSException& e) {
+      L<<Logger::Error<<"Unable to load the signature cache, starting with an empty one: "<<e.reason<<endl;
+    }
+  }
+
   // NOW SAFE TO CREATE THREADS!
   dl->go();
 
@@ -544,6 +630,12 @@ void mainthread()
 
   pthread_create(&qtid,0,carbonDumpThread, 0); // runs even w/o carbon, might change @ runtime    
 
+  if(g_zoneCache.isEnabled())
+    pthread_create(&qtid,0,zoneCacheRefreshThread, 0);
+
+  if(!::arg()["signature-cache-file"].empty() && ::arg().asNum("signature-cache-save-interval") > 0)
+    pthread_create(&qtid,0,signatureCacheSaveThread, 0);
+
 #ifdef HAVE_SYSTEMD
   /* If we are here, notify systemd that we are ay-ok! This might have some
    * timing issues with the backend-threads. e.g. if the initial MySQL connection
@@ -186,6 +186,19 @@ public:
     return 0;
   }
   bool notifyDomain(const DNSName &domain);
+
+  //! what the last incoming transfer of a zone did, for 'pdns_control xfr-stats'
+  struct TransferStats
+  {
+    time_t when{0};
+    uint32_t serial{0};
+    bool incremental{false}; //!< last transfer was applied as an IXFR
+    size_t records{0}; //!< records removed and added by an IXFR, or stored by an AXFR
+    unsigned int usec{0};
+    uint64_t ixfrs{0};
+    uint64_t axfrs{0};
+  };
+  map<DNSName, TransferStats> getTransferStats();
 private:
   void makeNotifySockets();
   void queueNotifyDomain(const DNSName &domain, UeberBackend *B);
@@ -194,8 +207,9 @@ private:
   pthread_mutex_t d_holelock;
   void launchRetrievalThreads();
   void suck(const DNSName &domain, const string &remote);
-  void ixfrSuck(const DNSName &domain, const TSIGTriplet& tt, const ComboAddress& laddr, const ComboAddress& remote, boost::scoped_ptr<AuthLua>& pdl,
+  bool ixfrSuck(const DNSName &domain, const TSIGTriplet& tt, const ComboAddress& laddr, const ComboAddress& remote, boost::scoped_ptr<AuthLua>& pdl,
                 ZoneStatus& zs, vector<DNSRecord>* axfr);
+  void recordTransfer(const DNSName &domain, bool incremental, uint32_t serial, size_t records, unsigned int usec);
 
   void slaveRefresh(PacketHandler *P);
   void masterUpdateCheck(PacketHandler *P);
@@ -203,6 +217,7 @@ private:
   
   UniQueue d_suckdomains;
   set<DNSName> d_inprogress;
+  map<DNSName, TransferStats> d_transferstats;
   
   Semaphore d_suck_sem;
   Semaphore d_any_sem;
@@ -94,6 +94,34 @@ struct TSIGKey {
    std::string key;
 };
 
+//! A record for DNSBackend::feedRecords(), with the optional ordername feedRecord() takes as a pointer
+struct DNSFeedRecord
+{
+  DNSFeedRecord() : hasOrdername(false) {}
+  DNSFeedRecord(const DNSResourceRecord& rr_) : rr(rr_), hasOrdername(false) {}
+  DNSFeedRecord(const DNSResourceRecord& rr_, const string& ordername_) : rr(rr_), ordername(ordername_), hasOrdername(true) {}
+
+  DNSResourceRecord rr;
+  string ordername;
+  bool hasOrdername;
+};
+
+//! The arguments of one DNSBackend::updateDNSSECOrderNameAndAuth() call, for updateDNSSECOrderNamesAndAuth()
+struct DNSOrderNameUpdate
+{
+  DNSName qname;
+  DNSName ordername;
+  bool auth;
+  uint16_t qtype;
+};
+
+//! One of the independent questions handed to DNSBackend::lookupBatch()
+struct DNSLookupQuestion
+{
+  QType qtype;
+  DNSName qname;
+};
+
 class DNSPacket;
 
 //! This virtual base class defines the interface for backends for the ahudns.
@@ -114,6 +142,20 @@ public:
   virtual void lookup(const QType &qtype, const DNSName &qdomain, DNSPacket *pkt_p=0, int zoneId=-1)=0; 
   virtual bool get(DNSResourceRecord &)=0; //!< retrieves one DNSResource record, returns false if no more were available
 
+  //! Answers several independent questions at once, answers[n] receives the records for questions[n]
+  /** Backends that can answer all of them in fewer round trips than one lookup() per question
+      should override this. The default just asks the questions one by one. */
+  virtual void lookupBatch(const vector<DNSLookupQuestion>& questions, vector<vector<DNSResourceRecord> >& answers, DNSPacket *pkt_p=0, int zoneId=-1)
+  {
+    DNSResourceRecord rr;
+    answers.assign(questions.size(), vector<DNSResourceRecord>());
+    for(vector<DNSLookupQuestion>::size_type n = 0; n < questions.size(); ++n) {
+      lookup(questions[n].qtype, questions[n].qname, pkt_p, zoneId);
+      while(get(rr))
+        answers[n].push_back(rr);
+    }
+  }
+
   //! Initiates a list of the specified domain
   /** Once initiated, DNSResourceRecord objects can be retrieved using get(). Should return false
       if the backend does not consider itself responsible for the id passed.
@@ -202,6 +244,15 @@ public:
     return false;
   }
 
+  //! applies a batch of updateDNSSECOrderNameAndAuth() calls, in order
+  virtual bool updateDNSSECOrderNamesAndAuth(uint32_t domain_id, const DNSName& zonename, const vector<DNSOrderNameUpdate>& updates)
+  {
+    bool ret = true;
+    for(const auto& update : updates)
+      ret = updateDNSSECOrderNameAndAuth(domain_id, zonename, update.qname, update.ordername, update.auth, update.qtype) && ret;
+    return ret;
+  }
+
   virtual bool updateEmptyNonTerminals(uint32_t domain_id, const DNSName& zonename, set<DNSName>& insert, set<DNSName>& erase, bool remove)
   {
     return false;
@@ -271,6 +322,16 @@ public:
   {
     return false; // no problem!
   }
+  //! feeds a batch of records to a zone, needs a call to startTransaction first. Backends that can insert many rows at once should override this
+  virtual bool feedRecords(const vector<DNSFeedRecord>& records)
+  {
+    for(const auto& record : records) {
+      string ordername(record.ordername);
+      if(!feedRecord(record.rr, record.hasOrdername ? &ordername : 0))
+        return false;
+    }
+    return true;
+  }
   virtual bool feedEnts(int domain_id, map<DNSName,bool> &nonterm)
   {
     return false;
@@ -681,8 +681,16 @@ void moreLua(bool client)
         throw std::runtime_error("Protobuf support is required to use RemoteLogResponseAction");
 #endif
       });
-    g_lua.writeFunction("newRemoteLogger", [client](const std::string& remote, boost::optional<uint16_t> timeout, boost::optional<uint64_t> maxQueuedEntries, boost::optional<uint8_t> reconnectWaitTime) {
-        return std::make_shared<RemoteLogger>(ComboAddress(remote), timeout ? *timeout : 2, maxQueuedEntries ? *maxQueuedEntries : 100, reconnectWaitTime ? *reconnectWaitTime : 1);
+    g_lua.writeFunction("newRemoteLogger", [client](const std::string& remote, boost::optional<uint16_t> timeout, boost::optional<uint64_t> maxQueuedEntries, boost::optional<uint8_t> reconnectWaitTime, boost::optional<uint16_t> connections) {
+        return std::make_shared<RemoteLogger>(ComboAddress(remote), timeout ? *timeout : 2, maxQueuedEntries ? *maxQueuedEntries : 100, reconnectWaitTime ? *reconnectWaitTime : 1, connections ? *connections : 1);
+      });
+
+    g_lua.registerFunction<void(RemoteLogger::*)()>("printStats", [](const RemoteLogger& logger) {
+        setLuaNoSideEffect();
+        auto stats = logger.getStats();
+        for(const auto& s : stats) {
+          g_outputBuffer+=s.first+"\t"+std::to_string((uint64_t)s.second)+"\n";
+        }
       });
 
     g_lua.writeFunction("TeeAction", [](const std::string& remote, boost::optional<bool> addECS) {
@@ -187,8 +187,6 @@ static void doLatencyAverages(double udiff)
 bool responseContentMatches(const char* response, const uint16_t responseLen, const DNSName& qname, const uint16_t qtype, const uint16_t qclass, const ComboAddress& remote)
 {
   uint16_t rqtype, rqclass;
-  unsigned int consumed;
-  DNSName rqname;
   const struct dnsheader* dh = (struct dnsheader*) response;
 
   if (responseLen < sizeof(dnsheader)) {
@@ -196,7 +194,19 @@ bool responseContentMatches(const char* response, const uint16_t responseLen, co
   }
 
   try {
-    rqname=DNSName(response, responseLen, sizeof(dnsheader), false, &rqtype, &rqclass, &consumed);
+    /* look at the question in place, no need to copy the name out of the packet */
+    DNSNameView rqname(response, responseLen, sizeof(dnsheader));
+    size_t pos = sizeof(dnsheader) + rqname.wirelength();
+    if (pos + 4 > responseLen) {
+      throw std::range_error("Trying to read past the end of the buffer ("+std::to_string(pos + 4)+ " > " + std::to_string(responseLen)+")");
+    }
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(response) + pos;
+    rqtype = (p[0] << 8) | p[1];
+    rqclass = (p[2] << 8) | p[3];
+
+    if (rqtype != qtype || rqclass != qclass || rqname != qname) {
+      return false;
+    }
   }
   catch(std::exception& e) {
     if(responseLen > (ssize_t)sizeof(dnsheader))
@@ -205,10 +215,6 @@ bool responseContentMatches(const char* response, const uint16_t responseLen, co
     return false;
   }
 
-  if (rqtype != qtype || rqclass != qclass || rqname != qname) {
-    return false;
-  }
-
   return true;
 }
 
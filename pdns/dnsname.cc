@@ -151,6 +151,37 @@ std::string DNSName::toString(const std::string& separator, const bool trailing)
   return ret.substr(0, ret.size()-!trailing);
 }
 
+void DNSName::appendToString(std::string& output) const
+{
+  if (empty()) {
+    throw std::out_of_range("Attempt to print an unset dnsname");
+  }
+
+  if(isRoot()) {
+    output.append(1, '.');
+    return;
+  }
+
+  // same escaping as escapeLabel()
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(d_storage.c_str());
+  const unsigned char* end = p + d_storage.size();
+  for(; p < end && *p; p += *p + 1) {
+    for(const unsigned char* c = p + 1; c <= p + *p; ++c) {
+      if(*c == '.' || *c == '\\') {
+        output.append(1, '\\');
+        output.append(1, (char)*c);
+      }
+      else if(*c > 0x21 && *c < 0x7e)
+        output.append(1, (char)*c);
+      else {
+        char escaped[4] = { '\\', (char)('0' + *c / 100), (char)('0' + (*c / 10) % 10), (char)('0' + *c % 10) };
+        output.append(escaped, sizeof(escaped));
+      }
+    }
+    output.append(1, '.');
+  }
+}
+
 std::string DNSName::toLogString() const
 {
   if (empty()) {
@@ -182,24 +213,22 @@ size_t DNSName::wirelength() const {
   return d_storage.length();
 }
 
-// Are WE part of parent
-bool DNSName::isPartOf(const DNSName& parent) const
+//! is the wire format name [ours, oursEnd) part of [parent, parentEnd)
+static bool wireIsPartOf(const char* ours, const char* oursEnd, const char* parent, const char* parentEnd)
 {
-  if(parent.empty() || empty())
-    throw std::out_of_range("empty dnsnames aren't part of anything");
-
-  if(parent.d_storage.size() > d_storage.size())
+  size_t parentSize = parentEnd - parent;
+  if(parentSize > static_cast<size_t>(oursEnd - ours))
     return false;
 
   // this is slightly complicated since we can't start from the end, since we can't see where a label begins/ends then
-  for(auto us=d_storage.cbegin(); us<d_storage.cend(); us+=*us+1) {
-    auto distance = std::distance(us,d_storage.cend());
-    if (distance < 0 || static_cast<size_t>(distance) < parent.d_storage.size()) {
+  for(auto us=ours; us<oursEnd; us+=*us+1) {
+    auto distance = std::distance(us,oursEnd);
+    if (distance < 0 || static_cast<size_t>(distance) < parentSize) {
       break;
     }
-    if (static_cast<size_t>(distance) == parent.d_storage.size()) {
-      auto p = parent.d_storage.cbegin();
-      for(; us != d_storage.cend(); ++us, ++p) {
+    if (static_cast<size_t>(distance) == parentSize) {
+      auto p = parent;
+      for(; us != oursEnd; ++us, ++p) {
         if(dns2_tolower(*p) != dns2_tolower(*us))
           return false;
       }
@@ -212,6 +241,25 @@ bool DNSName::isPartOf(const DNSName& parent) const
   return false;
 }
 
+//! case insensitive comparison of two wire format names of the same length
+static bool wireEquals(const char* lhs, const char* rhs, size_t len)
+{
+  for(size_t n = len; n-- > 0; ) {   // backwards, names tend to differ at the front
+    if(dns2_tolower(lhs[n]) != dns2_tolower(rhs[n]))
+      return false;
+  }
+  return true;
+}
+
+// Are WE part of parent
+bool DNSName::isPartOf(const DNSName& parent) const
+{
+  if(parent.empty() || empty())
+    throw std::out_of_range("empty dnsnames aren't part of anything");
+
+  return wireIsPartOf(d_storage.cbegin(), d_storage.cend(), parent.d_storage.cbegin(), parent.d_storage.cend());
+}
+
 DNSName DNSName::makeRelative(const DNSName& zone) const
 {
   DNSName ret(*this);
@@ -220,6 +268,7 @@ DNSName DNSName::makeRelative(const DNSName& zone) const
 }
 void DNSName::makeUsRelative(const DNSName& zone) 
 {
+  invalidateHash();
   if (isPartOf(zone)) {
     d_storage.erase(d_storage.size()-zone.d_storage.size());
     d_storage.append(1, (char)0); // put back the trailing 0
@@ -259,6 +308,7 @@ void DNSName::appendRawLabel(const char* start, unsigned int length)
   if(d_storage.size() + length > 254) // reserve one byte for the label length
     throw std::range_error("name too long to append");
 
+  invalidateHash();
   if(d_storage.empty()) {
     d_storage.append(1, (char)length);
   }
@@ -281,9 +331,11 @@ void DNSName::prependRawLabel(const std::string& label)
   if(d_storage.empty())
     d_storage.append(1, (char)0);
 
+  invalidateHash();
   string_t prep(1, (char)label.size());
   prep.append(label.c_str(), label.size());
-  d_storage = prep+d_storage;
+  prep += d_storage;
+  d_storage = std::move(prep);
 }
 
 bool DNSName::slowCanonCompare(const DNSName& rhs) const 
@@ -308,6 +360,7 @@ bool DNSName::chopOff()
 {
   if(d_storage.empty() || d_storage[0]==0)
     return false;
+  invalidateHash();
   d_storage.erase(0, (unsigned int)d_storage[0]+1);
   return true;
 }
@@ -339,13 +392,56 @@ bool DNSName::operator==(const DNSName& rhs) const
   if(rhs.empty() != empty() || rhs.d_storage.size() != d_storage.size())
     return false;
 
-  auto us = d_storage.crbegin();
-  auto p = rhs.d_storage.crbegin();
-  for(; us != d_storage.crend() && p != rhs.d_storage.crend(); ++us, ++p) {   // why does this go backward? 
-    if(dns2_tolower(*p) != dns2_tolower(*us))
-      return false;
+  return wireEquals(d_storage.c_str(), rhs.d_storage.c_str(), d_storage.size());
+}
+
+DNSNameView::DNSNameView(const char* data, size_t len, size_t offset)
+{
+  if (offset >= len)
+    throw std::range_error("Trying to read past the end of the buffer ("+std::to_string(offset)+ " >= "+std::to_string(len)+")");
+
+  const unsigned char* start = (const unsigned char*)data + offset;
+  const unsigned char* end = (const unsigned char*)data + len;
+  const unsigned char* pos = start;
+  while(*pos) {
+    if(*pos & 0xc0)
+      throw std::range_error("Found compressed label, a DNSNameView can not follow it");
+    pos += *pos + 1;
+    if(pos >= end)
+      throw std::range_error("Found an invalid label length in qname");
+    if(pos - start > 254)
+      throw std::range_error("name too long");
   }
-  return true;
+  d_data = (const char*)start;
+  d_len = pos - start + 1;
+}
+
+bool DNSNameView::operator==(const DNSName& rhs) const
+{
+  return rhs.d_storage.size() == d_len && wireEquals(d_data, rhs.d_storage.c_str(), d_len);
+}
+
+bool DNSNameView::isPartOf(const DNSName& parent) const
+{
+  if(parent.empty())
+    throw std::out_of_range("empty dnsnames aren't part of anything");
+
+  return wireIsPartOf(d_data, d_data + d_len, parent.d_storage.cbegin(), parent.d_storage.cend());
+}
+
+unsigned int DNSNameView::countLabels() const
+{
+  unsigned int count=0;
+  for(const unsigned char* p = (const unsigned char*)d_data; *p; p+=*p+1)
+    ++count;
+  return count;
+}
+
+DNSName DNSNameView::toDNSName() const
+{
+  DNSName ret;
+  ret.d_storage.append(d_data, d_len);
+  return ret;
 }
 
 size_t hash_value(DNSName const& d)
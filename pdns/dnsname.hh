@@ -4,14 +4,11 @@
 #include <set>
 #include <deque>
 #include <strings.h>
+#include <string.h>
 #include <stdexcept>
-
-#include <boost/version.hpp>
-
-// it crashes on OSX and doesn't compile on OpenBSD
-#if BOOST_VERSION >= 104800 && ! defined( __APPLE__ ) && ! defined(__OpenBSD__)
-#include <boost/container/string.hpp>
-#endif
+#include <algorithm>
+#include <atomic>
+#include <iterator>
 
 uint32_t burtleCI(const unsigned char* k, uint32_t lengh, uint32_t init);
 
@@ -39,10 +36,194 @@ inline char dns2_tolower(char c)
   return c;
 }
 
+/* Holds the wire format of a DNSName. Names of up to s_inlineCapacity bytes, which is nearly all
+   of them, are stored within the object, so creating, copying and modifying them does not allocate.
+   Implements the part of the std::string interface that DNSName needs. */
+class DNSNameStorage
+{
+public:
+  static const size_t s_inlineCapacity = 60;
+  static const size_t npos = static_cast<size_t>(-1);
+
+  typedef char* iterator;
+  typedef const char* const_iterator;
+  typedef std::reverse_iterator<iterator> reverse_iterator;
+  typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+  DNSNameStorage() : d_ptr(d_inline), d_size(0), d_capacity(s_inlineCapacity)
+  {
+  }
+  DNSNameStorage(size_t count, char c) : DNSNameStorage()
+  {
+    append(count, c);
+  }
+  DNSNameStorage(const DNSNameStorage& rhs) : DNSNameStorage()
+  {
+    append(rhs.d_ptr, rhs.d_size);
+  }
+  DNSNameStorage(DNSNameStorage&& rhs) noexcept : DNSNameStorage()
+  {
+    *this = std::move(rhs);
+  }
+  ~DNSNameStorage()
+  {
+    if(d_ptr != d_inline)
+      delete[] d_ptr;
+  }
+
+  DNSNameStorage& operator=(const DNSNameStorage& rhs)
+  {
+    if(this != &rhs) {
+      d_size = 0;
+      append(rhs.d_ptr, rhs.d_size);
+    }
+    return *this;
+  }
+  DNSNameStorage& operator=(DNSNameStorage&& rhs) noexcept
+  {
+    if(this == &rhs)
+      return *this;
+    if(rhs.d_ptr == rhs.d_inline) {
+      memcpy(d_ptr, rhs.d_ptr, rhs.d_size); // we always have room for an inline name
+      d_size = rhs.d_size;
+    }
+    else {
+      if(d_ptr != d_inline)
+        delete[] d_ptr;
+      d_ptr = rhs.d_ptr;
+      d_size = rhs.d_size;
+      d_capacity = rhs.d_capacity;
+      rhs.d_ptr = rhs.d_inline;
+      rhs.d_capacity = s_inlineCapacity;
+    }
+    rhs.d_size = 0;
+    return *this;
+  }
+
+  size_t size() const { return d_size; }
+  size_t length() const { return d_size; }
+  bool empty() const { return d_size == 0; }
+  const char* c_str() const { return d_ptr; } //!< NOT 0 terminated
+  const char* data() const { return d_ptr; }
+  char& operator[](size_t pos) { return d_ptr[pos]; }
+  char operator[](size_t pos) const { return d_ptr[pos]; }
+
+  iterator begin() { return d_ptr; }
+  iterator end() { return d_ptr + d_size; }
+  const_iterator begin() const { return d_ptr; }
+  const_iterator end() const { return d_ptr + d_size; }
+  const_iterator cbegin() const { return d_ptr; }
+  const_iterator cend() const { return d_ptr + d_size; }
+  reverse_iterator rbegin() { return reverse_iterator(end()); }
+  reverse_iterator rend() { return reverse_iterator(begin()); }
+  const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+  const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+  const_reverse_iterator crbegin() const { return const_reverse_iterator(end()); }
+  const_reverse_iterator crend() const { return const_reverse_iterator(begin()); }
+
+  void reserve(size_t capacity)
+  {
+    if(capacity > d_capacity)
+      grow(capacity);
+  }
+  void clear()
+  {
+    d_size = 0;
+  }
+  void assign(size_t count, char c)
+  {
+    d_size = 0;
+    append(count, c);
+  }
+  DNSNameStorage& append(size_t count, char c)
+  {
+    reserve(d_size + count);
+    memset(d_ptr + d_size, c, count);
+    d_size += count;
+    return *this;
+  }
+  DNSNameStorage& append(const char* p, size_t len)
+  {
+    reserve(d_size + len);
+    memmove(d_ptr + d_size, p, len);
+    d_size += len;
+    return *this;
+  }
+  DNSNameStorage& append(const char* begin, const char* end)
+  {
+    return append(begin, end - begin);
+  }
+  DNSNameStorage& operator+=(const DNSNameStorage& rhs)
+  {
+    return append(rhs.d_ptr, rhs.d_size);
+  }
+  //! removes len bytes from pos
+  void erase(size_t pos, size_t len=npos)
+  {
+    if(pos > d_size)
+      throw std::out_of_range("DNSNameStorage::erase beyond the end");
+    len = std::min(len, d_size - pos);
+    memmove(d_ptr + pos, d_ptr + pos + len, d_size - pos - len);
+    d_size -= len;
+  }
+  //! replaces the (at most) len bytes from pos by str
+  void replace(size_t pos, size_t len, const DNSNameStorage& str)
+  {
+    if(pos > d_size)
+      throw std::out_of_range("DNSNameStorage::replace beyond the end");
+    if(&str == this) {
+      DNSNameStorage copy(str);
+      replace(pos, len, copy);
+      return;
+    }
+    len = std::min(len, d_size - pos);
+    size_t newsize = d_size - len + str.d_size;
+    reserve(newsize);
+    memmove(d_ptr + pos + str.d_size, d_ptr + pos + len, d_size - pos - len);
+    memcpy(d_ptr + pos, str.d_ptr, str.d_size);
+    d_size = newsize;
+  }
+
+private:
+  void grow(size_t capacity)
+  {
+    if(capacity > 0xffff)
+      throw std::range_error("name too long");
+    capacity = std::max(capacity, std::min<size_t>(2 * d_capacity, 0xffff));
+    char* p = new char[capacity];
+    memcpy(p, d_ptr, d_size);
+    if(d_ptr != d_inline)
+      delete[] d_ptr;
+    d_ptr = p;
+    d_capacity = capacity;
+  }
+
+  char* d_ptr; //!< d_inline, or a buffer on the heap
+  uint16_t d_size;
+  uint16_t d_capacity;
+  char d_inline[s_inlineCapacity];
+};
+
+class DNSNameView;
+
 class DNSName
 {
 public:
   DNSName()  {}          //!< Constructs an *empty* DNSName, NOT the root!
+  DNSName(const DNSName& rhs) : d_storage(rhs.d_storage), d_hash(rhs.d_hash.load(std::memory_order_relaxed)) {}
+  DNSName(DNSName&& rhs) noexcept : d_storage(std::move(rhs.d_storage)), d_hash(rhs.d_hash.load(std::memory_order_relaxed)) {}
+  DNSName& operator=(const DNSName& rhs)
+  {
+    d_storage = rhs.d_storage;
+    d_hash.store(rhs.d_hash.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    return *this;
+  }
+  DNSName& operator=(DNSName&& rhs) noexcept
+  {
+    d_storage = std::move(rhs.d_storage);
+    d_hash.store(rhs.d_hash.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    return *this;
+  }
   explicit DNSName(const char* p);      //!< Constructs from a human formatted, escaped presentation
   explicit DNSName(const std::string& str) : DNSName(str.c_str()) {}; //!< Constructs from a human formatted, escaped presentation
   DNSName(const char* p, int len, int offset, bool uncompress, uint16_t* qtype=0, uint16_t* qclass=0, unsigned int* consumed=0, uint16_t minOffset=0); //!< Construct from a DNS Packet, taking the first question if offset=12
@@ -52,6 +233,7 @@ public:
   bool operator!=(const DNSName& other) const { return !(*this == other); }
 
   std::string toString(const std::string& separator=".", const bool trailing=true) const;              //!< Our human-friendly, escaped, representation
+  void appendToString(std::string& output) const; //!< Appends what toString() returns to output, without temporaries
   std::string toLogString() const; //!< like plain toString, but returns (empty) on empty names
   std::string toStringNoDot() const { return toString(".", false); }
   std::string toStringRootDot() const { if(isRoot()) return "."; else return toString(".", false); }
@@ -70,11 +252,20 @@ public:
   size_t wirelength() const; //!< Number of total bytes in the name
   bool empty() const { return d_storage.empty(); }
   bool isRoot() const { return d_storage.size()==1 && d_storage[0]==0; }
-  void clear() { d_storage.clear(); }
+  void clear() { d_storage.clear(); invalidateHash(); }
   void trimToLabels(unsigned int);
   size_t hash(size_t init=0) const
   {
-    return burtleCI((const unsigned char*)d_storage.c_str(), d_storage.size(), init);
+    if(init)
+      return burtleCI((const unsigned char*)d_storage.c_str(), d_storage.size(), init);
+
+    // computed once, names are hashed over and over by caches and load balancing policies
+    uint32_t ret = d_hash.load(std::memory_order_relaxed);
+    if(!ret) {
+      ret = burtleCI((const unsigned char*)d_storage.c_str(), d_storage.size(), 0);
+      d_hash.store(ret, std::memory_order_relaxed);
+    }
+    return ret;
   }
   DNSName& operator+=(const DNSName& rhs)
   {
@@ -83,6 +274,8 @@ public:
     if(rhs.empty())
       return *this;
 
+    invalidateHash();
+
     if(d_storage.empty())
       d_storage+=rhs.d_storage;
     else
@@ -103,14 +296,17 @@ public:
   inline bool canonCompare(const DNSName& rhs) const;
   bool slowCanonCompare(const DNSName& rhs) const;  
 
-#if BOOST_VERSION >= 104800 && ! defined( __APPLE__ ) && ! defined(__OpenBSD__)
-  typedef boost::container::string string_t;
-#else
-  typedef std::string string_t;
-#endif
+  typedef DNSNameStorage string_t;
+
+  const string_t& getStorage() const { return d_storage; } //!< Wire format, without copying
 
 private:
+  friend class DNSNameView;
+
   string_t d_storage;
+  mutable std::atomic<uint32_t> d_hash{0}; //!< 0 if not computed yet (or if the hash happens to be 0)
+
+  void invalidateHash() { d_hash.store(0, std::memory_order_relaxed); }
 
   void packetParser(const char* p, int len, int offset, bool uncompress, uint16_t* qtype, uint16_t* qclass, unsigned int* consumed, int depth, uint16_t minOffset);
   static std::string escapeLabel(const std::string& orig);
@@ -180,6 +376,42 @@ inline bool DNSName::canonCompare(const DNSName& rhs) const
 }
 
 
+/* A name in wire format inside a buffer, usually a packet, that can be compared to and hashed like a
+   DNSName without copying it into one. Compression is not supported, which is fine for the question.
+   The buffer has to outlive the view. */
+class DNSNameView
+{
+public:
+  //! throws std::range_error if there is no valid uncompressed name at offset
+  DNSNameView(const char* data, size_t len, size_t offset);
+
+  size_t wirelength() const { return d_len; }
+  const char* data() const { return d_data; }
+  size_t hash(size_t init=0) const //!< same value as DNSName::hash()
+  {
+    return burtleCI((const unsigned char*)d_data, d_len, init);
+  }
+  bool operator==(const DNSName& rhs) const;
+  bool operator!=(const DNSName& rhs) const { return !(*this == rhs); }
+  bool isPartOf(const DNSName& parent) const;
+  unsigned int countLabels() const;
+  DNSName toDNSName() const;
+
+private:
+  const char* d_data;
+  size_t d_len;
+};
+
+inline bool operator==(const DNSName& lhs, const DNSNameView& rhs)
+{
+  return rhs == lhs;
+}
+
+inline bool operator!=(const DNSName& lhs, const DNSNameView& rhs)
+{
+  return !(rhs == lhs);
+}
+
 struct CanonDNSNameCompare: public std::binary_function<DNSName, DNSName, bool>
 {
   bool operator()(const DNSName&a, const DNSName& b) const
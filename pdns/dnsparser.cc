@@ -306,6 +306,194 @@ void MOADNSParser::init(const char *packet, unsigned int len)
 }
 
 
+void LazyMOADNSParser::init(size_t len)
+{
+  if(len < sizeof(dnsheader))
+    throw MOADNSException("Packet shorter than minimal header");
+  if(len > std::numeric_limits<uint16_t>::max())
+    throw MOADNSException("Packet too large");
+  d_len = len;
+
+  memcpy(&d_header, d_packet, sizeof(dnsheader));
+
+  if(d_header.opcode != Opcode::Query && d_header.opcode != Opcode::Notify && d_header.opcode != Opcode::Update)
+    throw MOADNSException("Can't parse non-query packet with opcode="+ std::to_string(d_header.opcode));
+
+  d_header.qdcount=ntohs(d_header.qdcount);
+  d_header.ancount=ntohs(d_header.ancount);
+  d_header.nscount=ntohs(d_header.nscount);
+  d_header.arcount=ntohs(d_header.arcount);
+
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(d_packet);
+  size_t pos = sizeof(dnsheader); // not uint16_t, that would wrap around on a 64k packet and never reach d_len
+  unsigned int n = 0;
+  bool validPacket = false;
+  try {
+    d_qtype = d_qclass = 0;
+
+    for(n=0; n < d_header.qdcount; ++n) {
+      unsigned int consumed;
+      d_qname = DNSName(d_packet, d_len, pos, true, &d_qtype, &d_qclass, &consumed, sizeof(dnsheader));
+      pos += consumed + 4;
+    }
+
+    validPacket = true;
+    const unsigned int total = d_header.ancount + d_header.nscount + d_header.arcount;
+    if(total > s_inlineEntries)
+      d_overflow.reserve(total - s_inlineEntries);
+
+    for(n=0; n < total; ++n) {
+      Entry entry;
+      if(n < d_header.ancount)
+        entry.d_place = DNSResourceRecord::ANSWER;
+      else if(n < d_header.ancount + d_header.nscount)
+        entry.d_place = DNSResourceRecord::AUTHORITY;
+      else
+        entry.d_place = DNSResourceRecord::ADDITIONAL;
+
+      entry.d_nameoffset = pos;
+      pos = skipName(pos);
+      if(pos + sizeof(dnsrecordheader) > d_len)
+        throw std::out_of_range("record header extends beyond end of packet");
+
+      entry.d_type = (p[pos] << 8) | p[pos+1];
+      entry.d_class = (p[pos+2] << 8) | p[pos+3];
+      entry.d_ttl = (uint32_t(p[pos+4]) << 24) | (uint32_t(p[pos+5]) << 16) | (uint32_t(p[pos+6]) << 8) | p[pos+7];
+      entry.d_rdatalen = (p[pos+8] << 8) | p[pos+9];
+      pos += sizeof(dnsrecordheader);
+
+      if(pos + entry.d_rdatalen > d_len)
+        throw std::out_of_range("rdata extends beyond end of packet");
+      entry.d_rdataoffset = pos;
+      pos += entry.d_rdatalen;
+
+      if(entry.d_type == QType::TSIG && entry.d_class == 0xff)
+        d_tsigPos = entry.d_nameoffset;
+
+      addEntry(entry);
+    }
+  }
+  catch(std::out_of_range &re) {
+    if(validPacket && d_header.tc) { // same leniency for truncated packets as MOADNSParser
+      if(n < d_header.ancount) {
+        d_header.ancount=n; d_header.nscount = d_header.arcount = 0;
+      }
+      else if(n < d_header.ancount + d_header.nscount) {
+        d_header.nscount = n - d_header.ancount; d_header.arcount=0;
+      }
+      else {
+        d_header.arcount = n - d_header.ancount - d_header.nscount;
+      }
+    }
+    else {
+      throw MOADNSException("Error parsing packet of "+std::to_string(len)+" bytes (rd="+
+                            std::to_string(d_header.rd)+
+                            "), out of bounds: "+string(re.what()));
+    }
+  }
+  catch(std::range_error &re) {
+    throw MOADNSException("Error parsing packet of "+std::to_string(len)+" bytes, bad question: "+string(re.what()));
+  }
+}
+
+//! Returns the position just past the (possibly compressed) name at pos, without decoding it
+size_t LazyMOADNSParser::skipName(size_t pos) const
+{
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(d_packet);
+  for(;;) {
+    if(pos >= d_len)
+      throw std::out_of_range("name extends beyond end of packet");
+    uint8_t labellen = p[pos];
+    if(labellen == 0)
+      return pos + 1;
+    if((labellen & 0xc0) == 0xc0) {
+      if(pos + 2 > d_len)
+        throw std::out_of_range("compression pointer extends beyond end of packet");
+      return pos + 2;
+    }
+    if(labellen & 0xc0)
+      throw std::out_of_range("invalid label length "+std::to_string(labellen));
+    pos += labellen + 1;
+  }
+}
+
+void LazyMOADNSParser::addEntry(const Entry& entry)
+{
+  if(d_count < s_inlineEntries)
+    d_inline[d_count] = entry;
+  else
+    d_overflow.push_back(entry);
+  d_count++;
+}
+
+DNSName LazyMOADNSParser::getName(size_t n) const
+{
+  if(n >= d_count)
+    throw std::out_of_range("record "+std::to_string(n)+" does not exist, packet has "+std::to_string(d_count));
+  try {
+    return DNSName(d_packet, d_len, (*this)[n].d_nameoffset, true, 0, 0, 0, sizeof(dnsheader));
+  }
+  catch(std::range_error& re) {
+    throw MOADNSException("Error parsing name of record "+std::to_string(n)+": "+string(re.what()));
+  }
+}
+
+shared_ptr<DNSRecordContent> LazyMOADNSParser::getContent(size_t n) const
+{
+  if(n >= d_count)
+    throw std::out_of_range("record "+std::to_string(n)+" does not exist, packet has "+std::to_string(d_count));
+
+  if(d_content.empty())
+    d_content.assign(d_packet + sizeof(dnsheader), d_packet + d_len);
+
+  const Entry& entry = (*this)[n];
+  DNSRecord dr;
+  dr.d_place = entry.d_place;
+  dr.d_type = entry.d_type;
+  dr.d_class = entry.d_class;
+  dr.d_ttl = entry.d_ttl;
+  dr.d_clen = entry.d_rdatalen;
+
+  PacketReader pr(d_content);
+  pr.d_pos = entry.d_rdataoffset - sizeof(dnsheader) - sizeof(dnsrecordheader);
+  struct dnsrecordheader ah;
+  try {
+    pr.getDnsrecordheader(ah); // sets up the rdata bounds for the record parsers
+    return std::shared_ptr<DNSRecordContent>(DNSRecordContent::mastermake(dr, pr, d_header.opcode));
+  }
+  catch(std::out_of_range& re) {
+    throw MOADNSException("Error parsing content of record "+std::to_string(n)+", out of bounds: "+string(re.what()));
+  }
+}
+
+DNSRecord LazyMOADNSParser::getRecord(size_t n) const
+{
+  const Entry& entry = (*this)[n];
+  DNSRecord dr;
+  dr.d_name = getName(n);
+  dr.d_place = entry.d_place;
+  dr.d_type = entry.d_type;
+  dr.d_class = entry.d_class;
+  dr.d_ttl = entry.d_ttl;
+  dr.d_clen = entry.d_rdatalen;
+  dr.d_content = getContent(n);
+  return dr;
+}
+
+void LazyMOADNSParser::setTTL(size_t n, uint32_t ttl)
+{
+  if(!d_writable)
+    throw std::logic_error("LazyMOADNSParser::setTTL() called on a parser over a const packet");
+  if(n >= d_count)
+    throw std::out_of_range("record "+std::to_string(n)+" does not exist, packet has "+std::to_string(d_count));
+
+  Entry& entry = n < s_inlineEntries ? d_inline[n] : d_overflow[n - s_inlineEntries];
+  uint32_t nttl = htonl(ttl);
+  // the TTL sits between the class and the rdlength, right in front of the rdata
+  memcpy(d_writable + entry.d_rdataoffset - sizeof(uint16_t) - sizeof(nttl), &nttl, sizeof(nttl));
+  entry.d_ttl = ttl;
+}
+
 void PacketReader::getDnsrecordheader(struct dnsrecordheader &ah)
 {
   unsigned int n;
@@ -377,6 +377,76 @@ private:
   uint16_t d_tsigPos;
 };
 
+/** Parses a packet like MOADNSParser, but only indexes the records: for each RR we note where its name and
+    rdata live, plus the type, class and TTL. No DNSRecordContent (nor owner DNSName) is built until asked for
+    with getName(), getContent() or getRecord(). The packet is NOT copied, so it must outlive the parser.
+
+    When constructed from a non-const buffer, setTTL() rewrites TTLs in the packet itself. */
+class LazyMOADNSParser : public boost::noncopyable
+{
+public:
+  struct Entry
+  {
+    uint16_t d_nameoffset;  //!< offset of the owner name, from the start of the packet
+    uint16_t d_rdataoffset; //!< offset of the rdata, from the start of the packet
+    uint16_t d_rdatalen;
+    uint16_t d_type;
+    uint16_t d_class;
+    uint32_t d_ttl;
+    DNSResourceRecord::Place d_place;
+  };
+
+  LazyMOADNSParser(const char* packet, size_t len) : d_packet(packet), d_writable(nullptr)
+  {
+    init(len);
+  }
+
+  LazyMOADNSParser(char* packet, size_t len) : d_packet(packet), d_writable(packet)
+  {
+    init(len);
+  }
+
+  DNSName d_qname;
+  uint16_t d_qclass, d_qtype;
+  dnsheader d_header;   //!< in host byte order, like MOADNSParser's
+
+  size_t size() const
+  {
+    return d_count;
+  }
+
+  const Entry& operator[](size_t n) const
+  {
+    return n < s_inlineEntries ? d_inline[n] : d_overflow.at(n - s_inlineEntries);
+  }
+
+  DNSName getName(size_t n) const;
+  shared_ptr<DNSRecordContent> getContent(size_t n) const;
+  DNSRecord getRecord(size_t n) const;  //!< fully materialised, as MOADNSParser would have built it
+  void setTTL(size_t n, uint32_t ttl);  //!< throws if the parser was constructed from a const buffer
+
+  uint16_t getTSIGPos() const
+  {
+    return d_tsigPos;
+  }
+
+private:
+  static const size_t s_inlineEntries = 16;
+
+  void init(size_t len);
+  size_t skipName(size_t pos) const;
+  void addEntry(const Entry& entry);
+
+  const char* d_packet;
+  char* d_writable;
+  uint16_t d_len;
+  uint16_t d_tsigPos{0};
+  size_t d_count{0};
+  Entry d_inline[s_inlineEntries];
+  vector<Entry> d_overflow;
+  mutable vector<uint8_t> d_content; //!< packet minus header, only filled when a PacketReader is needed
+};
+
 string simpleCompress(const string& label, const string& root="");
 void ageDNSPacket(char* packet, size_t length, uint32_t seconds);
 void ageDNSPacket(std::string& packet, uint32_t seconds);
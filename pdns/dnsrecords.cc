@@ -546,6 +546,33 @@ bool getEDNSOpts(const MOADNSParser& mdp, EDNSOpts* eo)
   return false;
 }
 
+bool getEDNSOpts(const LazyMOADNSParser& mdp, EDNSOpts* eo)
+{
+  eo->d_Z=0;
+  // like the MOADNSParser version above, the first OPT record in the additional section wins
+  for(size_t n = mdp.d_header.ancount + mdp.d_header.nscount; n < mdp.size(); ++n) {
+    const LazyMOADNSParser::Entry& entry = mdp[n];
+    if(entry.d_place != DNSResourceRecord::ADDITIONAL || entry.d_type != QType::OPT)
+      continue;
+
+    eo->d_packetsize=entry.d_class;
+
+    EDNS0Record stuff;
+    uint32_t ttl=ntohl(entry.d_ttl);
+    memcpy(&stuff, &ttl, sizeof(stuff));
+
+    eo->d_extRCode=stuff.extRCode;
+    eo->d_version=stuff.version;
+    eo->d_Z = ntohs(stuff.Z);
+    auto orc = std::dynamic_pointer_cast<OPTRecordContent>(mdp.getContent(n));
+    if(!orc)
+      return false;
+    orc->getData(eo->d_options);
+    return true;
+  }
+  return false;
+}
+
 DNSRecord makeOpt(int udpsize, int extRCode, int Z)
 {
   EDNS0Record stuff;
@@ -717,6 +717,7 @@ struct EDNSOpts
 
 class MOADNSParser;
 bool getEDNSOpts(const MOADNSParser& mdp, EDNSOpts* eo);
+bool getEDNSOpts(const LazyMOADNSParser& mdp, EDNSOpts* eo);
 DNSRecord makeOpt(int udpsize, int extRCode, int Z);
 void reportBasicTypes();
 void reportOtherTypes();
@@ -140,4 +140,6 @@ string calculateHMAC(const std::string& key, const std::string& text, TSIGHashEn
 string makeTSIGMessageFromTSIGPacket(const string& opacket, unsigned int tsigoffset, const DNSName& keyname, const TSIGRecordContent& trc, const string& previous, bool timersonly, unsigned int dnsHeaderOffset=0);
 void addTSIG(DNSPacketWriter& pw, TSIGRecordContent* trc, const DNSName& tsigkeyname, const string& tsigsecret, const string& tsigprevious, bool timersonly);
 uint64_t signatureCacheSize(const std::string& str);
+size_t dumpSignatureCache(const std::string& fname);
+size_t loadSignatureCache(const std::string& fname);
 #endif
@@ -31,8 +31,30 @@
 #include "lock.hh"
 #include "arguments.hh"
 #include "statbag.hh"
+#include "misc.hh"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/sequenced_index.hpp>
+#include <boost/multi_index/member.hpp>
+using namespace ::boost::multi_index;
 extern StatBag S;
 
+/* Signatures are made for a window of a week, and are valid from a week before to two weeks after that
+   window, so an RRSIG handed out has at least two weeks to go. Instead of having all windows start at the same moment, which would make every cached
+   signature go stale at once, each RRset gets its own offset within the week. The offset is derived
+   from the name and type, so it is the same across restarts and across servers. */
+static uint32_t getSignatureWindowStart(const DNSName& qname, uint16_t qtype)
+{
+  uint32_t offset = qname.hash(qtype) % (7*86400);
+  uint32_t start = time(0) - offset;
+  start -= (start % (7*86400));
+  return start + offset;
+}
+
 /* this is where the RRSIGs begin, keys are retrieved,
    but the actual signing happens in fillOutRRSIG */
 int getRRSIGsForRRSET(DNSSECKeeper& dk, const DNSName& signer, const DNSName signQName, uint16_t signQType, uint32_t signTTL,
@@ -40,14 +62,14 @@ int getRRSIGsForRRSET(DNSSECKeeper& dk, const DNSName& signer, const DNSName sig
 {
   if(toSign.empty())
     return -1;
-  uint32_t startOfWeek = getStartOfWeek();
+  uint32_t startOfWindow = getSignatureWindowStart(signQName, signQType);
   RRSIGRecordContent rrc;
   rrc.d_type=signQType;
 
   rrc.d_labels=signQName.countLabels()-signQName.isWildcard();
   rrc.d_originalttl=signTTL; 
-  rrc.d_siginception=startOfWeek - 7*86400; // XXX should come from zone metadata
-  rrc.d_sigexpire=startOfWeek + 14*86400;
+  rrc.d_siginception=startOfWindow - 7*86400; // XXX should come from zone metadata
+  rrc.d_sigexpire=startOfWindow + 21*86400;
   rrc.d_signer = signer;
   rrc.d_tag = 0;
 
@@ -104,17 +126,208 @@ void addSignature(DNSSECKeeper& dk, UeberBackend& db, const DNSName& signer, con
   toSign.clear();
 }
 
-static pthread_rwlock_t g_signatures_lock = PTHREAD_RWLOCK_INITIALIZER;
-typedef map<pair<string, string>, string> signaturecache_t;
-static signaturecache_t g_signatures;
-static int g_cacheweekno;
+/* The signature cache is split in shards, each with its own lock, LRU list and expiry index.
+   An entry is useful until the end of the signing window of the RRSIG it holds, after which
+   getRRSIGsForRRSET() moves on to a new window and the cache key changes. */
+struct SignatureCacheEntry
+{
+  std::string d_key;
+  std::string d_signature;
+  uint32_t d_ttd;
+};
+
+typedef multi_index_container<
+  SignatureCacheEntry,
+  indexed_by <
+    hashed_unique<member<SignatureCacheEntry, std::string, &SignatureCacheEntry::d_key> >,
+    sequenced<>,
+    ordered_non_unique<member<SignatureCacheEntry, uint32_t, &SignatureCacheEntry::d_ttd> >
+  >
+> signaturecache_t;
+
+struct SignatureCacheShard
+{
+  SignatureCacheShard() : d_lastPurge(0)
+  {
+    pthread_mutex_init(&d_lock, 0);
+  }
+  ~SignatureCacheShard()
+  {
+    pthread_mutex_destroy(&d_lock);
+  }
+
+  pthread_mutex_t d_lock;
+  signaturecache_t d_map;
+  time_t d_lastPurge;
+};
+
+static const unsigned int s_signatureCacheShards = 32;
+static SignatureCacheShard g_signatures[s_signatureCacheShards];
+
+static SignatureCacheShard& getSignatureCacheShard(const std::string& key)
+{
+  return g_signatures[burtle((const unsigned char*)key.c_str(), key.size(), 0) % s_signatureCacheShards];
+}
+
+static size_t getMaxSignatureCacheShardSize()
+{
+  const static size_t maxcachesize = ::arg().asNum("max-signature-cache-entries", INT_MAX);
+  return std::max(maxcachesize / s_signatureCacheShards, (size_t)1);
+}
+
+static bool getCachedSignature(const std::string& key, std::string& signature)
+{
+  SignatureCacheShard& shard = getSignatureCacheShard(key);
+  Lock l(&shard.d_lock);
+  auto iter = shard.d_map.find(key);
+  if(iter == shard.d_map.end())
+    return false;
+
+  signature = iter->d_signature;
+  shard.d_map.get<1>().relocate(shard.d_map.get<1>().end(), shard.d_map.project<1>(iter));
+  return true;
+}
+
+static void cacheSignature(const std::string& key, const std::string& signature, uint32_t ttd, time_t now)
+{
+  SignatureCacheShard& shard = getSignatureCacheShard(key);
+  const size_t maxShardSize = getMaxSignatureCacheShardSize();
+
+  Lock l(&shard.d_lock);
+  if(now - shard.d_lastPurge >= 60) {
+    auto& ttdIndex = shard.d_map.get<2>();
+    ttdIndex.erase(ttdIndex.begin(), ttdIndex.upper_bound((uint32_t)now));
+    shard.d_lastPurge = now;
+  }
+
+  SignatureCacheEntry entry;
+  entry.d_key = key;
+  entry.d_signature = signature;
+  entry.d_ttd = ttd;
+
+  auto res = shard.d_map.insert(entry);
+  if(!res.second) {
+    shard.d_map.replace(res.first, entry);
+    shard.d_map.get<1>().relocate(shard.d_map.get<1>().end(), shard.d_map.project<1>(res.first));
+  }
+
+  auto& lru = shard.d_map.get<1>();
+  while(lru.size() > maxShardSize)
+    lru.pop_front();
+}
 
 AtomicCounter* g_signatureCount;
 
 uint64_t signatureCacheSize(const std::string& str)
 {
-  ReadLock l(&g_signatures_lock);
-  return g_signatures.size();
+  uint64_t ret = 0;
+  for(auto& shard : g_signatures) {
+    Lock l(&shard.d_lock);
+    ret += shard.d_map.size();
+  }
+  return ret;
+}
+
+static const char s_signatureCacheMagic[] = "PDNSSC01";
+
+/* On-disk format: the 8 byte magic, followed by one record per entry consisting of the
+   ttd (32 bits), key length and signature length (16 bits each, all in network order),
+   then the key and the signature */
+size_t dumpSignatureCache(const std::string& fname)
+{
+  const std::string tmpname = fname + ".tmp";
+  FILE* fp = fopen(tmpname.c_str(), "w");
+  if(!fp)
+    throw PDNSException("Unable to open '"+tmpname+"' for writing: "+stringerror());
+
+  size_t count = 0;
+  bool ok = fwrite(s_signatureCacheMagic, 1, 8, fp) == 8;
+  const uint32_t now = time(0);
+  for(auto& shard : g_signatures) {
+    Lock l(&shard.d_lock);
+    for(const auto& entry : shard.d_map.get<1>()) {
+      if(!ok)
+        break;
+      if(entry.d_ttd <= now || entry.d_key.size() > 65535 || entry.d_signature.size() > 65535)
+        continue;
+      uint32_t ttd = htonl(entry.d_ttd);
+      uint16_t keylen = htons(entry.d_key.size());
+      uint16_t siglen = htons(entry.d_signature.size());
+      ok = fwrite(&ttd, sizeof(ttd), 1, fp) == 1 &&
+        fwrite(&keylen, sizeof(keylen), 1, fp) == 1 &&
+        fwrite(&siglen, sizeof(siglen), 1, fp) == 1 &&
+        fwrite(entry.d_key.c_str(), 1, entry.d_key.size(), fp) == entry.d_key.size() &&
+        fwrite(entry.d_signature.c_str(), 1, entry.d_signature.size(), fp) == entry.d_signature.size();
+      count++;
+    }
+  }
+
+  if(fclose(fp) != 0 || !ok) {
+    unlink(tmpname.c_str());
+    throw PDNSException("Unable to write signature cache to '"+tmpname+"'");
+  }
+  if(rename(tmpname.c_str(), fname.c_str()) < 0) {
+    unlink(tmpname.c_str());
+    throw PDNSException("Unable to rename '"+tmpname+"' to '"+fname+"': "+stringerror());
+  }
+  return count;
+}
+
+size_t loadSignatureCache(const std::string& fname)
+{
+  int fd = open(fname.c_str(), O_RDONLY);
+  if(fd < 0) {
+    if(errno == ENOENT)
+      return 0;
+    throw PDNSException("Unable to open '"+fname+"' for reading: "+stringerror());
+  }
+
+  struct stat st;
+  if(fstat(fd, &st) < 0) {
+    close(fd);
+    throw PDNSException("Unable to stat '"+fname+"': "+stringerror());
+  }
+  if(st.st_size < 8) {
+    close(fd);
+    return 0;
+  }
+
+  void* mapped = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(mapped == MAP_FAILED)
+    throw PDNSException("Unable to map '"+fname+"': "+stringerror());
+
+  const char* data = (const char*)mapped;
+  const size_t size = st.st_size;
+  if(memcmp(data, s_signatureCacheMagic, 8) != 0) {
+    munmap(mapped, size);
+    throw PDNSException("'"+fname+"' is not a signature cache file");
+  }
+
+  size_t count = 0;
+  const time_t now = time(0);
+  size_t pos = 8;
+  while(pos + 8 <= size) {
+    uint32_t ttd;
+    uint16_t keylen, siglen;
+    memcpy(&ttd, data + pos, sizeof(ttd));
+    memcpy(&keylen, data + pos + 4, sizeof(keylen));
+    memcpy(&siglen, data + pos + 6, sizeof(siglen));
+    ttd = ntohl(ttd);
+    keylen = ntohs(keylen);
+    siglen = ntohs(siglen);
+    pos += 8;
+    if(pos + keylen + siglen > size)
+      break;
+    if(ttd > now) {
+      cacheSignature(std::string(data + pos, keylen), std::string(data + pos + keylen, siglen), ttd, now);
+      count++;
+    }
+    pos += keylen + siglen;
+  }
+
+  munmap(mapped, size);
+  return count;
 }
 
 void fillOutRRSIG(DNSSECPrivateKey& dpk, const DNSName& signQName, RRSIGRecordContent& rrc, vector<shared_ptr<DNSRecordContent> >& toSign) 
@@ -128,35 +341,16 @@ void fillOutRRSIG(DNSSECPrivateKey& dpk, const DNSName& signQName, RRSIGRecordCo
   rrc.d_algorithm = drc.d_algorithm;
   
   string msg=getMessageForRRSET(signQName, rrc, toSign); // this is what we will hash & sign
-  pair<string, string> lookup(rc->getPubKeyHash(), pdns_md5sum(msg));  // this hash is a memory saving exercise
-  
-  bool doCache=1;
-  if(doCache)
-  {
-    ReadLock l(&g_signatures_lock);
-    signaturecache_t::const_iterator iter = g_signatures.find(lookup);
-    if(iter != g_signatures.end()) {
-      rrc.d_signature=iter->second;
-      return;
-    }
-    // else cerr<<"Miss!"<<endl;  
-  }
-  
+  string lookup = rc->getPubKeyHash() + pdns_md5sum(msg);  // this hash is a memory saving exercise
+
+  if(getCachedSignature(lookup, rrc.d_signature))
+    return;
+
   rrc.d_signature = rc->sign(msg);
   (*g_signatureCount)++;
-  if(doCache) {
-    /* we add some jitter here so not all your slaves start pruning their caches at the very same millisecond */
-    int weekno = (time(0) - dns_random(3600)) / (86400*7);  // we just spent milliseconds doing a signature, microsecond more won't kill us
-    const static int maxcachesize=::arg().asNum("max-signature-cache-entries", INT_MAX);
-
-    WriteLock l(&g_signatures_lock);
-    if(g_cacheweekno < weekno || g_signatures.size() >= (uint) maxcachesize) {  // blunt but effective (C) Habbie, mind04
-      L<<Logger::Warning<<"Cleared signature cache."<<endl;
-      g_signatures.clear();
-      g_cacheweekno = weekno;
-    }
-    g_signatures[lookup] = rrc.d_signature;
-  }
+
+  /* the signing window this RRSIG belongs to ends two weeks before it expires, after that we will not look it up again */
+  cacheSignature(lookup, rrc.d_signature, rrc.d_sigexpire - 14*86400, time(0));
 }
 
 static bool rrsigncomp(const DNSResourceRecord& a, const DNSResourceRecord& b)
@@ -6,9 +6,97 @@
 #include "dnsparser.hh"
 
 #include <limits.h>
+#include <pthread.h>
+
+DNSCompressionTable::DNSCompressionTable() : d_entries(64, Entry{0, 0, 0}), d_used(0), d_generation(1)
+{
+}
+
+void DNSCompressionTable::clear()
+{
+  if(++d_generation == 0) { // only after 65535 packets, so normally clearing is free
+    for(auto& entry : d_entries)
+      entry.generation = 0;
+    d_generation = 1;
+  }
+  d_used = 0;
+}
+
+void DNSCompressionTable::insert(uint32_t hash, uint16_t offset)
+{
+  if(2 * (d_used + 1) > d_entries.size())
+    grow();
+
+  const size_t mask = d_entries.size() - 1;
+  size_t n = hash & mask;
+  while(d_entries[n].generation == d_generation)
+    n = (n + 1) & mask;
+  d_entries[n] = Entry{hash, offset, d_generation};
+  d_used++;
+}
+
+void DNSCompressionTable::grow()
+{
+  vector<Entry> old(d_entries.size() * 2, Entry{0, 0, 0});
+  old.swap(d_entries);
+  d_used = 0;
+  for(const auto& entry : old)
+    if(entry.generation == d_generation)
+      insert(entry.hash, entry.offset);
+}
+
+/* Compression tables are handed from one writer to the next on the same thread, so the
+   table does not have to be allocated (and grown) again for every packet. */
+static pthread_key_t s_compressionTablesKey;
+static pthread_once_t s_compressionTablesOnce = PTHREAD_ONCE_INIT;
+
+static void freeCompressionTables(void* arg)
+{
+  auto tables = static_cast<vector<DNSCompressionTable*>*>(arg);
+  for(auto table : *tables)
+    delete table;
+  delete tables;
+}
+
+static void makeCompressionTablesKey()
+{
+  pthread_key_create(&s_compressionTablesKey, freeCompressionTables);
+}
+
+static vector<DNSCompressionTable*>* getCompressionTables()
+{
+  pthread_once(&s_compressionTablesOnce, makeCompressionTablesKey);
+  auto tables = static_cast<vector<DNSCompressionTable*>*>(pthread_getspecific(s_compressionTablesKey));
+  if(!tables) {
+    tables = new vector<DNSCompressionTable*>();
+    pthread_setspecific(s_compressionTablesKey, tables);
+  }
+  return tables;
+}
+
+static DNSCompressionTable* acquireCompressionTable()
+{
+  auto tables = getCompressionTables();
+  if(tables->empty())
+    return new DNSCompressionTable();
+  DNSCompressionTable* ret = tables->back();
+  tables->pop_back();
+  return ret;
+}
+
+static void releaseCompressionTable(DNSCompressionTable* table)
+{
+  auto tables = getCompressionTables();
+  if(tables->size() >= 4) { // more than this many writers at the same time is rare
+    delete table;
+    return;
+  }
+  table->clear();
+  tables->push_back(table);
+}
 
 DNSPacketWriter::DNSPacketWriter(vector<uint8_t>& content, const DNSName& qname, uint16_t  qtype, uint16_t qclass, uint8_t opcode)
-  : d_pos(0), d_content(content), d_qname(qname), d_canonic(false), d_lowerCase(false)
+  : d_pos(0), d_content(content), d_qname(qname), d_compression(acquireCompressionTable()), d_canonic(false), d_lowerCase(false)
 {
   d_content.clear();
   dnsheader dnsheader;
@@ -48,7 +136,6 @@ DNSPacketWriter::DNSPacketWriter(vector<uint8_t>& content, const DNSName& qname,
   memcpy(&*i, &qclass, 2);
 
   d_stuff=0xffff;
-  d_labelmap.reserve(16);
   d_truncatemarker=d_content.size();
   d_sor = 0;
   d_rollbackmarker = 0;
@@ -58,6 +145,11 @@ DNSPacketWriter::DNSPacketWriter(vector<uint8_t>& content, const DNSName& qname,
   d_recordplace = DNSResourceRecord::ANSWER;
 }
 
+DNSPacketWriter::~DNSPacketWriter()
+{
+  releaseCompressionTable(d_compression);
+}
+
 dnsheader* DNSPacketWriter::getHeader()
 {
   return reinterpret_cast<dnsheader*>(&*d_content.begin());
@@ -184,117 +276,106 @@ void DNSPacketWriter::xfrUnquotedText(const string& text, bool lenField)
   d_record.insert(d_record.end(), text.c_str(), text.c_str() + text.length());
 }
 
-/* FIXME400: check that this beats a map */
-DNSPacketWriter::lmap_t::iterator find(DNSPacketWriter::lmap_t& nmap, const DNSName& name)
+//! byte at 'pos' in the packet as it will be sent, -1 if that has not been written (yet)
+int DNSPacketWriter::byteAt(unsigned int pos) const
 {
-  DNSPacketWriter::lmap_t::iterator ret;
-  for(ret=nmap.begin(); ret != nmap.end(); ++ret)
-    if(ret->first == name)
-      break;
-  return ret;
+  if(pos < d_content.size())
+    return d_content[pos];
+  pos -= d_content.size();
+  if(pos < d_stuff) // the record header is not in d_record, but will be in front of it
+    return -1;
+  pos -= d_stuff;
+  if(pos < d_record.size())
+    return d_record[pos];
+  return -1;
 }
 
-// //! tokenize a label into parts, the parts describe a begin offset and an end offset
-// bool labeltokUnescape(labelparts_t& parts, const string& label)
-// {
-//   string::size_type epos = label.size(), lpos(0), pos;
-//   bool unescapedSomething = false;
-//   const char* ptr=label.c_str();
-
-//   parts.clear();
-
-//   for(pos = 0 ; pos < epos; ++pos) {
-//     if(ptr[pos]=='\\') {
-//       pos++;
-//       unescapedSomething = true;
-//       continue;
-//     }
-//     if(ptr[pos]=='.') {
-//       parts.push_back(make_pair(lpos, pos));
-//       lpos=pos+1;
-//     }
-//   }
-
-//   if(lpos < pos)
-//     parts.push_back(make_pair(lpos, pos));
-//   return unescapedSomething;
-// }
+//! if the packet has the name in wire format 'name' at 'pos', following compression pointers, case-insensitive
+bool DNSPacketWriter::nameIsAt(const char* name, uint16_t pos) const
+{
+  unsigned int current = pos;
+  unsigned int pointers = 0;
+  for(;;) {
+    int len = byteAt(current);
+    if(len < 0)
+      return false;
+    if((len & 0xc0) == 0xc0) {
+      int low = byteAt(current + 1);
+      if(low < 0 || ++pointers > 64)
+        return false;
+      current = ((len & 0x3f) << 8) | low;
+      continue;
+    }
+    if(len != (uint8_t)*name)
+      return false;
+    if(!len)
+      return true;
+    for(int n = 1; n <= len; ++n) {
+      int c = byteAt(current + n);
+      if(c < 0 || dns_tolower(c) != dns_tolower(name[n]))
+        return false;
+    }
+    name += len + 1;
+    current += len + 1;
+  }
+}
 
 // this is the absolute hottest function in the pdns recursor
 void DNSPacketWriter::xfrName(const DNSName& name, bool compress, bool)
 {
-  //cerr<<"xfrName: name=["<<name.toString()<<"] compress="<<compress<<endl;
-  // string label = d_lowerCase ? toLower(Label) : Label;
-  // FIXME400: we ignore d_lowerCase for now
-  // cerr<<"xfrName writing ["<<name.toString()<<"]"<<endl;
-  std::vector<std::string> parts = name.getRawLabels();
-  // labelparts_t parts;
-  // cerr<<"labelcount: "<<parts.size()<<endl;
-
   if(d_canonic)
     compress=false;
 
-  if(!parts.size()) { // otherwise we encode '..'
+  if(name.empty() || name.isRoot()) { // otherwise we encode '..'
     d_record.push_back(0);
     return;
   }
 
+  const string wire = name.toDNSString();
+
   // d_stuff is amount of stuff that is yet to be written out - the dnsrecordheader for example
   unsigned int pos=d_content.size() + d_record.size() + d_stuff;
-  // bool deDot = labellen && (label[labellen-1]=='.'); // make sure we don't store trailing dots in the labelmap
-
   unsigned int startRecordSize=d_record.size();
-  unsigned int startPos;
-
-  DNSName towrite = name;
-  /* FIXME400: if we are not compressing, there is no reason to work per-label */
-  for(auto &label: parts) {
-    if(d_lowerCase) label=toLower(label);
-    //cerr<<"xfrName labelpart ["<<label<<"], left to write ["<<towrite.toString()<<"]"<<endl;
-
-    auto li=d_labelmap.end();
-    // see if we've written out this domain before
-    //cerr<<"compress="<<compress<<", searching? for compression pointer to '"<<towrite.toString()<<"', "<<d_labelmap.size()<<" cmp-records"<<endl;
-    if(compress && (li=find(d_labelmap, towrite))!=d_labelmap.end()) {
-      //cerr<<"doing compression, my label=["<<label<<"] found match ["<<li->first.toString()<<"]"<<endl;
-      //cerr<<"\tFound a compression pointer to '"<<towrite.toString()<<"': "<<li->second<<endl;
-      if (d_record.size() - startRecordSize + label.size() > 253) // chopped does not include a length octet for the first label and the root label
-        throw MOADNSException("DNSPacketWriter::xfrName() found overly large (compressed) name");
-      uint16_t offset=li->second;
-      offset|=0xc000;
-      d_record.push_back((char)(offset >> 8));
-      d_record.push_back((char)(offset & 0xff));
-      goto out;                                 // skip trailing 0 in case of compression
-    }
 
-    if(li==d_labelmap.end() && pos< 16384) {
-      //      cerr<<"\tStoring a compression pointer to '"<<chopped<<"': "<<pos<<endl;
-      d_labelmap.push_back(make_pair(towrite, pos));                       //  if untrue, we need to count - also, don't store offsets > 16384, won't work
-      //cerr<<"stored ["<<towrite.toString()<<"] at pos "<<pos<<endl;
+  /* Every suffix of the name, starting at each label, is looked up by a hash of its wire format.
+     Offsets found are checked against the packet, so hash collisions and offsets that went
+     stale through rollback() or truncate() are harmless. */
+  for(size_t labelpos = 0; wire[labelpos]; ) {
+    const char* suffix = wire.c_str() + labelpos;
+    uint8_t labelsize = *suffix;
+    uint32_t hash = burtleCI((const unsigned char*)suffix, wire.size() - labelpos, 0);
+
+    if(compress) {
+      int offset = d_compression->find(hash, [this, suffix](uint16_t candidate) { return nameIsAt(suffix, candidate); });
+      if(offset >= 0) {
+        if (d_record.size() - startRecordSize + labelsize > 253) // chopped does not include a length octet for the first label and the root label
+          throw MOADNSException("DNSPacketWriter::xfrName() found overly large (compressed) name");
+        offset|=0xc000;
+        d_record.push_back((char)(offset >> 8));
+        d_record.push_back((char)(offset & 0xff));
+        return;                                 // skip trailing 0 in case of compression
+      }
     }
 
-    startPos=pos;
+    if(pos < 16384) // don't store offsets > 16384, won't work
+      d_compression->insert(hash, pos);
 
-    char labelsize=label.size();
-    //cerr<<"labelsize = "<<int(labelsize)<<" for label ["<<label<<"]"<<endl;
+    if(labelsize > 63)
+      throw MOADNSException("DNSPacketWriter::xfrName() found overly large label in name");
     d_record.push_back(labelsize);
-    unsigned int len=d_record.size();
-    d_record.resize(len + labelsize);
-    memcpy(((&*d_record.begin()) + len), label.c_str(), labelsize); // FIXME400 do not want memcpy
+    if(d_lowerCase) {
+      for(unsigned int n = 1; n <= labelsize; ++n)
+        d_record.push_back(dns_tolower(suffix[n]));
+    }
+    else
+      d_record.insert(d_record.end(), suffix + 1, suffix + 1 + labelsize);
     pos+=labelsize+1;
-
-    if(pos - startPos == 1)
-      throw MOADNSException("DNSPacketWriter::xfrName() found empty label in the middle of name");
-    if(pos - startPos > 64)
-      throw MOADNSException("DNSPacketWriter::xfrName() found overly large label in name");
-    towrite.chopOff();   /* FIXME400: iterating the label vector while keeping this chopoff in sync is a hack */
+    labelpos+=labelsize+1;
   }
   d_record.push_back(0); // insert root label
 
   if (d_record.size() - startRecordSize > 255)
     throw MOADNSException("DNSPacketWriter::xfrName() found overly large name");
-
- out:;
 }
 
 void DNSPacketWriter::xfrBlob(const string& blob, int  )
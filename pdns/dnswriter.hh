@@ -34,14 +34,50 @@
 
 */
 
+/** The name compression dictionary of a DNSPacketWriter. It maps a hash of every name (suffix) written
+    to its offset in the packet, without keeping a copy of the name - the caller verifies candidates
+    against the packet itself. Cleared in constant time, so it can be reused for the next packet. */
+class DNSCompressionTable
+{
+public:
+  DNSCompressionTable();
+
+  void clear();
+  void insert(uint32_t hash, uint16_t offset);
+
+  //! offset of the first entry with this hash for which matches(offset) is true, -1 if there is none
+  template<typename T> int find(uint32_t hash, const T& matches) const
+  {
+    const size_t mask = d_entries.size() - 1;
+    for(size_t n = hash & mask; d_entries[n].generation == d_generation; n = (n + 1) & mask) {
+      if(d_entries[n].hash == hash && matches(d_entries[n].offset))
+        return d_entries[n].offset;
+    }
+    return -1;
+  }
+
+private:
+  struct Entry
+  {
+    uint32_t hash;
+    uint16_t offset;
+    uint16_t generation; //!< entries of an older generation are unused
+  };
+
+  void grow();
+
+  vector<Entry> d_entries;
+  size_t d_used;
+  uint16_t d_generation;
+};
+
 class DNSPacketWriter : public boost::noncopyable
 {
 
 public:
-  typedef vector<pair<DNSName, uint16_t> > lmap_t;
-
   //! Start a DNS Packet in the vector passed, with question qname, qtype and qclass
   DNSPacketWriter(vector<uint8_t>& content, const DNSName& qname, uint16_t  qtype, uint16_t qclass=QClass::IN, uint8_t opcode=0);
+  ~DNSPacketWriter();
 
   /** Start a new DNS record within this packet for namq, qtype, ttl, class and in the requested place. Note that packets can only be written in natural order -
       ANSWER, AUTHORITY, ADDITIONAL */
@@ -115,6 +151,9 @@ public:
   bool eof() { return true; } // we don't know how long the record should be
 
 private:
+  int byteAt(unsigned int pos) const;
+  bool nameIsAt(const char* name, uint16_t pos) const;
+
   // We declare 1 uint_16 in the public section, these 3 align on a 8-byte boundry
   uint16_t d_stuff;
   uint16_t d_sor;
@@ -124,7 +163,7 @@ private:
   vector <uint8_t> d_record;
   DNSName d_qname;
   DNSName d_recordqname;
-  lmap_t d_labelmap;
+  DNSCompressionTable* d_compression;
 
   uint32_t d_recordttl;
   uint16_t d_recordqtype, d_recordqclass;
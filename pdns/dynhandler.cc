@@ -380,6 +380,29 @@ string DLListZones(const vector<string>&parts, Utility::pid_t ppid)
   return ret.str();
 }
 
+string DLTransferStatsHandler(const vector<string>&parts, Utility::pid_t ppid)
+{
+  extern CommunicatorClass Communicator;
+  auto stats = Communicator.getTransferStats();
+
+  DNSName filter;
+  if(parts.size() > 1)
+    filter = DNSName(parts[1]);
+
+  ostringstream ret;
+  time_t now = time(0);
+  for(const auto& zone : stats) {
+    if(!filter.empty() && zone.first != filter)
+      continue;
+    const auto& ts = zone.second;
+    ret<<zone.first<<" last="<<(ts.incremental ? "IXFR" : "AXFR")<<" serial="<<ts.serial<<" records="<<ts.records<<" msec="<<ts.usec/1000;
+    ret<<" age="<<(now - ts.when)<<" ixfrs="<<ts.ixfrs<<" axfrs="<<ts.axfrs<<endl;
+  }
+  if(!filter.empty() && ret.str().empty())
+    return "No transfers of '"+filter.toString()+"' recorded";
+  return ret.str();
+}
+
 string DLPolicy(const vector<string>&parts, Utility::pid_t ppid)
 {
   if(LPE) {
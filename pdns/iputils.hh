@@ -30,6 +30,7 @@
 #include <stdio.h>
 #include <functional>
 #include <bitset>
+#include <deque>
 #include "pdnsexception.hh"
 #include "misc.hh"
 #include <sys/socket.h>
@@ -455,9 +456,9 @@ private:
   uint8_t d_bits;
 };
 
-/** Per-bit binary tree map implementation with <Netmask,T> pair.
+/** Path-compressed binary tree map implementation with <Netmask,T> pair.
  *
- * This is an binary tree implementation for storing attributes for IPv4 and IPv6 prefixes.
+ * This is a binary tree (Patricia trie) implementation for storing attributes for IPv4 and IPv6 prefixes.
  * The most simple use case is simple NetmaskTree<bool> used by NetmaskGroup, which only
  * wants to know if given IP address is matched in the prefixes stored.
  *
@@ -466,7 +467,10 @@ private:
  *
  * You can store IPv4 and IPv6 addresses to same tree, separate payload storage is kept per AFI.
  *
- * To erase something copy values to new tree sans the value you want to erase.
+ * Nodes only exist where prefixes branch or carry a value, so a /24 costs at most two nodes
+ * instead of 24. All nodes live in a single vector and refer to each other by index, which keeps
+ * a lookup to a handful of cache lines. Values are kept apart from the nodes and never move, so
+ * pointers returned by insert() and lookup() stay valid until the value is erased.
  *
  * Use swap if you need to move the tree to another NetmaskTree instance, it is WAY faster
  * than using copy ctor or assigment operator, since it moves the nodes and tree root to
@@ -484,41 +488,115 @@ public:
   typedef size_t size_type;
 
 private:
+  /** Address bits, IPv4 addresses use the top 32 bits of d_high. Internal use only.
+    */
+  struct Bits {
+    uint64_t d_high;
+    uint64_t d_low;
+
+    explicit Bits(const ComboAddress& ca) {
+      if (ca.sin4.sin_family == AF_INET) {
+        d_high = static_cast<uint64_t>(be32toh(ca.sin4.sin_addr.s_addr)) << 32;
+        d_low = 0;
+      } else {
+        uint64_t addr[2];
+        memcpy(addr, ca.sin6.sin6_addr.s6_addr, sizeof(addr));
+        d_high = be64toh(addr[0]);
+        d_low = be64toh(addr[1]);
+      }
+    }
+
+    //<! Value of bit n, counted from the most significant one
+    unsigned int bit(unsigned int n) const {
+      return n < 64 ? (d_high >> (63 - n)) & 1 : (d_low >> (127 - n)) & 1;
+    }
+
+    //<! Clears everything past the first n bits
+    void truncate(unsigned int n) {
+      d_high &= highMask(n);
+      d_low &= lowMask(n);
+    }
+
+    //<! Do we match other on the first n bits?
+    bool matches(const Bits& other, unsigned int n) const {
+      return ((d_high ^ other.d_high) & highMask(n)) == 0 && ((d_low ^ other.d_low) & lowMask(n)) == 0;
+    }
+
+    //<! Number of leading bits we have in common with other, at most limit
+    unsigned int common(const Bits& other, unsigned int limit) const {
+      unsigned int ret;
+      uint64_t diff = d_high ^ other.d_high;
+      if (diff)
+        ret = __builtin_clzll(diff);
+      else {
+        diff = d_low ^ other.d_low;
+        ret = diff ? 64 + __builtin_clzll(diff) : 128;
+      }
+      return std::min(ret, limit);
+    }
+
+    static uint64_t highMask(unsigned int n) {
+      return n == 0 ? 0 : (n >= 64 ? ~0ULL : ~0ULL << (64 - n));
+    }
+
+    static uint64_t lowMask(unsigned int n) {
+      return n <= 64 ? 0 : (n >= 128 ? ~0ULL : ~0ULL << (128 - n));
+    }
+  };
+
   /** Single node in tree, internal use only.
     */
-  class TreeNode : boost::noncopyable {
-  public:
-     explicit TreeNode(int bits) noexcept : parent(NULL),d_bits(bits) {
-     }
-
-     //<! Makes a left node with one more bit than parent
-     TreeNode* make_left() {
-       if (!left) {
-         left = unique_ptr<TreeNode>(new TreeNode(d_bits+1));
-         left->parent = this;
-       }
-       return left.get();
-     }
-
-     //<! Makes a right node with one more bit than parent
-     TreeNode* make_right() {
-       if (!right) {
-         right = unique_ptr<TreeNode>(new TreeNode(d_bits+1));
-         right->parent = this;
-       }
-       return right.get();
-     }
-
-     unique_ptr<TreeNode> left;
-     unique_ptr<TreeNode> right;
-     TreeNode* parent;
-
-     unique_ptr<node_type> node4; //<! IPv4 value-pair
-     unique_ptr<node_type> node6; //<! IPv6 value-pair
-
-     int d_bits; //<! How many bits have been used so far
+  struct TreeNode {
+    TreeNode(const Bits& prefix, unsigned int bits) noexcept : d_prefix(prefix), d_value(0), d_bits(bits) {
+      d_prefix.truncate(bits);
+      d_child[0] = d_child[1] = 0;
+    }
+
+    Bits d_prefix;        //<! Bits leading to this node, masked to d_bits
+    uint32_t d_child[2];  //<! Index of left (0) and right (1) child, 0 if none (0 is a root, never a child)
+    uint32_t d_value;     //<! Index in d_values plus one, 0 if this node carries no value
+    uint8_t d_bits;       //<! How many bits have been used so far
   };
 
+  static bool isV4(const ComboAddress& ca) {
+    return ca.sin4.sin_family == AF_INET;
+  }
+
+  //<! Index of the root for this family, creating both roots on first use
+  uint32_t root(const ComboAddress& ca) {
+    if (d_tree.empty()) {
+      ComboAddress any;
+      d_tree.push_back(TreeNode(Bits(any), 0));
+      d_tree.push_back(TreeNode(Bits(any), 0));
+    }
+    return isV4(ca) ? 0 : 1;
+  }
+
+  static unsigned int maxBits(const ComboAddress& ca) {
+    return isV4(ca) ? 32 : 128;
+  }
+
+  uint32_t newNode(const Bits& prefix, unsigned int bits) {
+    d_tree.push_back(TreeNode(prefix, bits));
+    return d_tree.size() - 1;
+  }
+
+  //<! Looks for the node holding exactly key, returns false if there is none
+  bool find(const key_type& key, uint32_t& idx) const {
+    if (d_tree.empty())
+      return false;
+    const ComboAddress& network = key.getNetwork();
+    Bits addr(network);
+    unsigned int bits = std::min<unsigned int>(key.getBits(), maxBits(network));
+    idx = isV4(network) ? 0 : 1;
+    while (d_tree[idx].d_bits < bits) {
+      idx = d_tree[idx].d_child[addr.bit(d_tree[idx].d_bits)];
+      if (!idx || d_tree[idx].d_bits > bits || !addr.matches(d_tree[idx].d_prefix, d_tree[idx].d_bits))
+        return false;
+    }
+    return true;
+  }
+
 public:
   NetmaskTree() noexcept {
   }
@@ -531,6 +609,8 @@ public:
   }
 
   NetmaskTree& operator=(const NetmaskTree& rhs) {
+    if (this == &rhs)
+      return *this;
     clear();
     // see above.
     for(auto const& node: rhs._nodes)
@@ -550,55 +630,59 @@ public:
 
   //<! Creates new value-pair in tree and returns it.
   node_type& insert(const key_type& key) {
-    // lazily initialize tree on first insert.
-    if (!root) root = unique_ptr<TreeNode>(new TreeNode(0));
-    TreeNode* node = root.get();
-    node_type* value = nullptr;
-
-    if (key.getNetwork().sin4.sin_family == AF_INET) {
-      std::bitset<32> addr(be32toh(key.getNetwork().sin4.sin_addr.s_addr));
-      int bits = 0;
-      // we turn left on 0 and right on 1
-      while(bits < key.getBits()) {
-        uint8_t val = addr[31-bits];
-        if (val)
-          node = node->make_right();
-        else
-          node = node->make_left();
-        bits++;
+    const ComboAddress& network = key.getNetwork();
+    Bits addr(network);
+    unsigned int bits = std::min<unsigned int>(key.getBits(), maxBits(network));
+    uint32_t idx = root(network);
+    uint32_t target = 0;
+
+    // invariant: the node at idx is a prefix of addr, and not longer than bits
+    while (!target) {
+      if (d_tree[idx].d_bits == bits) {
+        target = idx;
+        break;
       }
-      // only create node if not yet assigned
-      if (!node->node4) {
-        node->node4 = unique_ptr<node_type>(new node_type());
-        _nodes.push_back(node->node4.get());
+      unsigned int dir = addr.bit(d_tree[idx].d_bits);
+      uint32_t child = d_tree[idx].d_child[dir];
+      if (!child) {
+        // road ends, hang a new leaf here
+        target = newNode(addr, bits);
+        d_tree[idx].d_child[dir] = target;
+        break;
       }
-      value = node->node4.get();
-    } else {
-      uint64_t* addr = (uint64_t*)key.getNetwork().sin6.sin6_addr.s6_addr;
-      std::bitset<64> addr_low(be64toh(addr[1]));
-      std::bitset<64> addr_high(be64toh(addr[0]));
-      int bits = 0;
-      while(bits < key.getBits()) {
-        uint8_t val;
-        // we use high address until we are
-        if (bits < 64) val = addr_high[63-bits];
-        // past 64 bits, and start using low address
-        else val = addr_low[127-bits];
-
-        // we turn left on 0 and right on 1
-        if (val)
-          node = node->make_right();
-        else
-          node = node->make_left();
-        bits++;
+      unsigned int childBits = d_tree[child].d_bits;
+      unsigned int common = addr.common(d_tree[child].d_prefix, std::min(bits, childBits));
+      if (common == childBits) {
+        idx = child;
+        continue;
       }
-      // only create node if not yet assigned
-      if (!node->node6) {
-        node->node6 = unique_ptr<node_type>(new node_type());
-        _nodes.push_back(node->node6.get());
+      // the child diverges from us (or goes on past us), put a node at the point where we part
+      Bits childPrefix = d_tree[child].d_prefix;
+      uint32_t split = newNode(addr, common);
+      d_tree[split].d_child[childPrefix.bit(common)] = child;
+      d_tree[idx].d_child[dir] = split;
+      if (common == bits) {
+        target = split;
+      } else {
+        target = newNode(addr, bits);
+        d_tree[split].d_child[addr.bit(common)] = target;
+      }
+    }
+
+    // only create value if not yet assigned
+    if (!d_tree[target].d_value) {
+      uint32_t slot;
+      if (!d_free.empty()) {
+        slot = d_free.back();
+        d_free.pop_back();
+      } else {
+        slot = d_values.size();
+        d_values.emplace_back();
       }
-      value = node->node6.get();
+      d_tree[target].d_value = slot + 1;
+      _nodes.push_back(&d_values[slot]);
     }
+    node_type* value = &d_values[d_tree[target].d_value - 1];
     // assign key
     value->first = key;
     return *value;
@@ -626,108 +710,47 @@ public:
 
   //<! Perform best match lookup for value, using at most max_bits
   const node_type* lookup(const ComboAddress& value, int max_bits = 128) const {
-    if (!root) return nullptr;
-
-    TreeNode *node = root.get();
-    node_type *ret = nullptr;
-
-    // exact same thing as above, except
-    if (value.sin4.sin_family == AF_INET) {
-      max_bits = std::max(0,std::min(max_bits,32));
-      std::bitset<32> addr(be32toh(value.sin4.sin_addr.s_addr));
-      int bits = 0;
-
-      while(bits < max_bits) {
-        // ...we keep track of last non-empty node
-        if (node->node4) ret = node->node4.get();
-        uint8_t val = addr[31-bits];
-        // ...and we don't create left/right hand
-        if (val) {
-          if (node->right) node = node->right.get();
-          // ..and we break when road ends
-          else break;
-        } else {
-          if (node->left) node = node->left.get();
-          else break;
-        }
-        bits++;
-      }
-      // needed if we did not find one in loop
-      if (node->node4) ret = node->node4.get();
-    } else {
-      uint64_t* addr = (uint64_t*)value.sin6.sin6_addr.s6_addr;
-      max_bits = std::max(0,std::min(max_bits,128));
-      std::bitset<64> addr_low(be64toh(addr[1]));
-      std::bitset<64> addr_high(be64toh(addr[0]));
-      int bits = 0;
-      while(bits < max_bits) {
-        if (node->node6) ret = node->node6.get();
-        uint8_t val;
-        if (bits < 64) val = addr_high[63-bits];
-        else val = addr_low[127-bits];
-        if (val) {
-          if (node->right) node = node->right.get();
-          else break;
-        } else {
-          if (node->left) node = node->left.get();
-          else break;
-        }
-        bits++;
-      }
-      if (node->node6) ret = node->node6.get();
+    if (d_tree.empty()) return nullptr;
+
+    Bits addr(value);
+    unsigned int bits = std::max(0, std::min(max_bits, static_cast<int>(maxBits(value))));
+    uint32_t idx = isV4(value) ? 0 : 1;
+    uint32_t ret = 0;
+
+    for (;;) {
+      const TreeNode& node = d_tree[idx];
+      // we keep track of last node with a value
+      if (node.d_value) ret = node.d_value;
+      if (node.d_bits >= bits) break;
+      idx = node.d_child[addr.bit(node.d_bits)];
+      // ...and we break when road ends, or leaves our address
+      if (!idx || d_tree[idx].d_bits > bits || !addr.matches(d_tree[idx].d_prefix, d_tree[idx].d_bits))
+        break;
     }
 
     // this can be nullptr.
-    return ret;
+    return ret ? &d_values[ret - 1] : nullptr;
   }
 
   //<! Removes key from TreeMap. This does not clean up the tree.
   void erase(const key_type& key) {
-    TreeNode *node = root.get();
-
-    // no tree, no value
-    if ( node == nullptr ) return;
-
-    // exact same thing as above, except
-    if (key.getNetwork().sin4.sin_family == AF_INET) {
-      std::bitset<32> addr(be32toh(key.getNetwork().sin4.sin_addr.s_addr));
-      int bits = 0;
-      while(node && bits < key.getBits()) {
-        uint8_t val = addr[31-bits];
-        if (val) {
-          node = node->right.get();
-        } else {
-          node = node->left.get();
-        }
-        bits++;
-      }
-      if (node) {
-        for(auto it = _nodes.begin(); it != _nodes.end(); it++)
-           if (node->node4.get() == *it) _nodes.erase(it);
-        node->node4.reset();
-      }
-    } else {
-      uint64_t* addr = (uint64_t*)key.getNetwork().sin6.sin6_addr.s6_addr;
-      std::bitset<64> addr_low(be64toh(addr[1]));
-      std::bitset<64> addr_high(be64toh(addr[0]));
-      int bits = 0;
-      while(node && bits < key.getBits()) {
-        uint8_t val;
-        if (bits < 64) val = addr_high[63-bits];
-        else val = addr_low[127-bits];
-        if (val) {
-          node = node->right.get();
-        } else {
-          node = node->left.get();
-        }
-        bits++;
-      }
-      if (node) {
-        for(auto it = _nodes.begin(); it != _nodes.end(); it++)
-           if (node->node6.get() == *it) _nodes.erase(it);
-        node->node6.reset();
+    uint32_t idx;
+    if (!find(key, idx))
+      return;
+
+    uint32_t slot = d_tree[idx].d_value;
+    if (!slot)
+      return;
+    node_type* value = &d_values[slot - 1];
+    for(auto it = _nodes.begin(); it != _nodes.end(); it++) {
+      if (*it == value) {
+        _nodes.erase(it);
+        break;
       }
     }
+    *value = node_type(); // release whatever the payload holds
+    d_free.push_back(slot - 1);
+    d_tree[idx].d_value = 0;
   }
 
   void erase(const string& key) {
@@ -756,18 +779,30 @@ public:
   //<! Clean out the tree
   void clear() {
     _nodes.clear();
-    root.reset(nullptr);
+    d_tree.clear();
+    d_values.clear();
+    d_free.clear();
   }
 
   //<! swaps the contents, rhs is left with nullptr.
   void swap(NetmaskTree& rhs) {
-    root.swap(rhs.root);
+    d_tree.swap(rhs.d_tree);
+    d_values.swap(rhs.d_values);
+    d_free.swap(rhs.d_free);
     _nodes.swap(rhs._nodes);
   }
 
+  //<! Approximate number of bytes used by the tree itself, not counting what the values point to
+  size_t memoryUsage() const {
+    return sizeof(*this) + d_tree.capacity() * sizeof(TreeNode) + d_values.size() * sizeof(node_type) +
+      d_free.capacity() * sizeof(uint32_t) + _nodes.capacity() * sizeof(node_type*);
+  }
+
 private:
-  unique_ptr<TreeNode> root; //<! Root of our tree
-  std::vector<node_type*> _nodes; //<! Container for actual values
+  std::vector<TreeNode> d_tree; //<! Nodes, 0 is the IPv4 root and 1 the IPv6 one
+  std::deque<node_type> d_values; //<! Actual values, these never move
+  std::vector<uint32_t> d_free; //<! Slots in d_values freed by erase()
+  std::vector<node_type*> _nodes; //<! Values in insertion order, for iteration
 };
 
 /** This class represents a group of supplemental Netmask classes. An IP address matchs
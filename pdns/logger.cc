@@ -30,10 +30,77 @@ extern StatBag S;
 #endif
 #include "lock.hh"
 #include "namespaces.hh"
+#include <limits.h>
+#include <sys/uio.h>
 
 pthread_once_t Logger::s_once;
 pthread_key_t Logger::s_loggerKey;
 
+/** Single producer, single consumer queue of records. The producer is the thread owning it,
+    the consumer is the writer thread. */
+class Logger::RecordQueue
+{
+public:
+  explicit RecordQueue(size_t size) : d_orphaned(false), d_records(size), d_head(0), d_tail(0)
+  {
+  }
+
+  //! only takes the message if there is room for it
+  bool push(string& msg, time_t t, Urgency u, bool console, bool syslog)
+  {
+    uint64_t head = d_head.load(std::memory_order_relaxed);
+    if(head - d_tail.load(std::memory_order_acquire) >= d_records.size())
+      return false;
+    Record& rec = d_records[head % d_records.size()];
+    rec.d_msg = std::move(msg);
+    rec.d_time = t;
+    rec.d_urgency = u;
+    rec.d_console = console;
+    rec.d_syslog = syslog;
+    d_head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  void drain(vector<Record>& out)
+  {
+    uint64_t tail = d_tail.load(std::memory_order_relaxed);
+    uint64_t head = d_head.load(std::memory_order_acquire);
+    for(; tail != head; ++tail)
+      out.push_back(std::move(d_records[tail % d_records.size()]));
+    d_tail.store(tail, std::memory_order_release);
+  }
+
+  std::atomic<bool> d_orphaned; //!< set when the owning thread exits, the writer then deletes us
+
+private:
+  vector<Record> d_records;
+  std::atomic<uint64_t> d_head;
+  std::atomic<uint64_t> d_tail;
+};
+
+//! writes all of iov, even if the kernel takes it in pieces
+static void writevAll(int fd, struct iovec* iov, int count)
+{
+  while(count > 0) {
+    ssize_t res = writev(fd, iov, count);
+    if(res < 0) {
+      if(errno == EINTR)
+        continue;
+      return; // nowhere left to complain to
+    }
+    size_t written = res;
+    while(count > 0 && written >= iov->iov_len) {
+      written -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if(count > 0) {
+      iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+      iov->iov_len -= written;
+    }
+  }
+}
+
 Logger &theL(const string &pname)
 {
   static Logger l("", LOG_DAEMON);
@@ -44,13 +111,21 @@ Logger &theL(const string &pname)
 
 void Logger::log(const string &msg, Urgency u)
 {
+  if(d_async) {
+    if(u > Error)
+      enqueue(getPerThread(), string(msg), u);
+    else
+      writeThrough(string(msg), u);
+    return;
+  }
+
 #ifndef RECURSOR
   bool mustAccount(false);
 #endif
   struct tm tm;
   time_t t;
   time(&t);
-  tm=*localtime(&t);
+  localtime_r(&t, &tm);
 
   if(u<=consoleUrgency) {
     char buffer[50];
@@ -75,6 +150,147 @@ void Logger::log(const string &msg, Urgency u)
 #endif
 }
 
+void Logger::enqueue(PerThread* pt, string&& msg, Urgency u)
+{
+  bool console = u <= consoleUrgency;
+  bool sys = u <= d_loglevel && !d_disableSyslog;
+  if(!console && !sys)
+    return;
+
+  if(!pt->d_queue) {
+    pt->d_queue = new RecordQueue(d_queueSize);
+    Lock l(&d_queuesLock);
+    d_queues.push_back(pt->d_queue);
+  }
+
+  time_t now = time(0);
+  while(!pt->d_queue->push(msg, now, u, console, sys)) {
+    if(d_dropOnFull) {
+      d_dropped++;
+      return;
+    }
+    usleep(1000); // wait for the writer to catch up
+  }
+}
+
+//! writes msg straight away, but only after what is still queued, all with d_queuesLock held
+void Logger::writeThrough(string&& msg, Urgency u)
+{
+  Record rec;
+  rec.d_console = u <= consoleUrgency;
+  rec.d_syslog = u <= d_loglevel && !d_disableSyslog;
+  if(!rec.d_console && !rec.d_syslog)
+    return;
+  rec.d_msg = std::move(msg);
+  rec.d_time = time(0);
+  rec.d_urgency = u;
+
+  vector<Record> batch;
+  Lock l(&d_queuesLock);
+  drainQueues(batch);
+  batch.push_back(std::move(rec));
+  writeBatch(batch, true);
+}
+
+//! moves everything queued into batch, call with d_queuesLock held
+void Logger::drainQueues(vector<Record>& batch)
+{
+  for(auto iter = d_queues.begin(); iter != d_queues.end(); ) {
+    RecordQueue* queue = *iter;
+    // read this first, so we also get what the thread logged just before exiting
+    bool orphaned = queue->d_orphaned.load(std::memory_order_acquire);
+    queue->drain(batch);
+    if(orphaned) {
+      delete queue;
+      iter = d_queues.erase(iter);
+    }
+    else
+      ++iter;
+  }
+}
+
+void Logger::writeBatch(vector<Record>& batch, bool account)
+{
+  // console lines are three iovecs each: timestamp, message, newline
+  vector<string> stamps;
+  stamps.reserve(batch.size());
+  vector<struct iovec> iov;
+  iov.reserve(3 * batch.size());
+  static char newline[] = "\n";
+
+  time_t lastTime = 0;
+  char buffer[50] = "";
+  for(auto& rec : batch) {
+    if(!rec.d_console)
+      continue;
+    if(rec.d_time != lastTime) {
+      struct tm tm;
+      localtime_r(&rec.d_time, &tm);
+      strftime(buffer, sizeof(buffer), "%b %d %H:%M:%S ", &tm);
+      lastTime = rec.d_time;
+    }
+    stamps.push_back(buffer);
+    iov.push_back({const_cast<char*>(stamps.back().c_str()), stamps.back().size()});
+    iov.push_back({const_cast<char*>(rec.d_msg.c_str()), rec.d_msg.size()});
+    iov.push_back({newline, 1});
+  }
+
+  const size_t maxIov = (IOV_MAX / 3) * 3; // never split a line over two calls
+  for(size_t pos = 0; pos < iov.size(); pos += maxIov)
+    writevAll(STDERR_FILENO, &iov[pos], std::min(maxIov, iov.size() - pos));
+
+  for(const auto& rec : batch) {
+    if(rec.d_syslog)
+      syslog(rec.d_urgency, "%s", rec.d_msg.c_str());
+#ifndef RECURSOR
+    if(account)
+      S.ringAccount("logmessages", rec.d_msg);
+#endif
+  }
+}
+
+void* Logger::writerThreadHelper(void* self)
+{
+  static_cast<Logger*>(self)->writerThread();
+  return 0;
+}
+
+void Logger::writerThread()
+{
+  vector<Record> batch;
+  for(;;) {
+    bool stop;
+    {
+      // holding the lock while writing keeps writeThrough() from overtaking this batch
+      Lock l(&d_queuesLock);
+      drainQueues(batch);
+      stop = d_stop.load();
+      if(!batch.empty())
+        writeBatch(batch, !stop); // when stopping, the StatBag may already be gone
+    }
+
+    if(batch.empty()) {
+      if(stop)
+        return;
+      usleep(10000);
+      continue;
+    }
+    batch.clear();
+  }
+}
+
+void Logger::setAsync(size_t queueSize, bool dropOnFull)
+{
+  if(d_async)
+    return;
+  d_queueSize = queueSize ? queueSize : 1;
+  d_dropOnFull = dropOnFull;
+
+  if(pthread_create(&d_writer, 0, writerThreadHelper, this))
+    unixDie("Creating log writer thread");
+  d_async = true;
+}
+
 void Logger::setLoglevel( Urgency u )
 {
   d_loglevel = u;
@@ -115,6 +331,12 @@ Logger::Logger(const string &n, int facility)
   d_disableSyslog=false;
   consoleUrgency=Error;
   name=n;
+  d_async=false;
+  d_stop=false;
+  d_dropOnFull=false;
+  d_queueSize=0;
+  d_dropped=0;
+  pthread_mutex_init(&d_queuesLock, 0);
 
   if(pthread_once(&s_once, initKey))
     unixDie("Creating thread key for logger");
@@ -123,6 +345,14 @@ Logger::Logger(const string &n, int facility)
 
 }
 
+Logger::~Logger()
+{
+  if(d_async) {
+    d_stop = true;
+    pthread_join(d_writer, 0);
+  }
+}
+
 Logger& Logger::operator<<(Urgency u)
 {
   getPerThread()->d_urgency=u;
@@ -132,6 +362,8 @@ Logger& Logger::operator<<(Urgency u)
 void Logger::perThreadDestructor(void* buf)
 {
   PerThread* pt = (PerThread*) buf;
+  if(pt->d_queue)
+    pt->d_queue->d_orphaned.store(true, std::memory_order_release);
   delete pt;
 }
 
@@ -223,7 +455,13 @@ Logger& Logger::operator<<(ostream & (&)(ostream &))
 {
   PerThread* pt =getPerThread();
 
-  log(pt->d_output, pt->d_urgency);
+  if(d_async && pt->d_urgency > Error) {
+    string msg;
+    msg.swap(pt->d_output); // the queue takes it over, no copy
+    enqueue(pt, std::move(msg), pt->d_urgency);
+  }
+  else
+    log(pt->d_output, pt->d_urgency);
   pt->d_output.clear();
   pt->d_urgency=Info;
   return *this;
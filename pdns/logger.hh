@@ -28,6 +28,8 @@
 #include <sstream>
 #include <syslog.h>
 #include <pthread.h>
+#include <atomic>
+#include <vector>
 
 #include "namespaces.hh"
 #include "dnsname.hh"
@@ -38,6 +40,7 @@ class Logger
 {
 public:
   Logger(const string &, int facility=LOG_DAEMON); //!< pass the identification you wish to appear in the log
+  ~Logger(); //!< stops the writer thread, after it has written out what is still queued
 
   //! The urgency of a log message
   enum Urgency {All=32767,Alert=LOG_ALERT, Critical=LOG_CRIT, Error=LOG_ERR, Warning=LOG_WARNING,
@@ -61,8 +64,14 @@ public:
     d_disableSyslog = d;
   }
 
-  //! Log to a file.
-  void toFile( const string & filename );
+  /** From now on, queue messages in a per-thread buffer of queueSize entries, and have a
+      writer thread do the actual writing in batches. When a buffer is full, the message is
+      dropped if dropOnFull is set, otherwise the logging thread waits for room.
+      Messages of Error and above are still written straight away, after everything that was
+      queued before them, so they do not overtake the messages that led up to them.
+      Call this after daemonizing, the writer thread does not survive a fork. */
+  void setAsync(size_t queueSize, bool dropOnFull);
+  uint64_t getDroppedMessages() const { return d_dropped; } //!< messages lost to full queues
   
   void resetFlags(){flags=0;open();} //!< zero the flags
   /** Use this to stream to your log, like this:
@@ -87,19 +96,38 @@ public:
   Logger& operator<<(std::ostream & (&)(std::ostream &)); //!< this is to recognise the endl, and to commit the log
 
 private:
+  //! a message waiting for the writer thread
+  struct Record
+  {
+    string d_msg;
+    time_t d_time;
+    Urgency d_urgency;
+    bool d_console;
+    bool d_syslog;
+  };
+  class RecordQueue;
+
   struct PerThread
   {
     PerThread() 
     {
       d_urgency=Info;
+      d_queue=nullptr;
     }
     string d_output;
     Urgency d_urgency;
+    RecordQueue* d_queue; //!< only when logging asynchronously, owned by the writer thread
   };
   static void initKey();
   static void perThreadDestructor(void *);
   PerThread* getPerThread();
   void open();
+  void enqueue(PerThread* pt, string&& msg, Urgency u);
+  void writeThrough(string&& msg, Urgency u);
+  void drainQueues(vector<Record>& batch);
+  void writeBatch(vector<Record>& batch, bool account);
+  static void* writerThreadHelper(void* self);
+  void writerThread();
 
   string name;
   int flags;
@@ -108,6 +136,14 @@ private:
   Urgency consoleUrgency;
   bool opened;
   bool d_disableSyslog;
+  std::atomic<bool> d_async;
+  std::atomic<bool> d_stop;
+  pthread_t d_writer;
+  bool d_dropOnFull;
+  size_t d_queueSize;
+  std::atomic<uint64_t> d_dropped;
+  pthread_mutex_t d_queuesLock; //!< protects d_queues, held from draining them until their records are written
+  vector<RecordQueue*> d_queues;
   static pthread_once_t s_once;
   static pthread_key_t s_loggerKey;
 };
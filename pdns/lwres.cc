@@ -35,6 +35,7 @@
 #include <cstring>
 #include <string>
 #include <vector>
+#include <deque>
 #include "dns.hh"
 #include "qtype.hh"
 #include "pdnsexception.hh"
@@ -45,11 +46,145 @@
 #include "dnsparser.hh"
 #include "logger.hh"
 #include "dns_random.hh"
-#include <boost/scoped_array.hpp>
 #include <boost/algorithm/string.hpp>
 #include "validate-recursor.hh"
 #include "ednssubnet.hh"
 
+unsigned int g_tcpOutMaxIdleMsec;
+size_t g_tcpOutMaxIdlePerAuth;
+
+/* Outgoing TCP connections are kept per thread once a query has been answered, so that
+   further queries to the same authoritative server don't pay for a new handshake.
+   A connection is only ever used by a single query at a time, and is only kept if
+   the answer matched the query we sent. */
+struct OutgoingTCPConnection
+{
+  shared_ptr<Socket> d_socket;
+  struct timeval d_lastUsed;
+};
+
+typedef map<ComboAddress, std::deque<OutgoingTCPConnection> > tcpoutconnections_t;
+static __thread tcpoutconnections_t* t_tcpOutConnections;
+
+static bool isIdleTCPOutConnectionUsable(const OutgoingTCPConnection& conn, const struct timeval& now)
+{
+  struct timeval idle = now - conn.d_lastUsed;
+  if((uint64_t)idle.tv_sec*1000 + idle.tv_usec/1000 >= g_tcpOutMaxIdleMsec)
+    return false;
+
+  // an idle connection should have nothing to read, anything else is EOF, an error or a stray answer
+  char c;
+  ssize_t got=recv(conn.d_socket->getHandle(), &c, sizeof(c), MSG_PEEK | MSG_DONTWAIT);
+  return got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+//! returns an idle connection to remote if we have a usable one (unless forceNew is set), a new one otherwise
+static shared_ptr<Socket> getTCPOutConnection(const ComboAddress& remote, const struct timeval& now, bool* reused, bool forceNew=false)
+{
+  *reused=false;
+  if(t_tcpOutConnections && !forceNew) {
+    auto it = t_tcpOutConnections->find(remote);
+    if(it != t_tcpOutConnections->end()) {
+      auto& idle = it->second;
+      while(!idle.empty()) {
+        OutgoingTCPConnection conn = idle.back(); // most recently used first
+        idle.pop_back();
+        if(isIdleTCPOutConnectionUsable(conn, now)) {
+          if(idle.empty())
+            t_tcpOutConnections->erase(it);
+          g_stats.tcpOutConnectionsReused++;
+          *reused=true;
+          return conn.d_socket;
+        }
+      }
+      t_tcpOutConnections->erase(it);
+    }
+  }
+
+  shared_ptr<Socket> s=std::make_shared<Socket>(remote.sin4.sin_family, SOCK_STREAM);
+  s->setNonBlocking();
+  ComboAddress local = getQueryLocalAddress(remote.sin4.sin_family, 0);
+  s->bind(local);
+  s->connect(remote);
+  g_stats.tcpOutConnectionsNew++;
+  return s;
+}
+
+static void releaseTCPOutConnection(const ComboAddress& remote, const shared_ptr<Socket>& s, const struct timeval& now)
+{
+  if(!g_tcpOutMaxIdlePerAuth || !g_tcpOutMaxIdleMsec)
+    return;
+
+  if(!t_tcpOutConnections)
+    t_tcpOutConnections = new tcpoutconnections_t();
+
+  auto& idle = (*t_tcpOutConnections)[remote];
+  while(idle.size() >= g_tcpOutMaxIdlePerAuth)
+    idle.pop_front();
+
+  OutgoingTCPConnection conn;
+  conn.d_socket = s;
+  conn.d_lastUsed = now;
+  idle.push_back(conn);
+}
+
+void pruneTCPOutConnections(const struct timeval& now)
+{
+  if(!t_tcpOutConnections)
+    return;
+
+  for(auto it = t_tcpOutConnections->begin(); it != t_tcpOutConnections->end(); ) {
+    auto& idle = it->second;
+    idle.erase(std::remove_if(idle.begin(), idle.end(),
+                              [&now](const OutgoingTCPConnection& conn) { return !isIdleTCPOutConnectionUsable(conn, now); }),
+               idle.end());
+    if(idle.empty())
+      t_tcpOutConnections->erase(it++);
+    else
+      ++it;
+  }
+}
+
+uint64_t getTCPOutConnectionsIdle()
+{
+  uint64_t count=0;
+  if(t_tcpOutConnections) {
+    for(const auto& entry : *t_tcpOutConnections)
+      count+=entry.second.size();
+  }
+  return count;
+}
+
+// -1 is error, 0 is timeout, 1 is success. Only succeeds if the answer carries the id we sent.
+static int tcpExchange(const shared_ptr<Socket>& s, const string& packet, uint16_t id, string& answer)
+{
+  int ret=asendtcp(packet, s.get());
+  if(!(ret>0))
+    return ret;
+
+  ret=arecvtcp(answer, 2, s.get(), false);
+  if(!(ret > 0))
+    return ret;
+
+  uint16_t tlen;
+  memcpy(&tlen, answer.c_str(), sizeof(tlen));
+  size_t len=ntohs(tlen);
+
+  ret=arecvtcp(answer, len, s.get(), false);
+  if(!(ret > 0))
+    return ret;
+
+  if(answer.size() < sizeof(dnsheader))
+    return -1;
+
+  dnsheader dh;
+  memcpy(&dh, answer.c_str(), sizeof(dh));
+  if(dh.id != id)
+    return -1;
+
+  return 1;
+}
+
 //! returns -2 for OS limits error, -1 for permanent error that has to do with remote **transport**, 0 for timeout, 1 for success
 /** lwr is only filled out in case 1 was returned, and even when returning 1 for 'success', lwr might contain DNS errors
     Never throws! 
@@ -57,8 +192,7 @@
 int asyncresolve(const ComboAddress& ip, const DNSName& domain, int type, bool doTCP, bool sendRDQuery, int EDNS0Level, struct timeval* now, boost::optional<Netmask>& srcmask, LWResult *lwr)
 {
   size_t len;
-  size_t bufsize=g_outgoingEDNSBufsize;
-  scoped_array<unsigned char> buf(new unsigned char[bufsize]);
+  string buf; // the answer is handed to us by the event loop, no need for a buffer of our own
   vector<uint8_t> vpacket;
   //  string mapped0x20=dns0x20(domain);
   DNSPacketWriter pw(vpacket, domain, type);
@@ -113,50 +247,36 @@ int asyncresolve(const ComboAddress& ip, const DNSName& domain, int type, bool d
   
     // sleep until we see an answer to this, interface to mtasker
     
-    ret=arecvfrom(reinterpret_cast<char *>(buf.get()), bufsize-1,0, ip, &len, pw.getHeader()->id, 
+    ret=arecvfrom(buf, 0, ip, &len, pw.getHeader()->id,
                   domain, type, queryfd, now);
   }
   else {
     try {
-      Socket s(ip.sin4.sin_family, SOCK_STREAM);
-
-      s.setNonBlocking();
-      ComboAddress local = getQueryLocalAddress(ip.sin4.sin_family, 0);
-
-      s.bind(local);
-        
       ComboAddress remote = ip;
-      remote.sin4.sin_port = htons(53);      
-      s.connect(remote);
-      
+      remote.sin4.sin_port = htons(53);
+
       uint16_t tlen=htons(vpacket.size());
-      char *lenP=(char*)&tlen;
-      const char *msgP=(const char*)&*vpacket.begin();
-      string packet=string(lenP, lenP+2)+string(msgP, msgP+vpacket.size());
-      
-      ret=asendtcp(packet, &s);
-      if(!(ret>0))           
-        return ret;
-      
-      packet.clear();
-      ret=arecvtcp(packet, 2, &s, false);
-      if(!(ret > 0))
-        return ret;
-      
-      memcpy(&tlen, packet.c_str(), sizeof(tlen));
-      len=ntohs(tlen); // switch to the 'len' shared with the rest of the function
-      
-      ret=arecvtcp(packet, len, &s, false);
+      string packet;
+      packet.reserve(vpacket.size() + sizeof(tlen));
+      packet.append((const char*)&tlen, sizeof(tlen));
+      packet.append((const char*)&*vpacket.begin(), vpacket.size());
+
+      bool reused=false;
+      shared_ptr<Socket> s=getTCPOutConnection(remote, *now, &reused);
+      ret=tcpExchange(s, packet, pw.getHeader()->id, buf);
+      if(ret < 0 && reused) {
+        // the remote might have closed the idle connection on us, try once more on a fresh one
+        s=getTCPOutConnection(remote, *now, &reused, true);
+        ret=tcpExchange(s, packet, pw.getHeader()->id, buf);
+      }
       if(!(ret > 0))
         return ret;
-      
-      if(len > bufsize) {
-        bufsize=len;
-        scoped_array<unsigned char> narray(new unsigned char[bufsize]);
-        buf.swap(narray);
-      }
-      memcpy(buf.get(), packet.c_str(), len);
 
+      len=buf.size(); // switch to the 'len' shared with the rest of the function
+
+      struct timeval done;
+      Utility::gettimeofday(&done, 0);
+      releaseTCPOutConnection(remote, s, done);
       ret=1;
     }
     catch(NetworkError& ne) {
@@ -174,7 +294,7 @@ int asyncresolve(const ComboAddress& ip, const DNSName& domain, int type, bool d
   lwr->d_records.clear();
   try {
     lwr->d_tcbit=0;
-    MOADNSParser mdp((const char*)buf.get(), len);
+    MOADNSParser mdp(buf.c_str(), len);
     lwr->d_aabit=mdp.d_header.aa;
     lwr->d_tcbit=mdp.d_header.tc;
     lwr->d_rcode=mdp.d_header.rcode;
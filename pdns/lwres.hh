@@ -44,7 +44,7 @@
 
 int asendto(const char *data, size_t len, int flags, const ComboAddress& ip, uint16_t id,
             const DNSName& domain, uint16_t qtype,  int* fd);
-int arecvfrom(char *data, size_t len, int flags, const ComboAddress& ip, size_t *d_len, uint16_t id,
+int arecvfrom(std::string& packet, int flags, const ComboAddress& ip, size_t *d_len, uint16_t id,
               const DNSName& domain, uint16_t qtype, int fd, struct timeval* now);
 
 class LWResException : public PDNSException
@@ -66,5 +66,10 @@ public:
   bool d_haveEDNS{false};
 };
 
+extern unsigned int g_tcpOutMaxIdleMsec;
+extern size_t g_tcpOutMaxIdlePerAuth;
+void pruneTCPOutConnections(const struct timeval& now);
+uint64_t getTCPOutConnectionsIdle();
+
 int asyncresolve(const ComboAddress& ip, const DNSName& domain, int type, bool doTCP, bool sendRDQuery, int EDNS0Level, struct timeval* now, boost::optional<Netmask>& srcmask, LWResult* res);
 #endif // PDNS_LWRES_HH
@@ -26,6 +26,7 @@
 #include "mtasker.hh"
 #include "misc.hh"
 #include <stdio.h>
+#include <algorithm>
 #include <iostream>
 
 
@@ -250,6 +251,8 @@ template<class EventKey, class EventVal>int MTasker<EventKey,EventVal>::sendEven
   return 1;
 }
 
+template<class Key, class Val> const std::vector<size_t> MTasker<Key,Val>::s_stackUsageBuckets = { 16384, 32768, 65536, 131072, 262144 };
+
 //! launches a new thread
 /** The kernel can call this to make a new thread, which starts at the function start and gets passed the val void pointer.
     \param start Pointer to the function which will form the start of the thread
@@ -260,7 +263,13 @@ template<class Key, class Val>void MTasker<Key,Val>::makeThread(tfunc_t *start,
   auto uc=std::make_shared<pdns_ucontext_t>();
   
   uc->uc_link = &d_kernel; // come back to kernel after dying
-  uc->uc_stack.resize (d_stacksize);
+  if(!d_cachedStacks.empty()) {
+    uc->uc_stack = std::move(d_cachedStacks.back());
+    d_cachedStacks.pop_back();
+  }
+  else {
+    uc->uc_stack = pdns_stack_t(d_stacksize);
+  }
 
   auto& thread = d_threads[d_maxtid];
   auto mt = this;
@@ -301,7 +310,17 @@ template<class Key, class Val>bool MTasker<Key,Val>::schedule(struct timeval*  n
     return true;
   }
   if(!d_zombiesQueue.empty()) {
-    d_threads.erase(d_zombiesQueue.front());
+    auto thread = d_threads.find(d_zombiesQueue.front());
+    if(thread != d_threads.end()) {
+      size_t used = thread->second.startOfStack - thread->second.highestStackSeen;
+      auto bucket = std::lower_bound(s_stackUsageBuckets.cbegin(), s_stackUsageBuckets.cend(), used);
+      d_stackUsage.at(bucket - s_stackUsageBuckets.cbegin())++;
+
+      // the thread is done with its stack, keep it around for the next one
+      if(d_cachedStacks.size() < d_maxCachedStacks)
+        d_cachedStacks.push_back(std::move(thread->second.context->uc_stack));
+      d_threads.erase(thread);
+    }
     d_zombiesQueue.pop();
     return true;
   }
@@ -71,6 +71,9 @@ private:
   int d_tid;
   int d_maxtid;
   size_t d_stacksize;
+  size_t d_maxCachedStacks;
+  std::vector<pdns_stack_t> d_cachedStacks; // stacks of finished threads, ready for new ones
+  std::vector<uint64_t> d_stackUsage; // histogram of the maximum stack usage seen per thread
 
   EventVal d_waitval;
   enum waitstatusenum {Error=-1,TimeOut=0,Answer} d_waitstatus;
@@ -99,10 +102,14 @@ public:
       This limit applies solely to the stack, the heap is not limited in any way. If threads need to allocate a lot of data,
       the use of new/delete is suggested. 
    */
-  MTasker(size_t stacksize=8192) : d_tid(0), d_maxtid(0), d_stacksize(stacksize), d_waitstatus(Error)
+  MTasker(size_t stacksize=8192, size_t maxCachedStacks=0) : d_tid(0), d_maxtid(0), d_stacksize(stacksize), d_maxCachedStacks(maxCachedStacks),
+                                                               d_stackUsage(s_stackUsageBuckets.size() + 1, 0), d_waitstatus(Error)
   {
   }
 
+  //! upper bounds of the buckets of the stack usage histogram, the last bucket counts everything above
+  static const std::vector<size_t> s_stackUsageBuckets;
+
   typedef void tfunc_t(void *); //!< type of the pointer that starts a thread 
   int waitEvent(EventKey &key, EventVal *val=0, unsigned int timeoutMsec=0, struct timeval* now=0);
   void yield();
@@ -115,6 +122,14 @@ public:
   int getTid(); 
   unsigned int getMaxStackUsage();
   unsigned int getUsec();
+  const std::vector<uint64_t>& getStackUsageHistogram() const
+  {
+    return d_stackUsage;
+  }
+  size_t getCachedStacks() const
+  {
+    return d_cachedStacks.size();
+  }
 
 private:
   EventKey d_eventkey;   // for waitEvent, contains exact key it was awoken for
@@ -7,3 +7,69 @@
 #else
 #include "mtasker_ucontext.cc"
 #endif
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+static size_t getPageSize()
+{
+  static const size_t pageSize = sysconf(_SC_PAGESIZE);
+  return pageSize;
+}
+
+pdns_stack_t::pdns_stack_t(size_t size)
+{
+  const size_t pageSize = getPageSize();
+  size = ((size + pageSize - 1) / pageSize) * pageSize;
+
+  void* mapped = mmap(nullptr, size + pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapped == MAP_FAILED) {
+    throw std::runtime_error("Unable to allocate MThread stack of "+std::to_string(size)+" bytes: "+std::string(strerror(errno)));
+  }
+
+  // stacks grow down, so the guard page goes at the lowest address
+  if (mprotect(mapped, pageSize, PROT_NONE) < 0) {
+    int err = errno;
+    munmap(mapped, size + pageSize);
+    throw std::runtime_error("Unable to set up the guard page of an MThread stack: "+std::string(strerror(err)));
+  }
+
+  d_base = static_cast<char*>(mapped) + pageSize;
+  d_size = size;
+}
+
+pdns_stack_t::pdns_stack_t(pdns_stack_t&& rhs) noexcept: d_base(rhs.d_base), d_size(rhs.d_size)
+{
+  rhs.d_base = nullptr;
+  rhs.d_size = 0;
+}
+
+pdns_stack_t& pdns_stack_t::operator=(pdns_stack_t&& rhs) noexcept
+{
+  if (this != &rhs) {
+    release();
+    std::swap(d_base, rhs.d_base);
+    std::swap(d_size, rhs.d_size);
+  }
+  return *this;
+}
+
+pdns_stack_t::~pdns_stack_t()
+{
+  release();
+}
+
+void pdns_stack_t::release() noexcept
+{
+  if (d_base) {
+    const size_t pageSize = getPageSize();
+    munmap(d_base - pageSize, d_size + pageSize);
+    d_base = nullptr;
+    d_size = 0;
+  }
+}
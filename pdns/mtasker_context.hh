@@ -1,11 +1,35 @@
 #ifndef MTASKER_CONTEXT_HH
 #define MTASKER_CONTEXT_HH
 
-#include "lazy_allocator.hh"
 #include <boost/function.hpp>
-#include <vector>
+#include <cstddef>
 #include <exception>
 
+//! Stack memory for an MThread
+/** The stack is mmap()ed with an inaccessible guard page below it, so that overflowing it
+    crashes right away instead of silently corrupting whatever lives next to it. Memory is
+    only touched on use, and stacks can be moved around to be reused for another MThread. */
+class pdns_stack_t {
+public:
+    pdns_stack_t () noexcept: d_base(nullptr), d_size(0) {}
+    explicit pdns_stack_t (size_t size);
+    pdns_stack_t (pdns_stack_t&& rhs) noexcept;
+    pdns_stack_t& operator= (pdns_stack_t&& rhs) noexcept;
+    pdns_stack_t (pdns_stack_t const&) = delete;
+    pdns_stack_t& operator= (pdns_stack_t const&) = delete;
+    ~pdns_stack_t ();
+
+    char* data () const noexcept { return d_base; }
+    size_t size () const noexcept { return d_size; }
+    char& operator[] (size_t pos) const noexcept { return d_base[pos]; }
+
+private:
+    void release () noexcept;
+
+    char* d_base;
+    size_t d_size;
+};
+
 struct pdns_ucontext_t {
     pdns_ucontext_t ();
     pdns_ucontext_t (pdns_ucontext_t const&) = delete;
@@ -14,7 +38,7 @@ struct pdns_ucontext_t {
 
     void* uc_mcontext;
     pdns_ucontext_t* uc_link;
-    std::vector<char, lazy_allocator<char>> uc_stack;
+    pdns_stack_t uc_stack;
     std::exception_ptr exception;
 };
 
@@ -100,7 +100,8 @@ int PacketCache::get(DNSPacket *p, DNSPacket *cached, bool recursive)
     auto& mc=getMap(p->qdomain);
     TryReadLock l(&mc.d_mut); // take a readlock here
     if(!l.gotIt()) {
-      S.inc("deferred-cache-lookup");
+      static AtomicCounter& deferredLookups=*S.getPointer("deferred-cache-lookup");
+      deferredLookups++;
       return 0;
     }
 
@@ -195,8 +196,10 @@ void PacketCache::insert(const DNSName &qname, const QType& qtype, CacheEntryTyp
     if(!success)
       mc.d_map.replace(place, val);
   }
-  else 
-    S.inc("deferred-cache-inserts"); 
+  else {
+    static AtomicCounter& deferredInserts=*S.getPointer("deferred-cache-inserts");
+    deferredInserts++;
+  }
 }
 
 void PacketCache::insert(const DNSName &qname, const QType& qtype, CacheEntryType cet, const vector<DNSResourceRecord>& value, unsigned int ttl, int zoneID)
@@ -233,8 +236,10 @@ void PacketCache::insert(const DNSName &qname, const QType& qtype, CacheEntryTyp
     if(!success)
       mc.d_map.replace(place, val);
   }
-  else 
-    S.inc("deferred-cache-inserts"); 
+  else {
+    static AtomicCounter& deferredInserts=*S.getPointer("deferred-cache-inserts");
+    deferredInserts++;
+  }
 }
 
 
@@ -308,7 +313,8 @@ bool PacketCache::getEntry(const DNSName &qname, const QType& qtype, CacheEntryT
 
   TryReadLock l(&mc.d_mut); // take a readlock here
   if(!l.gotIt()) {
-    S.inc( "deferred-cache-lookup");
+    static AtomicCounter& deferredLookups=*S.getPointer("deferred-cache-lookup");
+    deferredLookups++;
     return false;
   }
 
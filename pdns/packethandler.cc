@@ -45,6 +45,7 @@
 #include "dnsproxy.hh"
 #include "version.hh"
 #include "common_startup.hh"
+#include "auth-zonecache.hh"
 
 #if 0
 #undef DLOG
@@ -374,7 +375,6 @@ bool PacketHandler::getBestWildcard(DNSPacket *p, SOAData& sd, const DNSName &ta
 /** dangling is declared true if we were unable to resolve everything */
 int PacketHandler::doAdditionalProcessingAndDropAA(DNSPacket *p, DNSPacket *r, const SOAData& soadata, bool retargeted)
 {
-  DNSResourceRecord rr;
   SOAData sd;
   sd.db=0;
 
@@ -391,6 +391,9 @@ int PacketHandler::doAdditionalProcessingAndDropAA(DNSPacket *p, DNSPacket *r, c
       crrs.push_back(**i);
 
     // we now have a copy, push_back on packet might reallocate!
+    // the address lookups are independent, so collect them all and ask the backends in one go
+    vector<DNSLookupQuestion> questions;
+    vector<vector<DNSResourceRecord>::size_type> askedFor;
     for(vector<DNSResourceRecord>::const_iterator i=crrs.begin(); i!=crrs.end(); ++i) {
       if(r->d.aa && i->qname.countLabels() && i->qtype.getCode()==QType::NS && !B.getSOA(i->qname,sd,p) && !retargeted) { // drop AA in case of non-SOA-level NS answer, except for root referral
         r->setA(false);
@@ -405,31 +408,39 @@ int PacketHandler::doAdditionalProcessingAndDropAA(DNSPacket *p, DNSPacket *r, c
         trim_left(content);
       }
 
+      DNSName target;
+      if (i->qtype.getCode()==QType::SRV) {
+        vector<string>parts;
+        stringtok(parts, content);
+        if (parts.size() < 3)
+          continue;
+        target=DNSName(parts[2]);
+      }
+      else
+        target=DNSName(content);
+
       QType qtypes[2];
       qtypes[0]="A"; qtypes[1]="AAAA";
       for(int n=0 ; n < d_doIPv6AdditionalProcessing + 1; ++n) {
-        if (i->qtype.getCode()==QType::SRV) {
-          vector<string>parts;
-          stringtok(parts, content);
-          if (parts.size() >= 3) {
-            B.lookup(qtypes[n], DNSName(parts[2]), p);
-          }
-          else
-            continue;
-        }
-        else {
-          B.lookup(qtypes[n], DNSName(content), p);
-        }
-        while(B.get(rr)) {
-          if(rr.domain_id!=i->domain_id && ::arg()["out-of-zone-additional-processing"]=="no") {
-            DLOG(L<<Logger::Warning<<"Not including out-of-zone additional processing of "<<i->qname<<" ("<<rr.qname<<")"<<endl);
-            continue; // not adding out-of-zone additional data
-          }
-          if(rr.auth && !rr.qname.isPartOf(soadata.qname)) // don't sign out of zone data using the main key 
-            rr.auth=false;
-          rr.d_place=DNSResourceRecord::ADDITIONAL;
-          r->addRecord(rr);
+        questions.push_back({qtypes[n], target});
+        askedFor.push_back(i - crrs.begin());
+      }
+    }
+
+    vector<vector<DNSResourceRecord> > answers;
+    B.lookupBatch(questions, answers, p);
+
+    for(vector<DNSLookupQuestion>::size_type n = 0; n < questions.size(); ++n) {
+      const DNSResourceRecord& from = crrs[askedFor[n]];
+      for(auto& rr : answers[n]) {
+        if(rr.domain_id!=from.domain_id && ::arg()["out-of-zone-additional-processing"]=="no") {
+          DLOG(L<<Logger::Warning<<"Not including out-of-zone additional processing of "<<from.qname<<" ("<<rr.qname<<")"<<endl);
+          continue; // not adding out-of-zone additional data
         }
+        if(rr.auth && !rr.qname.isPartOf(soadata.qname)) // don't sign out of zone data using the main key 
+          rr.auth=false;
+        rr.d_place=DNSResourceRecord::ADDITIONAL;
+        r->addRecord(rr);
       }
     }
   }
@@ -812,6 +823,11 @@ int PacketHandler::trySuperMasterSynchronous(DNSPacket *p, const DNSName& tsigke
       meta.push_back(tsigkeyname.toStringNoDot());
       db->setDomainMetadata(p->qdomain, "AXFR-MASTER-TSIG", meta);
     }
+    if(g_zoneCache.isEnabled()) {
+      DomainInfo di;
+      if(db->getDomainInfo(p->qdomain, di))
+        g_zoneCache.add(p->qdomain, di.id);
+    }
   }
   catch(PDNSException& ae) {
     L<<Logger::Error<<"Database error trying to create "<<p->qdomain<<" for potential supermaster "<<remote<<": "<<ae.reason<<endl;
@@ -1002,7 +1018,7 @@ void PacketHandler::makeNOError(DNSPacket* p, DNSPacket* r, const DNSName& targe
   if(d_dk.isSecuredZone(sd.qname))
     addNSECX(p, r, target, wildcard, sd.qname, mode);
 
-  S.ringAccount("noerror-queries",p->qdomain.toLogString()+"/"+p->qtype.getName());
+  S.ringAccount("noerror-queries", p->qdomain, p->qtype);
 }
 
 
@@ -1518,7 +1534,7 @@ DNSPacket *PacketHandler::questionOrRecurse(DNSPacket *p, bool *shouldRecurse)
     r=p->replyPacket(); // generate an empty reply packet
     r->setRcode(RCode::ServFail);
     S.inc("servfail-packets");
-    S.ringAccount("servfail-queries",p->qdomain.toLogString());
+    S.ringAccount("servfail-queries", p->qdomain);
   }
   catch(PDNSException &e) {
     L<<Logger::Error<<"Backend reported permanent error which prevented lookup ("+e.reason+"), aborting"<<endl;
@@ -1530,7 +1546,7 @@ DNSPacket *PacketHandler::questionOrRecurse(DNSPacket *p, bool *shouldRecurse)
     r=p->replyPacket(); // generate an empty reply packet
     r->setRcode(RCode::ServFail);
     S.inc("servfail-packets");
-    S.ringAccount("servfail-queries",p->qdomain.toLogString());
+    S.ringAccount("servfail-queries", p->qdomain);
   }
   return r; 
 
@@ -363,6 +363,11 @@ static void setSocketSendBuffer(int fd, uint32_t size)
 // you can ask this class for a UDP socket to send a query from
 // this socket is not yours, don't even think about deleting it
 // but after you call 'returnSocket' on it, don't assume anything anymore
+//
+// Returned sockets are kept bound and idle for a next query when udp-source-port-max-uses
+// allows it, so we don't need a socket() and bind() for every outgoing query. A socket is
+// closed after that many queries, and idle ones are picked at random, to keep our source
+// ports unpredictable.
 class UDPClientSocks
 {
   unsigned int d_numsocks;
@@ -371,15 +376,31 @@ public:
   {
   }
 
-  typedef set<int> socks_t;
+  struct SockState
+  {
+    int family;
+    unsigned int uses;
+  };
+  typedef map<int, SockState> socks_t;
   socks_t d_socks;
 
+  typedef vector<pair<int, SockState> > idlesocks_t;
+  idlesocks_t d_idle4, d_idle6;
+
+  static unsigned int s_maxUses;
+  static unsigned int s_maxIdle;
+
   // returning -2 means: temporary OS error (ie, out of files), -1 means error related to remote
   int getSocket(const ComboAddress& toaddr, int* fd)
   {
-    *fd=makeClientSocket(toaddr.sin4.sin_family);
-    if(*fd < 0) // temporary error - receive exception otherwise
-      return -2;
+    SockState state;
+    if(!getIdleSocket(toaddr.sin4.sin_family, fd, &state)) {
+      *fd=makeClientSocket(toaddr.sin4.sin_family);
+      if(*fd < 0) // temporary error - receive exception otherwise
+        return -2;
+      state.family=toaddr.sin4.sin_family;
+      state.uses=0;
+    }
 
     if(connect(*fd, (struct sockaddr*)(&toaddr), toaddr.getSocklen()) < 0) {
       int err = errno;
@@ -390,7 +411,8 @@ public:
       return -1;
     }
 
-    d_socks.insert(*fd);
+    state.uses++;
+    d_socks[*fd]=state;
     d_numsocks++;
     return 0;
   }
@@ -411,17 +433,52 @@ public:
       throw PDNSException("Trying to return a socket not in the pool");
     }
     try {
-      t_fdm->removeReadFD(*i);
+      t_fdm->removeReadFD(i->first);
     }
     catch(FDMultiplexerException& e) {
       // we sometimes return a socket that has not yet been assigned to t_fdm
     }
-    closesocket(*i);
+
+    idlesocks_t& idle = i->second.family == AF_INET ? d_idle4 : d_idle6;
+    if(i->second.uses < s_maxUses && idle.size() < s_maxIdle && drainSocket(i->first))
+      idle.push_back(*i);
+    else
+      closesocket(i->first);
 
     d_socks.erase(i++);
     --d_numsocks;
   }
 
+  // pick one of our idle sockets at random, if any
+  bool getIdleSocket(int family, int* fd, SockState* state)
+  {
+    idlesocks_t& idle = family == AF_INET ? d_idle4 : d_idle6;
+    if(idle.empty())
+      return false;
+
+    std::swap(idle[dns_random(idle.size())], idle.back());
+    *fd=idle.back().first;
+    *state=idle.back().second;
+    idle.pop_back();
+    return true;
+  }
+
+  // discard whatever arrived after we stopped listening, returns false if the socket is not fit for reuse
+  static bool drainSocket(int fd)
+  {
+    char buffer[512];
+    for(int tries=0; tries < 64; ++tries) {
+      ssize_t got=recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+      if(got < 0) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK)
+          return true;
+        if(errno != ECONNREFUSED) // pending ICMP errors are fine, we are about to connect elsewhere
+          return false;
+      }
+    }
+    return false;
+  }
+
   // returns -1 for errors which might go away, throws for ones that won't
   static int makeClientSocket(int family)
   {
@@ -458,6 +515,8 @@ public:
   }
 };
 
+unsigned int UDPClientSocks::s_maxUses;
+unsigned int UDPClientSocks::s_maxIdle;
 static __thread UDPClientSocks* t_udpclientsocks;
 
 /* these two functions are used by LWRes */
@@ -507,7 +566,7 @@ int asendto(const char *data, size_t len, int flags,
 }
 
 // -1 is error, 0 is timeout, 1 is success
-int arecvfrom(char *data, size_t len, int flags, const ComboAddress& fromaddr, size_t *d_len,
+int arecvfrom(std::string& packet, int flags, const ComboAddress& fromaddr, size_t *d_len,
               uint16_t id, const DNSName& domain, uint16_t qtype, int fd, struct timeval* now)
 {
   static optional<unsigned int> nearMissLimit;
@@ -521,7 +580,6 @@ int arecvfrom(char *data, size_t len, int flags, const ComboAddress& fromaddr, s
   pident.type = qtype;
   pident.remote=fromaddr;
 
-  string packet;
   int ret=MT->waitEvent(pident, &packet, g_networkTimeoutMsec, now);
 
   if(ret > 0) {
@@ -529,7 +587,6 @@ int arecvfrom(char *data, size_t len, int flags, const ComboAddress& fromaddr, s
       return -1;
 
     *d_len=packet.size();
-    memcpy(data,packet.c_str(),min(len,*d_len));
     if(*nearMissLimit && pident.nearMisses > *nearMissLimit) {
       L<<Logger::Error<<"Too many ("<<pident.nearMisses<<" > "<<*nearMissLimit<<") bogus answers for '"<<domain<<"' from "<<fromaddr.toString()<<", assuming spoof attempt."<<endl;
       g_stats.spoofCount++;
@@ -631,12 +688,11 @@ static void protobufLogQuery(const std::shared_ptr<RemoteLogger>& logger, uint8_
   logger->queueData(str);
 }
 
-static void protobufLogResponse(const std::shared_ptr<RemoteLogger>& logger, const RecProtoBufMessage& message)
+static void protobufLogResponse(const std::shared_ptr<RemoteLogger>& logger, const RecProtoBufMessage& message, std::string& buffer)
 {
 //  cerr <<message.toDebugString()<<endl;
-  std::string str;
-  message.serialize(str);
-  logger->queueData(str);
+  message.serialize(buffer);
+  logger->queueData(buffer);
 }
 #endif
 
@@ -661,6 +717,7 @@ void startDoResolve(void *p)
     auto luaconfsLocal = g_luaconfs.getLocal();
     std::string appliedPolicy;
     RecProtoBufMessage pbMessage(RecProtoBufMessage::Response);
+    std::string pbData; // the serialized pbMessage, which also goes into the packet cache
 #ifdef HAVE_PROTOBUF
     if (luaconfsLocal->protobufServer) {
       Netmask requestorNM(dc->d_remote, dc->d_remote.sin4.sin_family == AF_INET ? luaconfsLocal->protobufMaskV4 : luaconfsLocal->protobufMaskV6);
@@ -1001,7 +1058,7 @@ void startDoResolve(void *p)
       pbMessage.setAppliedPolicy(appliedPolicy);
       pbMessage.setPolicyTags(dc->d_policyTags);
       pbMessage.setQueryTime(dc->d_now.tv_sec, dc->d_now.tv_usec);
-      protobufLogResponse(luaconfsLocal->protobufServer, pbMessage);
+      protobufLogResponse(luaconfsLocal->protobufServer, pbMessage, pbData);
     }
 #endif
     if(!dc->d_tcp) {
@@ -1022,7 +1079,7 @@ void startDoResolve(void *p)
                                             g_now.tv_sec,
                                             pw.getHeader()->rcode == RCode::ServFail ? SyncRes::s_packetcacheservfailttl :
                                             min(minTTL,SyncRes::s_packetcachettl),
-                                            &pbMessage);
+                                            &pbData);
       }
       //      else cerr<<"Not putting in packet cache: "<<sr.wasVariable()<<endl;
     }
@@ -1385,22 +1442,26 @@ string* doProcessUDPQuestion(const std::string& question, const ComboAddress& fr
 
     bool cacheHit = false;
     RecProtoBufMessage pbMessage(DNSProtoBufMessage::DNSProtoBufMessageType::Response);
+    std::string pbData;
 #ifdef HAVE_PROTOBUF
     if(luaconfsLocal->protobufServer) {
       protobufLogQuery(luaconfsLocal->protobufServer, luaconfsLocal->protobufMaskV4, luaconfsLocal->protobufMaskV6, uniqueId, fromaddr, destaddr, ednssubnet, false, dh->id, question.size(), qname, qtype, qclass, std::string(), policyTags);
     }
 #endif /* HAVE_PROTOBUF */
 
-    cacheHit = (!SyncRes::s_nopacketcache && t_packetCache->getResponsePacket(ctag, question, g_now.tv_sec, &response, &age, &pbMessage));
+    cacheHit = (!SyncRes::s_nopacketcache && t_packetCache->getResponsePacket(ctag, question, g_now.tv_sec, &response, &age, &pbData));
     if (cacheHit) {
 #ifdef HAVE_PROTOBUF
       if(luaconfsLocal->protobufServer) {
+        if (!pbData.empty()) {
+          pbMessage.deserialize(pbData);
+        }
         Netmask requestorNM(fromaddr, fromaddr.sin4.sin_family == AF_INET ? luaconfsLocal->protobufMaskV4 : luaconfsLocal->protobufMaskV6);
         const ComboAddress& requestor = requestorNM.getMaskedNetwork();
         pbMessage.update(uniqueId, &requestor, &destaddr, false, dh->id);
         pbMessage.setEDNSSubnet(ednssubnet);
         pbMessage.setQueryTime(g_now.tv_sec, g_now.tv_usec);
-        protobufLogResponse(luaconfsLocal->protobufServer, pbMessage);
+        protobufLogResponse(luaconfsLocal->protobufServer, pbMessage, pbData);
       }
 #endif /* HAVE_PROTOBUF */
       if(!g_quiet)
@@ -1812,6 +1873,7 @@ static void houseKeeping(void *)
       DTime dt;
       dt.setTimeval(now);
       t_RC->doPrune(); // this function is local to a thread, so fine anyhow
+      pruneTCPOutConnections(now);
       t_packetCache->doPruneTo(::arg().asNum("max-packetcache-entries") / g_numWorkerThreads);
 
       pruneCollection(t_sstorage->negcache, ::arg().asNum("max-cache-entries") / (g_numWorkerThreads * 10), 200);
@@ -1882,6 +1944,55 @@ static void houseKeeping(void *)
     }
 }
 
+// resolves a popular record that is about to expire from the cache, without any client waiting for it
+static void refreshAhead(void* p)
+{
+  std::unique_ptr<pair<DNSName, uint16_t> > request(reinterpret_cast<pair<DNSName, uint16_t>*>(p));
+  struct timeval now;
+  Utility::gettimeofday(&now, 0);
+
+  SyncRes sr(now);
+  sr.setDoEDNS0(true);
+  sr.setRefresh();
+  sr.d_doDNSSEC = g_dnssecmode != DNSSECMode::Off;
+
+  vector<DNSRecord> ret;
+  int res=-1;
+  try {
+    res=sr.beginResolve(request->first, QType(request->second), QClass::IN, ret);
+  }
+  catch(ImmediateServFailException& e) {
+    if(g_logCommonErrors)
+      L<<Logger::Notice<<"Refresh-ahead of "<<request->first<<"|"<<QType(request->second).getName()<<" failed: "<<e.reason<<endl;
+  }
+  catch(PDNSException& e) {
+    L<<Logger::Error<<"Refresh-ahead of "<<request->first<<"|"<<QType(request->second).getName()<<" failed: "<<e.reason<<endl;
+  }
+  catch(std::exception& e) {
+    L<<Logger::Error<<"Refresh-ahead of "<<request->first<<"|"<<QType(request->second).getName()<<" failed: "<<e.what()<<endl;
+  }
+
+  if(res == RCode::ServFail || res < 0)
+    g_stats.refreshAheadFailures++;
+}
+
+static void startRefreshAhead()
+{
+  static __thread MemRecursorCache::refreshqueue_t* queue;
+  if(!queue)
+    queue = new MemRecursorCache::refreshqueue_t();
+
+  t_RC->getRefreshAheadQueue(*queue);
+  for(const auto& request : *queue) {
+    if(MT->numProcesses() > g_maxMThreads) { // clients come first, a later hit can queue the entry again
+      t_RC->cancelRefreshAhead(request.first, request.second);
+      continue;
+    }
+    g_stats.refreshAheadQueries++;
+    MT->makeThread(refreshAhead, new pair<DNSName, uint16_t>(request));
+  }
+}
+
 void makeThreadPipes()
 {
   for(unsigned int n=0; n < g_numThreads; ++n) {
@@ -2605,6 +2716,17 @@ int serviceMain(int argc, char*argv[])
   }
 
   g_networkTimeoutMsec = ::arg().asNum("network-timeout");
+  g_tcpOutMaxIdleMsec = ::arg().asNum("tcp-out-max-idle-ms");
+  g_tcpOutMaxIdlePerAuth = ::arg().asNum("tcp-out-max-idle-per-auth");
+  UDPClientSocks::s_maxUses = ::arg().asNum("udp-source-port-max-uses");
+  UDPClientSocks::s_maxIdle = ::arg().asNum("udp-source-port-max-idle");
+  MemRecursorCache::s_refreshAheadPerc = ::arg().asNum("refresh-ahead");
+  if(MemRecursorCache::s_refreshAheadPerc > 100) {
+    L<<Logger::Error<<"refresh-ahead is a percentage of the TTL and can't be larger than 100"<<endl;
+    exit(99);
+  }
+  MemRecursorCache::s_refreshAheadMinHits = ::arg().asNum("refresh-ahead-min-hits");
+  MemRecursorCache::s_maxStaleTTL = ::arg().asNum("max-stale-ttl");
 
   g_initialDomainMap = parseAuthAndForwards();
 
@@ -2633,6 +2755,8 @@ int serviceMain(int argc, char*argv[])
     L.toConsole(Logger::Critical);
     daemonize();
   }
+  if(::arg().mustDo("log-async"))
+    L.setAsync(::arg().asNum("log-async-queue-size"), ::arg().mustDo("log-async-drop"));
   signal(SIGUSR1,usr1Handler);
   signal(SIGUSR2,usr2Handler);
   signal(SIGPIPE,SIG_IGN);
@@ -2748,7 +2872,7 @@ try
     t_servfailqueryring->set_capacity(ringsize);
   }
 
-  MT=new MTasker<PacketID,string>(::arg().asNum("stack-size"));
+  MT=new MTasker<PacketID,string>(::arg().asNum("stack-size"), ::arg().asNum("stack-cache-size"));
 
   PacketID pident;
 
@@ -2787,6 +2911,10 @@ try
   for(;;) {
     while(MT->schedule(&g_now)); // MTasker letting the mthreads do their thing
 
+    if(MemRecursorCache::s_refreshAheadPerc) {
+      startRefreshAhead();
+    }
+
     if(!(counter%500)) {
       MT->makeThread(houseKeeping, 0);
     }
@@ -2864,6 +2992,7 @@ int main(int argc, char **argv)
 
   try {
     ::arg().set("stack-size","stack size per mthread")="200000";
+    ::arg().set("stack-cache-size","Number of stacks of finished mthreads kept per thread for reuse")="100";
     ::arg().set("soa-minimum-ttl","Don't change")="0";
     ::arg().set("no-shuffle","Don't change")="off";
     ::arg().set("local-port","port to listen on")="53";
@@ -2876,11 +3005,21 @@ int main(int argc, char **argv)
     ::arg().setSwitch("write-pid","Write a PID file")="yes";
     ::arg().set("loglevel","Amount of logging. Higher is more. Do not set below 3")="4";
     ::arg().set("disable-syslog","Disable logging to syslog, useful when running inside a supervisor that logs stdout")="no";
+    ::arg().setSwitch("log-async","Write out log messages from a separate thread")="no";
+    ::arg().set("log-async-queue-size","Number of log messages each thread can queue for the writer thread")="1024";
+    ::arg().setSwitch("log-async-drop","Drop log messages instead of waiting when a thread's log queue is full")="no";
     ::arg().set("log-common-errors","If we should log rather common errors")="no";
     ::arg().set("chroot","switch to chroot jail")="";
     ::arg().set("setgid","If set, change group id to this gid for more security")="";
     ::arg().set("setuid","If set, change user id to this uid for more security")="";
     ::arg().set("network-timeout", "Wait this nummer of milliseconds for network i/o")="1500";
+    ::arg().set("tcp-out-max-idle-ms", "Time in milliseconds an idle outgoing TCP connection is kept for reuse")="10000";
+    ::arg().set("max-stale-ttl", "Keep expired records this many seconds to serve them when no authoritative server can be reached, 0 to disable")="0";
+    ::arg().set("refresh-ahead", "Refresh popular records in the background once they are in the last percentage of their TTL given here, 0 to disable")="0";
+    ::arg().set("refresh-ahead-min-hits", "Minimum number of cache hits a record needs before it is refreshed ahead of expiry")="10";
+    ::arg().set("udp-source-port-max-uses", "Maximum number of outgoing queries sent from the same UDP source port, 1 means a fresh port for every query")="1";
+    ::arg().set("udp-source-port-max-idle", "Maximum number of idle outgoing UDP sockets kept per thread and address family for reuse")="200";
+    ::arg().set("tcp-out-max-idle-per-auth", "Maximum number of idle outgoing TCP connections kept per thread and per authoritative server, 0 to disable reuse")="10";
     ::arg().set("threads", "Launch this number of threads")="2";
     ::arg().set("processes", "Launch this number of processes (EXPERIMENTAL, DO NOT CHANGE)")="1"; // if we un-experimental this, need to fix openssl rand seeding for multiple PIDs!
     ::arg().set("config-name","Name of this virtual configuration - will rename the binary image")="";
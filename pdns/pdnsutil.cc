@@ -228,8 +228,10 @@ bool rectifyZone(DNSSECKeeper& dk, const DNSName& zone)
 
   bool realrr=true;
   uint32_t maxent = ::arg().asNum("max-ent-entries");
+  vector<DNSOrderNameUpdate> updates;
 
   dononterm:;
+  updates.clear();
   for (const auto& qname: qnames)
   {
     bool auth=true;
@@ -261,18 +263,18 @@ bool rectifyZone(DNSSECKeeper& dk, const DNSName& zone)
 
     if(g_verbose)
       cerr<<"'"<<qname<<"' -> '"<< ordername <<"'"<<endl;
-    sd.db->updateDNSSECOrderNameAndAuth(sd.domain_id, zone, qname, ordername, auth);
+    updates.push_back({qname, ordername, auth, QType::ANY});
 
     if(realrr)
     {
       if (dsnames.count(qname))
-        sd.db->updateDNSSECOrderNameAndAuth(sd.domain_id, zone, qname, ordername, true, QType::DS);
+        updates.push_back({qname, ordername, true, QType::DS});
       if (!auth || nsset.count(qname)) {
         ordername.clear();
         if(isOptOut && !dsnames.count(qname))
-          sd.db->updateDNSSECOrderNameAndAuth(sd.domain_id, zone, qname, ordername, false, QType::NS);
-        sd.db->updateDNSSECOrderNameAndAuth(sd.domain_id, zone, qname, ordername, false, QType::A);
-        sd.db->updateDNSSECOrderNameAndAuth(sd.domain_id, zone, qname, ordername, false, QType::AAAA);
+          updates.push_back({qname, ordername, false, QType::NS});
+        updates.push_back({qname, ordername, false, QType::A});
+        updates.push_back({qname, ordername, false, QType::AAAA});
       }
 
       if(doent)
@@ -307,6 +309,9 @@ bool rectifyZone(DNSSECKeeper& dk, const DNSName& zone)
     }
   }
 
+  if(!updates.empty())
+    sd.db->updateDNSSECOrderNamesAndAuth(sd.domain_id, zone, updates);
+
   if(realrr)
   {
     //cerr<<"Total: "<<nonterm.size()<<" Insert: "<<insnonterm.size()<<" Delete: "<<delnonterm.size()<<endl;
@@ -374,6 +379,62 @@ void dbBench(const std::string& fname)
   cout<<"Packet cache reports: "<<S.read("query-cache-hit")<<" hits (should be 0) and "<<S.read("query-cache-miss") <<" misses"<<endl;
 }
 
+int loadZoneBench(const DNSName& zone, unsigned int count)
+{
+  UeberBackend B("default");
+  DomainInfo di;
+
+  if(!B.getDomainInfo(zone, di)) {
+    B.createDomain(zone);
+    if(!B.getDomainInfo(zone, di)) {
+      cerr<<"Domain '"<<zone<<"' was not created - perhaps backend ("<<::arg()["launch"]<<") does not support storing new zones."<<endl;
+      return EXIT_FAILURE;
+    }
+  }
+  DNSBackend* db = di.backend;
+
+  DNSResourceRecord rr;
+  rr.domain_id=di.id;
+  rr.auth=true;
+  rr.ttl=3600;
+
+  vector<DNSFeedRecord> feed;
+  feed.reserve(1000);
+
+  DTime dt;
+  dt.set();
+  if(!db->startTransaction(zone, di.id)) {
+    cerr<<"Unable to start transaction for load of zone '"<<zone<<"'"<<endl;
+    return EXIT_FAILURE;
+  }
+
+  rr.qname=zone;
+  rr.qtype=QType::SOA;
+  rr.content="ns1."+zone.toStringNoDot()+" hostmaster."+zone.toStringNoDot()+" 1 10800 3600 604800 3600";
+  feed.push_back(DNSFeedRecord(rr));
+  rr.qtype=QType::NS;
+  rr.content="ns1."+zone.toStringNoDot();
+  feed.push_back(DNSFeedRecord(rr));
+
+  rr.qtype=QType::A;
+  for(unsigned int n=0; n < count; ++n) {
+    rr.qname=DNSName("host"+std::to_string(n))+zone;
+    rr.content="10."+std::to_string((n>>16) & 0xff)+"."+std::to_string((n>>8) & 0xff)+"."+std::to_string(n & 0xff);
+    feed.push_back(DNSFeedRecord(rr));
+    if(feed.size() >= 1000) {
+      db->feedRecords(feed);
+      feed.clear();
+    }
+  }
+  if(!feed.empty())
+    db->feedRecords(feed);
+  db->commitTransaction();
+
+  unsigned int usec=dt.udiff();
+  cout<<"Loaded "<<count+2<<" records into '"<<zone<<"' in "<<usec/1000<<" ms, "<<(usec ? (count+2)*1000000.0/usec : 0)<<" records/s"<<endl;
+  return EXIT_SUCCESS;
+}
+
 void rectifyAllZones(DNSSECKeeper &dk) 
 {
   UeberBackend B("default");
@@ -1129,6 +1190,7 @@ int loadZone(DNSName zone, const string& fname) {
   }
   rr.domain_id=di.id;  
   bool haveSOA = false;
+  vector<DNSFeedRecord> feed;
   while(zpt.get(rr)) {
     if(!rr.qname.isPartOf(zone) && rr.qname!=zone) {
       cerr<<"File contains record named '"<<rr.qname<<"' which is not part of zone '"<<zone<<"'"<<endl;
@@ -1140,8 +1202,14 @@ int loadZone(DNSName zone, const string& fname) {
       else
         haveSOA = true;
     }
-    db->feedRecord(rr);
+    feed.push_back(DNSFeedRecord(rr));
+    if(feed.size() >= 1000) {
+      db->feedRecords(feed);
+      feed.clear();
+    }
   }
+  if(!feed.empty())
+    db->feedRecords(feed);
   db->commitTransaction();
   return EXIT_SUCCESS;
 }
@@ -1924,6 +1992,10 @@ try
     cout<<"backend-cmd BACKEND CMD [CMD..]    Perform one or more backend commands"<<endl;
     cout<<"b2b-migrate OLD NEW                Move all data from one backend to another"<<endl;
     cout<<"bench-db [filename]                Bench database backend with queries, one domain per line"<<endl;
+    cout<<"bind-build-snapshots [ZONE..]      Parse the zone files of the BIND backend and write their snapshots,"<<endl;
+    cout<<"                                   for all zones if none are given"<<endl;
+    cout<<"bench-load-zone ZONE [COUNT]       Bench loading a generated zone of COUNT A records into the backend,"<<endl;
+    cout<<"                                   replacing the contents of ZONE"<<endl;
     cout<<"check-zone ZONE                    Check a zone for correctness"<<endl;
     cout<<"check-all-zones [exit-on-error]    Check all zones for correctness. Set exit-on-error to exit immediately"<<endl;
     cout<<"                                   after finding an error in a zone."<<endl;
@@ -2097,6 +2169,13 @@ loadMainConfig(g_vm["config-dir"].as<string>());
   else if(cmds[0] == "bench-db") {
     dbBench(cmds.size() > 1 ? cmds[1] : "");
   }
+  else if(cmds[0] == "bench-load-zone") {
+    if(cmds.size() < 2) {
+      cerr<<"Syntax: pdnsutil bench-load-zone ZONE [COUNT]"<<endl;
+      return 0;
+    }
+    exit(loadZoneBench(DNSName(cmds[1]), cmds.size() > 2 ? pdns_stou(cmds[2]) : 100000));
+  }
   else if (cmds[0] == "check-all-zones") {
     bool exitOnError = ((cmds.size() >= 2 ? cmds[1] : "") == "exit-on-error");
     exit(checkAllZones(dk, exitOnError));
@@ -3118,10 +3197,16 @@ loadMainConfig(g_vm["config-dir"].as<string>());
       // move records
       if (!src->list(di.zone, di.id, true)) throw PDNSException("Failed to list records");
       nr=0;
+      vector<DNSFeedRecord> feed;
       while(src->get(rr)) {
-        if (!tgt->feedRecord(rr)) throw PDNSException("Failed to feed record");
+        feed.push_back(DNSFeedRecord(rr));
+        if (feed.size() >= 1000) {
+          if (!tgt->feedRecords(feed)) throw PDNSException("Failed to feed record");
+          feed.clear();
+        }
         nr++;
       }
+      if (!feed.empty() && !tgt->feedRecords(feed)) throw PDNSException("Failed to feed record");
       // move comments
       nc=0;
       if (src->listComments(di.id)) {
@@ -3166,6 +3251,24 @@ loadMainConfig(g_vm["config-dir"].as<string>());
 
     cout<<"Remember to drop the old backend and run rectify-all-zones"<<endl;
 
+    return 0;
+  } else if (cmds[0] == "bind-build-snapshots") {
+    bool found = false;
+    string cmd = "build-snapshots";
+    for(auto i=next(begin(cmds)); i != end(cmds); ++i)
+      cmd += " " + *i;
+
+    for(DNSBackend *b : BackendMakers().all()) {
+      if (!boost::starts_with(b->getPrefix(), "bind"))
+        continue;
+      found = true;
+      cout<<b->directBackendCmd(cmd);
+    }
+
+    if (!found) {
+      cerr<<"No BIND backend configured"<<endl;
+      return 1;
+    }
     return 0;
   } else if (cmds[0] == "backend-cmd") {
     if (cmds.size() < 3) {
@@ -3,58 +3,202 @@
 #include "dnsparser.hh"
 #include "gettime.hh"
 
+/* Field numbers of dnsmessage.proto */
+enum PBDNSMessageField { PBType = 1, PBMessageId = 2, PBSocketFamily = 4, PBSocketProtocol = 5, PBFrom = 6, PBTo = 7, PBInBytes = 8, PBTimeSec = 9, PBTimeUsec = 10, PBId = 11, PBQuestion = 12, PBResponse = 13, PBOriginalRequestorSubnet = 14 };
+enum PBDNSQuestionField { PBQName = 1, PBQType = 2, PBQClass = 3 };
+enum PBDNSResponseField { PBRCode = 1, PBRRs = 2, PBAppliedPolicy = 3, PBTags = 4, PBQueryTimeSec = 5, PBQueryTimeUsec = 6 };
+enum PBDNSRRField { PBRRName = 1, PBRRType = 2, PBRRClass = 3, PBRRTTL = 4, PBRRData = 5 };
+
+/* Message types, socket families and protocols, as enumerated in dnsmessage.proto */
+static const uint32_t s_pbDNSQueryType = 1;
+static const uint32_t s_pbDNSResponseType = 2;
+static const uint32_t s_pbINET = 1;
+static const uint32_t s_pbINET6 = 2;
+static const uint32_t s_pbUDP = 1;
+static const uint32_t s_pbTCP = 2;
+
+static const uint8_t s_pbVarint = 0;
+static const uint8_t s_pbLengthDelimited = 2;
+
+static size_t pbVarintSize(uint64_t value)
+{
+  size_t size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    size++;
+  }
+  return size;
+}
+
+/* buffer has to hold at least 10 bytes, returns the number of bytes used */
+static size_t pbEncodeVarint(char* buffer, uint64_t value)
+{
+  size_t len = 0;
+  while (value >= 0x80) {
+    buffer[len++] = static_cast<char>((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  buffer[len++] = static_cast<char>(value);
+  return len;
+}
+
+static void pbAppendVarint(std::string& out, uint64_t value)
+{
+  char buffer[10];
+  out.append(buffer, pbEncodeVarint(buffer, value));
+}
+
+static void pbAppendKey(std::string& out, uint32_t field, uint8_t wireType)
+{
+  pbAppendVarint(out, (field << 3) | wireType);
+}
+
+static size_t pbUIntSize(uint32_t field, uint64_t value)
+{
+  return pbVarintSize(field << 3) + pbVarintSize(value);
+}
+
+static void pbAppendUInt(std::string& out, uint32_t field, uint64_t value)
+{
+  pbAppendKey(out, field, s_pbVarint);
+  pbAppendVarint(out, value);
+}
+
+static size_t pbBytesSize(uint32_t field, size_t len)
+{
+  return pbVarintSize(field << 3) + pbVarintSize(len) + len;
+}
+
+static void pbAppendBytes(std::string& out, uint32_t field, const void* data, size_t len)
+{
+  pbAppendKey(out, field, s_pbLengthDelimited);
+  pbAppendVarint(out, len);
+  out.append(static_cast<const char*>(data), len);
+}
+
+/* For content whose length is only known once written: appends a one byte
+   placeholder for the length and returns its position, for pbFinishLength() */
+static size_t pbStartLength(std::string& out)
+{
+  out.append(1, 0);
+  return out.size() - 1;
+}
+
+static void pbFinishLength(std::string& out, size_t pos)
+{
+  size_t len = out.size() - pos - 1;
+  if (len < 0x80) {
+    out[pos] = static_cast<char>(len);
+    return;
+  }
+  char varint[10];
+  size_t varintLen = pbEncodeVarint(varint, len);
+  out[pos] = varint[0];
+  out.insert(pos + 1, varint + 1, varintLen - 1);
+}
+
+static void pbAppendName(std::string& out, uint32_t field, const DNSName& name)
+{
+  pbAppendKey(out, field, s_pbLengthDelimited);
+  size_t pos = pbStartLength(out);
+  name.appendToString(out);
+  pbFinishLength(out, pos);
+}
+
+static bool pbReadVarint(const char*& pos, const char* end, uint64_t& value)
+{
+  value = 0;
+  for (unsigned int shift = 0; pos < end && shift < 64; shift += 7) {
+    uint8_t byte = static_cast<uint8_t>(*pos++);
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Reads the field at pos. For varints, value is the value. For length-delimited
+   fields, value is the length and payload points to the content. */
+static bool pbReadField(const char*& pos, const char* end, uint32_t& field, uint8_t& wireType, uint64_t& value, const char*& payload)
+{
+  uint64_t key;
+  if (!pbReadVarint(pos, end, key) || !pbReadVarint(pos, end, value)) {
+    return false;
+  }
+  field = key >> 3;
+  wireType = key & 0x7;
+  if (wireType == s_pbLengthDelimited) {
+    if (value > static_cast<uint64_t>(end - pos)) {
+      return false;
+    }
+    payload = pos;
+    pos += value;
+  }
+  else if (wireType != s_pbVarint) {
+    return false;
+  }
+  return true;
+}
+
+static uint8_t pbCopyBytes(uint8_t* dest, const void* src, uint64_t len)
+{
+  if (len > 16) {
+    len = 16;
+  }
+  memcpy(dest, src, len);
+  return len;
+}
+
 DNSProtoBufMessage::DNSProtoBufMessage(DNSProtoBufMessageType type)
 {
 #ifdef HAVE_PROTOBUF
-  d_message.set_type(type == DNSProtoBufMessage::DNSProtoBufMessageType::Query ? PBDNSMessage_Type_DNSQueryType : PBDNSMessage_Type_DNSResponseType);
+  d_type = type == DNSProtoBufMessage::DNSProtoBufMessageType::Query ? s_pbDNSQueryType : s_pbDNSResponseType;
 #endif /* HAVE_PROTOBUF */
 }
 
 void DNSProtoBufMessage::setQuestion(const DNSName& qname, uint16_t qtype, uint16_t qclass)
 {
 #ifdef HAVE_PROTOBUF
-  PBDNSMessage_DNSQuestion* question = d_message.mutable_question();
-  if (question) {
-    question->set_qname(qname.toString());
-    question->set_qtype(qtype);
-    question->set_qclass(qclass);
-  }
+  d_fields |= HasQuestion;
+  d_question.clear();
+  pbAppendName(d_question, PBQName, qname);
+  pbAppendUInt(d_question, PBQType, qtype);
+  pbAppendUInt(d_question, PBQClass, qclass);
 #endif /* HAVE_PROTOBUF */
 }
 
 void DNSProtoBufMessage::setBytes(size_t bytes)
 {
 #ifdef HAVE_PROTOBUF
-  d_message.set_inbytes(bytes);
+  d_fields |= HasInBytes;
+  d_inBytes = bytes;
 #endif /* HAVE_PROTOBUF */
 }
 
 void DNSProtoBufMessage::setResponseCode(uint8_t rcode)
 {
 #ifdef HAVE_PROTOBUF
-  PBDNSMessage_DNSResponse* response = d_message.mutable_response();
-  if (response) {
-    response->set_rcode(rcode);
-  }
+  d_fields |= HasResponse | HasResponseRCode;
+  d_rcode = rcode;
 #endif /* HAVE_PROTOBUF */
 }
 
 void DNSProtoBufMessage::setTime(time_t sec, uint32_t usec)
 {
 #ifdef HAVE_PROTOBUF
-  d_message.set_timesec(sec);
-  d_message.set_timeusec(usec);
+  d_fields |= HasTimeSec | HasTimeUsec;
+  d_timeSec = sec;
+  d_timeUsec = usec;
 #endif /* HAVE_PROTOBUF */
 }
 
 void DNSProtoBufMessage::setQueryTime(time_t sec, uint32_t usec)
 {
 #ifdef HAVE_PROTOBUF
-  PBDNSMessage_DNSResponse* response = d_message.mutable_response();
-  if (response) {
-    response->set_querytimesec(sec);
-    response->set_querytimeusec(usec);
-  }
+  d_fields |= HasResponse | HasResponseQueryTimeSec | HasResponseQueryTimeUsec;
+  d_queryTimeSec = sec;
+  d_queryTimeUsec = usec;
 #endif /* HAVE_PROTOBUF */
 }
 
@@ -64,15 +208,46 @@ void DNSProtoBufMessage::setEDNSSubnet(const Netmask& subnet)
   if (!subnet.empty()) {
     const ComboAddress ca = subnet.getNetwork();
     if (ca.sin4.sin_family == AF_INET) {
-      d_message.set_originalrequestorsubnet(&ca.sin4.sin_addr.s_addr, sizeof(ca.sin4.sin_addr.s_addr));
+      d_fields |= HasOriginalRequestorSubnet;
+      d_subnetLen = pbCopyBytes(d_subnet, &ca.sin4.sin_addr.s_addr, sizeof(ca.sin4.sin_addr.s_addr));
     }
     else if (ca.sin4.sin_family == AF_INET6) {
-      d_message.set_originalrequestorsubnet(&ca.sin6.sin6_addr.s6_addr, sizeof(ca.sin6.sin6_addr.s6_addr));
+      d_fields |= HasOriginalRequestorSubnet;
+      d_subnetLen = pbCopyBytes(d_subnet, &ca.sin6.sin6_addr.s6_addr, sizeof(ca.sin6.sin6_addr.s6_addr));
     }
   }
 #endif /* HAVE_PROTOBUF */
 }
 
+void DNSProtoBufMessage::encodeRR(std::string& rrs, const DNSName& name, uint16_t type, uint16_t qclass, uint32_t ttl, const char* rdata, size_t rdataLen)
+{
+  pbAppendKey(rrs, PBRRs, s_pbLengthDelimited);
+  size_t pos = pbStartLength(rrs);
+  pbAppendName(rrs, PBRRName, name);
+  pbAppendUInt(rrs, PBRRType, type);
+  pbAppendUInt(rrs, PBRRClass, qclass);
+  pbAppendUInt(rrs, PBRRTTL, ttl);
+  pbAppendBytes(rrs, PBRRData, rdata, rdataLen);
+  pbFinishLength(rrs, pos);
+}
+
+void DNSProtoBufMessage::encodeRR(std::string& rrs, const DNSName& name, uint16_t type, uint16_t qclass, uint32_t ttl, const DNSName& rdata)
+{
+  pbAppendKey(rrs, PBRRs, s_pbLengthDelimited);
+  size_t pos = pbStartLength(rrs);
+  pbAppendName(rrs, PBRRName, name);
+  pbAppendUInt(rrs, PBRRType, type);
+  pbAppendUInt(rrs, PBRRClass, qclass);
+  pbAppendUInt(rrs, PBRRTTL, ttl);
+  pbAppendName(rrs, PBRRData, rdata);
+  pbFinishLength(rrs, pos);
+}
+
+void DNSProtoBufMessage::addTag(const std::string& tag)
+{
+  pbAppendBytes(d_tags, PBTags, tag.c_str(), tag.size());
+}
+
 void DNSProtoBufMessage::addRRsFromPacket(const char* packet, const size_t len)
 {
 #ifdef HAVE_PROTOBUF
@@ -87,9 +262,7 @@ void DNSProtoBufMessage::addRRsFromPacket(const char* packet, const size_t len)
   if (ntohs(dh->qdcount) == 0)
     return;
 
-  PBDNSMessage_DNSResponse* response = d_message.mutable_response();
-  if (!response)
-    return;
+  d_fields |= HasResponse;
 
   vector<uint8_t> content(len - sizeof(dnsheader));
   copy(packet + sizeof(dnsheader), packet + len, content.begin());
@@ -127,14 +300,7 @@ void DNSProtoBufMessage::addRRsFromPacket(const char* packet, const size_t len)
     pr.xfrBlob(blob);
 
     if (ah.d_type == QType::A || ah.d_type == QType::AAAA) {
-      PBDNSMessage_DNSResponse_DNSRR* rr = response->add_rrs();
-      if (rr) {
-        rr->set_name(rrname.toString());
-        rr->set_type(ah.d_type);
-        rr->set_class_(ah.d_class);
-        rr->set_ttl(ah.d_ttl);
-        rr->set_rdata(blob.c_str(), blob.length());
-      }
+      encodeRR(d_rrs, rrname, ah.d_type, ah.d_class, ah.d_ttl, blob.c_str(), blob.length());
     }
   }
 #endif /* HAVE_PROTOBUF */
@@ -142,15 +308,297 @@ void DNSProtoBufMessage::addRRsFromPacket(const char* packet, const size_t len)
 
 void DNSProtoBufMessage::serialize(std::string& data) const
 {
+  data.clear();
 #ifdef HAVE_PROTOBUF
-  d_message.SerializeToString(&data);
+  /* fields have to be written in the order of their numbers to match libprotobuf */
+  if (d_type) {
+    pbAppendUInt(data, PBType, d_type);
+  }
+  if (d_fields & HasMessageId) {
+    pbAppendBytes(data, PBMessageId, d_messageId, d_messageIdLen);
+  }
+  if (d_fields & HasSocketFamily) {
+    pbAppendUInt(data, PBSocketFamily, d_socketFamily);
+  }
+  if (d_fields & HasSocketProtocol) {
+    pbAppendUInt(data, PBSocketProtocol, d_socketProtocol);
+  }
+  if (d_fields & HasFrom) {
+    pbAppendBytes(data, PBFrom, d_from, d_fromLen);
+  }
+  if (d_fields & HasTo) {
+    pbAppendBytes(data, PBTo, d_to, d_toLen);
+  }
+  if (d_fields & HasInBytes) {
+    pbAppendUInt(data, PBInBytes, d_inBytes);
+  }
+  if (d_fields & HasTimeSec) {
+    pbAppendUInt(data, PBTimeSec, d_timeSec);
+  }
+  if (d_fields & HasTimeUsec) {
+    pbAppendUInt(data, PBTimeUsec, d_timeUsec);
+  }
+  if (d_fields & HasId) {
+    pbAppendUInt(data, PBId, d_id);
+  }
+  if (d_fields & HasQuestion) {
+    pbAppendBytes(data, PBQuestion, d_question.c_str(), d_question.size());
+  }
+  if (d_fields & HasResponse) {
+    size_t responseSize = d_rrs.size() + d_tags.size();
+    if (d_fields & HasResponseRCode) {
+      responseSize += pbUIntSize(PBRCode, d_rcode);
+    }
+    if (d_fields & HasResponseAppliedPolicy) {
+      responseSize += pbBytesSize(PBAppliedPolicy, d_appliedPolicy.size());
+    }
+    if (d_fields & HasResponseQueryTimeSec) {
+      responseSize += pbUIntSize(PBQueryTimeSec, d_queryTimeSec);
+    }
+    if (d_fields & HasResponseQueryTimeUsec) {
+      responseSize += pbUIntSize(PBQueryTimeUsec, d_queryTimeUsec);
+    }
+
+    pbAppendKey(data, PBResponse, s_pbLengthDelimited);
+    pbAppendVarint(data, responseSize);
+    if (d_fields & HasResponseRCode) {
+      pbAppendUInt(data, PBRCode, d_rcode);
+    }
+    data.append(d_rrs);
+    if (d_fields & HasResponseAppliedPolicy) {
+      pbAppendBytes(data, PBAppliedPolicy, d_appliedPolicy.c_str(), d_appliedPolicy.size());
+    }
+    data.append(d_tags);
+    if (d_fields & HasResponseQueryTimeSec) {
+      pbAppendUInt(data, PBQueryTimeSec, d_queryTimeSec);
+    }
+    if (d_fields & HasResponseQueryTimeUsec) {
+      pbAppendUInt(data, PBQueryTimeUsec, d_queryTimeUsec);
+    }
+  }
+  if (d_fields & HasOriginalRequestorSubnet) {
+    pbAppendBytes(data, PBOriginalRequestorSubnet, d_subnet, d_subnetLen);
+  }
 #endif /* HAVE_PROTOBUF */
 }
 
+bool DNSProtoBufMessage::deserialize(const std::string& data)
+{
+#ifdef HAVE_PROTOBUF
+  d_question.clear();
+  d_rrs.clear();
+  d_appliedPolicy.clear();
+  d_tags.clear();
+  d_fields = 0;
+  d_type = 0;
+
+  const char* pos = data.c_str();
+  const char* end = pos + data.size();
+  uint32_t field;
+  uint8_t wireType;
+  uint64_t value;
+  const char* payload = nullptr;
+
+  while (pos < end) {
+    if (!pbReadField(pos, end, field, wireType, value, payload)) {
+      return false;
+    }
+
+    if (wireType == s_pbVarint) {
+      switch (field) {
+      case PBType: d_type = value; break;
+      case PBSocketFamily: d_fields |= HasSocketFamily; d_socketFamily = value; break;
+      case PBSocketProtocol: d_fields |= HasSocketProtocol; d_socketProtocol = value; break;
+      case PBInBytes: d_fields |= HasInBytes; d_inBytes = value; break;
+      case PBTimeSec: d_fields |= HasTimeSec; d_timeSec = value; break;
+      case PBTimeUsec: d_fields |= HasTimeUsec; d_timeUsec = value; break;
+      case PBId: d_fields |= HasId; d_id = value; break;
+      }
+      continue;
+    }
+
+    switch (field) {
+    case PBMessageId: d_fields |= HasMessageId; d_messageIdLen = pbCopyBytes(d_messageId, payload, value); break;
+    case PBFrom: d_fields |= HasFrom; d_fromLen = pbCopyBytes(d_from, payload, value); break;
+    case PBTo: d_fields |= HasTo; d_toLen = pbCopyBytes(d_to, payload, value); break;
+    case PBOriginalRequestorSubnet: d_fields |= HasOriginalRequestorSubnet; d_subnetLen = pbCopyBytes(d_subnet, payload, value); break;
+    case PBQuestion: d_fields |= HasQuestion; d_question.assign(payload, value); break;
+    case PBResponse: {
+      d_fields |= HasResponse;
+      const char* rpos = payload;
+      const char* rend = payload + value;
+      while (rpos < rend) {
+        const char* start = rpos;
+        const char* rpayload = nullptr;
+        if (!pbReadField(rpos, rend, field, wireType, value, rpayload)) {
+          return false;
+        }
+        if (wireType == s_pbVarint) {
+          switch (field) {
+          case PBRCode: d_fields |= HasResponseRCode; d_rcode = value; break;
+          case PBQueryTimeSec: d_fields |= HasResponseQueryTimeSec; d_queryTimeSec = value; break;
+          case PBQueryTimeUsec: d_fields |= HasResponseQueryTimeUsec; d_queryTimeUsec = value; break;
+          }
+        }
+        else if (field == PBRRs) {
+          d_rrs.append(start, rpos - start); // kept encoded, key included
+        }
+        else if (field == PBAppliedPolicy) {
+          d_fields |= HasResponseAppliedPolicy;
+          d_appliedPolicy.assign(rpayload, value);
+        }
+        else if (field == PBTags) {
+          d_tags.append(start, rpos - start);
+        }
+      }
+      break;
+    }
+    }
+  }
+  return true;
+#else
+  return false;
+#endif /* HAVE_PROTOBUF */
+}
+
+/* What toDebugString() needs to know about the fields of dnsmessage.proto to
+   print them the way libprotobuf's DebugString() does */
+struct PBDebugField
+{
+  uint32_t number;
+  const char* name;
+  enum Kind { UInt, Enum, Bytes, Message } kind;
+  const char* const* values;        //!< names of the values, for enums
+  size_t valuesCount;
+  const PBDebugField* fields;       //!< fields of the nested message
+  size_t fieldsCount;
+};
+
+static const char* const s_pbTypeNames[] = { nullptr, "DNSQueryType", "DNSResponseType" };
+static const char* const s_pbSocketFamilyNames[] = { nullptr, "INET", "INET6" };
+static const char* const s_pbSocketProtocolNames[] = { nullptr, "UDP", "TCP" };
+
+static const PBDebugField s_pbDebugQuestion[] = {
+  { PBQName, "qName", PBDebugField::Bytes, nullptr, 0, nullptr, 0 },
+  { PBQType, "qType", PBDebugField::UInt, nullptr, 0, nullptr, 0 },
+  { PBQClass, "qClass", PBDebugField::UInt, nullptr, 0, nullptr, 0 }
+};
+
+static const PBDebugField s_pbDebugRR[] = {
+  { PBRRName, "name", PBDebugField::Bytes, nullptr, 0, nullptr, 0 },
+  { PBRRType, "type", PBDebugField::UInt, nullptr, 0, nullptr, 0 },
+  { PBRRClass, "class", PBDebugField::UInt, nullptr, 0, nullptr, 0 },
+  { PBRRTTL, "ttl", PBDebugField::UInt, nullptr, 0, nullptr, 0 },
+  { PBRRData, "rdata", PBDebugField::Bytes, nullptr, 0, nullptr, 0 }
+};
+
+static const PBDebugField s_pbDebugResponse[] = {
+  { PBRCode, "rcode", PBDebugField::UInt, nullptr, 0, nullptr, 0 },
+  { PBRRs, "rrs", PBDebugField::Message, nullptr, 0, s_pbDebugRR, sizeof(s_pbDebugRR) / sizeof(*s_pbDebugRR) },
+  { PBAppliedPolicy, "appliedPolicy", PBDebugField::Bytes, nullptr, 0, nullptr, 0 },
+  { PBTags, "tags", PBDebugField::Bytes, nullptr, 0, nullptr, 0 },
+  { PBQueryTimeSec, "queryTimeSec", PBDebugField::UInt, nullptr, 0, nullptr, 0 },
+  { PBQueryTimeUsec, "queryTimeUsec", PBDebugField::UInt, nullptr, 0, nullptr, 0 }
+};
+
+static const PBDebugField s_pbDebugMessage[] = {
+  { PBType, "type", PBDebugField::Enum, s_pbTypeNames, 3, nullptr, 0 },
+  { PBMessageId, "messageId", PBDebugField::Bytes, nullptr, 0, nullptr, 0 },
+  { PBSocketFamily, "socketFamily", PBDebugField::Enum, s_pbSocketFamilyNames, 3, nullptr, 0 },
+  { PBSocketProtocol, "socketProtocol", PBDebugField::Enum, s_pbSocketProtocolNames, 3, nullptr, 0 },
+  { PBFrom, "from", PBDebugField::Bytes, nullptr, 0, nullptr, 0 },
+  { PBTo, "to", PBDebugField::Bytes, nullptr, 0, nullptr, 0 },
+  { PBInBytes, "inBytes", PBDebugField::UInt, nullptr, 0, nullptr, 0 },
+  { PBTimeSec, "timeSec", PBDebugField::UInt, nullptr, 0, nullptr, 0 },
+  { PBTimeUsec, "timeUsec", PBDebugField::UInt, nullptr, 0, nullptr, 0 },
+  { PBId, "id", PBDebugField::UInt, nullptr, 0, nullptr, 0 },
+  { PBQuestion, "question", PBDebugField::Message, nullptr, 0, s_pbDebugQuestion, sizeof(s_pbDebugQuestion) / sizeof(*s_pbDebugQuestion) },
+  { PBResponse, "response", PBDebugField::Message, nullptr, 0, s_pbDebugResponse, sizeof(s_pbDebugResponse) / sizeof(*s_pbDebugResponse) },
+  { PBOriginalRequestorSubnet, "originalRequestorSubnet", PBDebugField::Bytes, nullptr, 0, nullptr, 0 }
+};
+
+/* escapes like protobuf's CEscape() */
+static void pbDebugEscape(std::string& out, const char* data, size_t len)
+{
+  for (size_t idx = 0; idx < len; idx++) {
+    uint8_t c = static_cast<uint8_t>(data[idx]);
+    switch (c) {
+    case '\n': out.append("\\n"); break;
+    case '\r': out.append("\\r"); break;
+    case '\t': out.append("\\t"); break;
+    case '\"': out.append("\\\""); break;
+    case '\'': out.append("\\'"); break;
+    case '\\': out.append("\\\\"); break;
+    default:
+      if (c < 0x20 || c >= 0x7f) {
+        char octal[5];
+        snprintf(octal, sizeof(octal), "\\%03o", c);
+        out.append(octal, 4);
+      }
+      else {
+        out.append(1, static_cast<char>(c));
+      }
+    }
+  }
+}
+
+/* prints the fields encoded between pos and end, as libprotobuf's DebugString() would */
+static void pbDebugString(std::string& out, const char* pos, const char* end, const PBDebugField* fields, size_t fieldsCount, size_t indent)
+{
+  uint32_t number;
+  uint8_t wireType;
+  uint64_t value;
+  const char* payload = nullptr;
+
+  while (pos < end && pbReadField(pos, end, number, wireType, value, payload)) {
+    const PBDebugField* field = nullptr;
+    for (size_t idx = 0; idx < fieldsCount; idx++) {
+      if (fields[idx].number == number) {
+        field = &fields[idx];
+        break;
+      }
+    }
+    if (field == nullptr || (wireType == s_pbVarint) != (field->kind == PBDebugField::UInt || field->kind == PBDebugField::Enum)) {
+      continue;
+    }
+
+    out.append(indent, ' ');
+    out.append(field->name);
+    switch (field->kind) {
+    case PBDebugField::UInt:
+      out.append(": " + std::to_string(value) + "\n");
+      break;
+    case PBDebugField::Enum:
+      if (value < field->valuesCount && field->values[value] != nullptr) {
+        out.append(": " + std::string(field->values[value]) + "\n");
+      }
+      else {
+        out.append(": " + std::to_string(value) + "\n");
+      }
+      break;
+    case PBDebugField::Bytes:
+      out.append(": \"");
+      pbDebugEscape(out, payload, value);
+      out.append("\"\n");
+      break;
+    case PBDebugField::Message:
+      out.append(" {\n");
+      pbDebugString(out, payload, payload + value, field->fields, field->fieldsCount, indent + 2);
+      out.append(indent, ' ');
+      out.append("}\n");
+      break;
+    }
+  }
+}
+
 std::string DNSProtoBufMessage::toDebugString() const
 {
 #ifdef HAVE_PROTOBUF
-  return d_message.DebugString();
+  std::string data;
+  serialize(data);
+  std::string ret;
+  pbDebugString(ret, data.c_str(), data.c_str() + data.size(), s_pbDebugMessage, sizeof(s_pbDebugMessage) / sizeof(*s_pbDebugMessage), 0);
+  return ret;
 #else
   return std::string();
 #endif /* HAVE_PROTOBUF */
@@ -160,9 +608,8 @@ std::string DNSProtoBufMessage::toDebugString() const
 
 void DNSProtoBufMessage::setUUID(const boost::uuids::uuid& uuid)
 {
-  std::string* messageId = d_message.mutable_messageid();
-  messageId->resize(uuid.size());
-  std::copy(uuid.begin(), uuid.end(), messageId->begin());
+  d_fields |= HasMessageId;
+  d_messageIdLen = pbCopyBytes(d_messageId, uuid.begin(), uuid.size());
 }
 
 void DNSProtoBufMessage::update(const boost::uuids::uuid& uuid, const ComboAddress* requestor, const ComboAddress* responder, bool isTCP, uint16_t id)
@@ -172,25 +619,30 @@ void DNSProtoBufMessage::update(const boost::uuids::uuid& uuid, const ComboAddre
   setTime(ts.tv_sec, ts.tv_nsec / 1000);
 
   setUUID(uuid);
-  d_message.set_id(ntohs(id));
+  d_fields |= HasId | HasSocketFamily | HasSocketProtocol;
+  d_id = ntohs(id);
 
-  d_message.set_socketfamily((requestor && requestor->sin4.sin_family == AF_INET) ? PBDNSMessage_SocketFamily_INET : PBDNSMessage_SocketFamily_INET6);
-  d_message.set_socketprotocol(isTCP ? PBDNSMessage_SocketProtocol_TCP : PBDNSMessage_SocketProtocol_UDP);
+  d_socketFamily = (requestor && requestor->sin4.sin_family == AF_INET) ? s_pbINET : s_pbINET6;
+  d_socketProtocol = isTCP ? s_pbTCP : s_pbUDP;
 
   if (responder) {
     if (responder->sin4.sin_family == AF_INET) {
-      d_message.set_to(&responder->sin4.sin_addr.s_addr, sizeof(responder->sin4.sin_addr.s_addr));
+      d_fields |= HasTo;
+      d_toLen = pbCopyBytes(d_to, &responder->sin4.sin_addr.s_addr, sizeof(responder->sin4.sin_addr.s_addr));
     }
     else if (responder->sin4.sin_family == AF_INET6) {
-      d_message.set_to(&responder->sin6.sin6_addr.s6_addr, sizeof(responder->sin6.sin6_addr.s6_addr));
+      d_fields |= HasTo;
+      d_toLen = pbCopyBytes(d_to, &responder->sin6.sin6_addr.s6_addr, sizeof(responder->sin6.sin6_addr.s6_addr));
     }
   }
   if (requestor) {
     if (requestor->sin4.sin_family == AF_INET) {
-      d_message.set_from(&requestor->sin4.sin_addr.s_addr, sizeof(requestor->sin4.sin_addr.s_addr));
+      d_fields |= HasFrom;
+      d_fromLen = pbCopyBytes(d_from, &requestor->sin4.sin_addr.s_addr, sizeof(requestor->sin4.sin_addr.s_addr));
     }
     else if (requestor->sin4.sin_family == AF_INET6) {
-      d_message.set_from(&requestor->sin6.sin6_addr.s6_addr, sizeof(requestor->sin6.sin6_addr.s6_addr));
+      d_fields |= HasFrom;
+      d_fromLen = pbCopyBytes(d_from, &requestor->sin6.sin6_addr.s6_addr, sizeof(requestor->sin6.sin6_addr.s6_addr));
     }
   }
 }
@@ -200,7 +652,7 @@ DNSProtoBufMessage::DNSProtoBufMessage(DNSProtoBufMessageType type, const boost:
 {
   update(uuid, requestor, to, isTCP, qid);
 
-  d_message.set_type(type == DNSProtoBufMessage::DNSProtoBufMessageType::Query ? PBDNSMessage_Type_DNSQueryType : PBDNSMessage_Type_DNSResponseType);
+  d_type = type == DNSProtoBufMessage::DNSProtoBufMessageType::Query ? s_pbDNSQueryType : s_pbDNSResponseType;
 
   setBytes(bytes);
   setQuestion(domain, qtype, qclass);
@@ -1,4 +1,3 @@
-
 #pragma once
 
 #include <cstddef>
@@ -12,9 +11,13 @@
 #ifdef HAVE_PROTOBUF
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
-#include "dnsmessage.pb.h"
 #endif /* HAVE_PROTOBUF */
 
+/* Builds PBDNSMessage messages, as described in dnsmessage.proto.
+   We do not use the classes generated by protoc: the fields are kept as
+   plain values, or already encoded for the variable-length ones, and
+   serialize() writes the wire format directly. The output is the same, byte
+   for byte, as what libprotobuf produces for the same message. */
 class DNSProtoBufMessage
 {
 public:
@@ -40,15 +43,65 @@ public:
   void setQueryTime(time_t sec, uint32_t usec);
   void setResponseCode(uint8_t rcode);
   void addRRsFromPacket(const char* packet, const size_t len);
+  //! replaces the content of data with the encoded message, reusing its buffer
   void serialize(std::string& data) const;
+  //! replaces this message with the one encoded in data, as produced by serialize(). Returns false if data could not be parsed
+  bool deserialize(const std::string& data);
   std::string toDebugString() const;
 
 #ifdef HAVE_PROTOBUF
   DNSProtoBufMessage(DNSProtoBufMessage::DNSProtoBufMessageType type, const boost::uuids::uuid& uuid, const ComboAddress* requestor, const ComboAddress* responder, const DNSName& domain, int qtype, uint16_t qclass, uint16_t qid, bool isTCP, size_t bytes);
   void update(const boost::uuids::uuid& uuid, const ComboAddress* requestor, const ComboAddress* responder, bool isTCP, uint16_t id);
   void setUUID(const boost::uuids::uuid& uuid);
+#endif /* HAVE_PROTOBUF */
 
 protected:
-  PBDNSMessage d_message;
-#endif /* HAVE_PROTOBUF */
+  /* which optional fields have been set, since proto2 serializes a field
+     that has been set even if it holds its default value */
+  enum Field : uint32_t {
+    HasMessageId = 1 << 0,
+    HasSocketFamily = 1 << 1,
+    HasSocketProtocol = 1 << 2,
+    HasFrom = 1 << 3,
+    HasTo = 1 << 4,
+    HasInBytes = 1 << 5,
+    HasTimeSec = 1 << 6,
+    HasTimeUsec = 1 << 7,
+    HasId = 1 << 8,
+    HasQuestion = 1 << 9,
+    HasResponse = 1 << 10,
+    HasOriginalRequestorSubnet = 1 << 11,
+    HasResponseRCode = 1 << 12,
+    HasResponseAppliedPolicy = 1 << 13,
+    HasResponseQueryTimeSec = 1 << 14,
+    HasResponseQueryTimeUsec = 1 << 15
+  };
+
+  static void encodeRR(std::string& rrs, const DNSName& name, uint16_t type, uint16_t qclass, uint32_t ttl, const char* rdata, size_t rdataLen);
+  static void encodeRR(std::string& rrs, const DNSName& name, uint16_t type, uint16_t qclass, uint32_t ttl, const DNSName& rdata);
+  void addTag(const std::string& tag);
+
+  std::string d_question;      //!< encoded content of the DNSQuestion
+  std::string d_rrs;           //!< encoded DNSResponse.rrs entries, field keys included
+  std::string d_appliedPolicy;
+  std::string d_tags;          //!< encoded DNSResponse.tags entries, field keys included
+  uint64_t d_inBytes{0};
+  uint32_t d_fields{0};
+  uint32_t d_type{0};
+  uint32_t d_socketFamily{0};
+  uint32_t d_socketProtocol{0};
+  uint32_t d_timeSec{0};
+  uint32_t d_timeUsec{0};
+  uint32_t d_id{0};
+  uint32_t d_rcode{0};
+  uint32_t d_queryTimeSec{0};
+  uint32_t d_queryTimeUsec{0};
+  uint8_t d_messageId[16];
+  uint8_t d_from[16];
+  uint8_t d_to[16];
+  uint8_t d_subnet[16];
+  uint8_t d_messageIdLen{0};
+  uint8_t d_fromLen{0};
+  uint8_t d_toLen{0};
+  uint8_t d_subnetLen{0};
 };
@@ -5,10 +5,7 @@
 void RecProtoBufMessage::addRR(const DNSRecord& record)
 {
 #ifdef HAVE_PROTOBUF
-  PBDNSMessage_DNSResponse* response = d_message.mutable_response();
-  if (!response) {
-    return;
-  }
+  d_fields |= HasResponse;
 
   if (record.d_place != DNSResourceRecord::ANSWER ||
       record.d_class != QClass::IN ||
@@ -18,28 +15,18 @@ void RecProtoBufMessage::addRR(const DNSRecord& record)
     return;
   }
 
-   PBDNSMessage_DNSResponse_DNSRR* pbRR = response->add_rrs();
-   if (!pbRR) {
-     return;
-   }
-
-   pbRR->set_name(record.d_name.toString());
-   pbRR->set_type(record.d_type);
-   pbRR->set_class_(record.d_class);
-   pbRR->set_ttl(record.d_ttl);
    if (record.d_type == QType::A) {
      const ARecordContent& arc = dynamic_cast<const ARecordContent&>(*(record.d_content));
      ComboAddress data = arc.getCA();
-     pbRR->set_rdata(&data.sin4.sin_addr.s_addr, sizeof(data.sin4.sin_addr.s_addr));
+     encodeRR(d_rrs, record.d_name, record.d_type, record.d_class, record.d_ttl, reinterpret_cast<const char*>(&data.sin4.sin_addr.s_addr), sizeof(data.sin4.sin_addr.s_addr));
    }
    else if (record.d_type == QType::AAAA) {
      const AAAARecordContent& arc = dynamic_cast<const AAAARecordContent&>(*(record.d_content));
      ComboAddress data = arc.getCA();
-     pbRR->set_rdata(&data.sin6.sin6_addr.s6_addr, sizeof(data.sin6.sin6_addr.s6_addr));
+     encodeRR(d_rrs, record.d_name, record.d_type, record.d_class, record.d_ttl, reinterpret_cast<const char*>(&data.sin6.sin6_addr.s6_addr), sizeof(data.sin6.sin6_addr.s6_addr));
    } else if (record.d_type == QType::CNAME) {
      const CNAMERecordContent& crc = dynamic_cast<const CNAMERecordContent&>(*(record.d_content));
-     DNSName data = crc.getTarget();
-     pbRR->set_rdata(data.toString());
+     encodeRR(d_rrs, record.d_name, record.d_type, record.d_class, record.d_ttl, crc.getTarget());
    }
 #endif /* HAVE_PROTOBUF */
 }
@@ -54,9 +41,10 @@ void RecProtoBufMessage::addRRs(const std::vector<DNSRecord>& records)
 void RecProtoBufMessage::setAppliedPolicy(const std::string& policy)
 {
 #ifdef HAVE_PROTOBUF
-  PBDNSMessage_DNSResponse* response = d_message.mutable_response();
-  if (response && !policy.empty()) {
-    response->set_appliedpolicy(policy);
+  d_fields |= HasResponse;
+  if (!policy.empty()) {
+    d_fields |= HasResponseAppliedPolicy;
+    d_appliedPolicy = policy;
   }
 #endif /* HAVE_PROTOBUF */
 }
@@ -64,11 +52,9 @@ void RecProtoBufMessage::setAppliedPolicy(const std::string& policy)
 void RecProtoBufMessage::setPolicyTags(const std::vector<std::string>& policyTags)
 {
 #ifdef HAVE_PROTOBUF
-  PBDNSMessage_DNSResponse* response = d_message.mutable_response();
-  if (response) {
-    for (const auto& tag : policyTags) {
-      response->add_tags(tag);
-    }
+  d_fields |= HasResponse;
+  for (const auto& tag : policyTags) {
+    addTag(tag);
   }
 #endif /* HAVE_PROTOBUF */
 }
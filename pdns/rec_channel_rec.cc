@@ -34,6 +34,7 @@
 
 #include "secpoll-recursor.hh"
 #include "pubsuffix.hh"
+#include "lwres.hh"
 #include "namespaces.hh"
 pthread_mutex_t g_carbon_config_lock=PTHREAD_MUTEX_INITIALIZER;
 
@@ -586,6 +587,22 @@ static uint64_t calculateUptime()
   return time(0) - g_stats.startupTime;
 }
 
+static uint64_t getLogMessagesDropped()
+{
+  return L.getDroppedMessages();
+}
+
+static uint64_t getProtobufStat(uint64_t (RemoteLogger::*getter)() const)
+{
+#ifdef HAVE_PROTOBUF
+  auto luaconf = g_luaconfs.getLocal();
+  if (luaconf->protobufServer) {
+    return ((*luaconf->protobufServer).*getter)();
+  }
+#endif
+  return 0;
+}
+
 static string* pleaseGetCurrentQueries()
 {
   ostringstream ostr;
@@ -664,6 +681,26 @@ static uint64_t getConcurrentQueries()
   return broadcastAccFunction<uint64_t>(pleaseGetConcurrentQueries);
 }
 
+uint64_t* pleaseGetTCPOutConnectionsIdle()
+{
+  return new uint64_t(getTCPOutConnectionsIdle());
+}
+
+static uint64_t doGetTCPOutConnectionsIdle()
+{
+  return broadcastAccFunction<uint64_t>(pleaseGetTCPOutConnectionsIdle);
+}
+
+uint64_t* pleaseGetMThreadStackUsage(size_t bucket)
+{
+  return new uint64_t(MT->getStackUsageHistogram().at(bucket));
+}
+
+static uint64_t getMThreadStackUsage(size_t bucket)
+{
+  return broadcastAccFunction<uint64_t>(boost::bind(pleaseGetMThreadStackUsage, bucket));
+}
+
 uint64_t* pleaseGetCacheSize()
 {
   return new uint64_t(t_RC->size());
@@ -832,6 +869,12 @@ RecursorControlParser::RecursorControlParser()
   addGetStat("dlg-only-drops", &SyncRes::s_nodelegated);
   addGetStat("ignored-packets", &g_stats.ignoredCount);
   addGetStat("max-mthread-stack", &g_stats.maxMThreadStackUsage);
+  addGetStat("mthread-stack-usage-0-16k", boost::bind(getMThreadStackUsage, 0));
+  addGetStat("mthread-stack-usage-16k-32k", boost::bind(getMThreadStackUsage, 1));
+  addGetStat("mthread-stack-usage-32k-64k", boost::bind(getMThreadStackUsage, 2));
+  addGetStat("mthread-stack-usage-64k-128k", boost::bind(getMThreadStackUsage, 3));
+  addGetStat("mthread-stack-usage-128k-256k", boost::bind(getMThreadStackUsage, 4));
+  addGetStat("mthread-stack-usage-256k-plus", boost::bind(getMThreadStackUsage, 5));
   
   addGetStat("negcache-entries", boost::bind(getNegCacheSize));
   addGetStat("throttle-entries", boost::bind(getThrottleSize)); 
@@ -845,6 +888,9 @@ RecursorControlParser::RecursorControlParser()
   addGetStat("outgoing4-timeouts", &SyncRes::s_outgoing4timeouts);
   addGetStat("outgoing6-timeouts", &SyncRes::s_outgoing6timeouts);
   addGetStat("tcp-outqueries", &SyncRes::s_tcpoutqueries);
+  addGetStat("tcp-out-connections-new", &g_stats.tcpOutConnectionsNew);
+  addGetStat("tcp-out-connections-reused", &g_stats.tcpOutConnectionsReused);
+  addGetStat("tcp-out-connections-idle", doGetTCPOutConnectionsIdle);
   addGetStat("all-outqueries", &SyncRes::s_outqueries);
   addGetStat("ipv6-outqueries", &g_stats.ipv6queries);
   addGetStat("throttled-outqueries", &SyncRes::s_throttledqueries);
@@ -852,6 +898,10 @@ RecursorControlParser::RecursorControlParser()
   addGetStat("throttled-out", &SyncRes::s_throttledqueries);
   addGetStat("unreachables", &SyncRes::s_unreachables);
   addGetStat("chain-resends", &g_stats.chainResends);
+  addGetStat("refresh-ahead-queries", &g_stats.refreshAheadQueries);
+  addGetStat("refresh-ahead-failures", &g_stats.refreshAheadFailures);
+  addGetStat("refresh-ahead-hits", &g_stats.refreshAheadHits);
+  addGetStat("stale-answers", &g_stats.staleAnswers);
   addGetStat("tcp-clients", boost::bind(TCPConnection::getCurrentConnections));
 
 #ifdef __linux__
@@ -871,6 +921,11 @@ RecursorControlParser::RecursorControlParser()
   addGetStat("uptime", calculateUptime);
   addGetStat("real-memory-usage", boost::bind(getRealMemoryUsage, string()));
   addGetStat("fd-usage", boost::bind(getOpenFileDescriptors, string()));  
+  addGetStat("log-messages-dropped", getLogMessagesDropped);
+  addGetStat("protobuf-queued", boost::bind(getProtobufStat, &RemoteLogger::getQueued));
+  addGetStat("protobuf-sent", boost::bind(getProtobufStat, &RemoteLogger::getSent));
+  addGetStat("protobuf-dropped", boost::bind(getProtobufStat, &RemoteLogger::getDropped));
+  addGetStat("protobuf-bytes", boost::bind(getProtobufStat, &RemoteLogger::getBytes));
 
   //  addGetStat("query-rate", getQueryRate);
   addGetStat("user-msec", getUserTimeMsec);
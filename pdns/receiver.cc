@@ -553,6 +553,9 @@ int main(int argc, char **argv)
         daemonize();
     }
 
+    if(::arg().mustDo("log-async"))
+      L.setAsync(::arg().asNum("log-async-queue-size"), ::arg().mustDo("log-async-drop"));
+
     if(isGuarded(argv)) {
       L<<Logger::Warning<<"This is a guarded instance of pdns"<<endl;
       dl=new DynListener; // listens on stdin 
@@ -585,6 +588,7 @@ int main(int argc, char **argv)
     DynListener::registerFunc("RETRIEVE",&DLNotifyRetrieveHandler, "retrieve slave domain", "<domain>");
     DynListener::registerFunc("CURRENT-CONFIG",&DLCurrentConfigHandler, "retrieve the current configuration");
     DynListener::registerFunc("LIST-ZONES",&DLListZones, "show list of zones", "[master|slave|native]");
+    DynListener::registerFunc("XFR-STATS",&DLTransferStatsHandler, "show statistics on incoming zone transfers", "[<domain>]");
     DynListener::registerFunc("POLICY",&DLPolicy, "interact with policy engine", "[policy command]");
     DynListener::registerFunc("TOKEN-LOGIN", &DLTokenLogin, "Login to a PKCS#11 token", "<module> <slot> <pin>");
 
@@ -102,7 +102,7 @@ bool RecursorPacketCache::getResponsePacket(unsigned int tag, const std::string&
 }
 
 bool RecursorPacketCache::getResponsePacket(unsigned int tag, const std::string& queryPacket, time_t now,
-                                            std::string* responsePacket, uint32_t* age, RecProtoBufMessage* protobufMessage)
+                                            std::string* responsePacket, uint32_t* age, std::string* protobufMessage)
 {
   uint32_t h = canHashPacket(queryPacket);
   auto& idx = d_packetCache.get<HashTag>();
@@ -158,7 +158,7 @@ void RecursorPacketCache::insertResponsePacket(unsigned int tag, const DNSName&
   insertResponsePacket(tag, qname, qtype, queryPacket, responsePacket, now, ttl, nullptr);
 }
 
-void RecursorPacketCache::insertResponsePacket(unsigned int tag, const DNSName& qname, uint16_t qtype, const std::string& queryPacket, const std::string& responsePacket, time_t now, uint32_t ttl, const RecProtoBufMessage* protobufMessage)
+void RecursorPacketCache::insertResponsePacket(unsigned int tag, const DNSName& qname, uint16_t qtype, const std::string& queryPacket, const std::string& responsePacket, time_t now, uint32_t ttl, const std::string* protobufMessage)
 {
   auto qhash = canHashPacket(queryPacket);
   auto& idx = d_packetCache.get<HashTag>();
@@ -213,6 +213,9 @@ uint64_t RecursorPacketCache::bytes()
   uint64_t sum=0;
   for(const struct Entry& e :  d_packetCache) {
     sum += sizeof(e) + e.d_packet.length() + 4;
+#ifdef HAVE_PROTOBUF
+    sum += e.d_protobufMessage.length();
+#endif
   }
   return sum;
 }
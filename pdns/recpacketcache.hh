@@ -4,6 +4,7 @@
 #include <set>
 #include <inttypes.h>
 #include "dns.hh"
+#include "dnsname.hh"
 #include "namespaces.hh"
 #include <iostream>
 #include <boost/multi_index_container.hpp>
@@ -15,7 +16,6 @@
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
-#include "rec-protobuf.hh"
 
 
 using namespace ::boost::multi_index;
@@ -31,8 +31,9 @@ public:
   RecursorPacketCache();
   bool getResponsePacket(unsigned int tag, const std::string& queryPacket, time_t now, std::string* responsePacket, uint32_t* age);
   void insertResponsePacket(unsigned int tag, const DNSName& qname, uint16_t qtype, const std::string& queryPacket, const std::string& responsePacket, time_t now, uint32_t ttd);
-  bool getResponsePacket(unsigned int tag, const std::string& queryPacket, time_t now, std::string* responsePacket, uint32_t* age, RecProtoBufMessage* protobufMessage);
-  void insertResponsePacket(unsigned int tag, const DNSName& qname, uint16_t qtype, const std::string& queryPacket, const std::string& responsePacket, time_t now, uint32_t ttd, const RecProtoBufMessage* protobufMessage);
+  //! protobufMessage receives the protobuf response stored with the packet, already serialized
+  bool getResponsePacket(unsigned int tag, const std::string& queryPacket, time_t now, std::string* responsePacket, uint32_t* age, std::string* protobufMessage);
+  void insertResponsePacket(unsigned int tag, const DNSName& qname, uint16_t qtype, const std::string& queryPacket, const std::string& responsePacket, time_t now, uint32_t ttd, const std::string* protobufMessage);
   void doPruneTo(unsigned int maxSize=250000);
   uint64_t doDump(int fd);
   int doWipePacketCache(const DNSName& name, uint16_t qtype=0xffff, bool subtree=false);
@@ -53,7 +54,7 @@ private:
     uint16_t d_type;
     mutable std::string d_packet; // "I know what I am doing"
 #ifdef HAVE_PROTOBUF
-    mutable RecProtoBufMessage d_protobufMessage;
+    mutable std::string d_protobufMessage;
 #endif
     uint32_t d_qhash;
     uint32_t d_tag;
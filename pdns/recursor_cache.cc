@@ -11,6 +11,10 @@
 #include "cachecleaner.hh"
 #include "namespaces.hh"
 
+unsigned int MemRecursorCache::s_refreshAheadPerc;
+unsigned int MemRecursorCache::s_refreshAheadMinHits;
+uint32_t MemRecursorCache::s_maxStaleTTL;
+
 unsigned int MemRecursorCache::size()
 {
   return (unsigned int)d_cache.size();
@@ -30,8 +34,8 @@ unsigned int MemRecursorCache::bytes()
   return ret;
 }
 
-// returns -1 for no hits
-int MemRecursorCache::get(time_t now, const DNSName &qname, const QType& qt, vector<DNSRecord>* res, const ComboAddress& who, vector<std::shared_ptr<RRSIGRecordContent>>* signatures)
+// returns -1 for no hits. With serveStale, expired entries still within s_maxStaleTTL are returned with a short TTL
+int MemRecursorCache::get(time_t now, const DNSName &qname, const QType& qt, vector<DNSRecord>* res, const ComboAddress& who, vector<std::shared_ptr<RRSIGRecordContent>>* signatures, bool serveStale)
 {
   unsigned int ttd=0;
   //  cerr<<"looking up "<< qname<<"|"+qt.getName()<<"\n";
@@ -56,12 +60,18 @@ int MemRecursorCache::get(time_t now, const DNSName &qname, const QType& qt, vec
       }
     }
     for(cache_t::const_iterator i=d_cachecache.first; i != d_cachecache.second; ++i)
-      if(i->d_ttd > now && ((i->d_qtype == qt.getCode() || qt.getCode()==QType::ANY ||
+      if((i->d_ttd > now || (serveStale && (time_t)i->d_ttd + s_maxStaleTTL > now)) && ((i->d_qtype == qt.getCode() || qt.getCode()==QType::ANY ||
 			    (qt.getCode()==QType::ADDR && (i->d_qtype == QType::A || i->d_qtype == QType::AAAA) )) 
 			    && (!haveSubnetSpecific || i->d_netmask.match(who)))
          ) {
 
-	ttd = i->d_ttd;	
+        bool stale = i->d_ttd <= now;
+	ttd = stale ? now + s_staleAnswerTTL : i->d_ttd;
+        if(res && s_refreshAheadPerc && !stale) {
+          if(i->d_refreshedTTD && i->d_refreshedTTD <= now) // without the refresh, this would have been a miss
+            g_stats.refreshAheadHits++;
+          checkRefreshAhead(now, *i);
+        }
         //        cerr<<"Looking at "<<i->d_records.size()<<" records for this name"<<endl;
 	for(auto k=i->d_records.begin(); k != i->d_records.end(); ++k) {
 	  if(res) {
@@ -70,7 +80,7 @@ int MemRecursorCache::get(time_t now, const DNSName &qname, const QType& qt, vec
 	    dr.d_type = i->d_qtype;
 	    dr.d_class = 1;
 	    dr.d_content = *k; 
-	    dr.d_ttl = i->d_ttd;
+	    dr.d_ttl = ttd;
 	    dr.d_place = DNSResourceRecord::ANSWER;
 	    res->push_back(dr);
 	  }
@@ -96,6 +106,30 @@ int MemRecursorCache::get(time_t now, const DNSName &qname, const QType& qt, vec
 
 
 
+// queue popular entries that are about to expire for a refresh in the background
+void MemRecursorCache::checkRefreshAhead(time_t now, const CacheEntry& ce)
+{
+  ce.d_hits++;
+  if(ce.d_refreshQueued || ce.d_hits < s_refreshAheadMinHits)
+    return;
+
+  if(!ce.d_netmask.empty()) // subnet specific answers can't be refreshed on behalf of the client
+    return;
+
+  if(((uint64_t)ce.d_ttd - now) * 100 > (uint64_t)ce.d_origTTL * s_refreshAheadPerc)
+    return;
+
+  ce.d_refreshQueued=true;
+  d_refreshQueue.push_back(make_pair(ce.d_qname, ce.d_qtype));
+}
+
+void MemRecursorCache::cancelRefreshAhead(const DNSName& qname, uint16_t qtype)
+{
+  auto range=d_cache.equal_range(tie(qname, qtype));
+  for(auto i=range.first; i != range.second; ++i)
+    i->d_refreshQueued=false;
+}
+
 bool MemRecursorCache::attemptToRefreshNSTTL(const QType& qt, const vector<DNSRecord>& content, const CacheEntry& stored)
 {
   if(!stored.d_auth) {
@@ -155,6 +189,7 @@ void MemRecursorCache::replace(time_t now, const DNSName &qname, const QType& qt
     }
   }
   ce.d_records.clear();
+  const uint32_t ttdBefore = ce.d_ttd;
 
   // limit TTL of auth->auth NSset update if needed, except for root 
   if(ce.d_auth && auth && qt.getCode()==QType::NS && !isNew && !qname.isRoot()) {
@@ -179,6 +214,11 @@ void MemRecursorCache::replace(time_t now, const DNSName &qname, const QType& qt
     // there was code here that did things with TTL and auth. Unsure if it was good. XXX
   }
 
+  ce.d_refreshedTTD = (ce.d_refreshQueued && ttdBefore > now) ? ttdBefore : 0;
+  ce.d_origTTL = ce.d_ttd > now ? ce.d_ttd - now : 0;
+  ce.d_hits = 0;
+  ce.d_refreshQueued = false;
+
   if (!isNew) {
     moveCacheItemToBack(d_cache, stored);
   }
@@ -32,7 +32,7 @@ public:
   }
   unsigned int size();
   unsigned int bytes();
-  int get(time_t, const DNSName &qname, const QType& qt, vector<DNSRecord>* res, const ComboAddress& who, vector<std::shared_ptr<RRSIGRecordContent>>* signatures=0);
+  int get(time_t, const DNSName &qname, const QType& qt, vector<DNSRecord>* res, const ComboAddress& who, vector<std::shared_ptr<RRSIGRecordContent>>* signatures=0, bool serveStale=false);
 
   void replace(time_t, const DNSName &qname, const QType& qt,  const vector<DNSRecord>& content, const vector<shared_ptr<RRSIGRecordContent>>& signatures, bool auth, boost::optional<Netmask> ednsmask=boost::optional<Netmask>());
   void doPrune(void);
@@ -44,19 +44,34 @@ public:
   bool doAgeCache(time_t now, const DNSName& name, uint16_t qtype, int32_t newTTL);
   uint64_t cacheHits, cacheMisses;
 
+  typedef vector<pair<DNSName, uint16_t> > refreshqueue_t;
+  //! hands over the names that are due for a refresh-ahead, and empties the queue
+  void getRefreshAheadQueue(refreshqueue_t& queue)
+  {
+    queue.clear();
+    queue.swap(d_refreshQueue);
+  }
+  //! for names handed over by getRefreshAheadQueue() that could not be refreshed after all, so a later hit queues them again
+  void cancelRefreshAhead(const DNSName& qname, uint16_t qtype);
+
+  static unsigned int s_refreshAheadPerc; //!< refresh entries in the last s_refreshAheadPerc percent of their TTL, 0 disables
+  static unsigned int s_refreshAheadMinHits; //!< but only once they have been hit this many times
+  static uint32_t s_maxStaleTTL; //!< keep expired entries around this many seconds, to be served when resolving fails
+  static const uint32_t s_staleAnswerTTL=30; //!< TTL of records served from stale entries, as suggested by RFC 8767
+
 private:
 
   struct CacheEntry
   {
     CacheEntry(const boost::tuple<DNSName, uint16_t, Netmask>& key, const vector<shared_ptr<DNSRecordContent>>& records, bool auth) : 
-      d_qname(key.get<0>()), d_qtype(key.get<1>()), d_auth(auth), d_ttd(0), d_records(records), d_netmask(key.get<2>())
+      d_qname(key.get<0>()), d_qtype(key.get<1>()), d_auth(auth), d_ttd(0), d_records(records), d_netmask(key.get<2>()), d_origTTL(0), d_refreshedTTD(0), d_hits(0), d_refreshQueued(false)
     {}
 
     typedef vector<std::shared_ptr<DNSRecordContent>> records_t;
     vector<std::shared_ptr<RRSIGRecordContent>> d_signatures;
-    uint32_t getTTD() const
+    time_t getTTD() const
     {
-      return d_ttd;
+      return (time_t)d_ttd + s_maxStaleTTL; // expired entries are only pruned once we can't serve them stale anymore either
     }
 
     DNSName d_qname; 
@@ -65,6 +80,10 @@ private:
     uint32_t d_ttd;
     records_t d_records;
     Netmask d_netmask;
+    uint32_t d_origTTL; // TTL at the time the records were stored
+    uint32_t d_refreshedTTD; // if these records were stored by a refresh-ahead, when the ones they replaced would have expired
+    mutable uint32_t d_hits; // hits since the records were stored
+    mutable bool d_refreshQueued;
   };
 
   typedef multi_index_container<
@@ -87,6 +106,8 @@ private:
   pair<cache_t::iterator, cache_t::iterator> d_cachecache;
   DNSName d_cachedqname;
   bool d_cachecachevalid;
+  refreshqueue_t d_refreshQueue;
   bool attemptToRefreshNSTTL(const QType& qt, const vector<DNSRecord>& content, const CacheEntry& stored);
+  void checkRefreshAhead(time_t now, const CacheEntry& ce);
 };
 #endif
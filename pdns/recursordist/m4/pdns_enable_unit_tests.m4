@@ -0,0 +1 @@
+../../../m4/pdns_enable_unit_tests.m4
\ No newline at end of file
@@ -0,0 +1,69 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <boost/test/unit_test.hpp>
+
+#include "recursor_cache.hh"
+#include "syncres.hh"
+
+BOOST_AUTO_TEST_SUITE(recursorcache_cc)
+
+static void store(MemRecursorCache& rc, time_t now, const DNSName& qname, uint32_t ttl)
+{
+  DNSRecord dr;
+  dr.d_name = qname;
+  dr.d_type = QType::A;
+  dr.d_class = QClass::IN;
+  dr.d_ttl = now + ttl;
+  dr.d_content = std::make_shared<ARecordContent>(ComboAddress("192.0.2.1"));
+  rc.replace(now, qname, QType(QType::A), vector<DNSRecord>(1, dr), vector<std::shared_ptr<RRSIGRecordContent>>(), true);
+}
+
+BOOST_AUTO_TEST_CASE(test_RefreshAheadQueue) {
+  reportAllTypes();
+  MemRecursorCache::s_refreshAheadPerc = 50;
+  MemRecursorCache::s_refreshAheadMinHits = 2;
+
+  MemRecursorCache rc;
+  const DNSName qname("www.powerdns.com.");
+  const time_t now = time(nullptr);
+  store(rc, now, qname, 100);
+
+  MemRecursorCache::refreshqueue_t queue;
+  vector<DNSRecord> ret;
+  BOOST_CHECK_GT(rc.get(now + 60, qname, QType(QType::A), &ret, ComboAddress()), 0);
+  rc.getRefreshAheadQueue(queue);
+  BOOST_CHECK(queue.empty()); // not popular enough yet
+
+  BOOST_CHECK_GT(rc.get(now + 10, qname, QType(QType::A), &ret, ComboAddress()), 0);
+  rc.getRefreshAheadQueue(queue);
+  BOOST_CHECK(queue.empty()); // popular, but too early
+
+  BOOST_CHECK_GT(rc.get(now + 60, qname, QType(QType::A), &ret, ComboAddress()), 0);
+  BOOST_CHECK_GT(rc.get(now + 61, qname, QType(QType::A), &ret, ComboAddress()), 0);
+  rc.getRefreshAheadQueue(queue);
+  BOOST_REQUIRE_EQUAL(queue.size(), 1U); // and queued only once
+  BOOST_CHECK_EQUAL(queue.at(0).first, qname);
+  BOOST_CHECK_EQUAL(queue.at(0).second, QType::A);
+
+  /* a refresh that could not be started makes room for a new attempt */
+  rc.cancelRefreshAhead(qname, QType::A);
+  BOOST_CHECK_GT(rc.get(now + 62, qname, QType(QType::A), &ret, ComboAddress()), 0);
+  rc.getRefreshAheadQueue(queue);
+  BOOST_CHECK_EQUAL(queue.size(), 1U);
+
+  /* hits after the replaced entry would have expired are counted as savings */
+  const uint64_t hits = g_stats.refreshAheadHits;
+  store(rc, now + 70, qname, 100);
+  BOOST_CHECK_GT(rc.get(now + 80, qname, QType(QType::A), &ret, ComboAddress()), 0);
+  BOOST_CHECK_EQUAL(g_stats.refreshAheadHits, hits);
+  BOOST_CHECK_GT(rc.get(now + 110, qname, QType(QType::A), &ret, ComboAddress()), 0);
+  BOOST_CHECK_EQUAL(g_stats.refreshAheadHits, hits + 1);
+
+  MemRecursorCache::s_refreshAheadPerc = 0;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
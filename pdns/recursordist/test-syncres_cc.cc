@@ -0,0 +1,188 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <boost/test/unit_test.hpp>
+
+#include "arguments.hh"
+#include "lua-recursor4.hh"
+#include "lwres.hh"
+#include "rec-lua-conf.hh"
+#include "recursor_cache.hh"
+#include "syncres.hh"
+
+RecursorStats g_stats;
+GlobalStateHolder<LuaConfigItems> g_luaconfs;
+__thread MemRecursorCache* t_RC;
+NetmaskGroup* g_dontQuery;
+SuffixMatchNode g_delegationOnly;
+unsigned int g_numThreads = 1;
+
+/* Fake the functions pdns_recursor.cc, rec-lua-conf.cc and reczones.cc would have provided. Outgoing
+   queries end up in s_answer, which plays an authoritative root server answering for everything. */
+static std::function<int(const DNSName&, int, LWResult*)> s_answer;
+static unsigned int s_outqueries;
+
+LuaConfigItems::LuaConfigItems()
+{
+}
+
+ArgvMap &arg()
+{
+  static ArgvMap theArg;
+  return theArg;
+}
+
+boost::optional<Netmask> getEDNSSubnetMask(const ComboAddress& local, const DNSName&dn, const ComboAddress& rem)
+{
+  return boost::none;
+}
+
+bool RecursorLua4::preoutquery(const ComboAddress& ns, const ComboAddress& requestor, const DNSName& query, const QType& qtype, bool isTcp, vector<DNSRecord>& res, int& ret)
+{
+  return false;
+}
+
+int asyncresolve(const ComboAddress& ip, const DNSName& domain, int type, bool doTCP, bool sendRDQuery, int EDNS0Level, struct timeval* now, boost::optional<Netmask>& srcmask, LWResult* res)
+{
+  s_outqueries++;
+  return s_answer(domain, type, res);
+}
+
+void primeHints(void)
+{
+  time_t now = time(nullptr);
+  DNSRecord nsrr, arr;
+  nsrr.d_name = DNSName(".");
+  nsrr.d_type = QType::NS;
+  nsrr.d_ttl = now + 3600000;
+  nsrr.d_content = std::make_shared<NSRecordContent>(DNSName("a.root-servers.net."));
+  arr.d_name = DNSName("a.root-servers.net.");
+  arr.d_type = QType::A;
+  arr.d_ttl = now + 3600000;
+  arr.d_content = std::make_shared<ARecordContent>(ComboAddress("198.41.0.4"));
+
+  t_RC->replace(now, arr.d_name, QType(QType::A), vector<DNSRecord>(1, arr), vector<std::shared_ptr<RRSIGRecordContent>>(), true);
+  t_RC->replace(now, nsrr.d_name, QType(QType::NS), vector<DNSRecord>(1, nsrr), vector<std::shared_ptr<RRSIGRecordContent>>(), false);
+}
+
+static void init()
+{
+  reportAllTypes();
+  ::arg().set("max-cache-entries")="100000";
+
+  SyncRes::s_maxnegttl = 3600;
+  SyncRes::s_maxcachettl = 86400;
+  SyncRes::s_serverdownmaxfails = 64;
+  SyncRes::s_serverdownthrottletime = 60;
+  SyncRes::s_maxqperq = 50;
+  SyncRes::s_maxtotusec = 7000000;
+  SyncRes::s_doIPv6 = false;
+  SyncRes::setDefaultLogMode(SyncRes::LogNone);
+  MemRecursorCache::s_maxStaleTTL = 0;
+
+  delete t_RC;
+  t_RC = new MemRecursorCache();
+  struct timeval now;
+  gettimeofday(&now, nullptr);
+  SyncRes sr(now); // allocates t_sstorage
+  if(!t_sstorage->domainmap)
+    t_sstorage->domainmap = new SyncRes::domainmap_t();
+  primeHints();
+  s_outqueries = 0;
+}
+
+static int resolve(const DNSName& qname, bool refresh, vector<DNSRecord>& ret)
+{
+  struct timeval now;
+  gettimeofday(&now, nullptr);
+  SyncRes sr(now);
+  sr.setRefresh(refresh);
+  ret.clear();
+  return sr.beginResolve(qname, QType(QType::A), QClass::IN, ret);
+}
+
+BOOST_AUTO_TEST_SUITE(syncres_cc)
+
+BOOST_AUTO_TEST_CASE(test_refresh_bypasses_cache) {
+  init();
+  const DNSName target("www.powerdns.com.");
+  uint32_t ttl = 60;
+  s_answer = [&](const DNSName& domain, int type, LWResult* res) {
+    res->d_rcode = RCode::NoError;
+    res->d_aabit = true;
+    res->d_records.clear();
+    if(domain == target && type == QType::A) {
+      DNSRecord dr;
+      dr.d_name = domain;
+      dr.d_type = QType::A;
+      dr.d_class = QClass::IN;
+      dr.d_ttl = ttl;
+      dr.d_place = DNSResourceRecord::ANSWER;
+      dr.d_content = std::make_shared<ARecordContent>(ComboAddress("192.0.2.1"));
+      res->d_records.push_back(dr);
+    }
+    return 1;
+  };
+
+  vector<DNSRecord> ret;
+  BOOST_CHECK_EQUAL(resolve(target, false, ret), RCode::NoError);
+  BOOST_CHECK_EQUAL(ret.size(), 1);
+  BOOST_CHECK_EQUAL(s_outqueries, 1);
+
+  const time_t now = time(nullptr);
+  vector<DNSRecord> cached;
+  int left = t_RC->get(now, target, QType(QType::A), &cached, ComboAddress());
+  BOOST_CHECK(left > 0 && left <= 60);
+
+  /* a regular resolution is answered from the still valid entry */
+  BOOST_CHECK_EQUAL(resolve(target, false, ret), RCode::NoError);
+  BOOST_CHECK_EQUAL(ret.size(), 1);
+  BOOST_CHECK_EQUAL(s_outqueries, 1);
+
+  /* a refresh goes out, and the new TTL replaces the one in the cache */
+  ttl = 3600;
+  BOOST_CHECK_EQUAL(resolve(target, true, ret), RCode::NoError);
+  BOOST_CHECK_EQUAL(ret.size(), 1);
+  BOOST_CHECK_EQUAL(s_outqueries, 2);
+
+  left = t_RC->get(now, target, QType(QType::A), &cached, ComboAddress());
+  BOOST_CHECK_GT(left, 60);
+  BOOST_CHECK_LE(left, 3601);
+}
+
+BOOST_AUTO_TEST_CASE(test_refresh_does_not_serve_stale) {
+  init();
+  MemRecursorCache::s_maxStaleTTL = 3600;
+  const DNSName target("www.powerdns.com.");
+  bool down = false;
+  s_answer = [&](const DNSName& domain, int type, LWResult* res) {
+    if(down)
+      return 0; // timeout
+    res->d_rcode = RCode::NoError;
+    res->d_aabit = true;
+    res->d_records.clear();
+    DNSRecord dr;
+    dr.d_name = domain;
+    dr.d_type = QType::A;
+    dr.d_class = QClass::IN;
+    dr.d_ttl = 60;
+    dr.d_place = DNSResourceRecord::ANSWER;
+    dr.d_content = std::make_shared<ARecordContent>(ComboAddress("192.0.2.1"));
+    res->d_records.push_back(dr);
+    return 1;
+  };
+
+  vector<DNSRecord> ret;
+  BOOST_CHECK_EQUAL(resolve(target, false, ret), RCode::NoError);
+
+  /* the failure of a refresh is reported, not papered over with what is in the cache */
+  down = true;
+  BOOST_CHECK_EQUAL(resolve(target, true, ret), RCode::ServFail);
+  BOOST_CHECK_EQUAL(g_stats.staleAnswers, 0);
+  MemRecursorCache::s_maxStaleTTL = 0;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -1,3 +1,4 @@
+#include <limits>
 #include <unistd.h>
 #include "remote_logger.hh"
 #include "config.h"
@@ -8,15 +9,16 @@
 #include "dolog.hh"
 #endif
 
-bool RemoteLogger::reconnect()
+bool RemoteLogger::reconnect(int& sock)
 {
-  if (d_socket >= 0) {
-    close(d_socket);
+  if (sock >= 0) {
+    close(sock);
+    sock = -1;
   }
   try {
-    d_socket = SSocket(d_remote.sin4.sin_family, SOCK_STREAM, 0);
-    SConnect(d_socket, d_remote);
-    setNonBlocking(d_socket);
+    sock = SSocket(d_remote.sin4.sin_family, SOCK_STREAM, 0);
+    SConnect(sock, d_remote);
+    setNonBlocking(sock);
   }
   catch(const std::exception& e) {
 #ifdef WE_ARE_RECURSOR
@@ -24,65 +26,123 @@ bool RemoteLogger::reconnect()
 #else
     warnlog("Error connecting to remote logger %s: %s", d_remote.toStringWithPort(), e.what());
 #endif
+    if (sock >= 0) {
+      close(sock);
+      sock = -1;
+    }
     return false;
   }
   return true;
 }
 
-bool RemoteLogger::sendData(const char* buffer, size_t bufferSize)
+/* The queue is a bounded multi-producer, multi-consumer ring as described by
+   Dmitry Vyukov: each slot carries a sequence number telling whether it is
+   ready to be written (seq == pos) or read (seq == pos + 1) for a given position. */
+bool RemoteLogger::push(const std::string& data)
 {
-  size_t pos = 0;
-  while(pos < bufferSize) {
-    ssize_t written = write(d_socket, buffer + pos, bufferSize - pos);
-    if (written == -1) {
-      int res = errno;
-      if (res == EWOULDBLOCK || res == EAGAIN) {
-        return false;
+  uint64_t pos = d_enqueuePos.load(std::memory_order_relaxed);
+  Slot* slot;
+  for (;;) {
+    slot = &d_slots[pos % d_maxQueuedEntries];
+    uint64_t seq = slot->d_seq.load(std::memory_order_acquire);
+    int64_t diff = static_cast<int64_t>(seq - pos);
+    if (diff == 0) {
+      if (d_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        break;
       }
-      else if (res != EINTR) {
-        reconnect();
-        return false;
+    }
+    else if (diff < 0) {
+      return false; // full
+    }
+    else {
+      pos = d_enqueuePos.load(std::memory_order_relaxed);
+    }
+  }
+
+  slot->d_data.assign(data); // reuses the capacity left by the previous message
+  slot->d_seq.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+/* appends the next message, with its length prefix, to buffer */
+bool RemoteLogger::pop(std::string& buffer)
+{
+  uint64_t pos = d_dequeuePos.load(std::memory_order_relaxed);
+  Slot* slot;
+  for (;;) {
+    slot = &d_slots[pos % d_maxQueuedEntries];
+    uint64_t seq = slot->d_seq.load(std::memory_order_acquire);
+    int64_t diff = static_cast<int64_t>(seq - (pos + 1));
+    if (diff == 0) {
+      if (d_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        break;
       }
     }
-    else if (written == 0) {
-      reconnect();
-      return false;
+    else if (diff < 0) {
+      return false; // empty
     }
     else {
-      pos += (size_t) written;
+      pos = d_dequeuePos.load(std::memory_order_relaxed);
     }
   }
 
+  uint16_t len = slot->d_data.length();
+  buffer.append(1, static_cast<char>(len >> 8));
+  buffer.append(1, static_cast<char>(len & 0xff));
+  buffer.append(slot->d_data);
+  slot->d_seq.store(pos + d_maxQueuedEntries, std::memory_order_release);
   return true;
 }
 
-void RemoteLogger::worker()
+bool RemoteLogger::empty() const
 {
+  uint64_t pos = d_dequeuePos.load(std::memory_order_acquire);
+  return d_slots[pos % d_maxQueuedEntries].d_seq.load(std::memory_order_acquire) != pos + 1;
+}
+
+void RemoteLogger::worker(size_t idx)
+{
+  int& sock = d_sockets.at(idx);
+  std::string buffer;
+  buffer.reserve(s_maxBatchSize + 2 + 65535);
+
   while(true) {
-    std::string data;
-    {
-      std::unique_lock<std::mutex> lock(d_writeMutex);
-      d_queueCond.wait(lock, [this]{return (!d_writeQueue.empty()) || d_exiting;});
-      if (d_exiting) {
-        return;
+    if (d_exiting) {
+      return;
+    }
+
+    buffer.clear();
+    uint64_t count = 0;
+    while (buffer.size() < s_maxBatchSize && pop(buffer)) {
+      count++;
+    }
+
+    if (count == 0) {
+      std::unique_lock<std::mutex> lock(d_idleMutex);
+      d_idleWorkers++;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      /* queueData() checks d_idleWorkers after pushing, so either it sees us
+         and wakes us up, or we see its message here */
+      if (empty() && !d_exiting) {
+        d_queueCond.wait_for(lock, std::chrono::milliseconds(100));
       }
-      data = d_writeQueue.front();
-      d_writeQueue.pop();
+      d_idleWorkers--;
+      continue;
     }
 
     try {
-      uint16_t len = data.length();
-      len = htons(len);
-      writen2WithTimeout(d_socket, &len, sizeof(len), (int) d_timeout);
-      writen2WithTimeout(d_socket, data.c_str(), data.length(), (int) d_timeout);
+      writen2WithTimeout(sock, buffer.c_str(), buffer.length(), (int) d_timeout);
+      d_sent += count;
+      d_bytes += buffer.length();
     }
     catch(const std::runtime_error& e) {
+      d_dropped += count;
 #ifdef WE_ARE_RECURSOR
       L<<Logger::Info<<"Error sending data to remote logger "<<d_remote.toStringWithPort()<<": "<< e.what()<<endl;
 #else
       vinfolog("Error sending data to remote logger (%s): %s", d_remote.toStringWithPort(), e.what());
 #endif
-      while (!reconnect()) {
+      while (!d_exiting && !reconnect(sock)) {
         sleep(d_reconnectWaitTime);
       }
     }
@@ -91,27 +151,61 @@ void RemoteLogger::worker()
 
 void RemoteLogger::queueData(const std::string& data)
 {
-  {
-    std::unique_lock<std::mutex> lock(d_writeMutex);
-    if (d_writeQueue.size() >= d_maxQueuedEntries) {
-      d_writeQueue.pop();
-    }
-    d_writeQueue.push(data);
+  if (data.length() > std::numeric_limits<uint16_t>::max() || !push(data)) {
+    d_dropped++;
+    return;
+  }
+  d_queued++;
+
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (d_idleWorkers.load() > 0) {
+    std::lock_guard<std::mutex> lock(d_idleMutex);
+    d_queueCond.notify_one();
   }
-  d_queueCond.notify_one();
 }
 
-RemoteLogger::RemoteLogger(const ComboAddress& remote, uint16_t timeout, uint64_t maxQueuedEntries, uint8_t reconnectWaitTime): d_remote(remote), d_maxQueuedEntries(maxQueuedEntries), d_timeout(timeout), d_reconnectWaitTime(reconnectWaitTime), d_thread(&RemoteLogger::worker, this)
+std::unordered_map<std::string, double> RemoteLogger::getStats() const
 {
-  reconnect();
+  return {
+    {"queued", d_queued},
+    {"sent", d_sent},
+    {"dropped", d_dropped},
+    {"bytes", d_bytes}
+  };
+}
+
+RemoteLogger::RemoteLogger(const ComboAddress& remote, uint16_t timeout, uint64_t maxQueuedEntries, uint8_t reconnectWaitTime, uint16_t connections): d_maxQueuedEntries(maxQueuedEntries > 0 ? maxQueuedEntries : 1), d_remote(remote), d_timeout(timeout), d_reconnectWaitTime(reconnectWaitTime)
+{
+  d_slots = std::unique_ptr<Slot[]>(new Slot[d_maxQueuedEntries]);
+  for (uint64_t idx = 0; idx < d_maxQueuedEntries; idx++) {
+    d_slots[idx].d_seq.store(idx, std::memory_order_relaxed);
+  }
+
+  if (connections == 0) {
+    connections = 1;
+  }
+  d_sockets.resize(connections, -1);
+  for (auto& sock : d_sockets) {
+    reconnect(sock);
+  }
+  for (size_t idx = 0; idx < d_sockets.size(); idx++) {
+    d_threads.push_back(std::thread(&RemoteLogger::worker, this, idx));
+  }
 }
 
 RemoteLogger::~RemoteLogger()
 {
   d_exiting = true;
-  if (d_socket >= 0)
-    close(d_socket);
-  d_queueCond.notify_one();
-  d_thread.join();
+  {
+    std::lock_guard<std::mutex> lock(d_idleMutex);
+    d_queueCond.notify_all();
+  }
+  for (auto& thread : d_threads) {
+    thread.join();
+  }
+  for (auto& sock : d_sockets) {
+    if (sock >= 0) {
+      close(sock);
+    }
+  }
 }
-
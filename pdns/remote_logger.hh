@@ -3,34 +3,65 @@
 
 #include <atomic>
 #include <condition_variable>
-#include <queue>
+#include <memory>
+#include <mutex>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include "iputils.hh"
 
+/* Sends length-prefixed messages (protobuf in practice) to a remote collector.
+   queueData() can be called from any number of threads: messages go into a
+   bounded lock-free ring whose slots keep their buffer between uses, so the
+   steady state does no allocation. One worker per connection takes as many
+   messages as it can from the ring and sends them in a single write. */
 class RemoteLogger
 {
 public:
-  RemoteLogger(const ComboAddress& remote, uint16_t timeout=2, uint64_t maxQueuedEntries=100, uint8_t reconnectWaitTime=1);
+  RemoteLogger(const ComboAddress& remote, uint16_t timeout=2, uint64_t maxQueuedEntries=100, uint8_t reconnectWaitTime=1, uint16_t connections=1);
   ~RemoteLogger();
+  //! the message is dropped, and counted as such, when the queue is full
   void queueData(const std::string& data);
   std::string toString()
   {
     return d_remote.toStringWithPort();
   }
+  uint64_t getQueued() const { return d_queued; }   //!< messages accepted into the queue
+  uint64_t getSent() const { return d_sent; }       //!< messages sent to the collector
+  uint64_t getDropped() const { return d_dropped; } //!< messages lost to a full queue or a failed send
+  uint64_t getBytes() const { return d_bytes; }     //!< bytes sent to the collector, framing included
+  std::unordered_map<std::string, double> getStats() const;
 private:
-  bool reconnect();
-  bool sendData(const char* buffer, size_t bufferSize);
-  void worker();
+  struct Slot
+  {
+    std::atomic<uint64_t> d_seq;
+    std::string d_data;
+  };
+
+  bool reconnect(int& sock);
+  bool push(const std::string& data);
+  bool pop(std::string& buffer);
+  bool empty() const;
+  void worker(size_t idx);
+
+  static const size_t s_maxBatchSize = 65536; //!< a worker stops taking messages from the queue once it has this much to send
 
-  std::queue<std::string> d_writeQueue;
-  std::mutex d_writeMutex;
+  std::unique_ptr<Slot[]> d_slots;
+  uint64_t d_maxQueuedEntries;
+  std::atomic<uint64_t> d_enqueuePos{0};
+  std::atomic<uint64_t> d_dequeuePos{0};
+  std::atomic<uint64_t> d_queued{0};
+  std::atomic<uint64_t> d_sent{0};
+  std::atomic<uint64_t> d_dropped{0};
+  std::atomic<uint64_t> d_bytes{0};
+  std::atomic<uint16_t> d_idleWorkers{0};
+  std::mutex d_idleMutex;
   std::condition_variable d_queueCond;
   ComboAddress d_remote;
-  uint64_t d_maxQueuedEntries;
-  int d_socket{-1};
+  std::vector<int> d_sockets;
+  std::vector<std::thread> d_threads;
   uint16_t d_timeout;
   uint8_t d_reconnectWaitTime;
-  std::thread d_thread;
   std::atomic<bool> d_exiting{false};
 };
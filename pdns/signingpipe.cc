@@ -3,266 +3,345 @@
 #endif
 #include "signingpipe.hh"
 #include "misc.hh"
-#include <poll.h>
+#include "lock.hh"
+#include "logger.hh"
+#include <atomic>
 
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <netinet/tcp.h>
-#include <sched.h>
+/* The signing threads are shared by all ChunkedSigningPipes in the process, and are started
+   when the first pipe that needs to sign is created. Every thread has its own queue of batches,
+   and steals from the back of the other queues when its own queue runs dry. */
 
-// deal with partial reads
-namespace {
-int readn(int fd, void* buffer, unsigned int len)
+// a batch of signed RRsets, or the reason we could not sign them
+struct SignedBatch
 {
-  unsigned int pos=0;
-  int res;
-  for(;;) {
-    res = read(fd, (char*)buffer + pos, len - pos);
-    if(res == 0) {
-      if(pos)
-        throw runtime_error("Signing Pipe remote shut down in the middle of a message");
-      else {
-        //cerr<<"Got decent EOF on "<<fd<<endl;
-        return 0;
-      }
-    }
-      
-    if(res < 0) {
-      if(errno == EAGAIN || errno == EINTR) {
-        if(pos==0)
-          return -1;
-        waitForData(fd, -1); 
-        continue;
-      }
-      unixDie("Reading from socket in Signing Pipe loop");
-    }
-  
-    pos+=res;
-    if(pos == len)
-      break;
+  SignedBatch() : d_rrsets(0) {}
+  ChunkedSigningPipe::chunk_t d_records;
+  unsigned int d_rrsets;
+  string d_error;
+};
+
+// where the signing threads leave their work for a ChunkedSigningPipe, outlives the pipe if needed
+struct SigningPipeResults
+{
+  SigningPipeResults()
+  {
+    pthread_mutex_init(&d_lock, 0);
+    pthread_cond_init(&d_cond, 0);
+  }
+  ~SigningPipeResults()
+  {
+    pthread_cond_destroy(&d_cond);
+    pthread_mutex_destroy(&d_lock);
   }
-  return len;
-}
-}
 
+  pthread_mutex_t d_lock;
+  pthread_cond_t d_cond;
+  std::map<uint64_t, SignedBatch> d_done;
+};
 
-// used to pass information to the new thread
-struct StartHelperStruct
+struct SigningJob
 {
-  StartHelperStruct(ChunkedSigningPipe* csp, int id, int fd) : d_csp(csp), d_id(id), d_fd(fd){}
-  ChunkedSigningPipe* d_csp;
-  int d_id;
-  int d_fd;
+  std::shared_ptr<SigningPipeResults> d_results;
+  ChunkedSigningPipe::rrsetsigner_t d_rrsetSigner; // empty means: RRSIGs from the keys in the database
+  DNSName d_signer;
+  uint64_t d_id;
+  vector<ChunkedSigningPipe::rrset_t> d_rrsets;
 };
 
-// used to launch the new thread
-void* ChunkedSigningPipe::helperWorker(void* p)
-try
+namespace {
+bool
+dedupLessThan(const DNSResourceRecord& a, const DNSResourceRecord &b)
 {
-  StartHelperStruct shs=*(StartHelperStruct*)p;
-  delete (StartHelperStruct*)p;
-  
-  shs.d_csp->worker(shs.d_id, shs.d_fd);
-  return 0;
+  return (tie(a.content, a.ttl) < tie(b.content, b.ttl));
 }
-catch(...) {
-  L<<Logger::Error<<"Unknown exception in signing thread occurred"<<endl;
-  return 0;
+
+bool dedupEqual(const DNSResourceRecord& a, const DNSResourceRecord &b)
+{
+  return(tie(a.content, a.ttl) == tie(b.content, b.ttl));
 }
 
-ChunkedSigningPipe::ChunkedSigningPipe(const DNSName& signerName, bool mustSign, const string& servers, unsigned int workers)
-  : d_queued(0), d_outstanding(0), d_numworkers(workers), d_submitted(0), d_signer(signerName),
-    d_maxchunkrecords(100), d_tids(d_numworkers), d_mustSign(mustSign), d_final(false)
+void dedupRRSet(ChunkedSigningPipe::rrset_t& rrset)
 {
-  d_rrsetToSign = new rrset_t;
-  d_chunks.push_back(vector<DNSResourceRecord>()); // load an empty chunk
-  
-  if(!d_mustSign)
-    return;
-  
-  int fds[2];
-  
-  for(unsigned int n=0; n < d_numworkers; ++n) {
-    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) 
-      throw runtime_error("Unable to create communication socket in for ChunkedSigningPipe");
-    setCloseOnExec(fds[0]);
-    setCloseOnExec(fds[1]);
-    pthread_create(&d_tids[n], 0, helperWorker, (void*) new StartHelperStruct(this, n, fds[1]));
-    setNonBlocking(fds[0]);
-    d_sockets.push_back(fds[0]);
-  }
+  // our set contains contains records for one type and one name, but might not be sorted otherwise
+  sort(rrset.begin(), rrset.end(), dedupLessThan);
+  rrset.erase(unique(rrset.begin(), rrset.end(), dedupEqual), rrset.end());
 }
 
-ChunkedSigningPipe::~ChunkedSigningPipe()
+class SigningThreadPool
 {
-  delete d_rrsetToSign;
-  if(!d_mustSign)
-    return;
-  for(int fd :  d_sockets) {
-    close(fd); // this will trigger all threads to exit
+public:
+  static SigningThreadPool& getPool(unsigned int numWorkers)
+  {
+    static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+    static SigningThreadPool* s_pool;
+
+    Lock l(&s_lock);
+    if(!s_pool)
+      s_pool = new SigningThreadPool(std::max(numWorkers, 1U));
+    return *s_pool;
   }
-    
-  void* res;
-  for(pthread_t& tid :  d_tids) {
-    pthread_join(tid, &res);
+
+  void submit(SigningJob* job)
+  {
+    WorkerQueue& wq = *d_queues[d_nextQueue++ % d_queues.size()];
+    {
+      // count it before it can be taken, so d_pending never drops below zero
+      Lock l(&d_sleepLock);
+      d_pending++;
+    }
+    {
+      Lock l(&wq.d_lock);
+      wq.d_jobs.push_back(job);
+    }
+    Lock l(&d_sleepLock);
+    pthread_cond_signal(&d_wakeup);
   }
-  //cout<<"Did: "<<d_signed<<", records (!= chunks) submitted: "<<d_submitted<<endl;
-}
 
-namespace {
-bool
-dedupLessThan(const DNSResourceRecord& a, const DNSResourceRecord &b)
+private:
+  struct WorkerQueue
+  {
+    WorkerQueue()
+    {
+      pthread_mutex_init(&d_lock, 0);
+    }
+    pthread_mutex_t d_lock;
+    std::deque<SigningJob*> d_jobs;
+  };
+
+  struct StartHelperStruct
+  {
+    StartHelperStruct(SigningThreadPool* pool, unsigned int id) : d_pool(pool), d_id(id) {}
+    SigningThreadPool* d_pool;
+    unsigned int d_id;
+  };
+
+  explicit SigningThreadPool(unsigned int numWorkers) : d_pending(0), d_nextQueue(0)
+  {
+    pthread_mutex_init(&d_sleepLock, 0);
+    pthread_cond_init(&d_wakeup, 0);
+    for(unsigned int n=0; n < numWorkers; ++n)
+      d_queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+
+    for(unsigned int n=0; n < numWorkers; ++n) {
+      pthread_t tid;
+      pthread_create(&tid, 0, helperWorker, (void*) new StartHelperStruct(this, n));
+      pthread_detach(tid);
+    }
+  }
+
+  static void* helperWorker(void* p)
+  {
+    StartHelperStruct shs=*(StartHelperStruct*)p;
+    delete (StartHelperStruct*)p;
+    shs.d_pool->worker(shs.d_id);
+    return 0;
+  }
+
+  SigningJob* takeJob(unsigned int id)
+  {
+    for(unsigned int n=0; n < d_queues.size(); ++n) {
+      WorkerQueue& wq = *d_queues[(id + n) % d_queues.size()];
+      Lock l(&wq.d_lock);
+      if(wq.d_jobs.empty())
+        continue;
+      SigningJob* job;
+      if(!n) {  // our own queue, oldest first
+        job = wq.d_jobs.front();
+        wq.d_jobs.pop_front();
+      }
+      else {    // steal from the back of another queue
+        job = wq.d_jobs.back();
+        wq.d_jobs.pop_back();
+      }
+      --d_pending;
+      return job;
+    }
+    return 0;
+  }
+
+  void worker(unsigned int id);
+  void sign(std::unique_ptr<DNSSECKeeper>& dk, std::unique_ptr<UeberBackend>& db, SigningJob& job, SignedBatch& result);
+
+  vector<std::unique_ptr<WorkerQueue> > d_queues;
+  pthread_mutex_t d_sleepLock;
+  pthread_cond_t d_wakeup;
+  std::atomic<unsigned int> d_pending;
+  std::atomic<unsigned int> d_nextQueue;
+};
+
+void SigningThreadPool::sign(std::unique_ptr<DNSSECKeeper>& dk, std::unique_ptr<UeberBackend>& db, SigningJob& job, SignedBatch& result)
 {
-  return (tie(a.content, a.ttl) < tie(b.content, b.ttl));
+  if(!job.d_rrsetSigner && !dk) {
+    dk.reset(new DNSSECKeeper());
+    db.reset(new UeberBackend("key-only"));
+  }
+
+  set<DNSName> authSet;
+  authSet.insert(job.d_signer);
+  for(auto& rrset : job.d_rrsets) {
+    dedupRRSet(rrset);
+    if(job.d_rrsetSigner)
+      job.d_rrsetSigner(job.d_signer, rrset);
+    else
+      addRRSigs(*dk, *db, authSet, rrset);
+    result.d_records.insert(result.d_records.end(), std::make_move_iterator(rrset.begin()), std::make_move_iterator(rrset.end()));
+    ++result.d_rrsets;
+  }
 }
 
-bool dedupEqual(const DNSResourceRecord& a, const DNSResourceRecord &b)
+void SigningThreadPool::worker(unsigned int id)
 {
-  return(tie(a.content, a.ttl) == tie(b.content, b.ttl));
+  std::unique_ptr<DNSSECKeeper> dk; // only set up once a job needs them
+  std::unique_ptr<UeberBackend> db;
+
+  for(;;) {
+    SigningJob* job = takeJob(id);
+    if(!job) {
+      Lock l(&d_sleepLock);
+      while(!d_pending)
+        pthread_cond_wait(&d_wakeup, &d_sleepLock);
+      continue;
+    }
+
+    SignedBatch result;
+    try {
+      sign(dk, db, *job, result);
+    }
+    catch(PDNSException& pe) {
+      result.d_error = "PDNSException: "+pe.reason;
+    }
+    catch(std::exception& e) {
+      result.d_error = "std::exception: "+string(e.what());
+    }
+    catch(...) {
+      result.d_error = "unknown exception";
+    }
+
+    {
+      Lock l(&job->d_results->d_lock);
+      job->d_results->d_done[job->d_id] = std::move(result);
+      pthread_cond_signal(&job->d_results->d_cond);
+    }
+    delete job;
+  }
 }
 }
 
-void ChunkedSigningPipe::dedupRRSet()
+ChunkedSigningPipe::ChunkedSigningPipe(const DNSName& signerName, bool mustSign, const string& servers, unsigned int workers)
+  : d_queued(0), d_outstanding(0), d_results(std::make_shared<SigningPipeResults>()), d_batchRecords(0),
+    d_nextBatch(0), d_nextToCollect(0), d_numworkers(std::max(workers, 1U)), d_submitted(0), d_signer(signerName),
+    d_maxchunkrecords(100), d_mustSign(mustSign), d_final(false)
 {
-  // our set contains contains records for one type and one name, but might not be sorted otherwise
-  sort(d_rrsetToSign->begin(), d_rrsetToSign->end(), dedupLessThan);
-  d_rrsetToSign->erase(unique(d_rrsetToSign->begin(), d_rrsetToSign->end(), dedupEqual), d_rrsetToSign->end());
+  d_chunks.push_back(vector<DNSResourceRecord>()); // load an empty chunk
+  
+  if(d_mustSign)
+    SigningThreadPool::getPool(d_numworkers); // make sure the signing threads are running
+}
+
+ChunkedSigningPipe::~ChunkedSigningPipe()
+{
+  // batches still being signed keep d_results alive, nothing to wait for here
+  //cout<<"Did: "<<d_signed<<", records (!= chunks) submitted: "<<d_submitted<<endl;
 }
 
 bool ChunkedSigningPipe::submit(const DNSResourceRecord& rr)
 {
   ++d_submitted;
   // check if we have a full RRSET to sign
-  if(!d_rrsetToSign->empty() && (d_rrsetToSign->begin()->qtype.getCode() != rr.qtype.getCode()  ||  d_rrsetToSign->begin()->qname != rr.qname)) 
+  if(!d_rrsetToSign.empty() && (d_rrsetToSign.begin()->qtype.getCode() != rr.qtype.getCode()  ||  d_rrsetToSign.begin()->qname != rr.qname)) 
   {
-    dedupRRSet();
-    sendRRSetToWorker();
+    flushRRSet();
+    if(d_batchRecords >= d_maxchunkrecords)
+      sendBatchToPool();
   }
-  d_rrsetToSign->push_back(rr);
+  d_rrsetToSign.push_back(rr);
+  if(d_outstanding)
+    collectSigned(d_numworkers * 4); // only blocks when the signers are far behind
   return !d_chunks.empty() && d_chunks.front().size() >= d_maxchunkrecords; // "you can send more"
 }
 
-pair<vector<int>, vector<int> > ChunkedSigningPipe::waitForRW(bool rd, bool wr, int seconds)
+void ChunkedSigningPipe::addSignedToChunks(chunk_t& signedChunk)
 {
-  vector<pollfd> pfds;
+  chunk_t::iterator from = signedChunk.begin();
   
-  for(unsigned int n = 0; n < d_sockets.size(); ++n) {    
-    if(d_eof.count(d_sockets[n]))  
-      continue;
-    struct pollfd pfd;
-    memset(&pfd, 0, sizeof(pfd));
-    pfd.fd = d_sockets[n];
-    if(rd)
-      pfd.events |= POLLIN;
-    if(wr)
-      pfd.events |= POLLOUT;
-    pfds.push_back(pfd);
-  }
-  
-  int res = poll(&pfds[0], pfds.size(), (seconds < 0) ? -1 : (seconds * 1000)); // -1 = infinite
-  if(res < 0)
-    unixDie("polling for activity from signers, "+std::to_string(d_sockets.size()));
-  pair<vector<int>, vector<int> > vects;
-  for(unsigned int n = 0; n < pfds.size(); ++n) 
-    if(pfds[n].revents & POLLIN)
-      vects.first.push_back(pfds[n].fd);
-    else if(pfds[n].revents & POLLOUT)
-      vects.second.push_back(pfds[n].fd);
-  
-  return vects;
-}
-
-void ChunkedSigningPipe::addSignedToChunks(chunk_t* signedChunk)
-{
-  chunk_t::const_iterator from = signedChunk->begin();
-  
-  while(from != signedChunk->end()) {
+  while(from != signedChunk.end()) {
     chunk_t& fillChunk = d_chunks.back();
     
     chunk_t::size_type room = d_maxchunkrecords - fillChunk.size();
     
-    unsigned int fit = std::min(room, (chunk_t::size_type)(signedChunk->end() - from));
+    unsigned int fit = std::min(room, (chunk_t::size_type)(signedChunk.end() - from));
   
-    d_chunks.back().insert(fillChunk.end(), from , from + fit);
+    fillChunk.insert(fillChunk.end(), std::make_move_iterator(from), std::make_move_iterator(from + fit));
     from+=fit;
     
-    if(from != signedChunk->end()) // it didn't fit, so add a new chunk
+    if(from != signedChunk.end()) // it didn't fit, so add a new chunk
       d_chunks.push_back(chunk_t());
   }
 }
 
-void ChunkedSigningPipe::sendRRSetToWorker() // it sounds so socialist!
+// moves the RRset we have been building into the current batch
+void ChunkedSigningPipe::flushRRSet()
 {
+  if(d_rrsetToSign.empty())
+    return;
+
   if(!d_mustSign) {
+    dedupRRSet(d_rrsetToSign);
     addSignedToChunks(d_rrsetToSign);
-    d_rrsetToSign->clear();
+    d_rrsetToSign.clear();
     return;
   }
-  
-  if(d_final && !d_outstanding) // nothing to do!
+
+  d_batchRecords += d_rrsetToSign.size();
+  d_batch.push_back(std::move(d_rrsetToSign));
+  d_rrsetToSign.clear();
+}
+
+void ChunkedSigningPipe::sendBatchToPool() // it sounds so socialist!
+{
+  if(d_batch.empty())
     return;
-  
-  bool wantRead, wantWrite;
-  
-  wantWrite = !d_rrsetToSign->empty();
-  wantRead = d_outstanding || wantWrite;  // if we wrote, we want to read
-  
-  pair<vector<int>, vector<int> > rwVect;
-  
-  rwVect = waitForRW(wantRead, wantWrite, -1); // wait for something to happen  
-  
-  if(wantWrite && !rwVect.second.empty()) {
-    random_shuffle(rwVect.second.begin(), rwVect.second.end()); // pick random available worker
-    writen2(*rwVect.second.begin(), &d_rrsetToSign, sizeof(d_rrsetToSign));
-    d_rrsetToSign = new rrset_t;
-    d_outstanding++;
-    d_queued++;
-    wantWrite=false;
-  } 
-  
-  if(wantRead) {
-    while(d_outstanding) {
-      chunk_t* chunk;
-      
-      for(int fd :  rwVect.first) {
-        if(d_eof.count(fd))
-          continue;
-        
-        while(d_outstanding) {
-          int res = readn(fd, &chunk, sizeof(chunk));
-          if(!res) {
-            d_eof.insert(fd);
-            break;
-          }
-          if(res < 0) {
-            if(errno != EAGAIN && errno != EINTR)
-              unixDie("Error reading signed chunk from thread");
-            else
-              break;
-          }
-          
-          --d_outstanding;
-          
-          addSignedToChunks(chunk);
-          
-          delete chunk;
-        }
+
+  SigningJob* job = new SigningJob;
+  job->d_results = d_results;
+  job->d_rrsetSigner = d_rrsetSigner;
+  job->d_signer = d_signer;
+  job->d_id = d_nextBatch++;
+  job->d_rrsets.swap(d_batch);
+  d_batchRecords = 0;
+
+  d_outstanding++;
+  d_queued += job->d_rrsets.size(); // RRsets, like d_signed
+  SigningThreadPool::getPool(d_numworkers).submit(job);
+}
+
+// picks up the batches that are done, in order, and waits until no more than maxOutstanding are left
+void ChunkedSigningPipe::collectSigned(unsigned int maxOutstanding)
+{
+  vector<SignedBatch> ready;
+  {
+    Lock l(&d_results->d_lock);
+    for(;;) {
+      auto iter = d_results->d_done.begin();
+      if(iter != d_results->d_done.end() && iter->first == d_nextToCollect) {
+        ready.push_back(std::move(iter->second));
+        d_results->d_done.erase(iter);
+        ++d_nextToCollect;
+        --d_outstanding;
+        continue;
       }
-      if(!d_outstanding || !d_final)
+      if(d_outstanding <= maxOutstanding)
         break;
-      rwVect = waitForRW(1, 0, -1); // wait for something to happen  
+      pthread_cond_wait(&d_results->d_cond, &d_results->d_lock);
     }
   }
-  
-  if(wantWrite) {  // our optimization above failed, we now wait synchronously
-    rwVect = waitForRW(0, wantWrite, -1); // wait for something to happen  
-    random_shuffle(rwVect.second.begin(), rwVect.second.end()); // pick random available worker
-    writen2(*rwVect.second.begin(), &d_rrsetToSign, sizeof(d_rrsetToSign));
-    d_rrsetToSign = new rrset_t;
-    d_outstanding++;
-    d_queued++;
+
+  for(auto& batch : ready) {
+    if(!batch.d_error.empty())
+      throw PDNSException("Signing thread was unable to sign records for '"+d_signer.toString()+"', "+batch.d_error);
+    d_signed += batch.d_rrsets;
+    addSignedToChunks(batch.d_records);
   }
-  
 }
 
 unsigned int ChunkedSigningPipe::getReady()
@@ -273,44 +352,11 @@ unsigned int ChunkedSigningPipe::getReady()
    }
    return sum;
 }
-void ChunkedSigningPipe::worker(int id, int fd)
-try
-{
-  DNSSECKeeper dk;
-  UeberBackend db("key-only");
-  
-  chunk_t* chunk;
-  int res;
-  for(;;) {
-    res = readn(fd, &chunk, sizeof(chunk));
-    if(!res)
-      break;
-    if(res < 0)
-      unixDie("reading object pointer to sign from pdns");
-    set<DNSName> authSet;
-    authSet.insert(d_signer);
-    addRRSigs(dk, db, authSet, *chunk);
-    ++d_signed;
-    
-    writen2(fd, &chunk, sizeof(chunk));
-  }
-  close(fd);
-}
-catch(PDNSException& pe)
-{
-  L<<Logger::Error<<"Signing thread died because of PDNSException: "<<pe.reason<<endl;
-  close(fd);
-}
-catch(std::exception& e)
-{
-  L<<Logger::Error<<"Signing thread died because of std::exception: "<<e.what()<<endl;
-  close(fd);
-}
 
 void ChunkedSigningPipe::flushToSign()
 {
-  sendRRSetToWorker();
-  d_rrsetToSign->clear();
+  flushRRSet();
+  sendBatchToPool();
 }
 
 vector<DNSResourceRecord> ChunkedSigningPipe::getChunk(bool final)
@@ -319,15 +365,10 @@ vector<DNSResourceRecord> ChunkedSigningPipe::getChunk(bool final)
     // this means we should keep on reading until d_outstanding == 0
     d_final = true;
     flushToSign();
-    
-    for(int fd :  d_sockets) {
-      shutdown(fd, SHUT_WR); // perhaps this transmits EOF the other side
-      //cerr<<"shutdown of "<<fd<<endl;
-    }
   }
-  if(d_final)
-    flushToSign(); // should help us wait
-  vector<DNSResourceRecord> front=d_chunks.front();
+  if(d_outstanding)
+    collectSigned(d_final ? 0 : d_outstanding);
+  vector<DNSResourceRecord> front=std::move(d_chunks.front());
   d_chunks.pop_front();
   if(d_chunks.empty())
     d_chunks.push_back(vector<DNSResourceRecord>());
@@ -1,6 +1,9 @@
 #ifndef PDNS_SIGNINGPIPE
 #define PDNS_SIGNINGPIPE
 #include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
 #include <pthread.h>
 #include <stdio.h>
 #include "dnsseckeeper.hh"
@@ -11,46 +14,58 @@ bool readLStringFromSocket(int fd, string& msg);
 
 /** input: DNSResourceRecords ordered in qname,qtype (we emit a signature chunk on a break)
  *  output: "chunks" of those very same DNSResourceRecords, interleaved with signatures
+ *
+ *  RRsets are collected in batches and handed to a process-wide pool of signing threads, see
+ *  signingpipe.cc. Signed batches come back in the order they were submitted.
+ *  d_queued and d_signed count RRsets, d_outstanding counts batches still with the signing threads.
  */
 
+struct SigningPipeResults;
+
 class ChunkedSigningPipe
 {
 public:
   typedef vector<DNSResourceRecord> rrset_t; 
   typedef rrset_t chunk_t; // for now
+  typedef std::function<void(const DNSName& signer, rrset_t& rrset)> rrsetsigner_t;
   
   ChunkedSigningPipe(const DNSName& signerName, bool mustSign, /* FIXME servers is unused? */ const string& servers=string(), unsigned int numWorkers=3);
   ~ChunkedSigningPipe();
   bool submit(const DNSResourceRecord& rr);
   chunk_t getChunk(bool final=false);
+  //! signs the RRsets with this instead of adding RRSIGs from the keys in the database, for testing. Set before the first submit()
+  void setRRSetSigner(const rrsetsigner_t& signer)
+  {
+    d_rrsetSigner = signer;
+  }
 
   AtomicCounter d_signed;
-  int d_queued;
-  int d_outstanding;
+  unsigned int d_queued;
+  unsigned int d_outstanding;
   unsigned int getReady();
 private:
   void flushToSign();	
-  void dedupRRSet();
-  void sendRRSetToWorker(); // dispatch RRSET to worker
-  void addSignedToChunks(chunk_t* signedChunk);
-  pair<vector<int>, vector<int> > waitForRW(bool rd, bool wr, int seconds);
+  void flushRRSet();
+  void sendBatchToPool();
+  void collectSigned(unsigned int maxOutstanding);
+  void addSignedToChunks(chunk_t& signedChunk);
 
-  void worker(int n, int fd);
-  
-  static void* helperWorker(void* p);
+  std::shared_ptr<SigningPipeResults> d_results;
+  rrsetsigner_t d_rrsetSigner;
+  vector<rrset_t> d_batch;
+  chunk_t::size_type d_batchRecords;
+  uint64_t d_nextBatch;
+  uint64_t d_nextToCollect;
 
   unsigned int d_numworkers;
   int d_submitted;
 
-  rrset_t* d_rrsetToSign;
+  rrset_t d_rrsetToSign;
   std::deque< std::vector<DNSResourceRecord> > d_chunks;
   DNSName d_signer;
   
   chunk_t::size_type d_maxchunkrecords;
   
-  std::vector<int> d_sockets;
-  std::set<int> d_eof;
-  vector<pthread_t> d_tids;
   bool d_mustSign;
   bool d_final;
 };
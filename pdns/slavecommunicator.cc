@@ -65,6 +65,27 @@ void CommunicatorClass::addSuckRequest(const DNSName &domain, const string &mast
 
 }
 
+void CommunicatorClass::recordTransfer(const DNSName &domain, bool incremental, uint32_t serial, size_t records, unsigned int usec)
+{
+  Lock l(&d_lock);
+  TransferStats& ts = d_transferstats[domain];
+  ts.when = time(0);
+  ts.serial = serial;
+  ts.incremental = incremental;
+  ts.records = records;
+  ts.usec = usec;
+  if(incremental)
+    ts.ixfrs++;
+  else
+    ts.axfrs++;
+}
+
+map<DNSName, CommunicatorClass::TransferStats> CommunicatorClass::getTransferStats()
+{
+  Lock l(&d_lock);
+  return d_transferstats;
+}
+
 struct ZoneStatus
 {
   bool isDnssecZone{false};
@@ -78,23 +99,110 @@ struct ZoneStatus
   set<DNSName> nsset, qnames, secured;
   uint32_t domain_id;
   int numDeltas{0};
+  size_t numRecords{0}; //!< records removed and added by an IXFR, or stored by an AXFR
 };
 
+namespace {
+//! what we know about a single name while IXFR deltas are collapsed onto it
+struct IXFRNameState
+{
+  map<uint16_t, vector<DNSRecord> > rrsets;
+  set<uint16_t> before;  //!< types that were present before the deltas were applied
+  set<uint16_t> touched; //!< types changed by the deltas
+
+  bool existed() const
+  {
+    return !before.empty();
+  }
+  bool exists() const
+  {
+    for(const auto& rrset : rrsets)
+      if(!rrset.second.empty())
+        return true;
+    return false;
+  }
+  bool has(uint16_t qtype) const
+  {
+    auto iter = rrsets.find(qtype);
+    return iter != rrsets.end() && !iter->second.empty();
+  }
+};
+
+//! what listSubZone() tells us about a name: records at it, an ENT at it, records below it
+struct SubZoneState
+{
+  bool here{false};
+  bool ent{false};
+  bool below{false};
+};
+}
+
+static bool isDelegation(DNSBackend* db, const DomainInfo& di, const DNSName& qname, map<DNSName,bool>& cache)
+{
+  if(qname == di.zone)
+    return false;
+  auto iter = cache.find(qname);
+  if(iter != cache.end())
+    return iter->second;
+
+  bool found = false;
+  DNSResourceRecord rr;
+  db->lookup(QType(QType::NS), qname, 0, di.id);
+  while(db->get(rr))
+    if(rr.qtype.getCode() == QType::NS)
+      found = true;
+  cache[qname] = found;
+  return found;
+}
+
+//! true if one of the names between qname (exclusive) and the apex is a delegation
+static bool isOccluded(DNSBackend* db, const DomainInfo& di, DNSName qname, map<DNSName,bool>& cache)
+{
+  while(qname != di.zone && qname.chopOff()) {
+    if(isDelegation(db, di, qname, cache))
+      return true;
+  }
+  return false;
+}
+
+static bool getSubZoneState(DNSBackend* db, const DomainInfo& di, const DNSName& qname, SubZoneState& state)
+{
+  if(!db->listSubZone(qname, di.id))
+    return false;
+  DNSResourceRecord rr;
+  while(db->get(rr)) {
+    if(rr.qname == qname) {
+      if(rr.qtype.getCode())
+        state.here = true;
+      else
+        state.ent = true;
+    }
+    else if(rr.qtype.getCode())
+      state.below = true;
+  }
+  return true;
+}
+
+/* Applies an IXFR to the zone as targeted RRSet replacements. All deltas are first collapsed onto
+   the RRSets they touch, so a record that is changed in every serial is still only written once,
+   and everything is committed in a single transaction.
 
-void CommunicatorClass::ixfrSuck(const DNSName &domain, const TSIGTriplet& tt, const ComboAddress& laddr, const ComboAddress& remote, scoped_ptr<AuthLua>& pdl,
+   Returns false if the deltas can not be applied incrementally and a full AXFR is needed. If the
+   master answered with a full zone instead of deltas, it is returned in 'axfr'. */
+bool CommunicatorClass::ixfrSuck(const DNSName &domain, const TSIGTriplet& tt, const ComboAddress& laddr, const ComboAddress& remote, scoped_ptr<AuthLua>& pdl,
                                  ZoneStatus& zs, vector<DNSRecord>* axfr)
 {
   UeberBackend B; // fresh UeberBackend
 
   DomainInfo di;
   di.backend=0;
-  //  bool transaction=false;
+  bool transaction=false;
   try {
     DNSSECKeeper dk (&B); // reuse our UeberBackend copy for DNSSECKeeper
 
     if(!B.getDomainInfo(domain, di) || !di.backend) { // di.backend and B are mostly identical
-      L<<Logger::Error<<"Can't determine backend for domain '"<<domain<<"'"<<endl;
-      return;
+      L<<Logger::Error<<"Can't determine backend for domain '"<<domain<<"', IXFR needs a full transfer"<<endl;
+      return false;
     }
 
     soatimes st;
@@ -106,82 +214,245 @@ void CommunicatorClass::ixfrSuck(const DNSName &domain, const TSIGTriplet& tt, c
     auto deltas = getIXFRDeltas(remote, domain, dr, tt, laddr.sin4.sin_family ? &laddr : 0, ((size_t) ::arg().asNum("xfr-max-received-mbytes")) * 1024 * 1024);
     zs.numDeltas=deltas.size();
     //    cout<<"Got "<<deltas.size()<<" deltas from serial "<<di.serial<<", applying.."<<endl;
-    
+    if(deltas.empty())
+      return true;
+
+    if(deltas.front().first.empty()) { // we got passed an AXFR!
+      *axfr = deltas.front().second;
+      return false;
+    }
+
+    if(pdl) {
+      L<<Logger::Warning<<"Not applying IXFR deltas to '"<<domain<<"', it has a Lua AXFR filter script"<<endl;
+      return false;
+    }
+
+    bool secured = dk.isSecuredZone(domain);
+    bool presigned = secured && dk.isPresigned(domain);
+    bool narrow = false;
+    NSEC3PARAMRecordContent ns3pr;
+    bool nsec3 = secured && dk.getNSEC3PARAM(domain, &ns3pr, &narrow);
+    bool directDNSKEY = ::arg().mustDo("direct-dnskey");
+
+    // mirrors what the AXFR path stores, and spots changes in DNSSEC status that only a full transfer can handle
+    string reason;
+    auto wanted = [&](const DNSRecord& rec) {
+      switch(rec.d_type) {
+      case QType::NSEC:
+      case QType::NSEC3:
+        if(!secured)
+          reason = "the zone became presigned";
+        return false; // we synthesise these from the ordername
+      case QType::NSEC3PARAM:
+        if(!secured || presigned)
+          reason = "its NSEC3 parameters changed";
+        return false;
+      case QType::RRSIG:
+        if(!secured)
+          reason = "the zone became presigned";
+        return presigned;
+      case QType::DNSKEY:
+        return presigned || !secured || directDNSKEY;
+      }
+      return true;
+    };
+
+    for(const auto& d : deltas) {
+      for(const auto* records : {&d.first, &d.second}) {
+        for(const auto& rec : *records) {
+          if(!wanted(rec) && !reason.empty()) {
+            L<<Logger::Warning<<"IXFR of '"<<domain<<"' needs a full transfer, "<<reason<<endl;
+            return false;
+          }
+        }
+      }
+    }
+
+    // our hammer is 'replaceRRSet(domain_id, qname, qt, vector<DNSResourceRecord>& rrset)
+    // which thinks in terms of RRSETs
+    // however, IXFR does not, and removes and adds *records* (bummer)
+    // this means that we must retrieve every RRSET a delta touches, apply the add/remove
+    // updates of all deltas in order, and replaceRRSet the end result once.
+    map<DNSName, IXFRNameState> names;
+    auto getRRSet = [&](const DNSName& qname, uint16_t qtype) -> vector<DNSRecord>& {
+      auto iter = names.find(qname);
+      if(iter == names.end()) {
+        iter = names.insert({qname, IXFRNameState()}).first;
+        DNSResourceRecord rr;
+        di.backend->lookup(QType(QType::ANY), qname, 0, di.id);
+        while(di.backend->get(rr)) {
+          if(!rr.qtype.getCode() || rr.qname != qname)
+            continue;
+          iter->second.before.insert(rr.qtype.getCode());
+          iter->second.rrsets[rr.qtype.getCode()].push_back(DNSRecord(rr));
+        }
+      }
+      iter->second.touched.insert(qtype);
+      return iter->second.rrsets[qtype];
+    };
+
     for(const auto& d : deltas) {
       const auto& remove = d.first;
       const auto& add = d.second;
       //      cout<<"Delta sizes: "<<remove.size()<<", "<<add.size()<<endl;
-      
-      if(remove.empty()) { // we got passed an AXFR!
-        *axfr = add;
-        return;
-      }
-        
-
-      // our hammer is 'replaceRRSet(domain_id, qname, qt, vector<DNSResourceRecord>& rrset)
-      // which thinks in terms of RRSETs
-      // however, IXFR does not, and removes and adds *records* (bummer)
-      // this means that we must group updates by {qname,qtype}, retrieve the RRSET, apply
-      // the add/remove updates, and replaceRRSet the whole thing. 
-      
-      
-      map<pair<DNSName,uint16_t>, pair<vector<DNSRecord>, vector<DNSRecord> > > grouped;
-      
-      for(const auto& x: remove)
-        grouped[{x.d_name, x.d_type}].first.push_back(x);
-      for(const auto& x: add)
-        grouped[{x.d_name, x.d_type}].second.push_back(x);
-
-      di.backend->startTransaction(domain, -1);
-      for(const auto g : grouped) {
-        DNSResourceRecord rr;
-        vector<DNSRecord> rrset;
-        B.lookup(QType(g.first.second), g.first.first, 0, di.id);
-        while(B.get(rr)) {
-          rrset.push_back(DNSRecord{rr});
+
+      for(const auto& x : remove) {
+        if(!wanted(x))
+          continue;
+        DNSRecord rec(x);
+        rec.d_name += domain;
+        auto& rrset = getRRSet(rec.d_name, rec.d_type);
+        ++zs.numRecords;
+        if(rec.d_type == QType::SOA) {
+          rrset.clear();
+          continue;
         }
-        // O(N^2)!
-        rrset.erase(remove_if(rrset.begin(), rrset.end(), 
-                              [&g](const DNSRecord& dr) {
-                                return count(g.second.first.cbegin(), 
-                                             g.second.first.cend(), dr);
-                              }), rrset.end());
         // the DNSRecord== operator compares on name, type, class and lowercase content representation
+        auto pos = find(rrset.begin(), rrset.end(), rec);
+        if(pos == rrset.end()) {
+          L<<Logger::Warning<<"IXFR of '"<<domain<<"' removes "<<rec.d_name<<"|"<<DNSRecordContent::NumberToType(rec.d_type)<<" which we do not have, our copy has diverged and needs a full transfer"<<endl;
+          return false;
+        }
+        rrset.erase(pos);
+      }
 
-        for(const auto& x : g.second.second) {
-          rrset.push_back(x);
+      for(const auto& x : add) {
+        if(!wanted(x))
+          continue;
+        DNSRecord rec(x);
+        rec.d_name += domain;
+        auto& rrset = getRRSet(rec.d_name, rec.d_type);
+        ++zs.numRecords;
+        if(rec.d_type == QType::SOA) {
+          //            cout<<"New SOA: "<<x.d_content->getZoneRepresentation()<<endl;
+          auto sr = getRR<SOARecordContent>(rec);
+          zs.soa_serial=sr->d_st.serial;
         }
+        if(find(rrset.cbegin(), rrset.cend(), rec) == rrset.cend())
+          rrset.push_back(rec);
+      }
+    }
+
+    // a new or removed delegation changes the auth flag of everything below it, leave that to the AXFR code
+    for(const auto& n : names) {
+      if(n.first != domain && n.second.before.count(QType::NS) != (n.second.has(QType::NS) ? 1U : 0U)) {
+        L<<Logger::Warning<<"IXFR of '"<<domain<<"' changes the delegation at '"<<n.first<<"', which needs a full transfer"<<endl;
+        return false;
+      }
+    }
+
+    map<DNSName,bool> delegations;
+    transaction=di.backend->startTransaction(domain, -1);
+    for(const auto& n : names) {
+      const DNSName& qname = n.first;
+      const IXFRNameState& state = n.second;
+      bool occluded = isOccluded(di.backend, di, qname, delegations);
+      bool delegation = qname != domain && state.has(QType::NS);
 
+      for(const auto qtype : state.touched) {
         vector<DNSResourceRecord> replacement;
-        for(const auto& x : rrset) {
-          DNSResourceRecord dr(x);
-          dr.qname += domain;
-          dr.domain_id = di.id;
-          if(x.d_type == QType::SOA) {
-            //            cout<<"New SOA: "<<x.d_content->getZoneRepresentation()<<endl;
-            auto sr = getRR<SOARecordContent>(x);
-            zs.soa_serial=sr->d_st.serial;
-          }
-          
-          replacement.push_back(dr);
+        for(const auto& x : state.rrsets.find(qtype)->second) {
+          DNSResourceRecord rr(x);
+          rr.domain_id = di.id;
+          // RRSIG is always auth, even inside a delegation
+          rr.auth = (!occluded && (!delegation || qtype == QType::DS)) || qtype == QType::RRSIG;
+          replacement.push_back(rr);
+        }
+
+        if(!di.backend->replaceRRSet(di.id, qname, QType(qtype), replacement)) {
+          L<<Logger::Warning<<"Backend for '"<<domain<<"' can not replace RRSets, IXFR needs a full transfer"<<endl;
+          di.backend->abortTransaction();
+          return false;
+        }
+      }
+
+      // replaceRRSet does not know about ordername, so put it back like the AXFR code would
+      if(secured && state.exists()) {
+        DNSName ordername;
+        if(!occluded) {
+          if(!nsec3)
+            ordername = qname;
+          else if(!narrow && (!delegation || !(ns3pr.d_flags & 1) || state.has(QType::DS)))
+            ordername = DNSName(toBase32Hex(hashQNameWithSalt(ns3pr, qname))) + domain;
         }
+        di.backend->updateDNSSECOrderNameAndAuth(di.id, domain, qname, ordername, !occluded && !delegation);
+        if(delegation) {
+          di.backend->updateDNSSECOrderNameAndAuth(di.id, domain, qname, ordername, true, QType::DS);
+          if(presigned)
+            di.backend->updateDNSSECOrderNameAndAuth(di.id, domain, qname, ordername, true, QType::RRSIG);
+        }
+      }
+    }
+
+    // Names that appeared or disappeared may plug or create Empty Non Terminals. Backends without
+    // listSubZone() (bind) work these out themselves when the transaction is committed.
+    set<DNSName> insnonterm, delnonterm;
+    for(const auto& n : names) {
+      if(n.first == domain || n.second.existed() == n.second.exists())
+        continue;
+
+      SubZoneState here;
+      if(!getSubZoneState(di.backend, di, n.first, here))
+        break;
+
+      DNSName shorter(n.first);
+      if(n.second.exists()) {
+        if(here.ent)
+          delnonterm.insert(n.first);
+        while(shorter.chopOff() && shorter != domain) {
+          SubZoneState parent;
+          getSubZoneState(di.backend, di, shorter, parent);
+          if(parent.here || parent.ent)
+            break;
+          insnonterm.insert(shorter);
+        }
+      }
+      else if(here.below) {
+        insnonterm.insert(n.first);
+      }
+      else {
+        while(shorter.chopOff() && shorter != domain) {
+          SubZoneState parent;
+          getSubZoneState(di.backend, di, shorter, parent);
+          if(parent.here || parent.below)
+            break;
+          if(parent.ent)
+            delnonterm.insert(shorter);
+        }
+      }
+    }
 
-        di.backend->replaceRRSet(di.id, g.first.first+domain, QType(g.first.second), replacement);
+    if(!insnonterm.empty() || !delnonterm.empty()) {
+      di.backend->updateEmptyNonTerminals(di.id, domain, insnonterm, delnonterm, false);
+      if(secured) {
+        for(const auto& qname : insnonterm) {
+          bool auth = !isOccluded(di.backend, di, qname, delegations);
+          DNSName ordername;
+          if(nsec3 && !narrow && auth)
+            ordername = DNSName(toBase32Hex(hashQNameWithSalt(ns3pr, qname))) + domain;
+          di.backend->updateDNSSECOrderNameAndAuth(di.id, domain, qname, ordername, auth);
+        }
       }
-      di.backend->commitTransaction();
     }
+
+    di.backend->commitTransaction();
+    transaction=false;
+    return true;
   }
   catch(std::exception& p) {
     L<<Logger::Error<<"Got exception during IXFR: "<<p.what()<<endl;
+    if(transaction)
+      di.backend->abortTransaction();
     throw;
   }
   catch(PDNSException& p) {
     L<<Logger::Error<<"Got exception during IXFR: "<<p.reason<<endl;
+    if(transaction)
+      di.backend->abortTransaction();
     throw;
   }  
 }
 
-
 static bool processRecordForZS(const DNSName& domain, bool& firstNSEC3, DNSResourceRecord& rr, ZoneStatus& zs)
 {
   switch(rr.qtype.getCode()) {
@@ -298,6 +569,8 @@ void CommunicatorClass::suck(const DNSName &domain, const string &remote)
   DomainInfo di;
   di.backend=0;
   bool transaction=false;
+  DTime dt;
+  dt.set();
   try {
     DNSSECKeeper dk (&B); // reuse our UeberBackend copy for DNSSECKeeper
 
@@ -374,13 +647,25 @@ void CommunicatorClass::suck(const DNSName &domain, const string &remote)
         hadNarrow = zs.isNarrow;
       }
     }
-    else if(di.serial) {
+
+    if(di.serial) {
       vector<string> meta;
       B.getDomainMetadata(domain, "IXFR", meta);
       if(!meta.empty() && meta[0]=="1") {
         vector<DNSRecord> axfr;
         L<<Logger::Warning<<"Starting IXFR of '"<<domain<<"' from remote "<<raddr.toStringWithPort()<<endl;
-        ixfrSuck(domain, tt, laddr, raddr, pdl, zs, &axfr);
+        zs.soa_serial = di.serial;
+        if(ixfrSuck(domain, tt, laddr, raddr, pdl, zs, &axfr)) {
+          unsigned int usec = dt.udiff();
+          recordTransfer(domain, true, zs.soa_serial, zs.numRecords, usec);
+          di.backend->setFresh(zs.domain_id);
+          PC.purge(domain.toString()+"$");
+          L<<Logger::Warning<<"Done with IXFR of '"<<domain<<"' from remote '"<<remote<<"', got "<<zs.numDeltas<<" delta"<<addS(zs.numDeltas)<<", applied "<<zs.numRecords<<" record"<<addS(zs.numRecords)<<" in "<<usec/1000<<" ms, serial now "<<zs.soa_serial<<endl;
+          if(zs.numDeltas && ::arg().mustDo("slave-renotify"))
+            notifyDomain(domain);
+          return;
+        }
+        zs.numRecords = 0;
         if(!axfr.empty()) {
           L<<Logger::Warning<<"IXFR of '"<<domain<<"' from remote '"<<raddr.toStringWithPort()<<"' turned into an AXFR"<<endl;
           bool firstNSEC3=true;
@@ -399,8 +684,7 @@ void CommunicatorClass::suck(const DNSName &domain, const string &remote)
           }
         }
         else {
-          L<<Logger::Warning<<"Done with IXFR of '"<<domain<<"' from remote '"<<remote<<"', got "<<zs.numDeltas<<" delta"<<addS(zs.numDeltas)<<", serial now "<<zs.soa_serial<<endl;
-          return;
+          L<<Logger::Warning<<"IXFR of '"<<domain<<"' from remote '"<<raddr.toStringWithPort()<<"' could not be applied incrementally, falling back to AXFR"<<endl;
         }
       }
     }
@@ -481,7 +765,10 @@ void CommunicatorClass::suck(const DNSName &domain, const string &remote)
     DNSName shorter;
     set<DNSName> rrterm;
     map<DNSName,bool> nonterm;
-
+    // records are handed to the backend in chunks, so it can batch the inserts
+    const size_t feedBatch = 1000;
+    vector<DNSFeedRecord> feed;
+    feed.reserve(feedBatch);
 
     for(DNSResourceRecord& rr :  rrs) {
       if(!zs.isPresigned) {
@@ -535,26 +822,34 @@ void CommunicatorClass::suck(const DNSName &domain, const string &remote)
       if (rr.qtype.getCode() == QType::RRSIG)
         rr.auth=true;
 
-      // Add ordername and insert record
+      // Add ordername and queue record for insertion
       if (zs.isDnssecZone && rr.qtype.getCode() != QType::RRSIG) {
         if (zs.isNSEC3) {
           // NSEC3
           ordername=toBase32Hex(hashQNameWithSalt(zs.ns3pr, rr.qname));
           if(!zs.isNarrow && (rr.auth || (rr.qtype.getCode() == QType::NS && (!zs.optOutFlag || zs.secured.count(DNSName(ordername)))))) {
-            di.backend->feedRecord(rr, &ordername);
+            feed.push_back(DNSFeedRecord(rr, ordername));
           } else
-            di.backend->feedRecord(rr);
+            feed.push_back(DNSFeedRecord(rr));
         } else {
           // NSEC
           if (rr.auth || rr.qtype.getCode() == QType::NS) {
             ordername=toLower(labelReverse(makeRelative(rr.qname.toStringNoDot(), domain.toStringNoDot()))); // FIXME400
-            di.backend->feedRecord(rr, &ordername);
+            feed.push_back(DNSFeedRecord(rr, ordername));
           } else
-            di.backend->feedRecord(rr);
+            feed.push_back(DNSFeedRecord(rr));
         }
       } else
-        di.backend->feedRecord(rr);
+        feed.push_back(DNSFeedRecord(rr));
+      ++zs.numRecords;
+
+      if(feed.size() >= feedBatch) {
+        di.backend->feedRecords(feed);
+        feed.clear();
+      }
     }
+    if(!feed.empty())
+      di.backend->feedRecords(feed);
 
     // Insert empty non-terminals
     if(doent && !nonterm.empty()) {
@@ -569,8 +864,9 @@ void CommunicatorClass::suck(const DNSName &domain, const string &remote)
     di.backend->setFresh(zs.domain_id);
     PC.purge(domain.toString()+"$");
 
-
-    L<<Logger::Error<<"AXFR done for '"<<domain<<"', zone committed with serial number "<<zs.soa_serial<<endl;
+    unsigned int usec = dt.udiff();
+    recordTransfer(domain, false, zs.soa_serial, zs.numRecords, usec);
+    L<<Logger::Error<<"AXFR done for '"<<domain<<"', zone committed with serial number "<<zs.soa_serial<<", "<<zs.numRecords<<" record"<<addS(zs.numRecords)<<" in "<<usec/1000<<" ms"<<endl;
     if(::arg().mustDo("slave-renotify"))
       notifyDomain(domain);
   }
@@ -4,7 +4,13 @@
 #include "misc.hh"
 #include "dnswriter.hh"
 #include "dnsrecords.hh"
+#include "iputils.hh"
+#include "protobuf.hh"
+#include "zoneparser-tng.hh"
 #include <boost/format.hpp>
+#include <atomic>
+#include <random>
+#include <unordered_set>
 #ifndef RECURSOR
 #include "statbag.hh"
 #include "base64.hh"
@@ -13,6 +19,32 @@ StatBag S;
 
 volatile bool g_ret; // make sure the optimizer does not get too smart
 uint64_t g_totalRuns;
+std::atomic<uint64_t> g_allocations; // counted by our operator new, reported per run
+std::atomic<int64_t> g_liveBytes;      // bytes currently allocated through operator new
+
+static const size_t s_allocHeader = 16; // keeps the size of each allocation, and the alignment
+
+void* operator new(size_t size)
+{
+  g_allocations++;
+  char* ret = static_cast<char*>(malloc(size + s_allocHeader));
+  if(!ret)
+    throw std::bad_alloc();
+  memcpy(ret, &size, sizeof(size));
+  g_liveBytes += size;
+  return ret + s_allocHeader;
+}
+
+void operator delete(void* ptr) noexcept
+{
+  if(!ptr)
+    return;
+  char* start = static_cast<char*>(ptr) - s_allocHeader;
+  size_t size;
+  memcpy(&size, start, sizeof(size));
+  g_liveBytes -= size;
+  free(start);
+}
 
 volatile bool g_stop;
 
@@ -34,15 +66,17 @@ template<typename C> void doRun(const C& cmd, int mseconds=100)
   
   unsigned int runs=0;
   g_stop=false;
+  uint64_t allocations = g_allocations;
   CPUTime dt;
   dt.start();
   while(runs++, !g_stop) {
     cmd();
   }
   double delta=dt.ndiff()/1000000000.0;
-  boost::format fmt("'%s' %.02f seconds: %.1f runs/s, %.02f usec/run");
+  allocations = g_allocations - allocations;
+  boost::format fmt("'%s' %.02f seconds: %.1f runs/s, %.02f usec/run, %.02f allocs/run");
 
-  cerr<< (fmt % cmd.getName() % delta % (runs/delta) % (delta* 1000000.0/runs)) << endl;
+  cerr<< (fmt % cmd.getName() % delta % (runs/delta) % (delta* 1000000.0/runs) % (1.0*allocations/runs)) << endl;
   g_totalRuns += runs;
 }
 
@@ -509,6 +543,29 @@ struct ParsePacketBareTest
   std::string d_name;
 };
 
+struct ParsePacketLazyTest
+{
+  explicit ParsePacketLazyTest(const vector<uint8_t>& packet, const std::string& name) 
+    : d_packet(packet), d_name(name)
+  {}
+
+  string getName() const
+  {
+    return "parse '"+d_name+"' lazy";
+  }
+
+  void operator()() const
+  {
+    LazyMOADNSParser mdp((const char*)&*d_packet.begin(), d_packet.size());
+    unsigned int ttl = 0;
+    for(size_t n = 0; n < mdp.size(); ++n)
+      ttl += mdp[n].d_ttl;
+    g_ret = ttl;
+  }
+  const vector<uint8_t>& d_packet;
+  std::string d_name;
+};
+
 
 struct SimpleCompressTest
 {
@@ -528,6 +585,57 @@ struct SimpleCompressTest
   std::string d_name;
 };
 
+/* writes a response of many records with many different names, which stresses name compression.
+   The record contents are made in advance, so only writing the packet is measured */
+struct CompressManyNamesTest
+{
+  CompressManyNamesTest(const string& name, const vector<pair<DNSName, shared_ptr<DNSRecordContent> > >& records)
+    : d_name(name), d_records(records)
+  {}
+
+  string getName() const
+  {
+    return d_name;
+  }
+
+  void operator()() const
+  {
+    vector<uint8_t> packet;
+    DNSPacketWriter pw(packet, d_records.front().first, QType::ANY);
+    for(const auto& record : d_records) {
+      pw.startRecord(record.first, record.second->getType());
+      record.second->toPacket(pw);
+    }
+    pw.commit();
+  }
+  string d_name;
+  vector<pair<DNSName, shared_ptr<DNSRecordContent> > > d_records;
+};
+
+//! 50 names with a signed A record each
+vector<pair<DNSName, shared_ptr<DNSRecordContent> > > makeSignedAnswer()
+{
+  vector<pair<DNSName, shared_ptr<DNSRecordContent> > > ret;
+  for(int n = 0; n < 50; ++n) {
+    DNSName name("host"+std::to_string(n)+".dept"+std::to_string(n % 5)+".example.com");
+    ret.push_back(make_pair(name, shared_ptr<DNSRecordContent>(DNSRecordContent::mastermake(QType::A, 1, "192.0.2."+std::to_string(n)))));
+    ret.push_back(make_pair(name, shared_ptr<DNSRecordContent>(DNSRecordContent::mastermake(QType::RRSIG, 1, "A 8 4 3600 20170101000000 20160101000000 54321 example.com. dGhpcyBpcyBub3QgcmVhbGx5IGEgc2lnbmF0dXJlLCBidXQgaXQgaGFzIHRoZSByaWdodCBzaXpl"))));
+  }
+  return ret;
+}
+
+//! what a 64k AXFR message of a delegation-heavy zone looks like
+vector<pair<DNSName, shared_ptr<DNSRecordContent> > > makeAXFRChunk()
+{
+  vector<pair<DNSName, shared_ptr<DNSRecordContent> > > ret;
+  for(int n = 0; n < 500; ++n) {
+    DNSName name("customer"+std::to_string(n)+".example.com");
+    ret.push_back(make_pair(name, shared_ptr<DNSRecordContent>(DNSRecordContent::mastermake(QType::NS, 1, "ns"+std::to_string(n % 20)+".provider"+std::to_string(n % 7)+".net"))));
+    ret.push_back(make_pair(DNSName("www")+name, shared_ptr<DNSRecordContent>(DNSRecordContent::mastermake(QType::A, 1, "198.51.100."+std::to_string(n % 250)))));
+  }
+  return ret;
+}
+
 struct VectorExpandTest
 {
   string getName() const
@@ -578,6 +686,245 @@ struct DNSNameRootTest
 
 
 
+struct DNSNameCopyTest
+{
+  explicit DNSNameCopyTest(const DNSName& name) : d_name(name)
+  {}
+
+  string getName() const
+  {
+    return "DNSName copy "+d_name.toString();
+  }
+
+  void operator()() const
+  {
+    DNSName copy(d_name);
+    g_ret = copy.empty();
+  }
+
+  DNSName d_name;
+};
+
+struct DNSNameHashLookupTest
+{
+  explicit DNSNameHashLookupTest(unsigned int count)
+  {
+    for(unsigned int n = 0; n < count; ++n)
+      d_set.insert(DNSName("host"+std::to_string(n)+".powerdns.com"));
+    d_probe = DNSName("host"+std::to_string(count/2)+".powerdns.com");
+  }
+
+  string getName() const
+  {
+    return "DNSName lookup in set of "+std::to_string(d_set.size());
+  }
+
+  void operator()() const
+  {
+    g_ret = d_set.count(d_probe);
+  }
+
+  std::unordered_set<DNSName> d_set;
+  DNSName d_probe;
+};
+
+#ifdef HAVE_PROTOBUF
+struct ProtobufQueryTest
+{
+  ProtobufQueryTest() : d_requestor("192.0.2.1"), d_responder("192.0.2.53"), d_subnet("198.51.100.0/24"), d_qname("www.powerdns.com")
+  {
+    for(size_t idx = 0; idx < d_uuid.size(); ++idx)
+      d_uuid.data[idx] = idx;
+  }
+
+  string getName() const
+  {
+    return "protobuf query message";
+  }
+
+  void operator()() const
+  {
+    DNSProtoBufMessage message(DNSProtoBufMessage::Query, d_uuid, &d_requestor, &d_responder, d_qname, QType::A, QClass::IN, 4242, false, 33);
+    message.setEDNSSubnet(d_subnet);
+    message.serialize(d_buffer);
+  }
+
+  boost::uuids::uuid d_uuid;
+  ComboAddress d_requestor, d_responder;
+  Netmask d_subnet;
+  DNSName d_qname;
+  mutable std::string d_buffer;
+};
+
+struct ProtobufResponseTest
+{
+  ProtobufResponseTest() : d_requestor("192.0.2.1"), d_responder("192.0.2.53"), d_qname("www.powerdns.com")
+  {
+    for(size_t idx = 0; idx < d_uuid.size(); ++idx)
+      d_uuid.data[idx] = idx;
+    DNSPacketWriter pw(d_packet, d_qname, QType::A);
+    pw.getHeader()->qr = 1;
+    for(int n = 1; n <= 4; ++n) {
+      pw.startRecord(d_qname, QType::A, 3600);
+      pw.xfrIP(htonl(0xc0000200 + n));
+    }
+    pw.commit();
+  }
+
+  string getName() const
+  {
+    return "protobuf response message with 4 A records";
+  }
+
+  void operator()() const
+  {
+    DNSProtoBufMessage message(DNSProtoBufMessage::Response, d_uuid, &d_requestor, &d_responder, d_qname, QType::A, QClass::IN, 4242, false, d_packet.size());
+    message.setQueryTime(1234567890, 0);
+    message.setResponseCode(0);
+    message.addRRsFromPacket((const char*) d_packet.data(), d_packet.size());
+    message.serialize(d_buffer);
+  }
+
+  boost::uuids::uuid d_uuid;
+  ComboAddress d_requestor, d_responder;
+  DNSName d_qname;
+  vector<uint8_t> d_packet;
+  mutable std::string d_buffer;
+};
+#endif /* HAVE_PROTOBUF */
+
+struct DNSNameViewCompareTest
+{
+  explicit DNSNameViewCompareTest(const vector<uint8_t>& packet) : d_packet(packet), d_qname("www.powerdns.com")
+  {}
+
+  string getName() const
+  {
+    return "DNSNameView question compare";
+  }
+
+  void operator()() const
+  {
+    DNSNameView view(reinterpret_cast<const char*>(d_packet.data()), d_packet.size(), sizeof(dnsheader));
+    g_ret = (view == d_qname);
+  }
+
+  const vector<uint8_t>& d_packet;
+  DNSName d_qname;
+};
+
+struct DNSNameQuestionCompareTest
+{
+  explicit DNSNameQuestionCompareTest(const vector<uint8_t>& packet) : d_packet(packet), d_qname("www.powerdns.com")
+  {}
+
+  string getName() const
+  {
+    return "DNSName question parse and compare";
+  }
+
+  void operator()() const
+  {
+    DNSName name(reinterpret_cast<const char*>(d_packet.data()), d_packet.size(), sizeof(dnsheader), false);
+    g_ret = (name == d_qname);
+  }
+
+  const vector<uint8_t>& d_packet;
+  DNSName d_qname;
+};
+
+struct NetmaskTreeLookupTest
+{
+  NetmaskTreeLookupTest(unsigned int prefixes, unsigned int lookups) : d_lookups(lookups)
+  {
+    std::mt19937 gen(1);
+    int64_t before = g_liveBytes;
+    for(unsigned int n = 0; n < prefixes; ++n) {
+      ComboAddress ca("0.0.0.0");
+      ca.sin4.sin_addr.s_addr = htonl(gen());
+      d_tree.insert(Netmask(ca, 16 + gen() % 17)).second = n;
+    }
+    cerr<<"NetmaskTree with "<<d_tree.size()<<" prefixes uses "<<(g_liveBytes - before)<<" bytes"<<endl;
+
+    d_addresses.reserve(lookups);
+    for(unsigned int n = 0; n < lookups; ++n) {
+      ComboAddress ca("0.0.0.0");
+      ca.sin4.sin_addr.s_addr = htonl(gen());
+      d_addresses.push_back(ca);
+    }
+  }
+
+  string getName() const
+  {
+    return std::to_string(d_lookups)+" NetmaskTree lookups in "+std::to_string(d_tree.size())+" prefixes";
+  }
+
+  void operator()() const
+  {
+    unsigned int found = 0;
+    for(const auto& ca : d_addresses)
+      found += d_tree.match(ca);
+    g_ret = found;
+  }
+
+  NetmaskTree<unsigned int> d_tree;
+  vector<ComboAddress> d_addresses;
+  unsigned int d_lookups;
+};
+
+/* parses a generated zone of the given number of lines, a mix of the usual
+   record types with relative names, comments and blank lines */
+struct ZoneParserTest
+{
+  explicit ZoneParserTest(unsigned int lines) : d_lines(lines)
+  {
+    char path[] = "/tmp/speedtest-zone.XXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0)
+      throw runtime_error("Unable to create a temporary file: "+stringerror());
+    d_path = path;
+
+    FILE* fp = fdopen(fd, "w");
+    fprintf(fp, "$ORIGIN example.com.\n$TTL 3600\n@ IN SOA ns1 hostmaster ( 2017010101 ; serial\n 3h 15m 1w 1h )\n@ IN NS ns1\n");
+    for(unsigned int n = 0, line = 5; line < lines; ++n, line += 10) {
+      fprintf(fp, "host%u IN A 192.0.%u.%u\n", n, (n >> 8) & 0xff, n & 0xff);
+      fprintf(fp, "host%u 300 IN AAAA 2001:db8::%x\n", n, n);
+      fprintf(fp, "  IN MX 10 mail%u ; same owner\n", n);
+      fprintf(fp, "www%u IN CNAME host%u\n", n, n);
+      fprintf(fp, "txt%u.example.com. 1h IN TXT \"v=spf1 include:example.net ~all\"\n", n);
+      fprintf(fp, "_sip._udp.srv%u IN SRV 10 20 5060 sip%u\n", n, n);
+      fprintf(fp, "; a comment line\n");
+      fprintf(fp, "sub%u IN NS ns.sub%u\n", n, n);
+      fprintf(fp, "\n");
+      fprintf(fp, "ptr%u IN PTR host%u.example.org.\n", n, n);
+    }
+    fclose(fp);
+  }
+
+  ~ZoneParserTest()
+  {
+    unlink(d_path.c_str());
+  }
+
+  string getName() const
+  {
+    return "parse a zone of "+std::to_string(d_lines)+" lines";
+  }
+
+  void operator()() const
+  {
+    ZoneParserTNG zpt(d_path, DNSName("example.com"));
+    DNSResourceRecord rr;
+    unsigned int records = 0;
+    while(zpt.get(rr))
+      records++;
+    g_ret = records;
+  }
+
+  string d_path;
+  unsigned int d_lines;
+};
+
 struct IEqualsTest
 {
   string getName() const
@@ -688,17 +1035,21 @@ try
   doRun(TypicalRefTest());
 
 
-  packet = makeEmptyQuery();
+  vector<uint8_t> packet = makeEmptyQuery();
   doRun(ParsePacketTest(packet, "empty-query"));
 
   packet = makeTypicalReferral();
   cerr<<"typical referral size: "<<packet.size()<<endl;
   doRun(ParsePacketBareTest(packet, "typical-referral"));
+  doRun(ParsePacketLazyTest(packet, "typical-referral"));
 
   doRun(ParsePacketTest(packet, "typical-referral"));
 
   doRun(SimpleCompressTest("www.france.ds9a.nl"));
 
+  doRun(CompressManyNamesTest("100 signed records with 50 names", makeSignedAnswer()));
+  doRun(CompressManyNamesTest("axfr chunk of 1000 records", makeAXFRChunk()));
+
   
   doRun(VectorExpandTest());
 
@@ -749,6 +1100,23 @@ try
 
   doRun(DNSNameParseTest());
   doRun(DNSNameRootTest());
+  doRun(DNSNameCopyTest(DNSName("www.powerdns.com")));
+  doRun(DNSNameCopyTest(DNSName("a-rather-long-label-for-a-name.that-does-not-fit-inline.powerdns.com")));
+  doRun(DNSNameHashLookupTest(10000));
+
+  vector<uint8_t> question;
+  DNSPacketWriter qpw(question, DNSName("www.powerdns.com"), QType::A);
+  doRun(DNSNameQuestionCompareTest(question));
+  doRun(DNSNameViewCompareTest(question));
+
+  doRun(NetmaskTreeLookupTest(100000, 1000000), 1000);
+
+  doRun(ZoneParserTest(10000000));
+
+#ifdef HAVE_PROTOBUF
+  doRun(ProtobufQueryTest());
+  doRun(ProtobufResponseTest());
+#endif
 
   cerr<<"Total runs: " << g_totalRuns<<endl;
 
@@ -36,9 +36,82 @@
 
 #include "namespaces.hh"
 
-StatBag::StatBag()
+/** One name or address queued by a packet thread, for the aggregator to put in a ring.
+    Names are kept in wire format, addresses as they are. */
+struct StatRingSample
+{
+  enum Kind : uint8_t { Name, NameAndType, Address };
+
+  uint16_t d_qtype;
+  uint8_t d_ring;     //!< index in d_ringIndex, or d_comboringIndex for addresses
+  Kind d_kind;
+  uint8_t d_len;
+  char d_data[64];
+};
+
+static_assert(sizeof(ComboAddress) <= sizeof(StatRingSample::d_data), "a ComboAddress must fit in a StatRingSample");
+
+/** Single producer, single consumer queue of samples. The producer is the thread owning the buffer,
+    the consumer is whoever holds StatBag::d_sampleLock. When the ring is full, samples are dropped. */
+class StatRingSampleBuffer
+{
+public:
+  StatRingSampleBuffer() : d_head(0), d_tail(0), d_orphaned(false), d_seen(0)
+  {
+  }
+
+  //! decides if the calling thread should account this item, for 1-in-N sampling
+  bool sampleThis(unsigned int rate)
+  {
+    return rate <= 1 || (d_seen++ % rate) == 0;
+  }
+
+  //! returns the slot to fill, or nullptr if the buffer is full. Producer only
+  StatRingSample* reserve()
+  {
+    uint32_t head = d_head.load(std::memory_order_relaxed);
+    if(head - d_tail.load(std::memory_order_acquire) >= s_size)
+      return nullptr;
+    return &d_samples[head % s_size];
+  }
+
+  //! publishes the slot returned by reserve(). Producer only
+  void commit()
+  {
+    d_head.store(d_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  //! calls f on every published sample. Consumer only
+  template<typename F> void drain(F f)
+  {
+    uint32_t tail = d_tail.load(std::memory_order_relaxed);
+    uint32_t head = d_head.load(std::memory_order_acquire);
+    for(; tail != head; ++tail)
+      f(d_samples[tail % s_size]);
+    d_tail.store(tail, std::memory_order_release);
+  }
+
+  std::atomic<uint32_t> d_head;
+  std::atomic<uint32_t> d_tail;
+  std::atomic<bool> d_orphaned; //!< set when the owning thread exits, the consumer then deletes us
+
+private:
+  static const uint32_t s_size = 1024;
+
+  uint64_t d_seen;
+  StatRingSample d_samples[s_size];
+};
+
+static void orphanSampleBuffer(void* buffer)
+{
+  static_cast<StatRingSampleBuffer*>(buffer)->d_orphaned.store(true, std::memory_order_release);
+}
+
+StatBag::StatBag() : d_aggregatorRunning(false), d_stopAggregator(false), d_sampleRate(1)
 {
   d_doRings=false;
+  pthread_mutex_init(&d_sampleLock, 0);
+  pthread_key_create(&d_sampleKey, orphanSampleBuffer);
 }
 
 void StatBag::exists(const string &key)
@@ -155,6 +228,15 @@ AtomicCounter *StatBag::getPointer(const string &key)
 
 StatBag::~StatBag()
 {
+  if(d_aggregatorRunning) {
+    d_stopAggregator = true;
+    pthread_join(d_aggregator, 0);
+  }
+  for(auto buffer : d_sampleBuffers)
+    delete buffer;
+  pthread_key_delete(d_sampleKey);
+  pthread_mutex_destroy(&d_sampleLock);
+
   for(map<string, AtomicCounter *>::const_iterator i=d_stats.begin();
       i!=d_stats.end();
       i++)
@@ -164,6 +246,140 @@ StatBag::~StatBag()
   
 }
 
+int StatBag::findRing(const char* name) const
+{
+  for(size_t n = 0; n < d_ringIndex.size(); ++n) {
+    if(!strcmp(d_ringIndex[n].first.c_str(), name))
+      return n;
+  }
+  return -1;
+}
+
+int StatBag::findComboRing(const char* name) const
+{
+  for(size_t n = 0; n < d_comboringIndex.size(); ++n) {
+    if(!strcmp(d_comboringIndex[n].first.c_str(), name))
+      return n;
+  }
+  return -1;
+}
+
+StatRingSampleBuffer* StatBag::getSampleBuffer()
+{
+  StatRingSampleBuffer* buffer = static_cast<StatRingSampleBuffer*>(pthread_getspecific(d_sampleKey));
+  if(!buffer) {
+    buffer = new StatRingSampleBuffer();
+    {
+      Lock l(&d_sampleLock);
+      d_sampleBuffers.push_back(buffer);
+    }
+    pthread_setspecific(d_sampleKey, buffer);
+  }
+  return buffer;
+}
+
+void StatBag::sampleName(const char* name, const DNSName& qname, uint16_t qtype, bool withType)
+{
+  int ring = findRing(name);
+  if(ring < 0)
+    throw runtime_error("Attempting to account to non-existent ring '"+std::string(name)+"'");
+
+  StatRingSampleBuffer* buffer = getSampleBuffer();
+  if(!buffer->sampleThis(d_sampleRate))
+    return;
+
+  const auto& storage = qname.getStorage();
+  if(storage.size() > sizeof(StatRingSample::d_data)) {
+    // too long for a sample, these are rare enough to take the lock for
+    d_ringIndex[ring].second->account(withType ? qname.toLogString()+"/"+QType(qtype).getName() : qname.toLogString());
+    return;
+  }
+
+  StatRingSample* sample = buffer->reserve();
+  if(!sample)
+    return;
+  sample->d_ring = ring;
+  sample->d_kind = withType ? StatRingSample::NameAndType : StatRingSample::Name;
+  sample->d_qtype = qtype;
+  sample->d_len = storage.size();
+  memcpy(sample->d_data, storage.data(), storage.size());
+  buffer->commit();
+}
+
+void StatBag::sampleAddress(const char* name, const ComboAddress& item)
+{
+  int ring = findComboRing(name);
+  if(ring < 0)
+    throw runtime_error("Attempting to account to non-existent comboring '"+std::string(name)+"'");
+
+  StatRingSampleBuffer* buffer = getSampleBuffer();
+  if(!buffer->sampleThis(d_sampleRate))
+    return;
+
+  StatRingSample* sample = buffer->reserve();
+  if(!sample)
+    return;
+  sample->d_ring = ring;
+  sample->d_kind = StatRingSample::Address;
+  memcpy(sample->d_data, &item, sizeof(item));
+  buffer->commit();
+}
+
+void StatBag::drainSamples()
+{
+  Lock l(&d_sampleLock);
+  for(auto iter = d_sampleBuffers.begin(); iter != d_sampleBuffers.end(); ) {
+    StatRingSampleBuffer* buffer = *iter;
+    // read this first, so we also get the samples the thread queued just before exiting
+    bool orphaned = buffer->d_orphaned.load(std::memory_order_acquire);
+
+    buffer->drain([this](const StatRingSample& sample) {
+        if(sample.d_kind == StatRingSample::Address) {
+          ComboAddress ca;
+          memcpy(&ca, sample.d_data, sizeof(ca));
+          d_comboringIndex[sample.d_ring].second->account(ca);
+          return;
+        }
+        DNSName qname;
+        if(sample.d_len)
+          qname = DNSName(sample.d_data, sample.d_len, 0, false);
+        if(sample.d_kind == StatRingSample::NameAndType)
+          d_ringIndex[sample.d_ring].second->account(qname.toLogString()+"/"+QType(sample.d_qtype).getName());
+        else
+          d_ringIndex[sample.d_ring].second->account(qname.toLogString());
+      });
+
+    if(orphaned) {
+      delete buffer;
+      iter = d_sampleBuffers.erase(iter);
+    }
+    else
+      ++iter;
+  }
+}
+
+void* StatBag::aggregatorThread(void* self)
+{
+  StatBag* us = static_cast<StatBag*>(self);
+  while(!us->d_stopAggregator) {
+    usleep(10000);
+    us->drainSamples();
+  }
+  return 0;
+}
+
+void StatBag::doRings()
+{
+  if(!d_aggregatorRunning.exchange(true))
+    pthread_create(&d_aggregator, 0, aggregatorThread, this);
+  d_doRings=true;
+}
+
+void StatBag::setRingSampleRate(unsigned int rate)
+{
+  d_sampleRate = rate ? rate : 1;
+}
+
 template<typename T, typename Comp>
 StatRing<T,Comp>::StatRing(unsigned int size)
 {
@@ -228,17 +444,22 @@ void StatBag::declareRing(const string &name, const string &help, unsigned int s
 {
   d_rings[name]=StatRing<string>(size);
   d_rings[name].setHelp(help);
+  if(findRing(name.c_str()) < 0)
+    d_ringIndex.push_back(make_pair(name, &d_rings[name]));
 }
 
 void StatBag::declareComboRing(const string &name, const string &help, unsigned int size)
 {
   d_comborings[name]=StatRing<SComboAddress>(size);
   d_comborings[name].setHelp(help);
+  if(findComboRing(name.c_str()) < 0)
+    d_comboringIndex.push_back(make_pair(name, &d_comborings[name]));
 }
 
 
 vector<pair<string, unsigned int> > StatBag::getRing(const string &name)
 {
+  drainSamples();
   if(d_rings.count(name))
     return d_rings[name].get();
   else {
@@ -262,6 +483,7 @@ void StatRing<T,Comp>::reset()
 
 void StatBag::resetRing(const string &name)
 {
+  drainSamples(); // so nothing queued before the reset shows up after it
   if(d_rings.count(name))
     d_rings[name].reset();
   else
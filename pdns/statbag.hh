@@ -26,9 +26,12 @@
 #include <functional>
 #include <string>
 #include <vector>
+#include <atomic>
 #include "lock.hh"
 #include "namespaces.hh"
 #include "iputils.hh"
+#include "dnsname.hh"
+#include "qtype.hh"
 #include <boost/circular_buffer.hpp>
 
 
@@ -59,6 +62,8 @@ private:
 };
 
 
+class StatRingSampleBuffer;
+
 //! use this to gather and query statistics
 class StatBag
 {
@@ -71,6 +76,26 @@ class StatBag
   funcstats_t d_funcstats;
   bool d_doRings;
 
+  /* Names and addresses are not put in the rings by the packet threads themselves. Each thread
+     writes them, in wire format, to its own lock-free buffer, and the aggregator thread started
+     by doRings() moves them to the rings. Rings are looked up by name in these vectors,
+     which do not change once the rings have been declared. */
+  vector<pair<string, StatRing<string>*> > d_ringIndex;
+  vector<pair<string, StatRing<SComboAddress>*> > d_comboringIndex;
+  vector<StatRingSampleBuffer*> d_sampleBuffers;
+  pthread_mutex_t d_sampleLock; //!< protects d_sampleBuffers, and the reading side of the buffers
+  pthread_key_t d_sampleKey;
+  pthread_t d_aggregator;
+  std::atomic<bool> d_aggregatorRunning;
+  std::atomic<bool> d_stopAggregator;
+  unsigned int d_sampleRate;
+
+  int findRing(const char* name) const;
+  int findComboRing(const char* name) const;
+  StatRingSampleBuffer* getSampleBuffer();
+  void drainSamples();
+  static void* aggregatorThread(void* self);
+
 public:
   StatBag(); //!< Naked constructor. You need to declare keys before this class becomes useful
   ~StatBag();
@@ -84,25 +109,34 @@ public:
   void ringAccount(const char* name, const string &item)
   {
     if(d_doRings)  {
-      if(!d_rings.count(name))
+      int ring = findRing(name);
+      if(ring < 0)
 	throw runtime_error("Attempting to account to non-existent ring '"+std::string(name)+"'");
 
-      d_rings[name].account(item);
+      d_ringIndex[ring].second->account(item);
     }
   }
-  void ringAccount(const char* name, const ComboAddress &item)
+  //! accounts 'qname/qtype', through the calling thread's sample buffer
+  void ringAccount(const char* name, const DNSName& qname, const QType& qtype)
   {
-    if(d_doRings) {
-      if(!d_comborings.count(name))
-	throw runtime_error("Attempting to account to non-existent comboring '"+std::string(name)+"'");
-      d_comborings[name].account(item);
-    }
+    if(d_doRings)
+      sampleName(name, qname, qtype.getCode(), true);
   }
-
-  void doRings()
+  //! accounts 'qname', through the calling thread's sample buffer
+  void ringAccount(const char* name, const DNSName& qname)
   {
-    d_doRings=true;
+    if(d_doRings)
+      sampleName(name, qname, 0, false);
   }
+  //! accounts the address, through the calling thread's sample buffer
+  void ringAccount(const char* name, const ComboAddress &item)
+  {
+    if(d_doRings)
+      sampleAddress(name, item);
+  }
+
+  void doRings(); //!< start accounting to the rings, and the thread that fills them
+  void setRingSampleRate(unsigned int rate); //!< only account one in every 'rate' names and addresses, per thread
 
   vector<string>listRings();
   bool ringExists(const string &name);
@@ -122,6 +156,10 @@ public:
   AtomicCounter *getPointer(const string &key); //!< get a direct pointer to the value behind a key. Use this for high performance increments
   string getValueStr(const string &key); //!< read a value behind a key, and return it as a string
   string getValueStrZero(const string &key); //!< read a value behind a key, and return it as a string, and zero afterwards
+
+private:
+  void sampleName(const char* name, const DNSName& qname, uint16_t qtype, bool withType);
+  void sampleAddress(const char* name, const ComboAddress& item);
 };
 
 inline void StatBag::deposit(const string &key, int value)
@@ -291,6 +291,11 @@ public:
   {
     d_nocache=state;
   }
+  //! don't answer the qname|qtype passed to beginResolve() from the cache, but go out and replace what is there
+  void setRefresh(bool state=true)
+  {
+    d_refresh=state;
+  }
 
   void setDoEDNS0(bool state=true)
   {
@@ -480,8 +485,8 @@ private:
   int doResolve(const DNSName &qname, const QType &qtype, vector<DNSRecord>&ret, int depth, set<GetBestNSAnswer>& beenthere);
   bool doOOBResolve(const DNSName &qname, const QType &qtype, vector<DNSRecord>&ret, int depth, int &res);
   domainmap_t::const_iterator getBestAuthZone(DNSName* qname);
-  bool doCNAMECacheCheck(const DNSName &qname, const QType &qtype, vector<DNSRecord>&ret, int depth, int &res);
-  bool doCacheCheck(const DNSName &qname, const QType &qtype, vector<DNSRecord>&ret, int depth, int &res);
+  bool doCNAMECacheCheck(const DNSName &qname, const QType &qtype, vector<DNSRecord>&ret, int depth, int &res, bool serveStale=false);
+  bool doCacheCheck(const DNSName &qname, const QType &qtype, vector<DNSRecord>&ret, int depth, int &res, bool serveStale=false);
   void getBestNSFromCache(const DNSName &qname, const QType &qtype, vector<DNSRecord>&bestns, bool* flawedNSSet, int depth, set<GetBestNSAnswer>& beenthere);
   DNSName getBestNSNamesFromCache(const DNSName &qname, const QType &qtype, NsSet& nsset, bool* flawedNSSet, int depth, set<GetBestNSAnswer>&beenthere);
 
@@ -494,6 +499,7 @@ private:
   string d_prefix;
   bool d_cacheonly;
   bool d_nocache;
+  bool d_refresh;
   bool d_doEDNS0;
 
   static LogMode s_lm;
@@ -603,6 +609,12 @@ struct RecursorStats
   std::atomic<uint64_t> overCapacityDrops;
   std::atomic<uint64_t> ipv6queries;
   std::atomic<uint64_t> chainResends;
+  std::atomic<uint64_t> tcpOutConnectionsNew;
+  std::atomic<uint64_t> tcpOutConnectionsReused;
+  std::atomic<uint64_t> refreshAheadQueries;
+  std::atomic<uint64_t> refreshAheadFailures;
+  std::atomic<uint64_t> refreshAheadHits;
+  std::atomic<uint64_t> staleAnswers;
   std::atomic<uint64_t> nsSetInvalidations;
   std::atomic<uint64_t> ednsPingMatches;
   std::atomic<uint64_t> ednsPingMismatches;
@@ -27,6 +27,7 @@
 #include "dnssecinfra.hh"
 #include "dnsseckeeper.hh"
 #include <cstdio>
+#include <sys/uio.h>
 #include "base32.hh"
 #include <cstring>
 #include <cstdlib>
@@ -241,11 +242,15 @@ static void proxyQuestion(shared_ptr<DNSPacket> packet)
 
 static void incTCPAnswerCount(const ComboAddress& remote)
 {
-  S.inc("tcp-answers");
+  static AtomicCounter &tcpnumanswered=*S.getPointer("tcp-answers");
+  static AtomicCounter &tcpnumanswered4=*S.getPointer("tcp4-answers");
+  static AtomicCounter &tcpnumanswered6=*S.getPointer("tcp6-answers");
+
+  tcpnumanswered++;
   if(remote.sin4.sin_family == AF_INET6)
-    S.inc("tcp6-answers");
+    tcpnumanswered6++;
   else
-    S.inc("tcp4-answers");
+    tcpnumanswered4++;
 }
 void *TCPNameserver::doConnection(void *data)
 {
@@ -254,6 +259,9 @@ void *TCPNameserver::doConnection(void *data)
   int fd=(int)(long)data; // gotta love C (generates a harmless warning on opteron)
   ComboAddress remote;
   socklen_t remotelen=sizeof(remote);
+  static AtomicCounter &tcpnumreceived=*S.getPointer("tcp-queries");
+  static AtomicCounter &tcpnumreceived4=*S.getPointer("tcp4-queries");
+  static AtomicCounter &tcpnumreceived6=*S.getPointer("tcp6-queries");
 
   pthread_detach(pthread_self());
   if(getpeername(fd, (struct sockaddr *)&remote, &remotelen) < 0) {
@@ -291,11 +299,11 @@ void *TCPNameserver::doConnection(void *data)
       }
       
       getQuestion(fd, mesg.get(), pktlen, remote);
-      S.inc("tcp-queries");      
+      tcpnumreceived++;
       if(remote.sin4.sin_family == AF_INET6)
-        S.inc("tcp6-queries");
+        tcpnumreceived6++;
       else
-        S.inc("tcp4-queries");
+        tcpnumreceived4++;
 
       packet=shared_ptr<DNSPacket>(new DNSPacket);
       packet->setRemote(&remote);
@@ -531,6 +539,92 @@ namespace {
     ret->d_tcp = true;
     return ret;
   }
+
+  /* Collects the packets of an outgoing zone transfer and writes them out with a single writev() once
+     enough of them are queued. Packets are rendered (and TSIG signed) when they are queued. */
+  class AXFRPacketWriter
+  {
+  public:
+    explicit AXFRPacketWriter(int fd) : d_fd(fd), d_queuedBytes(0), d_sentBytes(0)
+    {
+    }
+
+    void queue(shared_ptr<DNSPacket> p)
+    {
+      g_rs.submitResponse(*p, false);
+
+      const string& packet = p->getString();
+      uint16_t len=htons(packet.length());
+      d_buffers.push_back(string((const char*)&len, 2));
+      d_buffers.back().append(packet);
+      d_queuedBytes += d_buffers.back().length();
+
+      if(d_queuedBytes >= s_maxQueuedBytes || d_buffers.size() >= s_maxQueuedPackets)
+        flush();
+    }
+
+    void flush()
+    {
+      if(d_buffers.empty())
+        return;
+
+      vector<struct iovec> iov(d_buffers.size());
+      for(unsigned int n = 0; n < d_buffers.size(); ++n) {
+        iov[n].iov_base = (void*)d_buffers[n].c_str();
+        iov[n].iov_len = d_buffers[n].length();
+      }
+
+      unsigned int pos = 0;
+      while(pos < iov.size()) {
+        ssize_t ret = writev(d_fd, &iov[pos], iov.size() - pos);
+        if(ret < 0) {
+          if(errno==EAGAIN) {
+            int res=waitForRWData(d_fd, false, 5, 0);
+            if(res < 0)
+              throw NetworkError("Waiting for data write");
+            if(!res)
+              throw NetworkError("Timeout writing data");
+            continue;
+          }
+          else
+            throw NetworkError("Writing data: "+stringerror());
+        }
+        if(!ret)
+          throw NetworkError("Did not fulfill TCP write due to EOF");
+
+        d_sentBytes += ret;
+        size_t written = ret;
+        while(written) {
+          if(written >= iov[pos].iov_len) {
+            written -= iov[pos].iov_len;
+            ++pos;
+          }
+          else {
+            iov[pos].iov_base = (char*)iov[pos].iov_base + written;
+            iov[pos].iov_len -= written;
+            written = 0;
+          }
+        }
+      }
+
+      d_buffers.clear();
+      d_queuedBytes = 0;
+    }
+
+    uint64_t getBytesSent() const
+    {
+      return d_sentBytes;
+    }
+
+  private:
+    static const size_t s_maxQueuedBytes = 65536;
+    static const size_t s_maxQueuedPackets = 64;
+
+    int d_fd;
+    size_t d_queuedBytes;
+    uint64_t d_sentBytes;
+    vector<string> d_buffers;
+  };
 }
 
 
@@ -729,15 +823,82 @@ int TCPNameserver::doAXFR(const DNSName &target, shared_ptr<DNSPacket> q, int ou
 
 
   const bool rectify = !(presignedZone || ::arg().mustDo("disable-axfr-rectify"));
+  /* Only NSEC(3) generation needs to know the auth flags and all names of the zone up front. For unsigned
+     zones, records go straight from the backend through the pipe and out, without keeping the zone in memory. */
+  const bool streaming = !securedZone;
   set<DNSName> qnames, nsset, terms;
   vector<DNSResourceRecord> rrs;
 
+  AXFRPacketWriter writer(outsock);
+  size_t maxBuffered = 0;
+  auto sendChunks = [&](bool final) {
+    maxBuffered = std::max(maxBuffered, rrs.size() + nsecxrepo.size() + csp.getReady());
+    for(;;) {
+      outpacket->getRRS() = csp.getChunk(final);
+      if(outpacket->getRRS().empty())
+        break;
+      if(!tsigkeyname.empty())
+        outpacket->setTSIGDetails(trc, tsigkeyname, tsigsecret, trc.d_mac, true);
+      writer.queue(outpacket);
+      trc.d_mac=outpacket->d_trc.d_mac;
+      outpacket=getFreshAXFRPacket(q);
+    }
+  };
+
+  string keyname;
+  set<string> ns3rrs;
+  unsigned int udiff;
+  DTime dt;
+  dt.set();
+  int records=0;
+  auto writeRecord = [&](DNSResourceRecord& rr) {
+    if (rr.qtype.getCode() == QType::RRSIG) {
+      RRSIGRecordContent rrc(rr.content);
+      if(presignedZone && rrc.d_type == QType::NSEC3)
+        ns3rrs.insert(fromBase32Hex(makeRelative(rr.qname.toStringNoDot(), target.toStringNoDot()))); // FIXME400
+      return;
+    }
+
+    // only skip the DNSKEY, CDNSKEY and CDS if direct-dnskey is enabled, to avoid changing behaviour
+    // when it is not enabled.
+    if(::arg().mustDo("direct-dnskey") && (rr.qtype.getCode() == QType::DNSKEY || rr.qtype.getCode() == QType::CDNSKEY || rr.qtype.getCode() == QType::CDS))
+      return;
+
+    records++;
+    if(securedZone && (rr.auth || rr.qtype.getCode() == QType::NS)) {
+      if (NSEC3Zone || rr.qtype.getCode()) {
+        keyname = NSEC3Zone ? hashQNameWithSalt(ns3pr, rr.qname) : labelReverse(rr.qname.toString());
+        NSECXEntry& ne = nsecxrepo[keyname];
+        ne.d_ttl = sd.default_ttl;
+        ne.d_auth = (ne.d_auth || rr.auth || (NSEC3Zone && (!ns3pr.d_flags || (presignedZone && ns3pr.d_flags))));
+        if (rr.qtype.getCode()) {
+          ne.d_set.insert(rr.qtype.getCode());
+        }
+      }
+    }
+
+    if (!rr.qtype.getCode())
+      return; // skip empty non-terminals
+
+    if(rr.qtype.getCode() == QType::SOA)
+      return; // skip SOA - would indicate end of AXFR
+
+    if(csp.submit(rr))
+      sendChunks(false);
+  };
+  auto addRecord = [&](DNSResourceRecord& rr) {
+    if(streaming)
+      writeRecord(rr);
+    else
+      rrs.push_back(rr);
+  };
+
   // Add the CDNSKEY and CDS records we created earlier
-  for (auto const &rr : cds)
-    rrs.push_back(rr);
+  for (auto &rr : cds)
+    addRecord(rr);
 
-  for (auto const &rr : cdnskey)
-    rrs.push_back(rr);
+  for (auto &rr : cdnskey)
+    addRecord(rr);
 
   while(sd.db->get(rr)) {
     if(rr.qname.isPartOf(target)) {
@@ -747,6 +908,7 @@ int TCPNameserver::doAXFR(const DNSName &target, shared_ptr<DNSPacket> q, int ou
         int ret2 = stubDoResolve(rr.content, QType::AAAA, ips);
         if(ret1 != RCode::NoError || ret2 != RCode::NoError) {
           L<<Logger::Error<<"Error resolving for ALIAS "<<rr.content<<", aborting AXFR"<<endl;
+          writer.flush();
           outpacket->setRcode(2); // 'SERVFAIL'
           sendPacket(outpacket,outsock);
           return 0;
@@ -754,14 +916,14 @@ int TCPNameserver::doAXFR(const DNSName &target, shared_ptr<DNSPacket> q, int ou
         for(const auto& ip: ips) {
           rr.qtype = ip.qtype;
           rr.content = ip.content;
-          rrs.push_back(rr);
+          addRecord(rr);
         }
       }
       else {
-        rrs.push_back(rr);
+        addRecord(rr);
       }
 
-      if (rectify) {
+      if (rectify && !streaming) {
         if (rr.qtype.getCode()) {
           qnames.insert(rr.qname);
           if(rr.qtype.getCode() == QType::NS && rr.qname!=target)
@@ -778,7 +940,7 @@ int TCPNameserver::doAXFR(const DNSName &target, shared_ptr<DNSPacket> q, int ou
     }
   }
 
-  if(rectify) {
+  if(rectify && !streaming) {
     // set auth
     for(DNSResourceRecord &rr :  rrs) {
       rr.auth=true;
@@ -847,60 +1009,8 @@ int TCPNameserver::doAXFR(const DNSName &target, shared_ptr<DNSPacket> q, int ou
 
 
   /* now write all other records */
-  
-  string keyname;
-  set<string> ns3rrs;
-  unsigned int udiff;
-  DTime dt;
-  dt.set();
-  int records=0;
-  for(DNSResourceRecord &rr :  rrs) {
-    if (rr.qtype.getCode() == QType::RRSIG) {
-      RRSIGRecordContent rrc(rr.content);
-      if(presignedZone && rrc.d_type == QType::NSEC3)
-        ns3rrs.insert(fromBase32Hex(makeRelative(rr.qname.toStringNoDot(), target.toStringNoDot()))); // FIXME400
-      continue;
-    }
-
-    // only skip the DNSKEY, CDNSKEY and CDS if direct-dnskey is enabled, to avoid changing behaviour
-    // when it is not enabled.
-    if(::arg().mustDo("direct-dnskey") && (rr.qtype.getCode() == QType::DNSKEY || rr.qtype.getCode() == QType::CDNSKEY || rr.qtype.getCode() == QType::CDS))
-      continue;
-
-    records++;
-    if(securedZone && (rr.auth || rr.qtype.getCode() == QType::NS)) {
-      if (NSEC3Zone || rr.qtype.getCode()) {
-        keyname = NSEC3Zone ? hashQNameWithSalt(ns3pr, rr.qname) : labelReverse(rr.qname.toString());
-        NSECXEntry& ne = nsecxrepo[keyname];
-        ne.d_ttl = sd.default_ttl;
-        ne.d_auth = (ne.d_auth || rr.auth || (NSEC3Zone && (!ns3pr.d_flags || (presignedZone && ns3pr.d_flags))));
-        if (rr.qtype.getCode()) {
-          ne.d_set.insert(rr.qtype.getCode());
-        }
-      }
-    }
-
-    if (!rr.qtype.getCode())
-      continue; // skip empty non-terminals
-
-    if(rr.qtype.getCode() == QType::SOA)
-      continue; // skip SOA - would indicate end of AXFR
-
-    if(csp.submit(rr)) {
-      for(;;) {
-        outpacket->getRRS() = csp.getChunk();
-        if(!outpacket->getRRS().empty()) {
-          if(!tsigkeyname.empty()) 
-            outpacket->setTSIGDetails(trc, tsigkeyname, tsigsecret, trc.d_mac, true);
-          sendPacket(outpacket, outsock);
-          trc.d_mac=outpacket->d_trc.d_mac;
-          outpacket=getFreshAXFRPacket(q);
-        }
-        else
-          break;
-      }
-    }
-  }
+  for(DNSResourceRecord &rr :  rrs)
+    writeRecord(rr);
   /*
   udiff=dt.udiffNoReset();
   cerr<<"Starting NSEC: "<<csp.d_signed/(udiff/1000000.0)<<" sigs/s, "<<csp.d_signed<<" / "<<udiff/1000000.0<<endl;
@@ -937,20 +1047,8 @@ int TCPNameserver::doAXFR(const DNSName &target, shared_ptr<DNSPacket> q, int ou
           rr.qtype = QType::NSEC3;
           rr.d_place = DNSResourceRecord::ANSWER;
           rr.auth=true;
-          if(csp.submit(rr)) {
-            for(;;) {
-              outpacket->getRRS() = csp.getChunk();
-              if(!outpacket->getRRS().empty()) {
-                if(!tsigkeyname.empty())
-                  outpacket->setTSIGDetails(trc, tsigkeyname, tsigsecret, trc.d_mac, true);
-                sendPacket(outpacket, outsock);
-                trc.d_mac=outpacket->d_trc.d_mac;
-                outpacket=getFreshAXFRPacket(q);
-              }
-              else
-                break;
-            }
-          }
+          if(csp.submit(rr))
+            sendChunks(false);
         }
       }
     }
@@ -972,20 +1070,8 @@ int TCPNameserver::doAXFR(const DNSName &target, shared_ptr<DNSPacket> q, int ou
       rr.qtype = QType::NSEC;
       rr.d_place = DNSResourceRecord::ANSWER;
       rr.auth=true;
-      if(csp.submit(rr)) {
-        for(;;) {
-          outpacket->getRRS() = csp.getChunk();
-          if(!outpacket->getRRS().empty()) {
-            if(!tsigkeyname.empty())
-              outpacket->setTSIGDetails(trc, tsigkeyname, tsigsecret, trc.d_mac, true); 
-            sendPacket(outpacket, outsock);
-            trc.d_mac=outpacket->d_trc.d_mac;
-            outpacket=getFreshAXFRPacket(q);
-          }
-          else
-            break;
-        }
-      }
+      if(csp.submit(rr))
+        sendChunks(false);
     }
   }
   /*
@@ -994,22 +1080,14 @@ int TCPNameserver::doAXFR(const DNSName &target, shared_ptr<DNSPacket> q, int ou
   cerr<<"Outstanding: "<<csp.d_outstanding<<", "<<csp.d_queued - csp.d_signed << endl;
   cerr<<"Ready for consumption: "<<csp.getReady()<<endl;
   * */
-  for(;;) { 
-    outpacket->getRRS() = csp.getChunk(true); // flush the pipe
-    if(!outpacket->getRRS().empty()) {
-      if(!tsigkeyname.empty())
-        outpacket->setTSIGDetails(trc, tsigkeyname, tsigsecret, trc.d_mac, true); // first answer is 'normal'
-      sendPacket(outpacket, outsock);
-      trc.d_mac=outpacket->d_trc.d_mac;
-      outpacket=getFreshAXFRPacket(q);
-    }
-    else 
-      break;
-  }
+  sendChunks(true); // flush the pipe
   
   udiff=dt.udiffNoReset();
-  if(securedZone) 
+  if(securedZone) {
     L<<Logger::Info<<"Done signing: "<<csp.d_signed/(udiff/1000000.0)<<" sigs/s, "<<endl;
+    S.deposit("signing-rrsets", csp.d_signed);
+    S.set("signing-rrsets-per-second", udiff ? csp.d_signed*1000000ULL/udiff : csp.d_signed);
+  }
   
   DLOG(L<<"Done writing out records"<<endl);
   /* and terminate with yet again the SOA record */
@@ -1019,10 +1097,13 @@ int TCPNameserver::doAXFR(const DNSName &target, shared_ptr<DNSPacket> q, int ou
   if(!tsigkeyname.empty())
     outpacket->setTSIGDetails(trc, tsigkeyname, tsigsecret, trc.d_mac, true); 
   
-  sendPacket(outpacket, outsock);
+  writer.queue(outpacket);
+  writer.flush();
   
   DLOG(L<<"last packet - close"<<endl);
-  L<<Logger::Error<<"AXFR of domain '"<<target<<"' to "<<q->getRemote()<<" finished"<<endl;
+  udiff=dt.udiffNoReset();
+  L<<Logger::Error<<"AXFR of domain '"<<target<<"' to "<<q->getRemote()<<" finished: "<<records<<" records, "<<writer.getBytesSent()<<" bytes in "<<udiff/1000<<" ms ("<<
+    (udiff ? writer.getBytesSent()*1000000/udiff : writer.getBytesSent())<<" bytes/s), at most "<<maxBuffered<<" records held in memory"<<endl;
 
   return 1;
 }
@@ -0,0 +1,90 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <boost/test/unit_test.hpp>
+
+#include "auth-zonecache.hh"
+
+BOOST_AUTO_TEST_SUITE(auth_zonecache_cc)
+
+static DomainInfo makeDomainInfo(const string& zone, uint32_t id)
+{
+  DomainInfo di;
+  di.zone = DNSName(zone);
+  di.id = id;
+  return di;
+}
+
+BOOST_AUTO_TEST_CASE(test_AuthZoneCacheEnclosing) {
+  AuthZoneCache zc;
+  vector<DomainInfo> zones;
+  zones.push_back(makeDomainInfo("powerdns.com.", 1));
+  zones.push_back(makeDomainInfo("sub.powerdns.com.", 2));
+  zones.push_back(makeDomainInfo("example.org.", 3));
+  zc.replace(zones);
+  BOOST_CHECK_EQUAL(zc.size(), 3U);
+
+  DNSName zone;
+  int zoneId = -1;
+  BOOST_CHECK(zc.getEnclosing(DNSName("www.powerdns.com."), &zone, &zoneId));
+  BOOST_CHECK_EQUAL(zone, DNSName("powerdns.com."));
+  BOOST_CHECK_EQUAL(zoneId, 1);
+
+  BOOST_CHECK(zc.getEnclosing(DNSName("a.b.SUB.powerdns.com."), &zone, &zoneId));
+  BOOST_CHECK_EQUAL(zone, DNSName("sub.powerdns.com."));
+  BOOST_CHECK_EQUAL(zoneId, 2);
+
+  BOOST_CHECK(zc.getEnclosing(DNSName("example.org."), &zone, &zoneId));
+  BOOST_CHECK_EQUAL(zone, DNSName("example.org."));
+  BOOST_CHECK_EQUAL(zoneId, 3);
+
+  BOOST_CHECK(!zc.getEnclosing(DNSName("www.example.net."), &zone, &zoneId));
+  BOOST_CHECK(!zc.getEnclosing(DNSName("com."), &zone, &zoneId));
+}
+
+BOOST_AUTO_TEST_CASE(test_AuthZoneCacheAddRemove) {
+  AuthZoneCache zc;
+  DNSName zone;
+  int zoneId = -1;
+
+  zc.add(DNSName("powerdns.com."), 1);
+  zc.add(DNSName("sub.powerdns.com."), 2);
+  BOOST_CHECK(zc.getEnclosing(DNSName("www.sub.powerdns.com."), &zone, &zoneId));
+  BOOST_CHECK_EQUAL(zoneId, 2);
+
+  zc.remove(DNSName("sub.powerdns.com."));
+  BOOST_CHECK_EQUAL(zc.size(), 1U);
+  BOOST_CHECK(zc.getEnclosing(DNSName("www.sub.powerdns.com."), &zone, &zoneId));
+  BOOST_CHECK_EQUAL(zone, DNSName("powerdns.com."));
+  BOOST_CHECK_EQUAL(zoneId, 1);
+
+  /* removing what is not there, or only exists as part of a longer name, changes nothing */
+  zc.remove(DNSName("sub.powerdns.com."));
+  zc.remove(DNSName("com."));
+  BOOST_CHECK_EQUAL(zc.size(), 1U);
+  BOOST_CHECK(zc.getEnclosing(DNSName("powerdns.com."), &zone, &zoneId));
+
+  /* the root is a zone like any other */
+  zc.add(DNSName("."), 3);
+  BOOST_CHECK_EQUAL(zc.size(), 2U);
+  BOOST_CHECK(zc.getEnclosing(DNSName("www.example.net."), &zone, &zoneId));
+  BOOST_CHECK_EQUAL(zone, DNSName("."));
+  BOOST_CHECK_EQUAL(zoneId, 3);
+  zc.remove(DNSName("."));
+  BOOST_CHECK(!zc.getEnclosing(DNSName("www.example.net."), &zone, &zoneId));
+
+  /* re-adding a zone updates its id */
+  zc.add(DNSName("powerdns.com."), 4);
+  BOOST_CHECK_EQUAL(zc.size(), 1U);
+  BOOST_CHECK(zc.getEnclosing(DNSName("www.POWERDNS.com."), &zone, &zoneId));
+  BOOST_CHECK_EQUAL(zoneId, 4);
+
+  zc.replace(vector<DomainInfo>());
+  BOOST_CHECK_EQUAL(zc.size(), 0U);
+  BOOST_CHECK(!zc.getEnclosing(DNSName("www.sub.powerdns.com."), &zone, &zoneId));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
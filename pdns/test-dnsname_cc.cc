@@ -657,5 +657,73 @@ BOOST_AUTO_TEST_CASE(test_wirelength) { // Testing if we get the correct value f
   BOOST_CHECK_EQUAL(sname.wirelength(), 19);
 }
 
+BOOST_AUTO_TEST_CASE(test_hashcache) { // The cached hash must follow modifications of the name
+  DNSName name("www.powerdns.com");
+  uint32_t h = name.hash();
+  BOOST_CHECK_EQUAL(h, name.hash());
+  BOOST_CHECK_EQUAL(h, DNSName("WWW.PowerDNS.COM").hash());
+
+  DNSName copy(name);
+  BOOST_CHECK_EQUAL(copy.hash(), h);
+
+  name.chopOff();
+  BOOST_CHECK_EQUAL(name.hash(), DNSName("powerdns.com").hash());
+  name.prependRawLabel("ns1");
+  BOOST_CHECK_EQUAL(name.hash(), DNSName("ns1.powerdns.com").hash());
+  name.appendRawLabel("nl");
+  BOOST_CHECK_EQUAL(name.hash(), DNSName("ns1.powerdns.com.nl").hash());
+  name.makeUsRelative(DNSName("com.nl"));
+  BOOST_CHECK_EQUAL(name.hash(), DNSName("ns1.powerdns").hash());
+  name += DNSName("org");
+  BOOST_CHECK_EQUAL(name.hash(), DNSName("ns1.powerdns.org").hash());
+  name.clear();
+  BOOST_CHECK_EQUAL(name.hash(), DNSName().hash());
+}
+
+BOOST_AUTO_TEST_CASE(test_appendToString) {
+  for(const auto& name : {DNSName("."), DNSName("www.powerdns.com."), DNSName("a\\.b\\\\c\\032d\\255\\000.example.")}) {
+    string out("prefix ");
+    name.appendToString(out);
+    BOOST_CHECK_EQUAL(out, "prefix " + name.toString());
+  }
+  string out;
+  BOOST_CHECK_THROW(DNSName().appendToString(out), std::out_of_range);
+}
+
+BOOST_AUTO_TEST_CASE(test_longname) { // Names that do not fit in the inline buffer
+  string label(63, 'a');
+  DNSName name(label+"."+label+"."+label+"."+string(61, 'b'));
+  BOOST_CHECK_EQUAL(name.wirelength(), 255);
+  DNSName copy(name);
+  BOOST_CHECK_EQUAL(copy, name);
+  DNSName moved(std::move(copy));
+  BOOST_CHECK_EQUAL(moved, name);
+  BOOST_CHECK(moved.isPartOf(DNSName(string(61, 'b'))));
+  moved.chopOff();
+  BOOST_CHECK_EQUAL(moved.countLabels(), 3);
+  moved.prependRawLabel(label);
+  BOOST_CHECK_EQUAL(moved.countLabels(), 4);
+  BOOST_CHECK_EQUAL(moved, name);
+}
+
+BOOST_AUTO_TEST_CASE(test_view) { // DNSNameView over an uncompressed question
+  vector<uint8_t> packet;
+  DNSPacketWriter dpw(packet, DNSName("www.PowerDNS.com"), QType::A);
+
+  DNSNameView view(reinterpret_cast<const char*>(packet.data()), packet.size(), sizeof(dnsheader));
+  BOOST_CHECK_EQUAL(view.wirelength(), 18);
+  BOOST_CHECK(view == DNSName("www.powerdns.com"));
+  BOOST_CHECK(DNSName("WWW.POWERDNS.COM") == view);
+  BOOST_CHECK(view != DNSName("powerdns.com"));
+  BOOST_CHECK(view.isPartOf(DNSName("powerdns.com")));
+  BOOST_CHECK(!view.isPartOf(DNSName("powerdns.org")));
+  BOOST_CHECK_EQUAL(view.countLabels(), 3);
+  BOOST_CHECK_EQUAL(view.hash(), DNSName("www.powerdns.com").hash());
+  BOOST_CHECK_EQUAL(view.toDNSName().toString(), "www.PowerDNS.com.");
+
+  BOOST_CHECK_THROW(DNSNameView(reinterpret_cast<const char*>(packet.data()), sizeof(dnsheader) + 5, sizeof(dnsheader)), std::range_error);
+  string compressed("\x03www\xc0\x0c", 6);
+  BOOST_CHECK_THROW(DNSNameView(compressed.c_str(), compressed.size(), 0), std::range_error);
+}
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,135 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <boost/test/unit_test.hpp>
+#include "dnsparser.hh"
+#include "dnsrecords.hh"
+#include "dnswriter.hh"
+#include "ednsoptions.hh"
+#include "iputils.hh"
+
+BOOST_AUTO_TEST_SUITE(test_dnsparser_cc)
+
+static vector<uint8_t> makeResponse(unsigned int count, bool withOpt)
+{
+  vector<uint8_t> packet;
+  DNSPacketWriter pw(packet, DNSName("www.powerdns.com"), QType::A);
+  pw.getHeader()->qr=1;
+  for(unsigned int n = 0; n < count; ++n) {
+    pw.startRecord(DNSName("www.powerdns.com"), QType::A, 3600 + n, QClass::IN, DNSResourceRecord::ANSWER);
+    ARecordContent(ComboAddress("192.0.2."+std::to_string(n % 250))).toPacket(pw);
+  }
+  pw.startRecord(DNSName("powerdns.com"), QType::NS, 86400, QClass::IN, DNSResourceRecord::AUTHORITY);
+  NSRecordContent(DNSName("ns1.powerdns.com")).toPacket(pw);
+  if(withOpt) {
+    DNSPacketWriter::optvect_t opts;
+    opts.push_back(make_pair(EDNSOptionCode::NSID, string("ns1")));
+    pw.addOpt(1232, 0, 0, opts);
+  }
+  pw.commit();
+  return packet;
+}
+
+BOOST_AUTO_TEST_CASE(test_lazy_matches_eager) {
+  reportAllTypes();
+  for(unsigned int count : {1, 15, 16, 17, 40}) {
+    vector<uint8_t> packet = makeResponse(count, true);
+    MOADNSParser mdp(reinterpret_cast<const char*>(packet.data()), packet.size());
+    LazyMOADNSParser lazy(reinterpret_cast<const char*>(packet.data()), packet.size());
+
+    BOOST_CHECK_EQUAL(lazy.d_qname, mdp.d_qname);
+    BOOST_CHECK_EQUAL(lazy.d_qtype, mdp.d_qtype);
+    BOOST_CHECK_EQUAL(lazy.d_qclass, mdp.d_qclass);
+    BOOST_CHECK_EQUAL(lazy.d_header.ancount, mdp.d_header.ancount);
+    BOOST_REQUIRE_EQUAL(lazy.size(), mdp.d_answers.size());
+
+    for(size_t n = 0; n < lazy.size(); ++n) {
+      const DNSRecord& eager = mdp.d_answers.at(n).first;
+      BOOST_CHECK_EQUAL(lazy[n].d_type, eager.d_type);
+      BOOST_CHECK_EQUAL(lazy[n].d_class, eager.d_class);
+      BOOST_CHECK_EQUAL(lazy[n].d_ttl, eager.d_ttl);
+      BOOST_CHECK_EQUAL(lazy[n].d_place, eager.d_place);
+      BOOST_CHECK_EQUAL(lazy[n].d_rdatalen, eager.d_clen);
+
+      DNSRecord dr = lazy.getRecord(n);
+      BOOST_CHECK_EQUAL(dr.d_name, eager.d_name);
+      BOOST_CHECK_EQUAL(dr.d_content->getZoneRepresentation(), eager.d_content->getZoneRepresentation());
+    }
+
+    EDNSOpts eo;
+    BOOST_REQUIRE(getEDNSOpts(lazy, &eo));
+    BOOST_CHECK_EQUAL(eo.d_packetsize, 1232);
+    BOOST_REQUIRE_EQUAL(eo.d_options.size(), 1);
+    BOOST_CHECK_EQUAL(eo.d_options.at(0).second, "ns1");
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_lazy_setttl) {
+  reportAllTypes();
+  vector<uint8_t> packet = makeResponse(20, false);
+  {
+    LazyMOADNSParser lazy(reinterpret_cast<char*>(packet.data()), packet.size());
+    for(size_t n = 0; n < lazy.size(); ++n)
+      lazy.setTTL(n, 42 + n);
+    BOOST_CHECK_EQUAL(lazy[19].d_ttl, 61);
+  }
+
+  MOADNSParser mdp(reinterpret_cast<const char*>(packet.data()), packet.size());
+  BOOST_REQUIRE_EQUAL(mdp.d_answers.size(), 21);
+  for(size_t n = 0; n < mdp.d_answers.size(); ++n)
+    BOOST_CHECK_EQUAL(mdp.d_answers.at(n).first.d_ttl, 42 + n);
+
+  LazyMOADNSParser ro(reinterpret_cast<const char*>(packet.data()), packet.size());
+  BOOST_CHECK_THROW(ro.setTTL(0, 1), std::logic_error);
+  BOOST_CHECK_THROW(ro.getContent(ro.size()), std::out_of_range);
+}
+
+BOOST_AUTO_TEST_CASE(test_lazy_truncated) {
+  reportAllTypes();
+  vector<uint8_t> packet = makeResponse(4, false);
+  packet.resize(packet.size() - 3);
+  BOOST_CHECK_THROW(LazyMOADNSParser(reinterpret_cast<const char*>(packet.data()), packet.size()), MOADNSException);
+
+  reinterpret_cast<dnsheader*>(packet.data())->tc = 1;
+  LazyMOADNSParser lazy(reinterpret_cast<const char*>(packet.data()), packet.size());
+  BOOST_CHECK_EQUAL(lazy.size(), 4);
+  BOOST_CHECK_EQUAL(lazy.d_header.ancount, 4);
+  BOOST_CHECK_EQUAL(lazy.d_header.nscount, 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_lazy_label_bytes_64k) {
+  /* a maximum-sized packet whose records are nothing but 63-byte labels: the
+     offset used to wrap around at 65536 and the parser would never terminate */
+  vector<uint8_t> packet(65535, 0x3f);
+  dnsheader* dh = reinterpret_cast<dnsheader*>(packet.data());
+  memset(dh, 0, sizeof(*dh));
+  dh->ancount = htons(1);
+  BOOST_CHECK_THROW(LazyMOADNSParser(reinterpret_cast<const char*>(packet.data()), packet.size()), MOADNSException);
+
+  dh->qdcount = htons(1);
+  dh->ancount = 0;
+  BOOST_CHECK_THROW(LazyMOADNSParser(reinterpret_cast<const char*>(packet.data()), packet.size()), MOADNSException);
+}
+
+BOOST_AUTO_TEST_CASE(test_lazy_first_opt_wins) {
+  reportAllTypes();
+  vector<uint8_t> packet;
+  DNSPacketWriter pw(packet, DNSName("www.powerdns.com"), QType::A);
+  DNSPacketWriter::optvect_t opts;
+  opts.push_back(make_pair(EDNSOptionCode::NSID, string("ns1")));
+  pw.addOpt(1232, 0, 0, opts); // with an empty rdata, the second addOpt() would not commit the first one
+  pw.addOpt(4096, 0, 0, opts);
+  pw.commit();
+
+  MOADNSParser mdp(reinterpret_cast<const char*>(packet.data()), packet.size());
+  LazyMOADNSParser lazy(reinterpret_cast<const char*>(packet.data()), packet.size());
+  EDNSOpts eager, eo;
+  BOOST_REQUIRE(getEDNSOpts(mdp, &eager));
+  BOOST_REQUIRE(getEDNSOpts(lazy, &eo));
+  BOOST_CHECK_EQUAL(eager.d_packetsize, 1232);
+  BOOST_CHECK_EQUAL(eo.d_packetsize, eager.d_packetsize);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
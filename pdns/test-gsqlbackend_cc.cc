@@ -0,0 +1,71 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <boost/test/unit_test.hpp>
+
+#include "dnsbackend.hh"
+#include "dnsrecords.hh"
+#include "backends/gsql/gsqlbackend.hh"
+
+BOOST_AUTO_TEST_SUITE(gsqlbackend_cc)
+
+BOOST_AUTO_TEST_CASE(test_multirow_question_marks) {
+  BOOST_CHECK_EQUAL(GSQLBackend::makeMultiRowInsertQuery("insert into records (content,ttl,prio,type,domain_id,disabled,name,ordername,auth,change_date) values (?,?,?,?,?,?,?,?,?,NULL)", 3),
+                    "insert into records (content,ttl,prio,type,domain_id,disabled,name,ordername,auth,change_date) values (?,?,?,?,?,?,?,?,?,NULL), (?,?,?,?,?,?,?,?,?,NULL), (?,?,?,?,?,?,?,?,?,NULL)");
+  BOOST_CHECK_EQUAL(GSQLBackend::makeMultiRowInsertQuery("INSERT INTO records (name) VALUES(?);", 2),
+                    "INSERT INTO records (name) VALUES(?), (?)");
+}
+
+BOOST_AUTO_TEST_CASE(test_multirow_dollar) {
+  BOOST_CHECK_EQUAL(GSQLBackend::makeMultiRowInsertQuery("insert into records (content,ttl,prio,type,domain_id,disabled,name,ordername,auth,change_date) values ($1,$2,$3,$4,$5,$6,$7,$8,$9,null)", 2),
+                    "insert into records (content,ttl,prio,type,domain_id,disabled,name,ordername,auth,change_date) values ($1,$2,$3,$4,$5,$6,$7,$8,$9,null), ($10,$11,$12,$13,$14,$15,$16,$17,$18,null)");
+
+  /* parameters can be used more than once, and in any order */
+  BOOST_CHECK_EQUAL(GSQLBackend::makeMultiRowInsertQuery("insert into records (domain_id,name,ordername) values ($2,$1,$1)", 3),
+                    "insert into records (domain_id,name,ordername) values ($2,$1,$1), ($4,$3,$3), ($6,$5,$5)");
+}
+
+BOOST_AUTO_TEST_CASE(test_multirow_dollar_multidigit) {
+  BOOST_CHECK_EQUAL(GSQLBackend::makeMultiRowInsertQuery("insert into t values ($1,$2,$3,$4,$5,$6,$7,$8,$9,$10,$11,$12)", 2),
+                    "insert into t values ($1,$2,$3,$4,$5,$6,$7,$8,$9,$10,$11,$12), ($13,$14,$15,$16,$17,$18,$19,$20,$21,$22,$23,$24)");
+
+  /* the highest parameter decides the stride, even if it comes first */
+  BOOST_CHECK_EQUAL(GSQLBackend::makeMultiRowInsertQuery("insert into t values ($10,$1)", 3),
+                    "insert into t values ($10,$1), ($20,$11), ($30,$21)");
+}
+
+BOOST_AUTO_TEST_CASE(test_multirow_named) {
+  BOOST_CHECK_EQUAL(GSQLBackend::makeMultiRowInsertQuery("insert into records (content,ttl,domain_id,name) values (:content,:ttl,:domain_id,:qname)", 2),
+                    "insert into records (content,ttl,domain_id,name) values (:content_0,:ttl_0,:domain_id_0,:qname_0), (:content_1,:ttl_1,:domain_id_1,:qname_1)");
+
+  /* casts are not parameters */
+  BOOST_CHECK_EQUAL(GSQLBackend::makeMultiRowInsertQuery("insert into records (name,auth) values (:qname, :auth::bool)", 2),
+                    "insert into records (name,auth) values (:qname_0, :auth_0::bool), (:qname_1, :auth_1::bool)");
+}
+
+BOOST_AUTO_TEST_CASE(test_multirow_quoted) {
+  /* nothing inside a literal is a placeholder, or ends the VALUES list */
+  BOOST_CHECK_EQUAL(GSQLBackend::makeMultiRowInsertQuery("insert into t values ($1,'$2 :x ? )',$2)", 2),
+                    "insert into t values ($1,'$2 :x ? )',$2), ($3,'$2 :x ? )',$4)");
+  BOOST_CHECK_EQUAL(GSQLBackend::makeMultiRowInsertQuery("insert into t values (:a,'10:30',:b)", 2),
+                    "insert into t values (:a_0,'10:30',:b_0), (:a_1,'10:30',:b_1)");
+
+  /* a doubled quote does not end the literal */
+  BOOST_CHECK_EQUAL(GSQLBackend::makeMultiRowInsertQuery("insert into t values ($1,'it''s $9')", 2),
+                    "insert into t values ($1,'it''s $9'), ($2,'it''s $9')");
+}
+
+BOOST_AUTO_TEST_CASE(test_multirow_unsupported) {
+  BOOST_CHECK_EQUAL(GSQLBackend::makeMultiRowInsertQuery("insert into t values (?)", 1), "");
+  BOOST_CHECK_EQUAL(GSQLBackend::makeMultiRowInsertQuery("insert into t select ?", 2), "");
+  BOOST_CHECK_EQUAL(GSQLBackend::makeMultiRowInsertQuery("insert into t values (?) on conflict do nothing", 2), "");
+  BOOST_CHECK_EQUAL(GSQLBackend::makeMultiRowInsertQuery("insert into t values (?", 2), "");
+  BOOST_CHECK_EQUAL(GSQLBackend::makeMultiRowInsertQuery("insert into t (myvalues) select ?", 2), "");
+  BOOST_CHECK_EQUAL(GSQLBackend::makeMultiRowInsertQuery("insert into t (a) select ? from u where b in (values (1))", 2), "");
+  BOOST_CHECK_EQUAL(GSQLBackend::makeMultiRowInsertQuery("call insert_record(?)", 2), "");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -5,6 +5,7 @@
 #endif
 #include <boost/test/unit_test.hpp>
 #include <bitset>
+#include <random>
 #include "iputils.hh"
 
 using namespace boost;
@@ -95,4 +96,98 @@ BOOST_AUTO_TEST_CASE(test_scale) {
   }
 }
 
+BOOST_AUTO_TEST_CASE(test_erase) {
+  NetmaskTree<int> nmt;
+  nmt.insert(Netmask("0.0.0.0/0")).second=0;
+  nmt.insert(Netmask("130.0.0.0/8")).second=8;
+  nmt.insert(Netmask("130.161.0.0/16")).second=16;
+  nmt.insert(Netmask("130.161.252.0/24")).second=24;
+  nmt.insert(Netmask("::/0")).second=6;
+  BOOST_CHECK_EQUAL(nmt.size(), 5);
+
+  nmt.erase(Netmask("130.161.0.0/16"));
+  BOOST_CHECK_EQUAL(nmt.size(), 4);
+  BOOST_CHECK_EQUAL(nmt.lookup(ComboAddress("130.161.252.1"))->second, 24);
+  BOOST_CHECK_EQUAL(nmt.lookup(ComboAddress("130.161.1.1"))->second, 8);
+
+  // not present, or only present as a path: nothing happens
+  nmt.erase(Netmask("130.161.0.0/17"));
+  nmt.erase(Netmask("130.160.0.0/16"));
+  BOOST_CHECK_EQUAL(nmt.size(), 4);
+
+  nmt.erase(Netmask("0.0.0.0/0"));
+  BOOST_CHECK_EQUAL(nmt.size(), 3);
+  BOOST_CHECK_EQUAL(nmt.lookup(ComboAddress("10.0.0.1")), (void*)0);
+  BOOST_CHECK_EQUAL(nmt.lookup(ComboAddress("::1"))->second, 6);
+
+  nmt.insert(Netmask("130.161.0.0/16")).second=17;
+  BOOST_CHECK_EQUAL(nmt.size(), 4);
+  BOOST_CHECK_EQUAL(nmt.lookup(ComboAddress("130.161.1.1"))->second, 17);
+
+  for(const auto& node : nmt)
+    BOOST_CHECK(nmt.has_key(node->first));
+}
+
+BOOST_AUTO_TEST_CASE(test_random) {
+  // compare best matches against a linear search over all masks
+  std::mt19937 gen(42);
+  vector<Netmask> masks;
+  NetmaskTree<int> nmt;
+  for(int i=0; i < 2000; ++i) {
+    ComboAddress ca;
+    int bits;
+    if(i % 2) {
+      ca = ComboAddress("10.0.0.0");
+      ca.sin4.sin_addr.s_addr = htonl(0x0a000000 | (gen() & 0x00ffffff));
+      bits = 8 + gen() % 25;
+    }
+    else {
+      ca = ComboAddress("2001:db8::");
+      for(int n = 4; n < 16; ++n)
+        ca.sin6.sin6_addr.s6_addr[n] = gen() & 0xff;
+      bits = 32 + gen() % 97;
+    }
+    Netmask nm(ca, bits);
+    masks.push_back(nm);
+    nmt.insert(nm).second = i;
+  }
+
+  NetmaskTree<int> copy(nmt);
+  for(int i=0; i < 20000; ++i) {
+    ComboAddress ca;
+    if(i % 2) {
+      ca = ComboAddress("10.0.0.0");
+      ca.sin4.sin_addr.s_addr = htonl(0x0a000000 | (gen() & 0x00ffffff));
+    }
+    else {
+      // start from a stored mask so we get deep matches as well
+      ca = masks.at(gen() % masks.size()).getNetwork();
+      if(ca.sin4.sin_family == AF_INET)
+        ca.sin4.sin_addr.s_addr ^= htonl(gen() & 0xff);
+      else
+        ca.sin6.sin6_addr.s6_addr[15] ^= gen() & 0xff;
+    }
+
+    int bestBits = -1;
+    for(const auto& nm : masks) {
+      if(nm.match(ca) && nm.getBits() > bestBits)
+        bestBits = nm.getBits();
+    }
+
+    auto found = nmt.lookup(ca);
+    auto copyFound = copy.lookup(ca);
+    if(bestBits < 0) {
+      BOOST_CHECK(!found);
+      BOOST_CHECK(!copyFound);
+    }
+    else {
+      BOOST_REQUIRE(found);
+      BOOST_REQUIRE(copyFound);
+      BOOST_CHECK_EQUAL(found->first.getBits(), bestBits);
+      BOOST_CHECK(found->first.match(ca));
+      BOOST_CHECK_EQUAL(copyFound->second, found->second);
+    }
+  }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
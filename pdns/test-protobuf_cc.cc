@@ -0,0 +1,227 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <boost/test/unit_test.hpp>
+
+#ifdef HAVE_PROTOBUF
+/* the messages generated by protoc are what our encoder has to match */
+#include "dnsmessage.pb.h"
+#include "dnsrecords.hh"
+#include "dnswriter.hh"
+#include "rec-protobuf.hh"
+
+static boost::uuids::uuid getUUID()
+{
+  boost::uuids::uuid uuid;
+  for (size_t idx = 0; idx < uuid.size(); idx++) {
+    uuid.data[idx] = idx * 17;
+  }
+  return uuid;
+}
+
+static void setAddress(std::string* dest, const ComboAddress& ca)
+{
+  if (ca.sin4.sin_family == AF_INET) {
+    dest->assign(reinterpret_cast<const char*>(&ca.sin4.sin_addr.s_addr), sizeof(ca.sin4.sin_addr.s_addr));
+  }
+  else {
+    dest->assign(reinterpret_cast<const char*>(&ca.sin6.sin6_addr.s6_addr), sizeof(ca.sin6.sin6_addr.s6_addr));
+  }
+}
+
+static void fillReference(PBDNSMessage& ref, PBDNSMessage_Type type, const ComboAddress& requestor, const ComboAddress& responder, const DNSName& qname, uint16_t qtype, uint16_t id, bool tcp, size_t bytes, time_t sec, uint32_t usec)
+{
+  auto uuid = getUUID();
+  ref.set_type(type);
+  ref.set_messageid(std::string(uuid.begin(), uuid.end()));
+  ref.set_socketfamily(requestor.sin4.sin_family == AF_INET ? PBDNSMessage_SocketFamily_INET : PBDNSMessage_SocketFamily_INET6);
+  ref.set_socketprotocol(tcp ? PBDNSMessage_SocketProtocol_TCP : PBDNSMessage_SocketProtocol_UDP);
+  setAddress(ref.mutable_from(), requestor);
+  setAddress(ref.mutable_to(), responder);
+  ref.set_inbytes(bytes);
+  ref.set_timesec(sec);
+  ref.set_timeusec(usec);
+  ref.set_id(ntohs(id));
+  ref.mutable_question()->set_qname(qname.toString());
+  ref.mutable_question()->set_qtype(qtype);
+  ref.mutable_question()->set_qclass(QClass::IN);
+}
+
+static std::string serializeReference(const PBDNSMessage& ref)
+{
+  std::string result;
+  BOOST_REQUIRE(ref.SerializeToString(&result));
+  return result;
+}
+
+BOOST_AUTO_TEST_SUITE(protobuf_cc)
+
+BOOST_AUTO_TEST_CASE(test_query) {
+  ComboAddress requestor("192.0.2.1"), responder("2001:db8::53");
+  DNSName qname("www.powerdns.com.");
+  RecProtoBufMessage message(DNSProtoBufMessage::Query, getUUID(), &requestor, &responder, qname, QType::AAAA, QClass::IN, htons(4242), false, 42);
+  message.setTime(1234567890, 123456);
+  message.setEDNSSubnet(Netmask("198.51.100.0/24"));
+  message.setAppliedPolicy("rpz.example.");
+  message.setPolicyTags({"tag1", "a longer tag"});
+
+  PBDNSMessage ref;
+  fillReference(ref, PBDNSMessage_Type_DNSQueryType, requestor, responder, qname, QType::AAAA, htons(4242), false, 42, 1234567890, 123456);
+  ComboAddress subnet("198.51.100.0");
+  setAddress(ref.mutable_originalrequestorsubnet(), subnet);
+  ref.mutable_response()->set_appliedpolicy("rpz.example.");
+  ref.mutable_response()->add_tags("tag1");
+  ref.mutable_response()->add_tags("a longer tag");
+
+  std::string data;
+  message.serialize(data);
+  BOOST_CHECK(data == serializeReference(ref));
+  BOOST_CHECK_EQUAL(message.toDebugString(), ref.DebugString());
+}
+
+BOOST_AUTO_TEST_CASE(test_response) {
+  reportAllTypes();
+  ComboAddress requestor("2001:db8::1"), responder("192.0.2.53");
+  /* long and escaped names, so that the length of a RR goes over one byte */
+  DNSName qname("a\\.b\\032c.this-is-a-rather-long-label-to-push-the-size-of-the-rr-up.and-another-one-for-good-measure.powerdns.com.");
+  DNSName target("target\\255.powerdns.com.");
+
+  vector<DNSRecord> records;
+  DNSRecord rec;
+  rec.d_name = qname;
+  rec.d_place = DNSResourceRecord::ANSWER;
+  rec.d_class = QClass::IN;
+  rec.d_ttl = 3600;
+  rec.d_type = QType::CNAME;
+  rec.d_content = std::shared_ptr<DNSRecordContent>(DNSRecordContent::mastermake(QType::CNAME, QClass::IN, target.toString()));
+  records.push_back(rec);
+  rec.d_name = target;
+  rec.d_type = QType::A;
+  rec.d_ttl = 86400;
+  rec.d_content = std::make_shared<ARecordContent>(ComboAddress("192.0.2.2"));
+  records.push_back(rec);
+  rec.d_type = QType::AAAA;
+  rec.d_content = std::make_shared<AAAARecordContent>(ComboAddress("2001:db8::2"));
+  records.push_back(rec);
+  rec.d_type = QType::TXT; // not exported
+  rec.d_content = std::shared_ptr<DNSRecordContent>(DNSRecordContent::mastermake(QType::TXT, QClass::IN, "\"text\""));
+  records.push_back(rec);
+
+  RecProtoBufMessage message(DNSProtoBufMessage::Response, getUUID(), &requestor, &responder, qname, QType::A, QClass::IN, htons(1), true, 512);
+  message.setTime(1234567890, 999999);
+  message.addRRs(records);
+  message.setResponseCode(RCode::NXDomain);
+  message.setAppliedPolicy("");
+  message.setQueryTime(1234567889, 5);
+
+  PBDNSMessage ref;
+  fillReference(ref, PBDNSMessage_Type_DNSResponseType, requestor, responder, qname, QType::A, htons(1), true, 512, 1234567890, 999999);
+  auto response = ref.mutable_response();
+  response->set_rcode(RCode::NXDomain);
+  auto rr = response->add_rrs();
+  rr->set_name(qname.toString());
+  rr->set_type(QType::CNAME);
+  rr->set_class_(QClass::IN);
+  rr->set_ttl(3600);
+  rr->set_rdata(target.toString());
+  rr = response->add_rrs();
+  rr->set_name(target.toString());
+  rr->set_type(QType::A);
+  rr->set_class_(QClass::IN);
+  rr->set_ttl(86400);
+  ComboAddress v4("192.0.2.2");
+  setAddress(rr->mutable_rdata(), v4);
+  rr = response->add_rrs();
+  rr->set_name(target.toString());
+  rr->set_type(QType::AAAA);
+  rr->set_class_(QClass::IN);
+  rr->set_ttl(86400);
+  ComboAddress v6("2001:db8::2");
+  setAddress(rr->mutable_rdata(), v6);
+  response->set_querytimesec(1234567889);
+  response->set_querytimeusec(5);
+
+  std::string data;
+  message.serialize(data);
+  BOOST_CHECK(data == serializeReference(ref));
+  BOOST_CHECK_EQUAL(message.toDebugString(), ref.DebugString());
+
+  /* what the packet cache does: store the serialized message, then update it for a new query */
+  RecProtoBufMessage cached(DNSProtoBufMessage::Response);
+  BOOST_REQUIRE(cached.deserialize(data));
+  std::string again;
+  cached.serialize(again);
+  BOOST_CHECK(again == data);
+
+  ComboAddress newRequestor("192.0.2.42");
+  cached.update(getUUID(), &newRequestor, &responder, false, htons(2));
+  cached.setTime(1234567900, 1);
+  cached.setQueryTime(1234567900, 0);
+  cached.serialize(again);
+
+  ref.set_socketfamily(PBDNSMessage_SocketFamily_INET);
+  ref.set_socketprotocol(PBDNSMessage_SocketProtocol_UDP);
+  setAddress(ref.mutable_from(), newRequestor);
+  ref.set_id(2);
+  ref.set_timesec(1234567900);
+  ref.set_timeusec(1);
+  ref.mutable_response()->set_querytimesec(1234567900);
+  ref.mutable_response()->set_querytimeusec(0);
+  BOOST_CHECK(again == serializeReference(ref));
+}
+
+BOOST_AUTO_TEST_CASE(test_rrsFromPacket) {
+  DNSName qname("powerdns.com.");
+  vector<uint8_t> packet;
+  DNSPacketWriter pw(packet, qname, QType::ANY);
+  pw.getHeader()->qr = 1;
+  pw.getHeader()->rcode = RCode::NoError;
+  pw.startRecord(qname, QType::A, 300);
+  ARecordContent(ComboAddress("192.0.2.1")).toPacket(pw);
+  pw.startRecord(qname, QType::MX, 300);
+  MXRecordContent(10, DNSName("mx.powerdns.com.")).toPacket(pw);
+  pw.startRecord(qname, QType::AAAA, 600);
+  AAAARecordContent(ComboAddress("2001:db8::1")).toPacket(pw);
+  pw.commit();
+
+  DNSProtoBufMessage message(DNSProtoBufMessage::Response);
+  message.setResponseCode(pw.getHeader()->rcode);
+  message.addRRsFromPacket(reinterpret_cast<const char*>(packet.data()), packet.size());
+
+  PBDNSMessage ref;
+  ref.set_type(PBDNSMessage_Type_DNSResponseType);
+  auto response = ref.mutable_response();
+  response->set_rcode(RCode::NoError);
+  auto rr = response->add_rrs();
+  rr->set_name(qname.toString());
+  rr->set_type(QType::A);
+  rr->set_class_(QClass::IN);
+  rr->set_ttl(300);
+  ComboAddress v4("192.0.2.1");
+  setAddress(rr->mutable_rdata(), v4);
+  rr = response->add_rrs();
+  rr->set_name(qname.toString());
+  rr->set_type(QType::AAAA);
+  rr->set_class_(QClass::IN);
+  rr->set_ttl(600);
+  ComboAddress v6("2001:db8::1");
+  setAddress(rr->mutable_rdata(), v6);
+
+  std::string data;
+  message.serialize(data);
+  BOOST_CHECK(data == serializeReference(ref));
+}
+
+BOOST_AUTO_TEST_CASE(test_deserializeInvalid) {
+  DNSProtoBufMessage message(DNSProtoBufMessage::Response);
+  BOOST_CHECK(!message.deserialize(std::string("\x08", 1)));
+  BOOST_CHECK(!message.deserialize(std::string("\x62\x10\x00", 3)));
+  BOOST_CHECK(message.deserialize(std::string()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+#endif /* HAVE_PROTOBUF */
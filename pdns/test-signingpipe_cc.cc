@@ -0,0 +1,84 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <boost/test/unit_test.hpp>
+
+#include "signingpipe.hh"
+
+BOOST_AUTO_TEST_SUITE(signingpipe_cc)
+
+static DNSName makeName(unsigned int n)
+{
+  return DNSName("n"+std::to_string(n)+".powerdns.com.");
+}
+
+// submits count single record RRsets and returns everything the pipe hands back, in order
+static ChunkedSigningPipe::chunk_t runPipe(ChunkedSigningPipe& csp, unsigned int count)
+{
+  ChunkedSigningPipe::chunk_t out;
+  for(unsigned int n = 0; n < count; ++n) {
+    DNSResourceRecord rr;
+    rr.qname = makeName(n);
+    rr.qtype = QType::A;
+    rr.ttl = 3600;
+    rr.content = "192.0.2.1";
+    if(csp.submit(rr)) {
+      auto chunk = csp.getChunk();
+      out.insert(out.end(), chunk.begin(), chunk.end());
+    }
+  }
+  for(;;) {
+    auto chunk = csp.getChunk(true);
+    if(chunk.empty())
+      break;
+    out.insert(out.end(), chunk.begin(), chunk.end());
+  }
+  return out;
+}
+
+BOOST_AUTO_TEST_CASE(test_signingpipe_order) {
+  const unsigned int count = 1000; // 10 batches of 100 RRsets
+  ChunkedSigningPipe csp(DNSName("powerdns.com."), true, string(), 4);
+  csp.setRRSetSigner([](const DNSName& signer, ChunkedSigningPipe::rrset_t& rrset) {
+      BOOST_CHECK_EQUAL(signer, DNSName("powerdns.com."));
+      if(rrset.front().qname == makeName(0))
+        usleep(50000); // make the first batch come back last
+      DNSResourceRecord sig(rrset.front());
+      sig.qtype = QType::RRSIG;
+      sig.content = "signature";
+      rrset.push_back(sig);
+    });
+
+  auto out = runPipe(csp, count);
+  BOOST_REQUIRE_EQUAL(out.size(), 2 * count);
+  for(unsigned int n = 0; n < count; ++n) {
+    BOOST_CHECK_EQUAL(out.at(2*n).qname, makeName(n));
+    BOOST_CHECK_EQUAL(out.at(2*n).qtype.getCode(), QType::A);
+    BOOST_CHECK_EQUAL(out.at(2*n+1).qname, makeName(n));
+    BOOST_CHECK_EQUAL(out.at(2*n+1).qtype.getCode(), QType::RRSIG);
+  }
+  BOOST_CHECK_EQUAL(csp.d_queued, count);
+  BOOST_CHECK_EQUAL(csp.d_signed, count);
+  BOOST_CHECK_EQUAL(csp.d_outstanding, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_signingpipe_error) {
+  ChunkedSigningPipe csp(DNSName("powerdns.com."), true, string(), 4);
+  csp.setRRSetSigner([](const DNSName& signer, ChunkedSigningPipe::rrset_t& rrset) {
+      if(rrset.front().qname == makeName(450))
+        throw std::runtime_error("no key");
+    });
+
+  try {
+    runPipe(csp, 1000);
+    BOOST_FAIL("the signing error was not reported");
+  }
+  catch(const PDNSException& pe) {
+    BOOST_CHECK(pe.reason.find("no key") != string::npos);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
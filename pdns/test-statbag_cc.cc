@@ -31,7 +31,16 @@ static void *threadMangler2(void* a)
   return 0;
 }
 
-
+static void *ringMangler(void* a)
+{
+  StatBag* S = (StatBag*)a;
+  ComboAddress remote("192.0.2.1");
+  for(unsigned int n=0; n < 500; ++n) {
+    S->ringAccount("queries", DNSName("www.example.com"), QType(QType::A));
+    S->ringAccount("remotes", remote);
+  }
+  return 0;
+}
 
 BOOST_AUTO_TEST_SUITE(misc_hh)
 
@@ -104,6 +113,58 @@ BOOST_AUTO_TEST_CASE(test_StatBagBasic) {
 #endif
 }
 
+BOOST_AUTO_TEST_CASE(test_StatBagRings) {
+  StatBag s;
+  s.declareRing("queries", "Queries");
+  s.declareRing("servfail-queries", "Failing queries");
+  s.declareComboRing("remotes", "Remotes");
+
+  // nothing is accounted until rings are turned on
+  s.ringAccount("queries", DNSName("www.example.com"), QType(QType::A));
+  BOOST_CHECK(s.getRing("queries").empty());
+
+  s.doRings();
+  pthread_t tid[4];
+  for(int i=0; i < 4; ++i)
+    pthread_create(&tid[i], 0, ringMangler, (void*)&s);
+  void* res;
+  for(int i=0; i < 4 ; ++i)
+    pthread_join(tid[i], &res);
+
+  // the threads are gone, but what they queued must still arrive
+  auto queries = s.getRing("queries");
+  BOOST_REQUIRE_EQUAL(queries.size(), 1);
+  BOOST_CHECK_EQUAL(queries.at(0).first, "www.example.com/A");
+  BOOST_CHECK_EQUAL(queries.at(0).second, 2000);
+  auto remotes = s.getRing("remotes");
+  BOOST_REQUIRE_EQUAL(remotes.size(), 1);
+  BOOST_CHECK_EQUAL(remotes.at(0).first, "192.0.2.1");
+  BOOST_CHECK_EQUAL(remotes.at(0).second, 2000);
+
+  // names too long for a sample take the locked path, and look the same
+  DNSName longName(string(50, 'a')+"."+string(50, 'b')+".example.com");
+  s.ringAccount("servfail-queries", longName);
+  s.ringAccount("servfail-queries", DNSName("short.example.com"));
+  s.ringAccount("servfail-queries", DNSName("short.example.com"));
+  auto servfails = s.getRing("servfail-queries");
+  BOOST_REQUIRE_EQUAL(servfails.size(), 2);
+  BOOST_CHECK_EQUAL(servfails.at(0).first, "short.example.com");
+  BOOST_CHECK_EQUAL(servfails.at(0).second, 2);
+  BOOST_CHECK_EQUAL(servfails.at(1).first, longName.toLogString());
+
+  s.resetRing("queries");
+  BOOST_CHECK(s.getRing("queries").empty());
+
+  s.setRingSampleRate(10);
+  for(int n=0; n < 1000; ++n)
+    s.ringAccount("queries", DNSName("www.example.com"), QType(QType::AAAA));
+  queries = s.getRing("queries");
+  BOOST_REQUIRE_EQUAL(queries.size(), 1);
+  BOOST_CHECK_EQUAL(queries.at(0).second, 100);
+
+  BOOST_CHECK_THROW(s.ringAccount("nonexistent", DNSName("www.example.com")), std::runtime_error);
+}
+
 
 BOOST_AUTO_TEST_SUITE_END()
 
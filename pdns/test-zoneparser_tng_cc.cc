@@ -55,4 +55,61 @@ BOOST_AUTO_TEST_CASE(test_tng_record_types) {
 
 }
 
+BOOST_AUTO_TEST_CASE(test_tng_buffered_read) {
+  reportAllTypes();
+
+  char incpath[]="/tmp/pdns-test-zone-inc.XXXXXX";
+  int fd=mkstemp(incpath);
+  if(fd < 0)
+    BOOST_FAIL("Unable to generate a temporary file");
+  string include="included IN CNAME target\n";
+  BOOST_REQUIRE_EQUAL(write(fd, include.c_str(), include.size()), static_cast<ssize_t>(include.size()));
+  close(fd);
+
+  char path[]="/tmp/pdns-test-zone.XXXXXX";
+  fd=mkstemp(path);
+  if(fd < 0) {
+    unlink(incpath);
+    BOOST_FAIL("Unable to generate a temporary file");
+  }
+
+  /* enough records for the file to span several reads, the last line has no newline */
+  const unsigned int count = 60000;
+  string zone="$GENERATE 1-3 gen$ A 192.0.2.$\n$INCLUDE "+string(incpath)+"\n";
+  for(unsigned int idx = 0; idx < count; idx++)
+    zone+="host"+std::to_string(idx)+" 300 IN MX 10 mail"+std::to_string(idx)+" ; padding\r\n";
+  zone+="last IN A 192.0.2.4";
+  BOOST_REQUIRE_EQUAL(write(fd, zone.c_str(), zone.size()), static_cast<ssize_t>(zone.size()));
+  close(fd);
+
+  ZoneParserTNG zp(path, DNSName("unit.test"));
+  DNSResourceRecord rr;
+
+  for(unsigned int idx = 1; idx <= 3; idx++) {
+    BOOST_REQUIRE(zp.get(rr));
+    BOOST_CHECK_EQUAL(rr.qname.toString(), "gen"+std::to_string(idx)+".unit.test.");
+    BOOST_CHECK_EQUAL(rr.content, "192.0.2."+std::to_string(idx));
+  }
+
+  BOOST_REQUIRE(zp.get(rr));
+  BOOST_CHECK_EQUAL(rr.qname.toString(), "included.unit.test.");
+  BOOST_CHECK_EQUAL(rr.qtype.getCode(), QType::CNAME);
+  BOOST_CHECK_EQUAL(rr.content, "target.unit.test");
+
+  unsigned int idx;
+  for(idx = 0; idx < count && zp.get(rr); idx++) {
+    if(rr.qname.toString() != "host"+std::to_string(idx)+".unit.test." || rr.ttl != 300 || rr.content != "10 mail"+std::to_string(idx)+".unit.test")
+      break;
+  }
+  BOOST_CHECK_EQUAL(idx, count);
+
+  BOOST_REQUIRE(zp.get(rr));
+  BOOST_CHECK_EQUAL(rr.qname.toString(), "last.unit.test.");
+  BOOST_CHECK_EQUAL(rr.content, "192.0.2.4");
+  BOOST_CHECK(!zp.get(rr));
+
+  unlink(path);
+  unlink(incpath);
+}
+
 BOOST_AUTO_TEST_SUITE_END();
@@ -45,6 +45,7 @@
 #include "dnspacket.hh"
 #include "logger.hh"
 #include "statbag.hh"
+#include "auth-zonecache.hh"
 
 extern StatBag S;
 
@@ -93,6 +94,11 @@ bool UeberBackend::createDomain(const DNSName &domain)
 {
   for(DNSBackend* mydb :  backends) {
     if(mydb->createDomain(domain)) {
+      if(g_zoneCache.isEnabled()) {
+        DomainInfo di;
+        if(mydb->getDomainInfo(domain, di))
+          g_zoneCache.add(domain, di.id);
+      }
       return true;
     }
   }
@@ -226,6 +232,12 @@ void UeberBackend::rediscover(string *status)
     if(status) 
       *status+=tmpstr + (i!=backends.begin() ? "\n" : "");
   }
+
+  if(g_zoneCache.isEnabled()) {
+    vector<DomainInfo> domains;
+    getAllDomains(&domains);
+    g_zoneCache.replace(domains);
+  }
 }
 
 
@@ -254,6 +266,17 @@ bool UeberBackend::getAuth(DNSPacket *p, SOAData *sd, const DNSName &target)
   DNSName choppedOff(target);
   vector<pair<size_t, SOAData> > bestmatch (backends.size(), make_pair(target.wirelength()+1, SOAData()));
   do {
+    // Skip straight to the closest enclosing zone we know about, instead of
+    // asking the backends for the SOA of every label in between
+    if(g_zoneCache.isEnabled()) {
+      DNSName apex;
+      int zoneId;
+      if(!g_zoneCache.getEnclosing(choppedOff, &apex, &zoneId)) {
+        DLOG(L<<Logger::Error<<"no enclosing zone in zone cache for: "<<choppedOff<<endl);
+        break;
+      }
+      choppedOff = apex;
+    }
 
     // Check cache
     if(sd->db != (DNSBackend *)-1 && (d_cache_ttl || d_negcache_ttl)) {
@@ -513,15 +536,8 @@ UeberBackend::~UeberBackend()
   cleanup();
 }
 
-// this handle is more magic than most
-void UeberBackend::lookup(const QType &qtype,const DNSName &qname, DNSPacket *pkt_p, int zoneId)
+void UeberBackend::waitForGo()
 {
-  if(stale) {
-    L<<Logger::Error<<"Stale ueberbackend received question, signalling that we want to be recycled"<<endl;
-    throw PDNSException("We are stale, please recycle");
-  }
-
-  DLOG(L<<"UeberBackend received question for "<<qtype.getName()<<" of "<<qname<<endl);
   if(!d_go) {
     pthread_mutex_lock(&d_mut);
     while (d_go==false) {
@@ -531,6 +547,18 @@ void UeberBackend::lookup(const QType &qtype,const DNSName &qname, DNSPacket *pk
     }
     pthread_mutex_unlock(&d_mut);
   }
+}
+
+// this handle is more magic than most
+void UeberBackend::lookup(const QType &qtype,const DNSName &qname, DNSPacket *pkt_p, int zoneId)
+{
+  if(stale) {
+    L<<Logger::Error<<"Stale ueberbackend received question, signalling that we want to be recycled"<<endl;
+    throw PDNSException("We are stale, please recycle");
+  }
+
+  DLOG(L<<"UeberBackend received question for "<<qtype.getName()<<" of "<<qname<<endl);
+  waitForGo();
 
   domain_id=zoneId;
 
@@ -570,6 +598,68 @@ void UeberBackend::lookup(const QType &qtype,const DNSName &qname, DNSPacket *pk
   d_handle.parent=this;
 }
 
+/* Same semantics as a lookup() per question: every question is answered by the first backend
+   that has records for it, and the answers end up in the query cache. But each backend only
+   gets one lookupBatch() call for all questions still open, so it can answer them together. */
+void UeberBackend::lookupBatch(const vector<DNSLookupQuestion>& questions, vector<vector<DNSResourceRecord> >& answers, DNSPacket *pkt_p, int zoneId)
+{
+  if(stale) {
+    L<<Logger::Error<<"Stale ueberbackend received question, signalling that we want to be recycled"<<endl;
+    throw PDNSException("We are stale, please recycle");
+  }
+  waitForGo();
+
+  if(!backends.size()) {
+    L<<Logger::Error<<"No database backends available - unable to answer questions."<<endl;
+    stale=true; // please recycle us!
+    throw PDNSException("We are stale, please recycle");
+  }
+
+  answers.assign(questions.size(), vector<DNSResourceRecord>());
+
+  Question q;
+  q.zoneId=zoneId;
+  vector<vector<DNSLookupQuestion>::size_type> open;
+  for(vector<DNSLookupQuestion>::size_type n = 0; n < questions.size(); ++n) {
+    q.qtype=questions[n].qtype;
+    q.qname=questions[n].qname;
+    if(cacheHas(q, answers[n]) < 0)
+      open.push_back(n);
+  }
+  const auto missed = open;
+
+  vector<DNSLookupQuestion> ask;
+  vector<vector<DNSResourceRecord> > got;
+  for(auto backend : backends) {
+    if(open.empty())
+      break;
+    ask.clear();
+    for(auto n : open)
+      ask.push_back(questions[n]);
+    backend->lookupBatch(ask, got, pkt_p, zoneId);
+
+    vector<vector<DNSLookupQuestion>::size_type> stillOpen;
+    for(vector<DNSLookupQuestion>::size_type m = 0; m < open.size(); ++m) {
+      if(m < got.size() && !got[m].empty())
+        answers[open[m]].swap(got[m]);
+      else
+        stillOpen.push_back(open[m]);
+    }
+    open.swap(stillOpen);
+  }
+
+  for(auto n : missed) {
+    q.qtype=questions[n].qtype;
+    q.qname=questions[n].qname;
+    if(answers[n].empty()) {
+      if(q.qname.countLabels())
+        addNegCache(q);
+    }
+    else
+      addCache(q, answers[n]);
+  }
+}
+
 void UeberBackend::getAllDomains(vector<DomainInfo> *domains, bool include_disabled) {
   for (vector<DNSBackend*>::iterator i = backends.begin(); i != backends.end(); ++i )
   {
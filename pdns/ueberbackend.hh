@@ -102,6 +102,8 @@ public:
   };
 
   void lookup(const QType &, const DNSName &qdomain, DNSPacket *pkt_p=0,  int zoneId=-1);
+  //! Answers independent questions together, see DNSBackend::lookupBatch(). Uses the query cache like lookup()
+  void lookupBatch(const vector<DNSLookupQuestion>& questions, vector<vector<DNSResourceRecord> >& answers, DNSPacket *pkt_p=0, int zoneId=-1);
 
   bool getAuth(DNSPacket *p, SOAData *sd, const DNSName &target);
   bool getSOA(const DNSName &domain, SOAData &sd, DNSPacket *p=0);
@@ -162,6 +164,7 @@ private:
   static bool d_go;
   bool stale;
 
+  void waitForGo();
   int cacheHas(const Question &q, vector<DNSResourceRecord> &rrs);
   void addNegCache(const Question &q);
   void addCache(const Question &q, const vector<DNSResourceRecord> &rrs);
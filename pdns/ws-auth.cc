@@ -43,6 +43,7 @@
 #include <iomanip>
 #include "zoneparser-tng.hh"
 #include "common_startup.hh"
+#include "auth-zonecache.hh"
 
 
 using json11::Json;
@@ -70,6 +71,7 @@ void AuthWebServer::go()
 {
   if(arg().mustDo("webserver"))
   {
+    S.setRingSampleRate(arg().asNum("webserver-ring-sample-rate"));
     S.doRings();
     pthread_create(&d_tid, 0, webThreadHelper, this);
     pthread_create(&d_tid, 0, statThreadHelper, this);
@@ -806,6 +808,8 @@ static void apiServerZoneDetail(HttpRequest* req, HttpResponse* resp) {
     if(!di.backend->deleteDomain(zonename))
       throw ApiException("Deleting domain '"+zonename.toString()+"' failed: backend delete failed/unsupported");
 
+    g_zoneCache.remove(zonename);
+
     // empty body on success
     resp->body = "";
     resp->status = 204; // No Content: declare that the zone is gone now
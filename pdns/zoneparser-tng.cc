@@ -35,6 +35,8 @@
 #include <deque>
 #include <boost/algorithm/string.hpp>
 #include <system_error>
+#include <fcntl.h>
+#include <unistd.h>
 
 static string g_INstr("IN");
 
@@ -42,6 +44,7 @@ ZoneParserTNG::ZoneParserTNG(const string& fname, const DNSName& zname, const st
                                                                                                d_zonename(zname), d_defaultttl(3600), 
                                                                                                d_templatecounter(0), d_templatestop(0),
                                                                                                d_templatestep(0), d_havedollarttl(false){
+  d_zonenametext = d_zonename.toStringRootDot();
   stackFile(fname);
 }
 
@@ -53,34 +56,93 @@ ZoneParserTNG::ZoneParserTNG(const vector<string> zonedata, const DNSName& zname
   d_zonedata = zonedata;
   d_zonedataline = d_zonedata.begin();
   d_fromfile = false;
+  d_zonenametext = d_zonename.toStringRootDot();
 }
 
 void ZoneParserTNG::stackFile(const std::string& fname)
 {
-  FILE *fp=fopen(fname.c_str(), "r");
-  if(!fp) {
+  int fd=open(fname.c_str(), O_RDONLY);
+  if(fd < 0) {
     std::error_code ec (errno,std::generic_category());
     throw std::system_error(ec, "Unable to open file '"+fname+"': "+stringerror());
   }
 
-  filestate fs(fp, fname);
-  d_filestates.push(fs);
+  struct stat st;
+  if(fstat(fd, &st) < 0) {
+    std::error_code ec (errno,std::generic_category());
+    close(fd);
+    throw std::system_error(ec, "Unable to stat file '"+fname+"': "+stringerror());
+  }
+  d_openedfiles.push_back({fname, st});
+  d_filestates.emplace(fd, fname);
   d_fromfile = true;
 }
 
 ZoneParserTNG::~ZoneParserTNG()
 {
   while(!d_filestates.empty()) {
-    fclose(d_filestates.top().d_fp);
+    close(d_filestates.top().d_fd);
     d_filestates.pop();
   }
 }
 
+//! reads the next line, '\n' included, into line. Returns false at the end of the file
+bool ZoneParserTNG::filestate::readLine(string& line)
+{
+  line.clear();
+  for(;;) {
+    if(d_bufpos == d_buflen) {
+      ssize_t got = read(d_fd, d_buffer.get(), s_readSize);
+      if(got < 0) {
+        if(errno == EINTR)
+          continue;
+        throw runtime_error("Error reading from file '"+d_filename+"': "+stringerror());
+      }
+      if(got == 0)
+        return !line.empty();
+      d_bufpos = 0;
+      d_buflen = got;
+    }
+    const char* start = d_buffer.get() + d_bufpos;
+    const char* eol = static_cast<const char*>(memchr(start, '\n', d_buflen - d_bufpos));
+    if(eol) {
+      line.append(start, eol + 1 - start);
+      d_bufpos += eol + 1 - start;
+      return true;
+    }
+    line.append(start, d_buflen - d_bufpos);
+    d_bufpos = d_buflen;
+  }
+}
+
 static string makeString(const string& line, const pair<string::size_type, string::size_type>& range)
 {
   return string(line.c_str() + range.first, range.second - range.first);
 }
 
+static bool isTrimChar(char c)
+{
+  return c==' ' || c=='\t' || c=='\r' || c=='\n' || c=='\x1a';
+}
+
+// what trim_right_if(str, is_any_of(" \t\r\n\x1a")) does, without building the set for every line
+static void trimRight(string& str)
+{
+  string::size_type len = str.length();
+  while(len > 0 && isTrimChar(str[len-1]))
+    len--;
+  str.resize(len);
+}
+
+static void trimBoth(string& str)
+{
+  trimRight(str);
+  string::size_type pos = 0;
+  while(pos < str.length() && isTrimChar(str[pos]))
+    pos++;
+  str.erase(0, pos);
+}
+
 static bool isTimeSpec(const string& nextpart)
 {
   if(nextpart.empty())
@@ -130,6 +192,48 @@ unsigned int ZoneParserTNG::makeTTLFromZone(const string& str)
   return val;
 }
 
+/* Appends the name in str[begin, end) the way toCanonic(d_zonename, name).toStringRootDot()
+   would have it. Names made of nothing but letters, digits and a few more characters that
+   need no escaping are done by hand, the rest goes through DNSName. */
+void ZoneParserTNG::appendCanonic(string& out, const string& str, string::size_type begin, string::size_type end)
+{
+  const char* name = str.c_str() + begin;
+  size_t len = end - begin;
+  // well within what a DNSName can hold, even once the zone is added
+  bool plain = len > 0 && len + d_zonenametext.length() < 240 && name[0] != '.';
+  size_t labellen = 0;
+  for(size_t pos = 0; plain && pos < len; pos++) {
+    char c = name[pos];
+    if(c == '.') {
+      plain = labellen > 0;
+      labellen = 0;
+    }
+    else if(isalnum(static_cast<unsigned char>(c)) || c == '-' || c == '_' || c == '*' || c == '/') {
+      plain = ++labellen <= 63;
+    }
+    else {
+      plain = len == 1 && c == '@';
+    }
+  }
+
+  if(!plain) {
+    out += toCanonic(d_zonename, string(name, len)).toStringRootDot();
+  }
+  else if(len == 1 && name[0] == '@') {
+    out += d_zonenametext;
+  }
+  else if(name[len-1] == '.') {
+    out.append(name, len - 1);
+  }
+  else {
+    out.append(name, len);
+    if(!d_zonename.isRoot()) {
+      out.append(1, '.');
+      out += d_zonenametext;
+    }
+  }
+}
+
 bool ZoneParserTNG::getTemplateLine()
 {
   if(d_templateparts.empty() || d_templatecounter > d_templatestop) // no template, or done with
@@ -271,12 +375,13 @@ bool ZoneParserTNG::get(DNSResourceRecord& rr, std::string* comment)
   if(!getTemplateLine() && !getLine())
     return false;
 
-  boost::trim_right_if(d_line, is_any_of(" \t\r\n\x1a"));
+  trimRight(d_line);
   if(comment)
     comment->clear();
   if(comment && d_line.find(';') != string::npos)
     *comment = d_line.substr(d_line.find(';'));
-  parts_t parts;
+  parts_t& parts = d_parts;
+  parts.clear();
   vstringtok(parts, d_line);
 
   if(parts.empty())
@@ -299,6 +404,7 @@ bool ZoneParserTNG::get(DNSResourceRecord& rr, std::string* comment)
     }
     else if(pdns_iequals(command, "$ORIGIN") && parts.size() > 1) {
       d_zonename = DNSName(makeString(d_line, parts[1]));
+      d_zonenametext = d_zonename.toStringRootDot();
     }
     else if(pdns_iequals(command, "$GENERATE") && parts.size() > 2) {
       // $GENERATE 1-127 $ CNAME $.0
@@ -307,10 +413,7 @@ bool ZoneParserTNG::get(DNSResourceRecord& rr, std::string* comment)
       d_templatestop=0;
       sscanf(range.c_str(),"%d-%d/%d", &d_templatecounter, &d_templatestop, &d_templatestep);
       d_templateline=d_line;
-      parts.pop_front();
-      parts.pop_front();
-
-      d_templateparts=parts;
+      d_templateparts.assign(parts.begin() + 2, parts.end());
       goto retry;
     }
     else
@@ -319,13 +422,15 @@ bool ZoneParserTNG::get(DNSResourceRecord& rr, std::string* comment)
   }
 
   bool prevqname=false;
-  string qname = makeString(d_line, parts[0]); // Don't use DNSName here!
+  parts_t::size_type partIdx = 0;
+  string& qname = d_qname; // Don't use DNSName here!
+  qname.assign(d_line, parts[0].first, parts[0].second - parts[0].first);
   if(dns_isspace(d_line[0])) {
     rr.qname=d_prevqname;
     prevqname=true;
   }else {
     rr.qname=DNSName(qname); 
-    parts.pop_front();
+    partIdx++;
     if(qname.empty() || qname[0]==';')
       goto retry;
   }
@@ -335,19 +440,18 @@ bool ZoneParserTNG::get(DNSResourceRecord& rr, std::string* comment)
     rr.qname += d_zonename;
   d_prevqname=rr.qname;
 
-  if(parts.empty()) 
+  if(partIdx == parts.size()) 
     throw exception("Line with too little parts "+getLineOfFile());
 
-  string nextpart;
+  string& nextpart = d_part;
   
   rr.ttl=d_defaultttl;
   bool haveTTL=0, haveQTYPE=0;
   pair<string::size_type, string::size_type> range;
 
-  while(!parts.empty()) {
-    range=parts.front();
-    parts.pop_front();
-    nextpart=makeString(d_line, range);
+  while(partIdx < parts.size()) {
+    range=parts[partIdx++];
+    nextpart.assign(d_line, range.first, range.second - range.first);
     if(nextpart.empty())
       break;
 
@@ -388,7 +492,7 @@ bool ZoneParserTNG::get(DNSResourceRecord& rr, std::string* comment)
   //  rr.content=d_line.substr(range.first);
   rr.content.assign(d_line, range.first, string::npos);
   chopComment(rr.content);
-  trim_if(rr.content, is_any_of(" \r\n\t\x1a"));
+  trimBoth(rr.content);
 
   if(rr.content.size()==1 && rr.content[0]=='@')
     rr.content=d_zonename.toString();
@@ -407,34 +511,50 @@ bool ZoneParserTNG::get(DNSResourceRecord& rr, std::string* comment)
       }
     }
   }
-  trim_if(rr.content, is_any_of(" \r\n\t\x1a"));
-
-  vector<string> recparts;
+  trimBoth(rr.content);
+
+  /* the names in the content are made absolute, the parts are located in rr.content
+     and the result is built in d_content, which then changes places with it */
+  parts_t& recparts = d_recparts;
+  string& content = d_content;
+  recparts.clear();
+  content.clear();
   switch(rr.qtype.getCode()) {
   case QType::MX:
-    stringtok(recparts, rr.content);
+    vstringtok(recparts, rr.content);
     if(recparts.size()==2) {
-      if (recparts[1]!=".")
-        recparts[1] = toCanonic(d_zonename, recparts[1]).toStringRootDot();
-      rr.content=recparts[0]+" "+recparts[1];
+      content.append(rr.content, recparts[0].first, recparts[0].second - recparts[0].first);
+      content.append(1, ' ');
+      if (rr.content.compare(recparts[1].first, recparts[1].second - recparts[1].first, ".") != 0)
+        appendCanonic(content, rr.content, recparts[1].first, recparts[1].second);
+      else
+        content.append(1, '.');
+      rr.content.swap(content);
     }
     break;
   
   case QType::RP:
-    stringtok(recparts, rr.content);
+    vstringtok(recparts, rr.content);
     if(recparts.size()==2) {
-      recparts[0] = toCanonic(d_zonename, recparts[0]).toStringRootDot();
-      recparts[1] = toCanonic(d_zonename, recparts[1]).toStringRootDot();
-      rr.content=recparts[0]+" "+recparts[1];
+      appendCanonic(content, rr.content, recparts[0].first, recparts[0].second);
+      content.append(1, ' ');
+      appendCanonic(content, rr.content, recparts[1].first, recparts[1].second);
+      rr.content.swap(content);
     }
     break;
 
   case QType::SRV:
-    stringtok(recparts, rr.content);
+    vstringtok(recparts, rr.content);
     if(recparts.size()==4) {
-      if(recparts[3]!=".")
-        recparts[3] = toCanonic(d_zonename, recparts[3]).toStringRootDot();
-      rr.content=recparts[0]+" "+recparts[1]+" "+recparts[2]+" "+recparts[3];
+      for(int n = 0; n < 3; n++) {
+        content.append(rr.content, recparts[n].first, recparts[n].second - recparts[n].first);
+        content.append(1, ' ');
+      }
+      if (rr.content.compare(recparts[3].first, recparts[3].second - recparts[3].first, ".") != 0)
+        appendCanonic(content, rr.content, recparts[3].first, recparts[3].second);
+      else
+        content.append(1, '.');
+      rr.content.swap(content);
     }
     break;
   
@@ -444,35 +564,38 @@ bool ZoneParserTNG::get(DNSResourceRecord& rr, std::string* comment)
   case QType::DNAME:
   case QType::PTR:
   case QType::AFSDB:
-    rr.content=toCanonic(d_zonename, rr.content).toStringRootDot();
+    appendCanonic(content, rr.content, 0, rr.content.length());
+    rr.content.swap(content);
     break;
 
-  case QType::SOA:
-    stringtok(recparts, rr.content);
-    if(recparts.size() > 7)
+  case QType::SOA: {
+    vector<string> soaparts;
+    stringtok(soaparts, rr.content);
+    if(soaparts.size() > 7)
       throw PDNSException("SOA record contents for "+rr.qname.toString()+" contains too many parts");
-    if(recparts.size() > 1) {
+    if(soaparts.size() > 1) {
       try {
-        recparts[0]=toCanonic(d_zonename, recparts[0]).toStringRootDot();
-        recparts[1]=toCanonic(d_zonename, recparts[1]).toStringRootDot();
+        soaparts[0]=toCanonic(d_zonename, soaparts[0]).toStringRootDot();
+        soaparts[1]=toCanonic(d_zonename, soaparts[1]).toStringRootDot();
       } catch (runtime_error &re) {
         throw PDNSException(re.what());
       }
     }
     rr.content.clear();
-    for(string::size_type n = 0; n < recparts.size(); ++n) {
+    for(string::size_type n = 0; n < soaparts.size(); ++n) {
       if(n)
         rr.content.append(1,' ');
 
       if(n > 1)
-        rr.content+=std::to_string(makeTTLFromZone(recparts[n]));
+        rr.content+=std::to_string(makeTTLFromZone(soaparts[n]));
       else
-        rr.content+=recparts[n];
+        rr.content+=soaparts[n];
 
       if(n==6 && !d_havedollarttl)
-        d_defaultttl=makeTTLFromZone(recparts[n]);
+        d_defaultttl=makeTTLFromZone(soaparts[n]);
     }
     break;
+  }
   default:;
   }
 
@@ -492,11 +615,11 @@ bool ZoneParserTNG::getLine()
     return false;
   }
   while(!d_filestates.empty()) {
-    if(stringfgets(d_filestates.top().d_fp, d_line)) {
+    if(d_filestates.top().readLine(d_line)) {
       d_filestates.top().d_lineno++;
       return true;
     }
-    fclose(d_filestates.top().d_fp);
+    close(d_filestates.top().d_fd);
     d_filestates.pop();
   }
   return false;
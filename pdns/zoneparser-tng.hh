@@ -26,6 +26,8 @@
 #include <cstdio>
 #include <stdexcept>
 #include <stack>
+#include <memory>
+#include <sys/stat.h>
 
 #include "namespaces.hh"
 
@@ -38,31 +40,49 @@ public:
   ~ZoneParserTNG();
   bool get(DNSResourceRecord& rr, std::string* comment=0);
   typedef runtime_error exception;
-  typedef deque<pair<string::size_type, string::size_type> > parts_t;
+  typedef vector<pair<string::size_type, string::size_type> > parts_t;
   DNSName getZoneName();
   string getLineOfFile(); // for error reporting purposes
   pair<string,int> getLineNumAndFile(); // idem
+  typedef vector<pair<string, struct stat> > openedfiles_t;
+  //! every file opened so far, the zone file first and then its $INCLUDEs, as they were when opened
+  const openedfiles_t& getOpenedFiles() const { return d_openedfiles; }
 private:
   bool getLine();
   bool getTemplateLine();
   void stackFile(const std::string& fname);
   unsigned makeTTLFromZone(const std::string& str);
+  void appendCanonic(string& out, const string& str, string::size_type begin, string::size_type end);
 
+  /* Files are read in large chunks, which getLine() then cuts into lines itself */
   struct filestate {
-    filestate(FILE* fp, string filename) : d_fp(fp), d_filename(filename), d_lineno(0){}
-    FILE *d_fp;
+    filestate(int fd, string filename) : d_fd(fd), d_filename(filename), d_lineno(0), d_buffer(new char[s_readSize]), d_bufpos(0), d_buflen(0) {}
+    bool readLine(string& line);
+    int d_fd;
     string d_filename;
     int d_lineno;
+    std::unique_ptr<char[]> d_buffer;
+    size_t d_bufpos;
+    size_t d_buflen;
   };
+  static const size_t s_readSize = 1024*1024;
 
   string d_reldir;
   string d_line;
   DNSName d_prevqname;
   DNSName d_zonename;
+  string d_zonenametext; //!< d_zonename, as toStringRootDot() has it
+  // buffers reused from one record to the next
+  parts_t d_parts;
+  parts_t d_recparts;
+  string d_qname;
+  string d_part;
+  string d_content;
   string d_templateline;
   vector<string> d_zonedata;
   vector<string>::iterator d_zonedataline;
   std::stack<filestate> d_filestates;
+  openedfiles_t d_openedfiles;
   parts_t d_templateparts;
   int d_defaultttl;
   uint32_t d_templatecounter, d_templatestop, d_templatestep;